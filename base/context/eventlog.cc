@@ -4,6 +4,7 @@
 #include <utility>
 
 #include "base/context/context.h"
+#include "base/util/type_url.h"
 
 namespace gp = google::protobuf;
 
@@ -23,17 +24,34 @@ std::size_t EventLog::GetClockIndex(const Clock* clock) {
   return res.first->second;
 }
 
+namespace {
+
+proto::Event MakeEvent(const Context& ctx, const Clock* clock, const char* verb, gp::Duration start_time,
+                       gp::Duration end_time) {
+  proto::Event event;
+  *event.mutable_parent_id() = ctx.activity_id();
+  event.set_verb(verb);
+  event.mutable_activity_id()->set_index(ctx.eventlog()->AllocActivityIndex());
+  event.mutable_clock_id()->set_index(ctx.eventlog()->GetClockIndex(clock));
+  *event.mutable_start_time() = start_time;
+  *event.mutable_end_time() = end_time;
+  *event.mutable_domain_id() = ctx.domain_id();
+  return event;
+}
+
+}  // namespace
+
 void Clock::LogActivity(const Context& ctx, const char* verb, gp::Duration start_time, gp::Duration end_time) const {
   if (ctx.is_logging_events()) {
-    proto::Event event;
-    *event.mutable_parent_id() = ctx.activity_id();
-    event.set_verb(verb);
-    event.mutable_activity_id()->set_index(ctx.eventlog()->AllocActivityIndex());
-    event.mutable_clock_id()->set_index(ctx.eventlog()->GetClockIndex(this));
-    *event.mutable_start_time() = start_time;
-    *event.mutable_end_time() = end_time;
-    *event.mutable_domain_id() = ctx.domain_id();
+    ctx.eventlog()->LogEvent(MakeEvent(ctx, this, verb, start_time, end_time));
+  }
+}
 
+void Clock::LogActivity(const Context& ctx, const char* verb, gp::Duration start_time, gp::Duration end_time,
+                        const gp::Message& metadata) const {
+  if (ctx.is_logging_events()) {
+    proto::Event event = MakeEvent(ctx, this, verb, start_time, end_time);
+    event.add_metadata()->PackFrom(metadata, kTypeVertexAI);
     ctx.eventlog()->LogEvent(std::move(event));
   }
 }
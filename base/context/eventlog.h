@@ -23,6 +23,10 @@ class Clock {
   // the start and end times, the caller should check to see whether event logging's enabled.
   void LogActivity(const Context& ctx, const char* verb, google::protobuf::Duration start_time,
                    google::protobuf::Duration end_time) const;
+
+  // Logs an activity, attaching the supplied metadata to it.
+  void LogActivity(const Context& ctx, const char* verb, google::protobuf::Duration start_time,
+                   google::protobuf::Duration end_time, const google::protobuf::Message& metadata) const;
 };
 
 // An EventLog is the abstract interface for a thing that accepts event data.
@@ -0,0 +1,99 @@
+// Copyright 2018 Intel Corporation
+
+#include "base/util/parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include "base/util/env.h"
+
+namespace vertexai {
+
+namespace {
+
+std::size_t PoolThreads() {
+  static const std::size_t threads = []() -> std::size_t {
+    auto env_threads = env::Get("PLAIDML_CODEGEN_THREADS");
+    if (!env_threads.empty()) {
+      return std::max(1, std::atoi(env_threads.c_str()));
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }();
+  return threads;
+}
+
+boost::asio::thread_pool& Pool() {
+  // The calling thread always takes part, so the pool supplies the rest.
+  static boost::asio::thread_pool pool{std::max<std::size_t>(1, PoolThreads() - 1)};
+  return pool;
+}
+
+// The state of a single ParallelForEach, shared with the pool workers; a
+// worker that starts after every call has been claimed simply returns.
+struct ForEachState {
+  ForEachState(std::size_t count, const std::function<void(std::size_t)>& func) : count{count}, func{func} {}
+
+  void Work() {
+    for (;;) {
+      std::size_t i = next++;
+      if (count <= i) {
+        return;
+      }
+      try {
+        func(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{mu};
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      std::lock_guard<std::mutex> lock{mu};
+      if (++done == count) {
+        cv.notify_all();
+      }
+    }
+  }
+
+  const std::size_t count;
+  const std::function<void(std::size_t)>& func;  // Only called while the caller is waiting
+  std::atomic<std::size_t> next{0};
+  std::mutex mu;
+  std::condition_variable cv;
+  std::size_t done = 0;
+  std::exception_ptr error;
+};
+
+}  // namespace
+
+std::size_t ParallelForEachConcurrency() { return PoolThreads(); }
+
+void ParallelForEach(std::size_t count, const std::function<void(std::size_t)>& func) {
+  std::size_t workers = std::min(count, PoolThreads());
+  if (workers <= 1) {
+    for (std::size_t i = 0; i < count; ++i) {
+      func(i);
+    }
+    return;
+  }
+  auto state = std::make_shared<ForEachState>(count, func);
+  for (std::size_t w = 1; w < workers; ++w) {
+    boost::asio::post(Pool(), [state]() { state->Work(); });
+  }
+  state->Work();
+  std::unique_lock<std::mutex> lock{state->mu};
+  state->cv.wait(lock, [&state]() { return state->done == state->count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+}  // namespace vertexai
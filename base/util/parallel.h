@@ -0,0 +1,18 @@
+// Copyright 2018 Intel Corporation
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace vertexai {
+
+// Runs func(0) through func(count - 1) concurrently on a process-wide task pool, with the calling thread taking part,
+// and returns once every call has finished.  If any call throws, the first exception is rethrown.  The pool's size
+// is the hardware concurrency, or PLAIDML_CODEGEN_THREADS if set; calls may themselves use ParallelForEach.
+void ParallelForEach(std::size_t count, const std::function<void(std::size_t)>& func);
+
+// The number of calls ParallelForEach runs at once, including the calling thread.
+std::size_t ParallelForEachConcurrency();
+
+}  // namespace vertexai
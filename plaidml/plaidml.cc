@@ -1584,9 +1584,16 @@ extern "C" plaidml_invocation* plaidml_schedule_invocation(vai_ctx* ctx, plaidml
       }
     }
 
+    double early_stop_margin = 0;
+    auto env_margin = vertexai::env::Get("PLAIDML_KERNEL_TRIAL_EARLY_STOP");
+    if (env_margin.length()) {
+      early_stop_margin = std::atof(env_margin.c_str());
+    }
+
     auto* params = prog.mutable_tile_scanning_params();
     params->set_max_trials(max_trials);
     params->set_max_trial_runs(max_trial_runs);
+    params->set_early_stop_margin(early_stop_margin);
 
     auto program = evaluator->MakeProgram(activity.ctx(), prog);
 
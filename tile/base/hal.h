@@ -186,6 +186,10 @@ class Compiler {
   virtual boost::future<std::unique_ptr<Library>> Build(const context::Context& ctx,
                                                         const std::vector<lang::KernelInfo>& kernels,
                                                         const proto::HardwareSettings& settings) = 0;
+
+  // Indicates whether Build may be called from multiple threads at once.  Callers serialize builds on compilers that
+  // aren't thread-safe.
+  virtual bool is_thread_safe() const { return false; }
 };
 
 // A Tile loader takes an executable binary image and turns it into a device-specific executable.
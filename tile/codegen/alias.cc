@@ -2,6 +2,8 @@
 
 #include "tile/codegen/alias.h"
 
+#include <utility>
+
 #include "base/util/throw.h"
 
 namespace vertexai {
@@ -10,18 +12,46 @@ namespace codegen {
 
 using namespace stripe;  // NOLINT
 
-static Affine UniqifyAffine(const Affine& orig, const std::string& prefix) {
-  Affine r;
-  for (const auto& kvp : orig.getMap()) {
-    if (kvp.first.empty()) {
-      r += kvp.second;
-    } else {
-      r += Affine(prefix + kvp.first, kvp.second);
+namespace {
+
+// Renames a block's indexes to depth-qualified symbols, interning each qualified name once per block rather than
+// once per access term.
+class IndexSymbols {
+ public:
+  IndexSymbols(const Block& block, const std::string& prefix) : prefix_{prefix} {
+    names_.reserve(block.idxs.size());
+    symbols_.reserve(block.idxs.size());
+    for (const auto& idx : block.idxs) {
+      names_.push_back(&idx.name);
+      symbols_.emplace_back(prefix + idx.name);
     }
   }
-  return r;
+
+  Symbol operator()(const std::string& name) const {
+    for (size_t i = 0; i < names_.size(); i++) {
+      if (*names_[i] == name) {
+        return symbols_[i];
+      }
+    }
+    return Symbol{prefix_ + name};
+  }
+
+ private:
+  std::string prefix_;
+  std::vector<const std::string*> names_;
+  std::vector<Symbol> symbols_;
+};
+
+CompactAffine UniqifyAffine(const Affine& orig, const IndexSymbols& symbols) {
+  CompactAffine::Terms terms;
+  for (const auto& kvp : orig.getMap()) {
+    terms.emplace_back(kvp.first.empty() ? Symbol{} : symbols(kvp.first), kvp.second);
+  }
+  return CompactAffine{std::move(terms)};
 }
 
+}  // namespace
+
 AliasType AliasInfo::Compare(const AliasInfo& ai, const AliasInfo& bi) {
   if (ai.base_name != bi.base_name) {
     return AliasType::None;
@@ -41,6 +71,7 @@ AliasMap::AliasMap() : depth_(0) {}
 AliasMap::AliasMap(const AliasMap& outer, stripe::Block* block) : depth_(outer.depth_ + 1) {
   // Make a prefix
   std::string prefix = std::string("d") + std::to_string(depth_) + ":";
+  IndexSymbols symbols{*block, prefix};
   // Make all inner alias data
   for (auto& ref : block->refs) {
     // Setup the place we are going to write to
@@ -70,7 +101,7 @@ AliasMap::AliasMap(const AliasMap& outer, stripe::Block* block) : depth_(outer.d
     }
     // Add in indexes from this block
     for (size_t i = 0; i < ref.access.size(); i++) {
-      info.access[i] += UniqifyAffine(ref.access[i], prefix);
+      info.access[i] += UniqifyAffine(ref.access[i], symbols);
     }
     // Set shape
     info.shape = ref.shape;
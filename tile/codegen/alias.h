@@ -25,7 +25,7 @@ struct AliasInfo {
   stripe::Block* base_block;
   stripe::Refinement* base_ref;
   std::string base_name;
-  std::vector<stripe::Affine> access;
+  std::vector<stripe::CompactAffine> access;  // In terms of depth-qualified index names, e.g. "d2:i"
   TensorShape shape;
 };
 
@@ -2,9 +2,25 @@
 
 #include "tile/codegen/autotile.h"
 
+#include <google/protobuf/text_format.h>
+#include <google/protobuf/util/json_util.h>
+#include <llvm/Support/Host.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#include "base/util/env.h"
 #include "base/util/logging.h"
 #include "base/util/printstring.h"
 #include "base/util/stream_container.h"
+#include "base/util/throw.h"
+#include "tile/codegen/jit.h"
 #include "tile/stripe/stripe.h"
 
 namespace vertexai {
@@ -70,13 +86,117 @@ static double TileCost(const Block& block, const proto::AutotilePass& options, c
   return cost;
 }
 
-static TileShape PickBestShape(const Block& block, const proto::AutotilePass& options) {
+namespace {
+
+// The parts of a Config that the roofline cost model uses.
+struct Roofline {
+  double ops_per_cycle;
+  double mem_bytes;
+  double bytes_per_cycle;
+  double cycles_per_second;
+};
+
+Roofline ResolveRoofline(const proto::RooflineCostModel& model, const proto::Config& cfg) {
+  Roofline roofline;
+  auto exec_it = cfg.exec_units().find(model.exec_unit());
+  if (exec_it == cfg.exec_units().end()) {
+    throw_with_trace(std::runtime_error(printstring("Autotile: unknown execution unit %s", model.exec_unit().c_str())));
+  }
+  roofline.ops_per_cycle = static_cast<double>(exec_it->second.ops_per_cycle()) * exec_it->second.count();
+  auto mem_it = cfg.mem_units().find(model.mem_unit());
+  if (mem_it == cfg.mem_units().end()) {
+    throw_with_trace(std::runtime_error(printstring("Autotile: unknown memory unit %s", model.mem_unit().c_str())));
+  }
+  roofline.mem_bytes = mem_it->second.size_kib() * 1024.0;
+  auto connects = [](const proto::Bus& bus, const std::string& from, const std::string& to) {
+    return std::count(bus.sources().begin(), bus.sources().end(), from) &&
+           std::count(bus.sinks().begin(), bus.sinks().end(), to);
+  };
+  roofline.bytes_per_cycle = 0;
+  for (const auto& bus : cfg.buses()) {
+    if (connects(bus, model.outer_mem_unit(), model.mem_unit()) ||
+        connects(bus, model.mem_unit(), model.outer_mem_unit())) {
+      roofline.bytes_per_cycle = bus.bytes_per_cycle();
+      break;
+    }
+  }
+  if (roofline.bytes_per_cycle <= 0 || roofline.ops_per_cycle <= 0 || cfg.clock_mhz() == 0) {
+    throw_with_trace(std::runtime_error(printstring("Autotile: no usable bus between %s and %s, or no throughput",
+                                                    model.outer_mem_unit().c_str(), model.mem_unit().c_str())));
+  }
+  roofline.cycles_per_second = cfg.clock_mhz() * 1e6;
+  return roofline;
+}
+
+// The bytes of ref spanned by one tile: in each dimension, the refinement's extent plus the distance its access
+// moves over the tile's index values.
+double TileFootprintBytes(const std::map<std::string, size_t>& tile_by_name, const Refinement& ref) {
+  double elems = 1;
+  for (size_t i = 0; i < ref.shape.dims.size(); i++) {
+    double extent = ref.shape.dims[i].size;
+    if (i < ref.access.size()) {
+      for (const auto& kvp : ref.access[i].getMap()) {
+        if (!kvp.first.empty()) {
+          extent += std::abs(kvp.second) * (static_cast<double>(tile_by_name.at(kvp.first)) - 1);
+        }
+      }
+    }
+    elems *= extent;
+  }
+  return elems * byte_width(ref.shape.type);
+}
+
+double RooflineCost(const Block& block, const Roofline& roofline, const TileShape& tile) {
+  std::map<std::string, size_t> tile_by_name;
+  for (size_t i = 0; i < block.idxs.size(); i++) {
+    tile_by_name[block.idxs[i].name] = tile[i];
+  }
+  double footprint = 0;
+  double transfer = 0;
+  for (const auto& ref : block.refs) {
+    if (ref.dir == RefDir::None) {
+      continue;
+    }
+    double bytes = TileFootprintBytes(tile_by_name, ref);
+    footprint += bytes;
+    transfer += bytes;
+    // Outputs that accumulate across tiles are read back as well as written.
+    if (IsWriteDir(ref.dir) && (ref.dir == RefDir::InOut || (!ref.agg_op.empty() && ref.agg_op != "assign"))) {
+      transfer += bytes;
+    }
+  }
+  if (footprint > roofline.mem_bytes) {
+    return std::numeric_limits<double>::infinity();
+  }
+  double ops = 0;
+  for (const auto& stmt : block.stmts) {
+    if (stmt->kind() == StmtKind::Intrinsic) {
+      ops++;
+    }
+  }
+  double tiles = 1;
+  double points = 1;
+  for (size_t i = 0; i < tile.size(); i++) {
+    tiles *= (block.idxs[i].range + tile[i] - 1) / tile[i];
+    points *= tile[i];
+  }
+  double compute_cycles = points * std::max(ops, 1.0) / roofline.ops_per_cycle;
+  double transfer_cycles = transfer / roofline.bytes_per_cycle;
+  return tiles * std::max(compute_cycles, transfer_cycles) / roofline.cycles_per_second;
+}
+
+}  // namespace
+
+// Returns up to count tiles in order of increasing cost, the first of which is the best.
+template <typename F>
+static std::vector<TileShape> PickBestShapes(const Block& block, const proto::AutotilePass& options, const F& tile_cost,
+                                             size_t count = 1) {
   size_t sz = block.idxs.size();
   std::multimap<double, TileShape> by_cost;
   std::map<TileShape, double> by_tile;
   std::set<std::pair<double, TileShape>> to_do;
   TileShape tile(sz, 1);
-  double cost = TileCost(block, options, tile);
+  double cost = tile_cost(tile);
   double base_cost = cost;
   by_tile.emplace(tile, cost);
   by_cost.emplace(cost, tile);
@@ -97,7 +217,7 @@ static TileShape PickBestShape(const Block& block, const proto::AutotilePass& op
         tile[i] = std::min(tile[i] + 1, block.idxs[i].range);
       }
       if (!by_tile.count(tile)) {
-        cost = TileCost(block, options, tile);
+        cost = tile_cost(tile);
         by_tile.emplace(tile, cost);
         by_cost.emplace(cost, tile);
         if (!std::isinf(cost)) {
@@ -108,21 +228,268 @@ static TileShape PickBestShape(const Block& block, const proto::AutotilePass& op
     }
   }
   IVLOG(2, "Autotile Result: " << by_cost.begin()->second << ", Cost: " << by_cost.begin()->first / base_cost);
-  return by_cost.begin()->second;
+  std::vector<TileShape> best{by_cost.begin()->second};
+  for (auto it = std::next(by_cost.begin()); it != by_cost.end() && best.size() < count && !std::isinf(it->first);
+       ++it) {
+    best.push_back(it->second);
+  }
+  return best;
 }
 
-void AutotilePass(Block* root, const proto::AutotilePass& options) {
+namespace {
+
+// The fastest measured tile for each measurement key, kept in an append-only file of JSON lines.
+class MeasurementCache {
+ public:
+  // Returns the process's cache for the indicated file.
+  static MeasurementCache* Instance(const std::string& path) {
+    static std::mutex mu;
+    static std::map<std::string, std::unique_ptr<MeasurementCache>> caches;
+    std::lock_guard<std::mutex> lock{mu};
+    auto& cache = caches[path];
+    if (!cache) {
+      cache.reset(new MeasurementCache{path});
+    }
+    return cache.get();
+  }
+
+  boost::optional<TileShape> Lookup(const std::string& key) {
+    std::lock_guard<std::mutex> lock{mu_};
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      return boost::none;
+    }
+    return TileShape(it->second.tile().begin(), it->second.tile().end());
+  }
+
+  void Insert(const std::string& key, const TileShape& tile, double seconds) {
+    proto::AutotileCacheEntry entry;
+    entry.set_key(key);
+    for (auto size : tile) {
+      entry.add_tile(size);
+    }
+    entry.set_seconds(seconds);
+    std::string line;
+    google::protobuf::util::MessageToJsonString(entry, &line);
+    std::lock_guard<std::mutex> lock{mu_};
+    entries_[key] = entry;
+    if (file_) {
+      file_ << line << std::endl;
+    }
+  }
+
+ private:
+  explicit MeasurementCache(const std::string& path) {
+    std::ifstream in{path};
+    std::string line;
+    while (std::getline(in, line)) {
+      proto::AutotileCacheEntry entry;
+      // Skip lines that don't parse, such as one cut short by a crash.
+      if (google::protobuf::util::JsonStringToMessage(line, &entry).ok() && entry.IsInitialized()) {
+        entries_[entry.key()] = entry;
+      }
+    }
+    file_.open(path, std::ios::app);
+    if (!file_) {
+      LOG(WARNING) << "Autotile: unable to write measurement cache " << path;
+    }
+  }
+
+  std::mutex mu_;
+  std::map<std::string, proto::AutotileCacheEntry> entries_;
+  std::ofstream file_;
+};
+
+// Runs block, split into tiles of the indicated shape, on synthetic buffers sized to the buffers it refines, and
+// returns its fastest run in seconds.
+double MeasureTile(const AliasMap& map, const Block& block, const proto::AutotilePass& options,
+                   const TileShape& tile) {
+  using clock = std::chrono::steady_clock;
+  auto tiled = CloneBlock(block);
+  if (ApplyTile(tiled.get(), tile)) {
+    AddTags(tiled.get(), FromProto(options.outer_set()));
+  }
+  Block program;
+  program.name = "autotile_" + block.name;
+  std::map<std::string, std::vector<uint8_t>> storage;
+  std::map<std::string, void*> buffers;
+  for (const auto& ref : block.refs) {
+    if (ref.dir == RefDir::None || storage.count(ref.from)) {
+      continue;
+    }
+    Refinement param = *map.at(ref.into).base_ref;
+    param.dir = RefDir::None;
+    param.from = "";
+    param.into = ref.from;
+    param.access = std::vector<Affine>(ref.access.size());
+    auto& bytes = storage[ref.from];
+    // Each byte of 0x3F makes every element type a modest nonzero value, so integer division can't trap and
+    // floating-point arithmetic doesn't slow down on denormals.
+    bytes.resize(param.shape.byte_size(), 0x3F);
+    buffers[ref.from] = bytes.data();
+    program.refs.push_back(param);
+  }
+  program.stmts.push_back(tiled);
+  JitOptions jit_options;
+  jit_options.parallel_tags = FromProto(options.outer_set());
+  JitProgram compiled{program, jit_options};
+  double best = std::numeric_limits<double>::infinity();
+  for (uint32_t run = 0; run < std::max(1u, options.measure().runs()); run++) {
+    auto start = clock::now();
+    compiled.Run(buffers);
+    best = std::min(best, std::chrono::duration<double>(clock::now() - start).count());
+  }
+  return best;
+}
+
+// Whether a tile read from the measurement cache is one the pass's search could have produced for block.
+template <typename F>
+bool IsCandidateShape(const Block& block, const proto::AutotilePass& options, const F& tile_cost,
+                      const TileShape& tile) {
+  if (tile.size() != block.idxs.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < tile.size(); i++) {
+    uint64_t range = block.idxs[i].range;
+    if (tile[i] < 1 || tile[i] > range) {
+      return false;
+    }
+    // The search doubles po2 tiles until they reach the range, at which point they're clamped to it.
+    if (options.only_po2() && tile[i] != range && (tile[i] & (tile[i] - 1))) {
+      return false;
+    }
+  }
+  return !std::isinf(tile_cost(tile));
+}
+
+// Times the best candidate tiles for a block, consulting and updating the measurement cache, and returns the
+// fastest.  Candidates that can't be compiled are skipped; if none can, the first candidate is returned.
+template <typename F>
+TileShape PickMeasuredShape(const AliasMap& map, const Block& block, const proto::AutotilePass& options,
+                            const proto::Config& cfg, const F& tile_cost, const std::vector<TileShape>& candidates) {
+  auto path = options.measure().cache_path();
+  if (path.empty()) {
+    path = env::Get("PLAIDML_AUTOTILE_CACHE");
+  }
+  MeasurementCache* cache = path.empty() ? nullptr : MeasurementCache::Instance(path);
+  auto key = MeasurementKey(block, options, cfg);
+  if (cache) {
+    auto tile = cache->Lookup(key);
+    if (tile && IsCandidateShape(block, options, tile_cost, *tile)) {
+      IVLOG(2, "Autotile: cached tile for " << block.name << ": " << *tile);
+      return *tile;
+    }
+    if (tile) {
+      IVLOG(1, "Autotile: ignoring cached tile " << *tile << " for " << block.name << ", which the options exclude");
+    }
+  }
+  TileShape best_tile = candidates.front();
+  double best_time = std::numeric_limits<double>::infinity();
+  for (const auto& tile : candidates) {
+    try {
+      double time = MeasureTile(map, block, options, tile);
+      IVLOG(2, "Autotile: " << block.name << " with tile " << tile << ": " << time * 1e6 << "us");
+      if (time < best_time) {
+        best_time = time;
+        best_tile = tile;
+      }
+    } catch (const std::exception& ex) {
+      IVLOG(1, "Autotile: unable to measure " << block.name << " with tile " << tile << ": " << ex.what());
+    }
+  }
+  if (cache && !std::isinf(best_time)) {
+    cache->Insert(key, best_tile, best_time);
+  }
+  return best_tile;
+}
+
+// Tiles a block as selected by the pass's options and tags the result.
+template <typename F>
+void TileBlock(const AliasMap& map, Block* block, const proto::AutotilePass& options, const proto::Config& cfg,
+               const F& tile_cost) {
+  TileShape tile;
+  if (options.has_measure()) {
+    auto candidates = PickBestShapes(*block, options, tile_cost, std::max(1u, options.measure().candidates()));
+    tile = PickMeasuredShape(map, *block, options, cfg, tile_cost, candidates);
+  } else {
+    tile = PickBestShapes(*block, options, tile_cost).front();
+  }
+  if (ApplyTile(block, tile)) {
+    AddTags(block, FromProto(options.outer_set()));
+    auto inner = Block::Downcast(*block->stmts.begin());
+    AddTags(inner.get(), FromProto(options.inner_set()));
+  }
+}
+
+// FNV-1a, which is stable across builds and platforms.
+std::string Fnv1a(const std::string& text) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : text) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return printstring("%016llx", static_cast<unsigned long long>(hash));  // NOLINT(runtime/int)
+}
+
+}  // namespace
+
+std::string BlockSignature(const Block& block) {
+  auto proto = IntoProto(block);
+  proto.clear_name();
+  proto.clear_comments();
+  for (auto& ref : *proto.mutable_refs()) {
+    ref.clear_from();
+  }
+  std::string text;
+  google::protobuf::TextFormat::PrintToString(proto, &text);
+  return Fnv1a(text);
+}
+
+std::string MeasurementKey(const Block& block, const proto::AutotilePass& options, const proto::Config& cfg) {
+  // The options that shape the candidates and the compiled tiles; reqs only select blocks, and the measurement
+  // settings only affect how carefully the candidates are timed.
+  auto shaping = options;
+  shaping.clear_reqs();
+  shaping.clear_measure();
+  std::string text;
+  google::protobuf::TextFormat::PrintToString(shaping, &text);
+  if (options.has_roofline()) {
+    std::string cfg_text;
+    google::protobuf::TextFormat::PrintToString(cfg, &cfg_text);
+    text += cfg_text;
+  }
+  static const std::string host = llvm::sys::getProcessTriple() + ";" + llvm::sys::getHostCPUName().str();
+  return BlockSignature(block) + ";" + Fnv1a(text) + ";" + host;
+}
+
+double RooflineTileCost(const Block& block, const proto::RooflineCostModel& model, const proto::Config& cfg,
+                        const TileShape& tile) {
+  return RooflineCost(block, ResolveRoofline(model, cfg), tile);
+}
+
+void AutotilePass(Block* root, const proto::AutotilePass& options, const proto::Config& cfg) {
   auto reqs = FromProto(options.reqs());
-  RunOnBlocks(root, reqs, [&options](const AliasMap& map, Block* block) {
-    TileShape tile = PickBestShape(*block, options);
-    if (ApplyTile(block, tile)) {
-      AddTags(block, FromProto(options.outer_set()));
-      auto inner = Block::Downcast(*block->stmts.begin());
-      AddTags(inner.get(), FromProto(options.inner_set()));
+  boost::optional<Roofline> roofline;
+  if (options.has_roofline()) {
+    roofline = ResolveRoofline(options.roofline(), cfg);
+  }
+  auto tile_block = [&options, &cfg, &roofline](const AliasMap& map, Block* block) {
+    if (roofline) {
+      TileBlock(map, block, options, cfg,
+                [&](const TileShape& shape) { return RooflineCost(*block, *roofline, shape); });
+    } else {
+      TileBlock(map, block, options, cfg, [&](const TileShape& shape) { return TileCost(*block, options, shape); });
     }
-  });
+  };
+  if (options.has_measure()) {
+    // Measurements made concurrently would compete for the machine.
+    RunOnBlocks(root, reqs, tile_block);
+  } else {
+    RunOnBlocksParallel(root, reqs, tile_block);
+  }
 }
 
+void AutotilePass(Block* root, const proto::AutotilePass& options) { AutotilePass(root, options, proto::Config{}); }
+
 }  // namespace codegen
 }  // namespace tile
 }  // namespace vertexai
@@ -15,8 +15,25 @@ namespace vertexai {
 namespace tile {
 namespace codegen {
 
+// Tiles each matching block with the tile that minimizes its estimated cost.  If options.roofline is set, the cost is
+// estimated from the hardware described by cfg.  If options.measure is set, the best few tiles by estimated cost are
+// instead compiled and timed, and the fastest is used; the choice is remembered in the measurement cache.
+void AutotilePass(stripe::Block* block, const proto::AutotilePass& options, const proto::Config& cfg);
 void AutotilePass(stripe::Block* block, const proto::AutotilePass& options);
 
+// A key identifying blocks that tile identically: a hash of the block with its name and the names of the buffers it
+// refines left out.
+std::string BlockSignature(const stripe::Block& block);
+
+// The measurement cache's key for block: its signature, a digest of the options and Config that select and compile
+// the candidate tiles, and the host's target triple and CPU, since a tile measured on one CPU may not suit another.
+std::string MeasurementKey(const stripe::Block& block, const proto::AutotilePass& options, const proto::Config& cfg);
+
+// The roofline model's estimate, in seconds, of the time to run block split into tiles of the indicated shape, or
+// infinity if a tile's refinements don't fit in the model's memory unit.
+double RooflineTileCost(const stripe::Block& block, const proto::RooflineCostModel& model, const proto::Config& cfg,
+                        const TileShape& tile);
+
 }  // namespace codegen
 }  // namespace tile
 }  // namespace vertexai
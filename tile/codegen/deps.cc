@@ -2,11 +2,13 @@
 
 #include "tile/codegen/deps.h"
 
+#include <algorithm>
 #include <set>
 #include <sstream>
 #include <stdexcept>
 #include <unordered_map>
-#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "base/util/throw.h"
 #include "tile/stripe/stripe.h"
@@ -19,15 +21,108 @@ using namespace stripe;  // NOLINT
 
 namespace {
 
+// The elements of a buffer that a statement may access, as a box in the coordinates of the buffer's base
+// refinement.  Each dimension is a symbolic offset (in terms of the indexes of enclosing blocks, which are the same
+// for every statement in the block being analyzed) plus a constant interval.
+struct Region {
+  struct Dim {
+    CompactAffine offset;  // Without a constant term
+    int64_t lo;
+    int64_t hi;  // Inclusive
+  };
+
+  // If false, the region's extent isn't known, and it's treated as covering the whole buffer.
+  bool bounded = false;
+  std::vector<Dim> dims;
+
+  bool Intersects(const Region& other) const {
+    if (!bounded || !other.bounded || dims.size() != other.dims.size()) {
+      return true;
+    }
+    for (size_t i = 0; i < dims.size(); i++) {
+      const auto& a = dims[i];
+      const auto& b = other.dims[i];
+      if (a.offset == b.offset && (a.hi < b.lo || b.hi < a.lo)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool Contains(const Region& other) const {
+    if (!bounded) {
+      return true;
+    }
+    if (!other.bounded || dims.size() != other.dims.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < dims.size(); i++) {
+      const auto& a = dims[i];
+      const auto& b = other.dims[i];
+      if (a.offset != b.offset || b.lo < a.lo || a.hi < b.hi) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Computes the region of the base buffer accessed through a refinement of the block being analyzed.  If inner is
+// given, the access is made through inner's refinement ref of that buffer, and the region covers every value of
+// inner's indexes.
+Region ComputeRegion(const AliasInfo& alias_info, const Block* inner, const Refinement* ref) {
+  Region region;
+  const auto& shape = ref ? ref->shape : alias_info.shape;
+  // A newly allocated buffer may have no accesses at all, which is the same as a zero access in every dimension.
+  size_t ndims = shape.dims.size();
+  if ((!alias_info.access.empty() && alias_info.access.size() != ndims) || (ref && ref->access.size() != ndims)) {
+    return region;
+  }
+  for (size_t i = 0; i < ndims; i++) {
+    CompactAffine access;
+    if (!alias_info.access.empty()) {
+      access = alias_info.access[i];
+    }
+    int64_t constant = access.constant();
+    Region::Dim dim{access - constant, constant, constant};
+    if (ref) {
+      for (const auto& kvp : ref->access[i].getMap()) {
+        if (kvp.first.empty()) {
+          dim.lo += kvp.second;
+          dim.hi += kvp.second;
+          continue;
+        }
+        const Index* idx = inner->idx_by_name(kvp.first);
+        if (!idx || !idx->affine.isConstant() || idx->range == 0) {
+          return region;
+        }
+        int64_t first = kvp.second * idx->affine.constant();
+        int64_t last = first + kvp.second * static_cast<int64_t>(idx->range - 1);
+        dim.lo += std::min(first, last);
+        dim.hi += std::max(first, last);
+      }
+    }
+    if (shape.dims[i].size == 0) {
+      return region;
+    }
+    dim.hi += static_cast<int64_t>(shape.dims[i].size) - 1;
+    region.dims.emplace_back(std::move(dim));
+  }
+  region.bounded = true;
+  return region;
+}
+
 struct Tracker {
+  struct Access {
+    StatementIt stmt;
+    Region region;
+  };
+
   // Tracks the state of a buffer as it's operated on by the Block's Statements.
   struct BufferInfo {
-    // TODO: Instead of tracking the latest writer, keep track of a
-    // list of all currently active writers, removing writers from the
-    // list when all written memory has been overwritten by subsequent writers.
-    bool has_latest_writer = false;
-    StatementIt latest_writer;
-    std::unordered_set<StatementIt> current_readers;
+    // The writes and reads that haven't been overwritten by a subsequent write.
+    std::vector<Access> writers;
+    std::vector<Access> readers;
   };
 
   // For each scalar: the Statement that wrote the scalar.
@@ -58,44 +153,63 @@ struct Tracker {
     dataflow_deps.insert(it->second);
   }
 
-  void WriteBuffer(StatementIt it, const std::string& name, const AliasMap& alias_map) {
+  // Records a write of the indicated region of a buffer.  The write depends on every earlier access to an
+  // intersecting region, and hides the earlier accesses it covers from later statements (which will depend on the
+  // write instead).
+  void WriteBuffer(StatementIt it, const std::string& name, const AliasMap& alias_map, Region region) {
     const AliasInfo& alias_info = alias_map.at(name);
     BufferInfo& buffer_info = buffers[alias_info.base_name];
 
-    // For now, we assume that each writing statement writes the entire
-    // buffer.  TODO: Track child blocks as sub-buffer writes.
-    if (buffer_info.has_latest_writer && buffer_info.latest_writer != it) {
-      dataflow_deps.insert(buffer_info.latest_writer);
+    for (const auto& writer : buffer_info.writers) {
+      if (writer.stmt != it && writer.region.Intersects(region)) {
+        dataflow_deps.insert(writer.stmt);
+      }
     }
 
-    for (StatementIt reader : buffer_info.current_readers) {
+    for (const auto& reader : buffer_info.readers) {
       // Writing a buffer we're also reading blocks on all readers that
       // aren't us, but otherwise looks like a normal write of a buffer
       // that something else is reading.
-      if (reader != it) {
-        dataflow_deps.insert(reader);
+      if (reader.stmt != it && reader.region.Intersects(region)) {
+        dataflow_deps.insert(reader.stmt);
       }
     }
 
-    buffer_info.has_latest_writer = true;
-    buffer_info.latest_writer = it;
-    buffer_info.current_readers.clear();
+    auto covered = [&region](const Access& access) { return region.Contains(access.region); };
+    buffer_info.writers.erase(std::remove_if(buffer_info.writers.begin(), buffer_info.writers.end(), covered),
+                              buffer_info.writers.end());
+    buffer_info.readers.erase(std::remove_if(buffer_info.readers.begin(), buffer_info.readers.end(), covered),
+                              buffer_info.readers.end());
+    buffer_info.writers.emplace_back(Access{it, std::move(region)});
   }
 
-  void ReadBuffer(StatementIt it, const std::string& name, const AliasMap& alias_map) {
+  // Records a read of the indicated region of a buffer, which depends on every earlier write to an intersecting
+  // region.
+  void ReadBuffer(StatementIt it, const std::string& name, const AliasMap& alias_map, Region region) {
     const AliasInfo& alias_info = alias_map.at(name);
     BufferInfo& buffer_info = buffers[alias_info.base_name];
 
-    if (buffer_info.has_latest_writer && buffer_info.latest_writer == it) {
-      // Reading a buffer we're also writing doesn't do anything; we just track the write.
-      return;
+    bool self_write = false;
+    for (const auto& writer : buffer_info.writers) {
+      if (writer.stmt == it) {
+        // Reading a buffer we're also writing doesn't do anything; we just track the write.
+        self_write = true;
+      } else if (writer.region.Intersects(region)) {
+        dataflow_deps.insert(writer.stmt);
+      }
     }
-
-    if (buffer_info.has_latest_writer) {
-      dataflow_deps.insert(buffer_info.latest_writer);
+    if (!self_write) {
+      buffer_info.readers.emplace_back(Access{it, std::move(region)});
     }
+  }
 
-    buffer_info.current_readers.insert(it);
+  // Records an access to the whole of a refinement of the block being analyzed.
+  void WriteBuffer(StatementIt it, const std::string& name, const AliasMap& alias_map) {
+    WriteBuffer(it, name, alias_map, ComputeRegion(alias_map.at(name), nullptr, nullptr));
+  }
+
+  void ReadBuffer(StatementIt it, const std::string& name, const AliasMap& alias_map) {
+    ReadBuffer(it, name, alias_map, ComputeRegion(alias_map.at(name), nullptr, nullptr));
   }
 };
 
@@ -146,11 +260,17 @@ void ComputeDepsForBlock(Block* block, const AliasMap& alias_map) {  //
           // IsWriteDir first, since a subsequent refinement might access
           // the same underlying physical buffer; we handle these cases in
           // ReadBuffer() and WriteBuffer().
+          // The region is that of the inner refinement, so that blocks accessing disjoint parts of a buffer (for
+          // instance, partitioned or unrolled tiles) don't depend on each other.
+          if (ref.dir == RefDir::None) {
+            continue;
+          }
+          auto region = ComputeRegion(alias_map.at(ref.from), inner.get(), &ref);
           if (IsReadDir(ref.dir)) {
-            tracker.ReadBuffer(it, ref.from, alias_map);
+            tracker.ReadBuffer(it, ref.from, alias_map, region);
           }
           if (IsWriteDir(ref.dir)) {
-            tracker.WriteBuffer(it, ref.from, alias_map);
+            tracker.WriteBuffer(it, ref.from, alias_map, region);
           }
         }
       } break;
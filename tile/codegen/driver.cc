@@ -2,10 +2,23 @@
 
 #include "tile/codegen/driver.h"
 
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <google/protobuf/util/json_util.h>
+
+#include "base/util/logging.h"
 #include "tile/codegen/autotile.h"
 #include "tile/codegen/cache.h"
 #include "tile/codegen/deps.h"
 #include "tile/codegen/fuse.h"
+#include "tile/codegen/layout.h"
 #include "tile/codegen/localize.h"
 #include "tile/codegen/partition.h"
 #include "tile/codegen/placer.h"
@@ -35,67 +48,211 @@ void DumpProgram(const stripe::Block& program,    //
   }
 }
 
+void DumpStats(const proto::OptimizeStats& stats, const OptimizeOptions& options) {
+  if (options.dump_passes) {
+    std::string json;
+    google::protobuf::util::JsonPrintOptions json_options;
+    json_options.add_whitespace = true;
+    google::protobuf::util::MessageToJsonString(stats, &json, json_options);
+    std::ofstream fout((options.dbg_dir / "stats.json").string());
+    fout << json << std::endl;
+  }
+}
+
+// Reads a "<key>: <value> kB" line from /proc/self/status, in bytes; returns
+// -1 if it's unavailable.
+int64_t ReadProcStatus(const std::string& key) {
+#if defined(__linux__)
+  std::ifstream status{"/proc/self/status"};
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, key.size() + 1, key + ":") == 0) {
+      std::istringstream value{line.substr(key.size() + 1)};
+      int64_t kb;
+      if (value >> kb) {
+        return kb * 1024;
+      }
+    }
+  }
+#endif
+  return -1;
+}
+
+// The number of bytes allocated from the heap, or -1 if the allocator
+// doesn't report it.
+int64_t HeapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  auto info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+  auto info = mallinfo();
+  return static_cast<unsigned>(info.uordblks) + static_cast<unsigned>(info.hblkhd);
+#else
+  return -1;
+#endif
+}
+
+const char* PassKind(const proto::Pass& pass) {
+  auto field = proto::Pass::descriptor()->FindFieldByNumber(pass.pass_case());
+  return field ? field->name().c_str() : "none";
+}
+
+void RunPass(stripe::Block* block, const proto::Pass& pass, const proto::Config& cfg, proto::PassStats* stats) {
+  switch (pass.pass_case()) {
+    case proto::Pass::kCache:
+      CachePass(block, pass.cache());
+      break;
+    case proto::Pass::kComputeDeps:
+      ComputeDepsPass(block, pass.compute_deps());
+      break;
+    case proto::Pass::kFusion:
+      FusionPass(block, pass.fusion());
+      break;
+    case proto::Pass::kLocalize:
+      LocalizePass(block, pass.localize());
+      break;
+    case proto::Pass::kLocateBlock:
+      LocateBlockPass(block, pass.locate_block());
+      break;
+    case proto::Pass::kLocateInnerBlock:
+      LocateInnerBlockPass(block, pass.locate_inner_block());
+      break;
+    case proto::Pass::kLocateMemory:
+      LocateMemoryPass(block, pass.locate_memory());
+      break;
+    case proto::Pass::kMemoryPlacement:
+      MemPlacementPass(block, pass.memory_placement(), stats ? stats->mutable_placement() : nullptr);
+      break;
+    case proto::Pass::kScalarize:
+      ScalarizePass(block, pass.scalarize());
+      break;
+    case proto::Pass::kSchedule:
+      SchedulePass(block, pass.schedule());
+      break;
+    case proto::Pass::kStencil:
+      StencilPass(block, pass.stencil());
+      break;
+    case proto::Pass::kAutotile:
+      AutotilePass(block, pass.autotile(), cfg);
+      break;
+    case proto::Pass::kTranspose:
+      TransposePass(block, pass.transpose());
+      break;
+    case proto::Pass::kPartition:
+      PartitionPass(block, pass.partition());
+      break;
+    case proto::Pass::kPruneIndexes:
+      PruneIndexesPass(block, pass.prune_indexes());
+      break;
+    case proto::Pass::kUnroll:
+      UnrollPass(block, pass.unroll());
+      break;
+    case proto::Pass::kBlockedLayout:
+      BlockedLayoutPass(block, pass.blocked_layout());
+      break;
+    default:
+      break;
+  }
+}
+
+void CountIR(const stripe::Block& block, proto::IRStats* stats) {
+  stats->set_blocks(stats->blocks() + 1);
+  stats->set_stmts(stats->stmts() + block.stmts.size());
+  stats->set_refs(stats->refs() + block.refs.size());
+  for (const auto& stmt : block.stmts) {
+    auto inner = stripe::Block::Downcast(stmt);
+    if (inner) {
+      CountIR(*inner, stats);
+    }
+  }
+}
+
 }  // namespace
 
+proto::IRStats ComputeIRStats(const stripe::Block& block) {
+  proto::IRStats stats;
+  stats.set_blocks(0);
+  stats.set_stmts(0);
+  stats.set_refs(0);
+  CountIR(block, &stats);
+  return stats;
+}
+
 void Optimize(stripe::Block* block, const proto::Config& cfg, const OptimizeOptions& options) {
+  // Statistics are only gathered when something will consume them.
+  bool logging_events = options.ctx && options.ctx->is_logging_events();
+  bool instrument = options.stats || options.dump_passes || logging_events || VLOG_IS_ON(1);
+  context::Activity optimize_activity;
+  if (logging_events) {
+    optimize_activity = context::Activity{*options.ctx, "tile::codegen::Optimize"};
+  }
+  proto::OptimizeStats summary;
+  auto optimize_start = std::chrono::steady_clock::now();
   size_t counter = 0;
   DumpProgram(*block, options, "initial", counter++);
   for (const auto& pass : cfg.passes()) {
     IVLOG(2, "Optimization Pass " << pass.name());
-    switch (pass.pass_case()) {
-      case proto::Pass::kCache:
-        CachePass(block, pass.cache());
-        break;
-      case proto::Pass::kComputeDeps:
-        ComputeDepsPass(block, pass.compute_deps());
-        break;
-      case proto::Pass::kFusion:
-        FusionPass(block, pass.fusion());
-        break;
-      case proto::Pass::kLocalize:
-        LocalizePass(block, pass.localize());
-        break;
-      case proto::Pass::kLocateBlock:
-        LocateBlockPass(block, pass.locate_block());
-        break;
-      case proto::Pass::kLocateInnerBlock:
-        LocateInnerBlockPass(block, pass.locate_inner_block());
-        break;
-      case proto::Pass::kLocateMemory:
-        LocateMemoryPass(block, pass.locate_memory());
-        break;
-      case proto::Pass::kMemoryPlacement:
-        MemPlacementPass(block, pass.memory_placement());
-        break;
-      case proto::Pass::kScalarize:
-        ScalarizePass(block, pass.scalarize());
-        break;
-      case proto::Pass::kSchedule:
-        SchedulePass(block, pass.schedule());
-        break;
-      case proto::Pass::kStencil:
-        StencilPass(block, pass.stencil());
-        break;
-      case proto::Pass::kAutotile:
-        AutotilePass(block, pass.autotile());
-        break;
-      case proto::Pass::kTranspose:
-        TransposePass(block, pass.transpose());
-        break;
-      case proto::Pass::kPartition:
-        PartitionPass(block, pass.partition());
-        break;
-      case proto::Pass::kPruneIndexes:
-        PruneIndexesPass(block, pass.prune_indexes());
-        break;
-      case proto::Pass::kUnroll:
-        UnrollPass(block, pass.unroll());
-        break;
-      default:
-        break;
+    if (!instrument) {
+      RunPass(block, pass, cfg, nullptr);
+      DumpProgram(*block, options, pass.name(), counter++);
+      continue;
+    }
+    context::Activity activity;
+    if (logging_events) {
+      activity = context::Activity{optimize_activity.ctx(), "tile::codegen::Pass"};
+    }
+    auto stats = summary.add_passes();
+    stats->set_name(pass.name());
+    stats->set_kind(PassKind(pass));
+    *stats->mutable_before() = ComputeIRStats(*block);
+    int64_t heap_before = HeapInUse();
+    auto start = std::chrono::steady_clock::now();
+
+    RunPass(block, pass, cfg, stats);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats->set_seconds(elapsed.count());
+    *stats->mutable_after() = ComputeIRStats(*block);
+    int64_t heap_after = HeapInUse();
+    if (0 <= heap_before && 0 <= heap_after) {
+      stats->set_heap_delta_bytes(heap_after - heap_before);
+    }
+    // The peak is process-wide and can't be reset without disturbing the host
+    // application's accounting (or other concurrent Optimize calls), so it's
+    // reported as is.
+    int64_t rss = ReadProcStatus("VmRSS");
+    if (0 <= rss) {
+      stats->set_rss_bytes(rss);
+    }
+    int64_t peak_rss = ReadProcStatus("VmHWM");
+    if (0 <= peak_rss) {
+      stats->set_peak_rss_bytes(peak_rss);
+    }
+    if (logging_events) {
+      activity.AddMetadata(*stats);
+    }
+    IVLOG(1, "Pass " << pass.name() << " (" << stats->kind() << "): " << stats->seconds() << "s, blocks "
+                     << stats->before().blocks() << " -> " << stats->after().blocks() << ", stmts "
+                     << stats->before().stmts() << " -> " << stats->after().stmts() << ", refs "
+                     << stats->before().refs() << " -> " << stats->after().refs());
+    for (const auto& placement : stats->placement()) {
+      IVLOG(1, "  Arena " << placement.loc().name() << ": " << placement.arena_bytes() << " bytes for "
+                          << placement.chunks() << " chunks, lower bound " << placement.lower_bound_bytes()
+                          << " bytes (" << placement.fragmentation() * 100 << "% fragmentation)");
     }
     DumpProgram(*block, options, pass.name(), counter++);
   }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - optimize_start;
+  summary.set_seconds(elapsed.count());
+  if (instrument) {
+    if (logging_events) {
+      optimize_activity.AddMetadata(summary);
+    }
+    DumpStats(summary, options);
+    if (options.stats) {
+      *options.stats = summary;
+    }
+  }
 }
 
 }  // namespace codegen
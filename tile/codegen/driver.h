@@ -4,6 +4,7 @@
 
 #include <boost/filesystem.hpp>
 
+#include "base/context/context.h"
 #include "tile/codegen/codegen.pb.h"
 #include "tile/stripe/stripe.h"
 
@@ -12,10 +13,21 @@ namespace tile {
 namespace codegen {
 
 struct OptimizeOptions {
-  bool dump_passes;
+  bool dump_passes = false;
   boost::filesystem::path dbg_dir;
+
+  // If set, the optimization and each pass are recorded as context::Activity events under this context
+  // ("tile::codegen::Optimize" and "tile::codegen::Pass"), with their statistics attached as metadata.
+  const context::Context* ctx = nullptr;
+
+  // If set, receives the statistics for each pass: wall time, block/statement/refinement counts before and after,
+  // and memory growth.  With dump_passes, the statistics are also written to stats.json in dbg_dir.
+  proto::OptimizeStats* stats = nullptr;
 };
 
+// Counts the blocks, statements, and refinements in a program.
+proto::IRStats ComputeIRStats(const stripe::Block& block);
+
 void Optimize(stripe::Block* block, const proto::Config& cfg, const OptimizeOptions& options);
 
 }  // namespace codegen
@@ -4,18 +4,32 @@
 
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Host.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
 #include <deque>
 #include <memory>
-
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <half.hpp>
 
+#include "base/util/logging.h"
 #include "base/util/printstring.h"
+#include "tile/codegen/tags.h"
 #include "tile/stripe/stripe.h"
 
 namespace vertexai {
@@ -24,16 +38,87 @@ namespace codegen {
 
 namespace {
 const char invoker_name_[] = "__invoke_";
+const char parallel_for_name_[] = "__stripe_parallel_for";
+const char merge_lock_name_[] = "__stripe_merge_lock";
+const char merge_unlock_name_[] = "__stripe_merge_unlock";
+
+// A refinement with neither a direction nor a source is a local allocation.
+bool IsLocalAlloc(const stripe::Refinement& ref) { return ref.dir == stripe::RefDir::None && ref.from.empty(); }
+
+// Refinements without a direction may still be written through, so only
+// inputs are known to be read-only.
+bool IsWritten(const stripe::Refinement& ref) { return ref.dir != stripe::RefDir::In && !IsLocalAlloc(ref); }
+
+// Returns true if distinct values of the index always address disjoint
+// elements of the refinement: some dimension is accessed only via the index,
+// with a stride covering the dimension's extent.
+bool Partitions(const stripe::Refinement& ref, const std::string& idx) {
+  for (size_t i = 0; i < ref.access.size(); ++i) {
+    int64_t coeff = ref.access[i][idx];
+    if (!coeff || static_cast<uint64_t>(std::abs(coeff)) < ref.shape.dims[i].size) {
+      continue;
+    }
+    bool only_idx = true;
+    for (const auto& term : ref.access[i].getMap()) {
+      if (!term.first.empty() && term.first != idx) {
+        only_idx = false;
+      }
+    }
+    if (only_idx) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The width in bits of the host's widest vector registers.
+unsigned HostVectorBits() {
+  static const unsigned bits = []() {
+    llvm::StringMap<bool> features;
+    if (!llvm::sys::getHostCPUFeatures(features)) {
+      return 128u;
+    }
+    if (features.lookup("avx512f")) {
+      return 512u;
+    }
+    if (features.lookup("avx")) {
+      return 256u;
+    }
+    return 128u;
+  }();
+  return bits;
+}
+
+// The host's CPU features, in the form expected by llvm::EngineBuilder.
+std::vector<std::string> HostAttributes() {
+  std::vector<std::string> attrs;
+  llvm::StringMap<bool> features;
+  if (llvm::sys::getHostCPUFeatures(features)) {
+    for (const auto& feature : features) {
+      attrs.push_back((feature.getValue() ? "+" : "-") + feature.getKey().str());
+    }
+  }
+  return attrs;
 }
 
+}  // namespace
+
 class Executable {
  public:
-  Executable(std::unique_ptr<llvm::Module>&& module, const std::vector<std::string>& parameters);
-  void Run(const std::map<std::string, void*>& buffers);
+  Executable(std::unique_ptr<llvm::LLVMContext> context, std::unique_ptr<llvm::Module>&& module,
+             const std::vector<std::string>& parameters);
+  const std::vector<std::string>& parameters() const { return parameters_; }
+  void Run(const std::map<std::string, void*>& buffers) const;
+  void Run(const std::vector<void*>& buffers) const;
 
  private:
+  using Invoker = void (*)(void**);
+
+  // The engine's code and data live in the context, so it must outlive the engine.
+  std::unique_ptr<llvm::LLVMContext> context_;
   std::unique_ptr<llvm::ExecutionEngine> engine_;
   std::vector<std::string> parameters_;
+  Invoker invoker_ = nullptr;
 };
 
 class Error : public std::runtime_error {
@@ -49,13 +134,24 @@ class Runtime : public llvm::RuntimeDyld::SymbolResolver {
 
 class Compiler : private stripe::ConstStmtVisitor {
  public:
-  Compiler();
+  explicit Compiler(const JitOptions& options);
   std::unique_ptr<Executable> CompileProgram(const stripe::Block& program);
 
  protected:
-  explicit Compiler(llvm::Module* module);
+  // How a block is split into a parallel region.
+  struct ParallelPlan {
+    size_t split = 0;              // The index divided among threads
+    std::vector<bool> privatize;  // Per refinement: whether it's accumulated per thread
+  };
+
+  Compiler(llvm::Module* module, const JitOptions& options, bool in_parallel);
   void GenerateInvoker(const stripe::Block& program, llvm::Function* main);
-  llvm::Function* CompileBlock(const stripe::Block& block);
+  llvm::Function* CompileBlock(const stripe::Block& block, const stripe::Index* split = nullptr);
+  bool PlanParallel(const stripe::Block& block, ParallelPlan* plan);
+  bool PlanVector(const stripe::Block& block, size_t* vidx, unsigned* width);
+  void VectorLoop(const stripe::Block& block, size_t vidx, unsigned width, llvm::Value* range);
+  llvm::Function* GenerateTask(const stripe::Block& block, llvm::Function* function, const ParallelPlan& plan);
+  void ParallelBlock(const stripe::Block& block, const ParallelPlan& plan);
   void Visit(const stripe::Load&) override;
   void Visit(const stripe::Store&) override;
   void Visit(const stripe::Constant&) override;
@@ -109,26 +205,41 @@ class Compiler : private stripe::ConstStmtVisitor {
   scalar Cast(scalar, DataType);
   scalar CheckBool(scalar);
   llvm::Type* CType(DataType);
+  llvm::Type* ValueType(DataType);
+  int64_t VectorStride(const buffer& buf);
+  llvm::Value* VectorPtr(const buffer& buf);
   llvm::Value* ElementPtr(const buffer& buf);
   llvm::Value* Eval(const stripe::Affine& access);
   void OutputType(llvm::Value* ret, const stripe::Intrinsic&);
   void OutputBool(llvm::Value* ret, const stripe::Intrinsic&);
   llvm::Type* IndexType();
   llvm::Value* IndexConst(ssize_t val);
-  llvm::FunctionType* BlockType(const stripe::Block&);
+  llvm::FunctionType* BlockType(const stripe::Block&, bool split);
+  llvm::Function* ExternalFunction(const std::string& name, llvm::FunctionType* type);
   llvm::Function* MallocFunction();
   llvm::Function* FreeFunction();
+  llvm::Function* CallocFunction();
+  llvm::Function* ParallelForFunction();
 
+  std::unique_ptr<llvm::LLVMContext> owned_context_;  // Handed to the Executable by CompileProgram
   llvm::LLVMContext& context_;
   llvm::IRBuilder<> builder_;
   llvm::Module* module_ = nullptr;
+  JitOptions options_;
+  bool in_parallel_ = false;
+  std::string vector_index_;   // The index being vectorized, if any
+  unsigned vector_width_ = 0;  // Lanes per scalar while emitting a vector body
 
   std::map<std::string, scalar> scalars_;
   std::map<std::string, buffer> buffers_;
   std::map<std::string, index> indexes_;
 };
 
-Compiler::Compiler() : context_(llvm::getGlobalContext()), builder_{context_} {
+Compiler::Compiler(const JitOptions& options)
+    : owned_context_{std::make_unique<llvm::LLVMContext>()},
+      context_(*owned_context_),
+      builder_{context_},
+      options_(options) {
   static std::once_flag init_once;
   std::call_once(init_once, []() {
     LLVMInitializeNativeTarget();
@@ -158,7 +269,9 @@ std::unique_ptr<Executable> Compiler::CompileProgram(const stripe::Block& progra
   llvm::legacy::PassManager modopt;
   pmb.populateModulePassManager(modopt);
   modopt.run(*module_);
-  module_->print(llvm::errs(), nullptr);
+  if (VLOG_IS_ON(4)) {
+    module_->print(llvm::errs(), nullptr);
+  }
   // Wrap the finished module and the buffer names into an Executable instance.
   std::vector<std::string> param_names;
   for (auto& ref : program.refs) {
@@ -167,10 +280,15 @@ std::unique_ptr<Executable> Compiler::CompileProgram(const stripe::Block& progra
   }
   std::unique_ptr<llvm::Module> xfermod(module_);
   module_ = nullptr;
-  return std::make_unique<Executable>(std::move(xfermod), param_names);
+  return std::make_unique<Executable>(std::move(owned_context_), std::move(xfermod), param_names);
 }
 
-Compiler::Compiler(llvm::Module* module) : context_(llvm::getGlobalContext()), builder_{context_}, module_(module) {
+Compiler::Compiler(llvm::Module* module, const JitOptions& options, bool in_parallel)
+    : context_(module->getContext()),
+      builder_{context_},
+      module_(module),
+      options_(options),
+      in_parallel_(in_parallel) {
   // This private constructor sets up a nested compiler instance which will
   // process a nested block, generating output into the same module as its
   // containing compiler instance.
@@ -220,10 +338,12 @@ void Compiler::GenerateInvoker(const stripe::Block& program, llvm::Function* mai
   builder_.CreateRetVoid();
 }
 
-llvm::Function* Compiler::CompileBlock(const stripe::Block& block) {
+llvm::Function* Compiler::CompileBlock(const stripe::Block& block, const stripe::Index* split) {
   // Generate a function implementing the body of this block.
   // Buffers (refinements) will be passed in as function parameters, as will
-  // the initial value for each index.
+  // the initial value for each index.  If an index is being split across a
+  // parallel region, a final parameter provides its iteration count, so that
+  // each thread can run a subrange.
 
   for (const auto& ref : block.refs) {
     buffers_[ref.into] = buffer{&ref};
@@ -235,16 +355,20 @@ llvm::Function* Compiler::CompileBlock(const stripe::Block& block) {
   // create the LLVM function which will implement the Stripe block
   auto linkage = llvm::Function::ExternalLinkage;
   auto name = block.name;
-  auto func_type = BlockType(block);
+  auto func_type = BlockType(block, split != nullptr);
   auto function = llvm::Function::Create(func_type, linkage, name, module_);
   // create a basic block; configure the builder to start there
   auto bb = llvm::BasicBlock::Create(context_, "entry", function);
   builder_.SetInsertPoint(bb);
 
   // associate parameter values with buffers and indexes
+  llvm::Value* split_count = nullptr;
   for (auto ai = function->arg_begin(); ai != function->arg_end(); ++ai) {
     unsigned idx = ai->getArgNo();
-    if (idx < block.refs.size()) {
+    if (idx == block.refs.size() + block.idxs.size()) {
+      ai->setName("count");
+      split_count = &(*ai);
+    } else if (idx < block.refs.size()) {
       std::string param_name = block.refs[idx].into;
       ai->setName(param_name);
       assert(nullptr == buffers_[param_name].base);
@@ -266,10 +390,22 @@ llvm::Function* Compiler::CompileBlock(const stripe::Block& block) {
     indexes_[idx.name].variable = variable;
   }
 
+  // An innermost block may have one index vectorized; that index's loop is
+  // emitted innermost, with the remaining indexes looping around it.
+  size_t vidx = block.idxs.size();
+  unsigned width = 0;
+  bool vectorize = PlanVector(block, &vidx, &width);
+  std::vector<size_t> order;
+  for (size_t i = 0; i < block.idxs.size(); ++i) {
+    if (i != vidx) {
+      order.push_back(i);
+    }
+  }
+
   // generate the basic blocks for each nested loop's evaluation stages
   std::vector<loop> loops;
-  for (auto& idx : block.idxs) {
-    std::string name = idx.name;
+  for (size_t i : order) {
+    std::string name = block.idxs[i].name;
     auto init = llvm::BasicBlock::Create(context_, "init_" + name, function);
     auto test = llvm::BasicBlock::Create(context_, "test_" + name, function);
     auto body = llvm::BasicBlock::Create(context_, "body_" + name, function);
@@ -278,54 +414,60 @@ llvm::Function* Compiler::CompileBlock(const stripe::Block& block) {
   }
 
   // initialize each loop index and generate the termination check
-  for (size_t i = 0; i < block.idxs.size(); ++i) {
-    builder_.CreateBr(loops[i].init);
-    builder_.SetInsertPoint(loops[i].init);
-    llvm::Value* variable = indexes_[block.idxs[i].name].variable;
-    llvm::Value* init = indexes_[block.idxs[i].name].init;
+  for (size_t l = 0; l < order.size(); ++l) {
+    const auto& idx = block.idxs[order[l]];
+    builder_.CreateBr(loops[l].init);
+    builder_.SetInsertPoint(loops[l].init);
+    llvm::Value* variable = indexes_[idx.name].variable;
+    llvm::Value* init = indexes_[idx.name].init;
     builder_.CreateStore(init, variable);
-    builder_.CreateBr(loops[i].test);
-    builder_.SetInsertPoint(loops[i].test);
+    builder_.CreateBr(loops[l].test);
+    builder_.SetInsertPoint(loops[l].test);
     llvm::Value* index = builder_.CreateLoad(variable);
-    llvm::Value* range = IndexConst(block.idxs[i].range);
+    llvm::Value* range = (&idx == split) ? split_count : IndexConst(idx.range);
     llvm::Value* limit = builder_.CreateAdd(init, range);
     llvm::Value* go = builder_.CreateICmpULT(index, limit);
-    builder_.CreateCondBr(go, loops[i].body, loops[i].done);
-    builder_.SetInsertPoint(loops[i].body);
+    builder_.CreateCondBr(go, loops[l].body, loops[l].done);
+    builder_.SetInsertPoint(loops[l].body);
   }
 
-  // check the constraints against the current index values and decide whether
-  // to execute the block body for this iteration
-  llvm::Value* go = builder_.getTrue();
-  for (auto& constraint : block.constraints) {
-    llvm::Value* gateval = Eval(constraint);
-    llvm::Value* check = builder_.CreateICmpSGE(gateval, IndexConst(0));
-    go = builder_.CreateAnd(check, go);
-  }
-  auto block_body = llvm::BasicBlock::Create(context_, "block", function);
-  auto block_done = llvm::BasicBlock::Create(context_, "next", function);
-  builder_.CreateCondBr(go, block_body, block_done);
-  builder_.SetInsertPoint(block_body);
+  if (vectorize) {
+    const auto& idx = block.idxs[vidx];
+    VectorLoop(block, vidx, width, (&idx == split) ? split_count : IndexConst(idx.range));
+  } else {
+    // check the constraints against the current index values and decide
+    // whether to execute the block body for this iteration
+    llvm::Value* go = builder_.getTrue();
+    for (auto& constraint : block.constraints) {
+      llvm::Value* gateval = Eval(constraint);
+      llvm::Value* check = builder_.CreateICmpSGE(gateval, IndexConst(0));
+      go = builder_.CreateAnd(check, go);
+    }
+    auto block_body = llvm::BasicBlock::Create(context_, "block", function);
+    auto block_done = llvm::BasicBlock::Create(context_, "next", function);
+    builder_.CreateCondBr(go, block_body, block_done);
+    builder_.SetInsertPoint(block_body);
+
+    // process each statement in the block body, generating code to modify the
+    // parameter buffer contents
+    for (const auto& stmt : block.stmts) {
+      stmt->Accept(this);
+    }
 
-  // process each statement in the block body, generating code to modify the
-  // parameter buffer contents
-  for (const auto& stmt : block.stmts) {
-    stmt->Accept(this);
+    // rejoin instruction flow after the constraint check
+    builder_.CreateBr(block_done);
+    builder_.SetInsertPoint(block_done);
   }
 
-  // rejoin instruction flow after the constraint check
-  builder_.CreateBr(block_done);
-  builder_.SetInsertPoint(block_done);
-
   // increment each index, from innermost to outermost, then jump back to test
-  for (size_t i = block.idxs.size(); i-- > 0;) {
-    llvm::Value* variable = indexes_[block.idxs[i].name].variable;
+  for (size_t l = order.size(); l-- > 0;) {
+    llvm::Value* variable = indexes_[block.idxs[order[l]].name].variable;
     llvm::Value* index = builder_.CreateLoad(variable);
     llvm::Value* increment = IndexConst(1);
     index = builder_.CreateAdd(index, increment);
     builder_.CreateStore(index, variable);
-    builder_.CreateBr(loops[i].test);
-    builder_.SetInsertPoint(loops[i].done);
+    builder_.CreateBr(loops[l].test);
+    builder_.SetInsertPoint(loops[l].done);
   }
 
   builder_.CreateRetVoid();
@@ -339,8 +481,18 @@ void Compiler::Visit(const stripe::Load& load) {
   // Look up the address of the target element.
   // Load the value from that address and use it to redefine the
   // destination scalar.
-  llvm::Value* element = ElementPtr(from);
-  llvm::Value* value = builder_.CreateLoad(element);
+  // Within a vector body, a unit-stride buffer supplies one element per lane,
+  // while a buffer the vector index doesn't address is broadcast.
+  llvm::Value* value = nullptr;
+  if (vector_width_ && VectorStride(from)) {
+    unsigned align = byte_width(from.refinement->shape.type);
+    value = builder_.CreateAlignedLoad(VectorPtr(from), align);
+  } else {
+    value = builder_.CreateLoad(ElementPtr(from));
+    if (vector_width_) {
+      value = builder_.CreateVectorSplat(vector_width_, value);
+    }
+  }
   scalars_[load.into] = scalar{value, from.refinement->shape.type};
 }
 
@@ -355,8 +507,29 @@ void Compiler::Visit(const stripe::Store& store) {
   buffer into = buffers_[store.into];
   scalar from = Cast(scalars_[store.from], into.refinement->shape.type);
   llvm::Value* value = from.value;
-  llvm::Value* element = ElementPtr(into);
   std::string agg_op = into.refinement->agg_op;
+  if (vector_width_) {
+    unsigned align = byte_width(from.type);
+    if (VectorStride(into)) {
+      // Each lane stores to its own element.
+      llvm::Value* element = VectorPtr(into);
+      if ("add" == agg_op) {
+        llvm::Value* prev = builder_.CreateAlignedLoad(element, align);
+        value = is_float(from.type) ? builder_.CreateFAdd(value, prev) : builder_.CreateAdd(value, prev);
+      }
+      builder_.CreateAlignedStore(value, element, align);
+      return;
+    }
+    // Every lane aggregates into the same element (PlanVector only allows
+    // this for "add"); sum the lanes, then aggregate the sum.
+    llvm::Value* sum = builder_.CreateExtractElement(value, builder_.getInt32(0));
+    for (unsigned lane = 1; lane < vector_width_; ++lane) {
+      llvm::Value* elt = builder_.CreateExtractElement(value, builder_.getInt32(lane));
+      sum = is_float(from.type) ? builder_.CreateFAdd(sum, elt) : builder_.CreateAdd(sum, elt);
+    }
+    value = sum;
+  }
+  llvm::Value* element = ElementPtr(into);
   if ("add" == agg_op) {
     llvm::Value* prev = builder_.CreateLoad(element);
     if (is_float(from.type)) {
@@ -377,12 +550,18 @@ void Compiler::Visit(const stripe::Constant& constant) {
   switch (constant.type) {
     case stripe::ConstType::Integer: {
       auto ty = builder_.getInt64Ty();
-      auto value = llvm::ConstantInt::get(ty, constant.iconst);
+      llvm::Value* value = llvm::ConstantInt::get(ty, constant.iconst);
+      if (vector_width_) {
+        value = builder_.CreateVectorSplat(vector_width_, value);
+      }
       scalars_[constant.name] = scalar{value, DataType::INT64};
     } break;
     case stripe::ConstType::Float: {
       auto ty = builder_.getDoubleTy();
-      auto value = llvm::ConstantFP::get(ty, constant.fconst);
+      llvm::Value* value = llvm::ConstantFP::get(ty, constant.fconst);
+      if (vector_width_) {
+        value = builder_.CreateVectorSplat(vector_width_, value);
+      }
       scalars_[constant.name] = scalar{value, DataType::FLOAT64};
     } break;
   }
@@ -417,8 +596,16 @@ void Compiler::Visit(const stripe::Intrinsic& intrinsic) {
 }
 
 void Compiler::Visit(const stripe::Block& block) {
+  // The outermost tagged block that can be split safely becomes a parallel
+  // region; blocks nested within it run serially.
+  ParallelPlan plan;
+  if (!in_parallel_ && !options_.parallel_tags.empty() && HasTags(block, options_.parallel_tags) &&
+      PlanParallel(block, &plan)) {
+    ParallelBlock(block, plan);
+    return;
+  }
   // Compile a nested block as a function in the same module
-  Compiler nested(module_);
+  Compiler nested(module_, options_, in_parallel_);
   auto function = nested.CompileBlock(block);
   // Generate a list of args.
   // The argument list begins with a pointer to each refinement. We will either
@@ -752,7 +939,7 @@ Compiler::scalar Compiler::Cast(scalar v, DataType to_type) {
   if (v.type == to_type) {
     return v;
   }
-  llvm::Type* to_llvmtype = CType(to_type);
+  llvm::Type* to_llvmtype = ValueType(to_type);
   bool from_signed = is_int(v.type) || is_float(v.type);
   bool to_signed = is_int(to_type) || is_float(to_type);
   auto op = llvm::CastInst::getCastOpcode(v.value, from_signed, to_llvmtype, to_signed);
@@ -796,6 +983,20 @@ llvm::Type* Compiler::CType(DataType type) {
   return builder_.getVoidTy();
 }
 
+llvm::Type* Compiler::ValueType(DataType type) {
+  // Within a vector body, each scalar holds one value per lane.
+  llvm::Type* ctype = CType(type);
+  return vector_width_ ? llvm::VectorType::get(ctype, vector_width_) : ctype;
+}
+
+int64_t Compiler::VectorStride(const buffer& buf) { return buf.refinement->FlatAccess()[vector_index_]; }
+
+llvm::Value* Compiler::VectorPtr(const buffer& buf) {
+  // The element addressed by the first lane, viewed as a vector.
+  llvm::Type* type = ValueType(buf.refinement->shape.type)->getPointerTo();
+  return builder_.CreateBitCast(ElementPtr(buf), type);
+}
+
 llvm::Value* Compiler::ElementPtr(const buffer& buf) {
   // Ask the source refinement to generate an access path, in the form of
   // a sequence of indexes to scale and sum. Load each index value, multiply,
@@ -806,8 +1007,11 @@ llvm::Value* Compiler::ElementPtr(const buffer& buf) {
 }
 
 llvm::Value* Compiler::Eval(const stripe::Affine& access) {
-  llvm::Value* offset = IndexConst(0);
+  llvm::Value* offset = IndexConst(access.constant());
   for (auto& term : access.getMap()) {
+    if (term.first.empty()) {
+      continue;  // The constant term
+    }
     llvm::Value* indexVar = indexes_[term.first].variable;
     llvm::Value* indexVal = builder_.CreateLoad(indexVar);
     llvm::Value* multiplier = IndexConst(term.second);
@@ -837,7 +1041,7 @@ llvm::Value* Compiler::IndexConst(ssize_t val) {
   return llvm::ConstantInt::get(ssizetype, val);
 }
 
-llvm::FunctionType* Compiler::BlockType(const stripe::Block& block) {
+llvm::FunctionType* Compiler::BlockType(const stripe::Block& block, bool split) {
   // Generate a type for the function which will implement this block.
   std::vector<llvm::Type*> param_types;
   // Each buffer base address will be provided as a parameter.
@@ -849,18 +1053,30 @@ llvm::FunctionType* Compiler::BlockType(const stripe::Block& block) {
   for (size_t i = 0; i < block.idxs.size(); ++i) {
     param_types.push_back(IndexType());
   }
+  // A split block takes the iteration count of its split index.
+  if (split) {
+    param_types.push_back(IndexType());
+  }
   // Blocks never return a value.
   llvm::Type* return_type = builder_.getVoidTy();
   return llvm::FunctionType::get(return_type, param_types, false);
 }
 
+llvm::Function* Compiler::ExternalFunction(const std::string& name, llvm::FunctionType* type) {
+  // Declare each external function once per module; redeclaring it would
+  // produce a renamed declaration the runtime can't resolve.
+  auto function = module_->getFunction(name);
+  if (!function) {
+    function = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, module_);
+  }
+  return function;
+}
+
 llvm::Function* Compiler::MallocFunction(void) {
   std::vector<llvm::Type*> argtypes{IndexType()};
   llvm::Type* rettype = builder_.getInt8PtrTy()->getPointerTo();
   auto functype = llvm::FunctionType::get(rettype, argtypes, false);
-  auto linkage = llvm::Function::ExternalLinkage;
-  const char* funcname = "malloc";
-  return llvm::Function::Create(functype, linkage, funcname, module_);
+  return ExternalFunction("malloc", functype);
 }
 
 llvm::Function* Compiler::FreeFunction(void) {
@@ -868,13 +1084,355 @@ llvm::Function* Compiler::FreeFunction(void) {
   std::vector<llvm::Type*> argtypes{ptrtype};
   llvm::Type* rettype = llvm::Type::getVoidTy(context_);
   auto functype = llvm::FunctionType::get(rettype, argtypes, false);
-  auto linkage = llvm::Function::ExternalLinkage;
-  const char* funcname = "free";
-  return llvm::Function::Create(functype, linkage, funcname, module_);
+  return ExternalFunction("free", functype);
+}
+
+llvm::Function* Compiler::CallocFunction(void) {
+  std::vector<llvm::Type*> argtypes{IndexType(), IndexType()};
+  llvm::Type* rettype = builder_.getInt8PtrTy()->getPointerTo();
+  auto functype = llvm::FunctionType::get(rettype, argtypes, false);
+  return ExternalFunction("calloc", functype);
+}
+
+llvm::Function* Compiler::ParallelForFunction(void) {
+  // void __stripe_parallel_for(void (*task)(i8** closure, iN begin, iN end), i8** closure, iN count, iN threads)
+  llvm::Type* closuretype = builder_.getInt8PtrTy()->getPointerTo();
+  llvm::Type* voidtype = builder_.getVoidTy();
+  auto tasktype = llvm::FunctionType::get(voidtype, {closuretype, IndexType(), IndexType()}, false);
+  std::vector<llvm::Type*> argtypes{tasktype->getPointerTo(), closuretype, IndexType(), IndexType()};
+  auto functype = llvm::FunctionType::get(voidtype, argtypes, false);
+  return ExternalFunction(parallel_for_name_, functype);
 }
 
-Executable::Executable(std::unique_ptr<llvm::Module>&& module, const std::vector<std::string>& parameters)
-    : parameters_(parameters) {
+bool Compiler::PlanVector(const stripe::Block& block, size_t* vidx, unsigned* width) {
+  // Only innermost blocks made up of loads, stores, constants, and intrinsics
+  // are vectorized; the element types must have a direct vector form.
+  if (!options_.vectorize || !block.constraints.empty()) {
+    return false;
+  }
+  std::set<std::string> loaded;
+  std::set<std::string> stored;
+  unsigned bits = 0;
+  for (const auto& stmt : block.stmts) {
+    switch (stmt->kind()) {
+      case stripe::StmtKind::Load:
+        loaded.insert(stripe::Load::Downcast(stmt)->from);
+        break;
+      case stripe::StmtKind::Store:
+        stored.insert(stripe::Store::Downcast(stmt)->into);
+        break;
+      case stripe::StmtKind::Constant:
+        break;
+      case stripe::StmtKind::Intrinsic: {
+        auto type = stripe::Intrinsic::Downcast(stmt)->type;
+        if (type == DataType::FLOAT16) {
+          return false;
+        }
+        if (type != DataType::BOOLEAN) {
+          bits = std::max<unsigned>(bits, byte_width(type) * 8);
+        }
+      } break;
+      default:
+        return false;
+    }
+  }
+  std::vector<const stripe::Refinement*> used;
+  for (const auto& ref : block.refs) {
+    bool is_loaded = loaded.count(ref.into);
+    bool is_stored = stored.count(ref.into);
+    if (!is_loaded && !is_stored) {
+      continue;
+    }
+    auto type = ref.shape.type;
+    if (type == DataType::BOOLEAN || type == DataType::FLOAT16 || ref.access.size() != ref.shape.dims.size()) {
+      return false;
+    }
+    // A vector of loads must not observe a store from an earlier lane, so
+    // written buffers may not be read, directly or through an alias.
+    if (is_stored) {
+      if (is_loaded) {
+        return false;
+      }
+      for (const auto& other : block.refs) {
+        if (&other != &ref && !ref.from.empty() && other.from == ref.from) {
+          return false;
+        }
+      }
+      if (!ref.agg_op.empty() && ref.agg_op != "add") {
+        return false;
+      }
+    }
+    bits = std::max<unsigned>(bits, byte_width(type) * 8);
+    used.push_back(&ref);
+  }
+  if (!bits) {
+    return false;
+  }
+  unsigned lanes = HostVectorBits() / bits;
+  if (lanes < 2) {
+    return false;
+  }
+  // Prefer the innermost index that every buffer either ignores or accesses
+  // with unit stride.  Lanes that store to the same element must be summed,
+  // so an index that stores ignore is only usable for "add" aggregations.
+  for (size_t i = block.idxs.size(); i-- > 0;) {
+    const auto& idx = block.idxs[i];
+    if (idx.range < lanes) {
+      continue;
+    }
+    bool unit = false;
+    bool usable = true;
+    for (const auto* ref : used) {
+      int64_t stride = ref->FlatAccess()[idx.name];
+      if (stride == 1) {
+        unit = true;
+      } else if (stride != 0 || (stored.count(ref->into) && ref->agg_op != "add")) {
+        usable = false;
+      }
+    }
+    if (unit && usable) {
+      *vidx = i;
+      *width = lanes;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Compiler::VectorLoop(const stripe::Block& block, size_t vidx, unsigned width, llvm::Value* range) {
+  // The vectorized index steps by the vector width while a full vector of
+  // iterations remains; the remaining iterations run one at a time.
+  llvm::Function* function = builder_.GetInsertBlock()->getParent();
+  const auto& idx = block.idxs[vidx];
+  llvm::Value* variable = indexes_[idx.name].variable;
+  llvm::Value* init = indexes_[idx.name].init;
+  auto vtest = llvm::BasicBlock::Create(context_, "vtest_" + idx.name, function);
+  auto vbody = llvm::BasicBlock::Create(context_, "vbody_" + idx.name, function);
+  auto stest = llvm::BasicBlock::Create(context_, "stest_" + idx.name, function);
+  auto sbody = llvm::BasicBlock::Create(context_, "sbody_" + idx.name, function);
+  auto done = llvm::BasicBlock::Create(context_, "done_" + idx.name, function);
+  builder_.CreateStore(init, variable);
+  llvm::Value* limit = builder_.CreateAdd(init, range);
+  builder_.CreateBr(vtest);
+
+  builder_.SetInsertPoint(vtest);
+  llvm::Value* index = builder_.CreateLoad(variable);
+  llvm::Value* go = builder_.CreateICmpULE(builder_.CreateAdd(index, IndexConst(width)), limit);
+  builder_.CreateCondBr(go, vbody, stest);
+  builder_.SetInsertPoint(vbody);
+  vector_index_ = idx.name;
+  vector_width_ = width;
+  for (const auto& stmt : block.stmts) {
+    stmt->Accept(this);
+  }
+  vector_width_ = 0;
+  index = builder_.CreateLoad(variable);
+  builder_.CreateStore(builder_.CreateAdd(index, IndexConst(width)), variable);
+  builder_.CreateBr(vtest);
+
+  builder_.SetInsertPoint(stest);
+  index = builder_.CreateLoad(variable);
+  go = builder_.CreateICmpULT(index, limit);
+  builder_.CreateCondBr(go, sbody, done);
+  builder_.SetInsertPoint(sbody);
+  for (const auto& stmt : block.stmts) {
+    stmt->Accept(this);
+  }
+  index = builder_.CreateLoad(variable);
+  builder_.CreateStore(builder_.CreateAdd(index, IndexConst(1)), variable);
+  builder_.CreateBr(stest);
+
+  builder_.SetInsertPoint(done);
+}
+
+bool Compiler::PlanParallel(const stripe::Block& block, ParallelPlan* plan) {
+  // Prefer an index that partitions every written refinement, so that
+  // threads can write directly; failing that, accumulate additive outputs
+  // per thread.  Other written refinements (including additive ones that are
+  // also read) must be partitioned by the split index.
+  for (bool allow_private : {false, true}) {
+    for (size_t i = 0; i < block.idxs.size(); ++i) {
+      if (block.idxs[i].range < 2) {
+        continue;
+      }
+      ParallelPlan candidate{i, std::vector<bool>(block.refs.size())};
+      bool ok = true;
+      for (size_t r = 0; ok && r < block.refs.size(); ++r) {
+        const auto& ref = block.refs[r];
+        if (!IsWritten(ref) || Partitions(ref, block.idxs[i].name)) {
+          continue;
+        }
+        // Threads' private accumulators start out zeroed, so only refinements
+        // the block never reads from can be accumulated privately.
+        if (allow_private && ref.dir == stripe::RefDir::Out && ref.agg_op == "add" &&
+            ref.access.size() == ref.shape.dims.size()) {
+          candidate.privatize[r] = true;
+          continue;
+        }
+        ok = false;
+      }
+      if (ok) {
+        *plan = std::move(candidate);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+llvm::Function* Compiler::GenerateTask(const stripe::Block& block, llvm::Function* function,
+                                       const ParallelPlan& plan) {
+  // Generate the function run by each thread of a parallel region:
+  //   void task(i8** closure, iN begin, iN end)
+  // The closure holds the block's buffer arguments followed by its index
+  // initial values; the task runs iterations [begin, end) of the split index.
+  llvm::Type* slottype = builder_.getInt8PtrTy();
+  llvm::Type* voidtype = builder_.getVoidTy();
+  auto tasktype = llvm::FunctionType::get(voidtype, {slottype->getPointerTo(), IndexType(), IndexType()}, false);
+  auto task = llvm::Function::Create(tasktype, llvm::Function::InternalLinkage, block.name + "_task", module_);
+  builder_.SetInsertPoint(llvm::BasicBlock::Create(context_, "entry", task));
+  auto ai = task->arg_begin();
+  llvm::Value* closure = &(*ai++);
+  llvm::Value* begin = &(*ai++);
+  llvm::Value* end = &(*ai);
+  auto slot = [&](size_t i) { return builder_.CreateLoad(builder_.CreateGEP(closure, IndexConst(i))); };
+
+  std::vector<llvm::Value*> inits;
+  for (size_t i = 0; i < block.idxs.size(); ++i) {
+    llvm::Value* init = builder_.CreatePtrToInt(slot(block.refs.size() + i), IndexType());
+    if (i == plan.split) {
+      init = builder_.CreateAdd(init, begin);
+    }
+    inits.push_back(init);
+  }
+  llvm::Value* count = builder_.CreateSub(end, begin);
+
+  struct Private {
+    const stripe::Refinement* ref;
+    llvm::Value* shared;  // The shared buffer
+    llvm::Value* data;    // The thread's accumulator
+    llvm::Value* lo;      // The accumulator's first element offset within the shared buffer
+    llvm::Value* len;     // The accumulator's element count
+  };
+  std::vector<Private> privates;
+  std::vector<llvm::Value*> allocs;
+  std::vector<llvm::Value*> args;
+  for (size_t r = 0; r < block.refs.size(); ++r) {
+    const auto& ref = block.refs[r];
+    llvm::Type* ptrtype = CType(ref.shape.type)->getPointerTo();
+    if (IsLocalAlloc(ref)) {
+      // Each thread gets its own local allocations.
+      llvm::Value* mem = builder_.CreateCall(MallocFunction(), {IndexConst(ref.shape.byte_size())});
+      allocs.push_back(mem);
+      args.push_back(builder_.CreateBitCast(mem, ptrtype));
+      continue;
+    }
+    llvm::Value* shared = builder_.CreateBitCast(slot(r), ptrtype);
+    if (!plan.privatize[r]) {
+      args.push_back(shared);
+      continue;
+    }
+    // Bound the elements this thread's iterations can touch, relative to the
+    // shared buffer, and accumulate into a zeroed buffer covering them.
+    stripe::Affine flat = ref.FlatAccess();
+    llvm::Value* lo = IndexConst(flat.constant());
+    llvm::Value* hi = IndexConst(flat.constant() + ref.shape.elem_size());
+    for (size_t i = 0; i < block.idxs.size(); ++i) {
+      int64_t coeff = flat[block.idxs[i].name];
+      if (!coeff) {
+        continue;
+      }
+      llvm::Value* start = builder_.CreateMul(inits[i], IndexConst(coeff));
+      llvm::Value* iters = (i == plan.split) ? count : IndexConst(block.idxs[i].range);
+      llvm::Value* span = builder_.CreateMul(builder_.CreateSub(iters, IndexConst(1)), IndexConst(coeff));
+      lo = builder_.CreateAdd(lo, start);
+      hi = builder_.CreateAdd(hi, start);
+      if (0 < coeff) {
+        hi = builder_.CreateAdd(hi, span);
+      } else {
+        lo = builder_.CreateAdd(lo, span);
+      }
+    }
+    llvm::Value* len = builder_.CreateSub(hi, lo);
+    llvm::Value* mem = builder_.CreateCall(CallocFunction(), {len, IndexConst(byte_width(ref.shape.type))});
+    allocs.push_back(mem);
+    llvm::Value* data = builder_.CreateBitCast(mem, ptrtype);
+    privates.push_back(Private{&ref, shared, data, lo, len});
+    args.push_back(builder_.CreateGEP(data, builder_.CreateNeg(lo)));
+  }
+  args.insert(args.end(), inits.begin(), inits.end());
+  args.push_back(count);
+  builder_.CreateCall(function, args, "");
+
+  // Merge the thread's accumulators into the shared buffers.
+  if (!privates.empty()) {
+    auto locktype = llvm::FunctionType::get(voidtype, false);
+    builder_.CreateCall(ExternalFunction(merge_lock_name_, locktype));
+    for (const auto& priv : privates) {
+      llvm::BasicBlock* pre = builder_.GetInsertBlock();
+      auto loop = llvm::BasicBlock::Create(context_, "merge", task);
+      auto done = llvm::BasicBlock::Create(context_, "merged", task);
+      builder_.CreateCondBr(builder_.CreateICmpSLT(IndexConst(0), priv.len), loop, done);
+      builder_.SetInsertPoint(loop);
+      llvm::PHINode* elem = builder_.CreatePHI(IndexType(), 2);
+      elem->addIncoming(IndexConst(0), pre);
+      llvm::Value* value = builder_.CreateLoad(builder_.CreateGEP(priv.data, elem));
+      llvm::Value* dest = builder_.CreateGEP(priv.shared, builder_.CreateAdd(priv.lo, elem));
+      llvm::Value* prev = builder_.CreateLoad(dest);
+      if (is_float(priv.ref->shape.type)) {
+        value = builder_.CreateFAdd(value, prev);
+      } else {
+        value = builder_.CreateAdd(value, prev);
+      }
+      builder_.CreateStore(value, dest);
+      llvm::Value* next = builder_.CreateAdd(elem, IndexConst(1));
+      elem->addIncoming(next, loop);
+      builder_.CreateCondBr(builder_.CreateICmpSLT(next, priv.len), loop, done);
+      builder_.SetInsertPoint(done);
+    }
+    builder_.CreateCall(ExternalFunction(merge_unlock_name_, locktype));
+  }
+  for (auto mem : allocs) {
+    builder_.CreateCall(FreeFunction(), {mem});
+  }
+  builder_.CreateRetVoid();
+  return task;
+}
+
+void Compiler::ParallelBlock(const stripe::Block& block, const ParallelPlan& plan) {
+  Compiler nested(module_, options_, true);
+  auto function = nested.CompileBlock(block, &block.idxs[plan.split]);
+  auto task = nested.GenerateTask(block, function, plan);
+  // Pack the block's arguments into a closure for the task: the buffer
+  // pointers, then the index initial values.  The closure lives in the
+  // current function's entry block, so that it isn't reallocated per loop
+  // iteration.
+  llvm::Type* slottype = builder_.getInt8PtrTy();
+  llvm::Function* current = builder_.GetInsertBlock()->getParent();
+  llvm::IRBuilder<> entry(&current->getEntryBlock(), current->getEntryBlock().begin());
+  size_t slot_count = block.refs.size() + block.idxs.size();
+  llvm::Value* closure = entry.CreateAlloca(slottype, IndexConst(slot_count));
+  size_t slot = 0;
+  for (const auto& ref : block.refs) {
+    llvm::Value* value = llvm::ConstantPointerNull::get(builder_.getInt8PtrTy());
+    if (!IsLocalAlloc(ref)) {
+      std::string name = ref.from.empty() ? ref.into : ref.from;
+      value = builder_.CreateBitCast(ElementPtr(buffers_[name]), slottype);
+    }
+    builder_.CreateStore(value, builder_.CreateGEP(closure, IndexConst(slot++)));
+  }
+  for (const auto& idx : block.idxs) {
+    llvm::Value* value = builder_.CreateIntToPtr(Eval(idx.affine), slottype);
+    builder_.CreateStore(value, builder_.CreateGEP(closure, IndexConst(slot++)));
+  }
+  llvm::Value* count = IndexConst(block.idxs[plan.split].range);
+  llvm::Value* threads = IndexConst(options_.max_threads);
+  builder_.CreateCall(ParallelForFunction(), {task, closure, count, threads}, "");
+}
+
+Executable::Executable(std::unique_ptr<llvm::LLVMContext> context, std::unique_ptr<llvm::Module>&& module,
+                       const std::vector<std::string>& parameters)
+    : context_{std::move(context)}, parameters_(parameters) {
   std::string errStr;
   std::unique_ptr<llvm::RuntimeDyld::SymbolResolver> rez(new Runtime);
   auto ee = llvm::EngineBuilder(std::move(module))
@@ -882,6 +1440,8 @@ Executable::Executable(std::unique_ptr<llvm::Module>&& module, const std::vector
                 .setEngineKind(llvm::EngineKind::JIT)
                 .setVerifyModules(true)
                 .setSymbolResolver(std::move(rez))
+                .setMCPU(llvm::sys::getHostCPUName())
+                .setMAttrs(HostAttributes())
                 .create();
   if (ee) {
     ee->finalizeObject();
@@ -889,16 +1449,31 @@ Executable::Executable(std::unique_ptr<llvm::Module>&& module, const std::vector
   } else {
     throw Error("Failed to create ExecutionEngine: " + errStr);
   }
+  // Resolve the entry point once; the generated code is immutable from here
+  // on, so it may be invoked concurrently.
+  invoker_ = reinterpret_cast<Invoker>(engine_->getFunctionAddress(invoker_name_));
+  if (!invoker_) {
+    throw Error("Failed to resolve the program entry point");
+  }
 }
 
-void Executable::Run(const std::map<std::string, void*>& buffers) {
+void Executable::Run(const std::map<std::string, void*>& buffers) const {
   std::vector<void*> args(parameters_.size());
   for (size_t i = 0; i < args.size(); ++i) {
-    args[i] = buffers.at(parameters_[i]);
+    auto it = buffers.find(parameters_[i]);
+    if (it == buffers.end()) {
+      throw Error("Missing buffer for program parameter: \"" + parameters_[i] + "\"");
+    }
+    args[i] = it->second;
   }
-  void* argvec = args.data();
-  uint64_t entrypoint = engine_->getFunctionAddress(invoker_name_);
-  ((void (*)(void*))entrypoint)(argvec);
+  invoker_(args.data());
+}
+
+void Executable::Run(const std::vector<void*>& buffers) const {
+  if (buffers.size() != parameters_.size()) {
+    throw Error(printstring("Program expects %zu buffers; got %zu", parameters_.size(), buffers.size()));
+  }
+  invoker_(const_cast<void**>(buffers.data()));
 }
 
 namespace rt {
@@ -906,6 +1481,44 @@ namespace rt {
 // that we won't be able to resolve from system libraries.
 float h2f(half_float::half n) { return n; }
 half_float::half f2h(float n) { return half_float::half_cast<half_float::half>(n); }
+
+size_t HardwareThreads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+boost::asio::thread_pool& ThreadPool() {
+  static boost::asio::thread_pool pool{HardwareThreads()};
+  return pool;
+}
+
+// Runs a parallel region: the iteration range is divided evenly among the
+// threads, with the calling thread running the first subrange.
+void parallel_for(void (*task)(void**, ssize_t, ssize_t), void** closure, ssize_t count, ssize_t max_threads) {
+  ssize_t threads = std::min<ssize_t>(count, max_threads ? max_threads : HardwareThreads());
+  if (threads <= 1) {
+    task(closure, 0, count);
+    return;
+  }
+  std::mutex mu;
+  std::condition_variable cv;
+  ssize_t pending = threads - 1;
+  for (ssize_t t = 1; t < threads; ++t) {
+    ssize_t begin = count * t / threads;
+    ssize_t end = count * (t + 1) / threads;
+    boost::asio::post(ThreadPool(), [&, begin, end]() {
+      task(closure, begin, end);
+      std::lock_guard<std::mutex> lock{mu};
+      if (--pending == 0) {
+        cv.notify_all();
+      }
+    });
+  }
+  task(closure, 0, count / threads);
+  std::unique_lock<std::mutex> lock{mu};
+  cv.wait(lock, [&]() { return pending == 0; });
+}
+
+std::mutex merge_mu;
+void merge_lock() { merge_mu.lock(); }
+void merge_unlock() { merge_mu.unlock(); }
 }  // namespace rt
 
 template <typename T>
@@ -921,8 +1534,14 @@ llvm::RuntimeDyld::SymbolInfo Runtime::findSymbol(const std::string& name) {
       {"__gnu_f2h_ieee", symInfo(rt::f2h)},
       {"___truncsfhf2", symInfo(rt::f2h)},
       {"___extendhfsf2", symInfo(rt::h2f)},
+      {parallel_for_name_, symInfo(rt::parallel_for)},
+      {merge_lock_name_, symInfo(rt::merge_lock)},
+      {merge_unlock_name_, symInfo(rt::merge_unlock)},
   };
   auto loc = symbols.find(name);
+  if (loc == symbols.end() && name[0] == '_') {
+    loc = symbols.find(name.substr(1));
+  }
   if (loc != symbols.end()) {
     return loc->second;
   }
@@ -945,10 +1564,27 @@ llvm::RuntimeDyld::SymbolInfo Runtime::findSymbolInLogicalDylib(const std::strin
   return llvm::RuntimeDyld::SymbolInfo(nullptr);
 }
 
-void JitExecute(const stripe::Block& program, const std::map<std::string, void*>& buffers) {
-  Compiler compiler;
-  auto executable = compiler.CompileProgram(program);
-  executable->Run(buffers);
+JitProgram::JitProgram(const stripe::Block& program, const JitOptions& options) {
+  // Each program has its own LLVMContext, so programs may be run and destroyed
+  // concurrently; compilation is still serialized, since the engines share the
+  // runtime's symbol table.
+  static std::mutex compile_mu;
+  std::lock_guard<std::mutex> lock{compile_mu};
+  Compiler compiler{options};
+  executable_ = compiler.CompileProgram(program);
+}
+
+JitProgram::~JitProgram() {}
+
+const std::vector<std::string>& JitProgram::parameters() const { return executable_->parameters(); }
+
+void JitProgram::Run(const std::map<std::string, void*>& buffers) const { executable_->Run(buffers); }
+
+void JitProgram::Run(const std::vector<void*>& buffers) const { executable_->Run(buffers); }
+
+void JitExecute(const stripe::Block& program, const std::map<std::string, void*>& buffers,
+                const JitOptions& options) {
+  JitProgram{program, options}.Run(buffers);
 }
 
 }  // namespace codegen
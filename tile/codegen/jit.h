@@ -3,7 +3,10 @@
 #pragma once
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "tile/stripe/stripe.h"
 
@@ -11,7 +14,47 @@ namespace vertexai {
 namespace tile {
 namespace codegen {
 
-void JitExecute(const stripe::Block& program, const std::map<std::string, void*>& buffers);
+class Executable;
+
+struct JitOptions {
+  // Blocks carrying all of these tags (e.g. the autotile pass's outer_set) are run as parallel regions: the
+  // outermost such block that can be split safely has one of its indexes divided across a thread pool.  Aggregated
+  // outputs that the split index doesn't partition are accumulated per thread and merged.  If empty, programs run
+  // serially.
+  std::set<std::string> parallel_tags;
+
+  // The maximum number of threads used by a parallel region; if zero, the hardware concurrency is used.
+  std::size_t max_threads = 0;
+
+  // Innermost blocks whose buffers are accessed with unit stride along some index are compiled to operate on a
+  // vector of iterations at a time, sized to the host's widest vector registers, with a scalar loop for any
+  // remainder.
+  bool vectorize = true;
+};
+
+// A Stripe program compiled to native code.  The program is compiled once, when the JitProgram is constructed, and
+// may then be run any number of times, from any number of threads concurrently, each run binding its own buffers.
+class JitProgram {
+ public:
+  explicit JitProgram(const stripe::Block& program, const JitOptions& options = JitOptions{});
+  ~JitProgram();
+
+  // The names of the program's buffer parameters, in the order expected by Run(const std::vector<void*>&).
+  const std::vector<std::string>& parameters() const;
+
+  // Runs the program, binding each buffer parameter by name.
+  void Run(const std::map<std::string, void*>& buffers) const;
+
+  // Runs the program, binding the buffer parameters positionally; this avoids per-run name lookups.
+  void Run(const std::vector<void*>& buffers) const;
+
+ private:
+  std::unique_ptr<Executable> executable_;
+};
+
+// Compiles and runs a program once.
+void JitExecute(const stripe::Block& program, const std::map<std::string, void*>& buffers,
+                const JitOptions& options = JitOptions{});
 
 }  // namespace codegen
 }  // namespace tile
@@ -0,0 +1,490 @@
+// Copyright 2018, Intel Corporation
+
+#include "tile/codegen/layout.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "base/util/logging.h"
+#include "base/util/printstring.h"
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+
+using namespace stripe;  // NOLINT
+
+namespace {
+
+// An access to a blocked dimension, separated into its outer and inner dimensions' parts.
+struct DimAccess {
+  Affine outer;
+  Affine inner;
+  int64_t inner_max = 0;  // The largest value the inner part takes
+};
+
+int64_t FloorDiv(int64_t a, int64_t b) { return a / b - (a % b < 0 ? 1 : 0); }
+
+bool IsZero(const Affine& affine) { return affine == Affine{}; }
+
+// Indexes that appear with other indexes in a component of one of the block's accesses, such as a convolution's
+// sliding windows.
+std::set<std::string> WindowIdxs(const Block& block) {
+  std::set<std::string> idxs;
+  for (const auto& ref : block.refs) {
+    for (const auto& access : ref.access) {
+      size_t terms = 0;
+      for (const auto& term : access.getMap()) {
+        terms += !term.first.empty();
+      }
+      if (terms > 1) {
+        for (const auto& term : access.getMap()) {
+          if (!term.first.empty()) {
+            idxs.insert(term.first);
+          }
+        }
+      }
+    }
+  }
+  return idxs;
+}
+
+// Whether every access to dimension dim of the buffer named name in block is by indexes outside of any window.
+bool IsPlainDim(const Block& block, const std::string& name, size_t dim) {
+  for (const auto& stmt : block.stmts) {
+    auto inner = Block::Downcast(stmt);
+    if (!inner) {
+      continue;
+    }
+    auto windows = WindowIdxs(*inner);
+    for (const auto& ref : inner->refs) {
+      if (ref.from != name) {
+        continue;
+      }
+      for (const auto& term : ref.access[dim].getMap()) {
+        if (windows.count(term.first)) {
+          return false;
+        }
+      }
+      if (!IsPlainDim(*inner, ref.into, dim)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// The dimensions of ref that could be blocked by factor, innermost first.  Returns none if ref is already contiguous
+// along a channel-like dimension.
+std::vector<size_t> BlockableDims(const Block& block, const Refinement& ref, int64_t factor) {
+  std::vector<size_t> dims;
+  for (size_t i = 0; i < ref.shape.dims.size(); i++) {
+    const auto& dim = ref.shape.dims[i];
+    if (!IsPlainDim(block, ref.into, i)) {
+      continue;
+    }
+    if (dim.stride == 1 && dim.size > 1) {
+      return {};
+    }
+    if (dim.stride != 1 && dim.size % factor == 0) {
+      dims.push_back(i);
+    }
+  }
+  std::stable_sort(dims.begin(), dims.end(), [&ref](size_t lhs, size_t rhs) {  //
+    return ref.shape.dims[lhs].stride < ref.shape.dims[rhs].stride;
+  });
+  return dims;
+}
+
+// The indexes of block that need splitting by factor so that access separates into outer and inner parts.
+std::vector<std::string> SplitIdxs(const Block& block, const Affine& access, int64_t factor) {
+  std::vector<std::string> names;
+  for (const auto& term : access.getMap()) {
+    if (term.first.empty() || term.second != 1) {
+      continue;
+    }
+    auto idx = block.idx_by_name(term.first);
+    if (idx && IsZero(idx->affine) && static_cast<uint64_t>(factor) < idx->range && idx->range % factor == 0) {
+      names.push_back(term.first);
+    }
+  }
+  return names;
+}
+
+// Splits an index of block into an outer index over every factor'th value and a new inner index, and rewrites the
+// block's uses of it.
+void SplitIdx(Block* block, const std::string& name, int64_t factor) {
+  auto inner_name = block->unique_idx_name(name + "_i");
+  for (auto& idx : block->idxs) {
+    if (idx.name == name) {
+      idx.range /= factor;
+    }
+  }
+  block->idxs.push_back(Index{inner_name, static_cast<uint64_t>(factor), Affine{}});
+  Affine replacement(name, factor);
+  replacement += Affine(inner_name);
+  for (auto& ref : block->refs) {
+    for (auto& access : ref.access) {
+      access.substitute(name, replacement);
+    }
+  }
+  for (auto& constraint : block->constraints) {
+    constraint.substitute(name, replacement);
+  }
+  for (const auto& stmt : block->stmts) {
+    auto inner = Block::Downcast(stmt);
+    if (inner) {
+      for (auto& idx : inner->idxs) {
+        idx.affine.substitute(name, replacement);
+      }
+    }
+  }
+}
+
+// Separates an access into outer and inner parts, as it will be once the indexes in splits are split.  Fails if the
+// inner part could be negative.
+bool Decompose(const Block& block, const Affine& access, int64_t factor, const std::set<std::string>& splits,
+               DimAccess* result) {
+  int64_t outer = FloorDiv(access.constant(), factor);
+  int64_t inner = access.constant() - outer * factor;
+  result->outer = Affine(outer);
+  result->inner = Affine(inner);
+  result->inner_max = inner;
+  for (const auto& term : access.getMap()) {
+    if (term.first.empty()) {
+      continue;
+    }
+    if (splits.count(term.first)) {
+      result->outer += Affine(term.first);
+      result->inner_max += factor - 1;
+      continue;
+    }
+    if (term.second % factor == 0) {
+      result->outer += Affine(term.first, term.second / factor);
+      continue;
+    }
+    auto idx = block.idx_by_name(term.first);
+    if (term.second < 0 || !idx || !IsZero(idx->affine)) {
+      return false;
+    }
+    result->inner += Affine(term.first, term.second);
+    result->inner_max += term.second * static_cast<int64_t>(idx->range - 1);
+  }
+  return true;
+}
+
+// Lays out dimension dim of the buffer as an outer dimension of a factor'th of its size and an inner dimension of
+// factor, with strides packing the inner dimension first and then the others from the innermost out.
+TensorShape BlockedShape(const TensorShape& shape, size_t dim, int64_t factor) {
+  TensorShape blocked = shape;
+  blocked.dims[dim].size /= factor;
+  blocked.dims.emplace_back(1, factor);
+  std::vector<size_t> order(shape.dims.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&shape](size_t lhs, size_t rhs) {  //
+    return shape.dims[lhs].stride < shape.dims[rhs].stride;
+  });
+  int64_t stride = factor;
+  for (auto i : order) {
+    blocked.dims[i].stride = stride;
+    stride *= blocked.dims[i].size;
+  }
+  return blocked;
+}
+
+bool RewriteChildren(Block* block, const Refinement& parent, size_t dim, int64_t factor, int64_t extent, bool apply);
+
+// Rewrites the refinements of block that refine parent for its blocked layout, splitting the block's indexes where
+// needed.  Unless apply is set, only checks that the rewrite is possible.  The parent's view holds extent elements
+// of its inner dimension.
+bool RewriteBlock(Block* block, const Refinement& parent, size_t dim, int64_t factor, int64_t extent, bool apply) {
+  std::vector<size_t> refs;
+  std::set<std::string> splits;
+  for (size_t i = 0; i < block->refs.size(); i++) {
+    if (block->refs[i].from == parent.into) {
+      refs.push_back(i);
+      for (const auto& name : SplitIdxs(*block, block->refs[i].access[dim], factor)) {
+        splits.insert(name);
+      }
+    }
+  }
+  if (refs.empty()) {
+    return true;
+  }
+  if (apply) {
+    for (const auto& name : splits) {
+      SplitIdx(block, name, factor);
+    }
+    splits.clear();
+  }
+  std::set<std::string> inner_idxs;
+  for (auto i : refs) {
+    auto& ref = block->refs[i];
+    DimAccess access;
+    if (!Decompose(*block, ref.access[dim], factor, splits, &access)) {
+      return false;
+    }
+    int64_t size = ref.shape.dims[dim].size;
+    int64_t outer_size = 1;
+    int64_t inner_size = size;
+    if (size >= factor) {
+      if (size % factor || access.inner_max != 0 || extent != factor) {
+        return false;
+      }
+      outer_size = size / factor;
+      inner_size = factor;
+    } else if (access.inner_max + size > extent) {
+      return false;
+    }
+    if (apply) {
+      ref.access[dim] = access.outer;
+      ref.access.push_back(access.inner);
+      ref.shape.dims[dim].size = outer_size;
+      ref.shape.dims.emplace_back(1, inner_size);
+      for (size_t j = 0; j < ref.shape.dims.size(); j++) {
+        ref.shape.dims[j].stride = parent.shape.dims[j].stride;
+      }
+      for (const auto& term : access.inner.getMap()) {
+        inner_idxs.insert(term.first);
+      }
+    }
+    if (!RewriteChildren(block, ref, dim, factor, inner_size, apply)) {
+      return false;
+    }
+  }
+  // The indexes walking the inner dimension become the innermost loops.
+  std::stable_partition(block->idxs.begin(), block->idxs.end(),
+                        [&inner_idxs](const Index& idx) { return !inner_idxs.count(idx.name); });
+  return true;
+}
+
+bool RewriteChildren(Block* block, const Refinement& parent, size_t dim, int64_t factor, int64_t extent, bool apply) {
+  for (const auto& stmt : block->stmts) {
+    if (stmt->kind() == StmtKind::Special) {
+      auto buffers = stmt->buffer_reads();
+      auto writes = stmt->buffer_writes();
+      buffers.insert(buffers.end(), writes.begin(), writes.end());
+      if (std::count(buffers.begin(), buffers.end(), parent.into)) {
+        return false;
+      }
+    }
+    auto inner = Block::Downcast(stmt);
+    if (inner && !RewriteBlock(inner.get(), parent, dim, factor, extent, apply)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The parts of a block and the blocks nested in it that a rewrite for a blocked layout changes, saved so that a
+// rewrite that fails partway can be undone.
+class RewriteSnapshot {
+ public:
+  explicit RewriteSnapshot(Block* block) { Save(block); }
+
+  void Restore() {
+    for (auto& saved : saved_) {
+      saved.block->idxs = std::move(saved.idxs);
+      saved.block->constraints = std::move(saved.constraints);
+      saved.block->refs = std::move(saved.refs);
+    }
+    saved_.clear();
+  }
+
+ private:
+  struct Saved {
+    Block* block;
+    std::vector<Index> idxs;
+    std::vector<Affine> constraints;
+    std::vector<Refinement> refs;
+  };
+
+  void Save(Block* block) {
+    saved_.push_back(Saved{block, block->idxs, block->constraints, block->refs});
+    for (const auto& stmt : block->stmts) {
+      auto inner = Block::Downcast(stmt);
+      if (inner) {
+        Save(inner.get());
+      }
+    }
+  }
+
+  std::vector<Saved> saved_;
+};
+
+// A refinement of a single element of parent.
+Refinement ElementRef(RefDir dir, const Refinement& parent, const std::string& into, std::vector<Affine> access) {
+  Refinement ref{};
+  ref.dir = dir;
+  ref.from = parent.into;
+  ref.into = into;
+  ref.access = std::move(access);
+  ref.shape = parent.shape;
+  for (auto& dim : ref.shape.dims) {
+    dim.size = 1;
+  }
+  ref.location = parent.location;
+  ref.offset = parent.offset;
+  return ref;
+}
+
+// A block copying a buffer between its original layout and its blocked copy.
+std::shared_ptr<Block> ConversionBlock(const Refinement& flat, const Refinement& blocked, size_t dim, int64_t factor,
+                                       bool to_blocked) {
+  auto block = std::make_shared<Block>();
+  block->name = (to_blocked ? "to_blocked_" : "from_blocked_") + flat.into;
+  block->set_tag("kernel");
+  block->set_tag("eltwise");
+  block->set_tag("relayout");
+  std::vector<Affine> flat_access;
+  std::vector<Affine> blocked_access;
+  for (size_t i = 0; i < flat.shape.dims.size(); i++) {
+    auto name = printstring("i%zu", i);
+    block->idxs.push_back(Index{name, blocked.shape.dims[i].size, Affine{}});
+    flat_access.emplace_back(name);
+    blocked_access.emplace_back(name);
+  }
+  auto inner_name = printstring("i%zu_i", dim);
+  block->idxs.push_back(Index{inner_name, static_cast<uint64_t>(factor), Affine{}});
+  flat_access[dim] *= factor;
+  flat_access[dim] += Affine(inner_name);
+  blocked_access.emplace_back(inner_name);
+  auto src = to_blocked ? ElementRef(RefDir::In, flat, "src", flat_access)
+                        : ElementRef(RefDir::In, blocked, "src", blocked_access);
+  auto dst = to_blocked ? ElementRef(RefDir::Out, blocked, "dst", blocked_access)
+                        : ElementRef(RefDir::Out, flat, "dst", flat_access);
+  block->refs.push_back(src);
+  block->refs.push_back(dst);
+  block->stmts.push_back(std::make_shared<Load>("src", "$x"));
+  block->stmts.push_back(std::make_shared<Store>("$x", "dst"));
+  return block;
+}
+
+bool UsesBuffer(const Statement& stmt, const std::string& name) {
+  auto reads = stmt.buffer_reads();
+  auto writes = stmt.buffer_writes();
+  return std::count(reads.begin(), reads.end(), name) || std::count(writes.begin(), writes.end(), name);
+}
+
+// Blocks one of the block's buffers along dim, if every refinement of it can be rewritten.
+bool BlockBuffer(Block* block, const std::string& name, size_t dim, int64_t factor) {
+  auto flat = *block->ref_by_into(name);
+  if (!RewriteChildren(block, flat, dim, factor, factor, false)) {
+    return false;
+  }
+  auto shape = BlockedShape(flat.shape, dim, factor);
+  // The check above should make the rewrite succeed, but if it fails partway, the buffer keeps its layout.
+  RewriteSnapshot snapshot{block};
+  auto abandon = [&]() {
+    snapshot.Restore();
+    LOG(WARNING) << "BlockedLayoutPass: unable to rewrite the refinements of " << name << " along dimension " << dim
+                 << "; leaving its layout unchanged";
+    return false;
+  };
+  if (flat.dir == RefDir::None) {
+    // An allocation in this block is simply laid out anew.
+    auto ref = block->ref_by_into(name);
+    ref->shape = shape;
+    ref->access.emplace_back();
+    if (!RewriteChildren(block, *ref, dim, factor, factor, true)) {
+      return abandon();
+    }
+    return true;
+  }
+
+  // The program's inputs and outputs keep their layout, and are copied to and from a blocked allocation.
+  Refinement blocked{};
+  blocked.dir = RefDir::None;
+  blocked.into = block->unique_ref_name(name + "_blocked");
+  blocked.access.resize(shape.dims.size());
+  blocked.shape = shape;
+  blocked.location = flat.location;
+  bool has_deps = false;
+  for (const auto& stmt : block->stmts) {
+    has_deps |= !stmt->deps.empty();
+    auto inner = Block::Downcast(stmt);
+    if (inner) {
+      for (auto& ref : inner->refs) {
+        if (ref.from == name) {
+          ref.from = blocked.into;
+        }
+      }
+    }
+  }
+  block->refs.push_back(blocked);
+  if (!RewriteChildren(block, blocked, dim, factor, factor, true)) {
+    return abandon();
+  }
+
+  std::vector<StatementIt> users;
+  for (auto it = block->stmts.begin(); it != block->stmts.end(); ++it) {
+    if (UsesBuffer(**it, blocked.into)) {
+      users.push_back(it);
+    }
+  }
+  if (flat.dir == RefDir::In || flat.dir == RefDir::InOut) {
+    auto pos = std::find_if(block->stmts.begin(), block->stmts.end(),
+                            [](const std::shared_ptr<Statement>& stmt) { return !stmt->has_tag("relayout"); });
+    auto to_blocked = block->stmts.insert(pos, ConversionBlock(flat, blocked, dim, factor, true));
+    if (has_deps) {
+      for (const auto& it : users) {
+        (*it)->deps.push_back(to_blocked);
+      }
+    }
+  }
+  if (flat.dir == RefDir::Out || flat.dir == RefDir::InOut) {
+    auto from_blocked = block->stmts.insert(block->stmts.end(), ConversionBlock(flat, blocked, dim, factor, false));
+    if (has_deps) {
+      (*from_blocked)->deps.assign(users.begin(), users.end());
+    }
+  }
+  return true;
+}
+
+void BlockLayouts(Block* block, int64_t vector_bytes) {
+  // Choose every buffer's dimension before rewriting any of them: rewriting splits the kernels' indexes, which
+  // would obscure their windows.
+  std::vector<std::tuple<std::string, std::vector<size_t>, int64_t>> plans;
+  for (const auto& ref : block->refs) {
+    int64_t factor = vector_bytes / static_cast<int64_t>(byte_width(ref.shape.type));
+    if (factor <= 1 || (ref.dir == RefDir::None && !ref.from.empty())) {
+      continue;
+    }
+    bool used_here = false;
+    for (const auto& stmt : block->stmts) {
+      used_here |= stmt->kind() != StmtKind::Block && UsesBuffer(*stmt, ref.into);
+    }
+    auto dims = BlockableDims(*block, ref, factor);
+    if (!used_here && !dims.empty()) {
+      plans.emplace_back(ref.into, dims, factor);
+    }
+  }
+  for (const auto& plan : plans) {
+    for (auto dim : std::get<1>(plan)) {
+      if (BlockBuffer(block, std::get<0>(plan), dim, std::get<2>(plan))) {
+        IVLOG(1, "BlockedLayoutPass: " << std::get<0>(plan) << " blocked by " << std::get<2>(plan)
+                                       << " along dimension " << dim);
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+void BlockedLayoutPass(Block* root, const proto::BlockedLayoutPass& options) {
+  auto reqs = FromProto(options.reqs());
+  RunOnBlocks(root, reqs, [&options](const AliasMap& map, Block* block) {  //
+    BlockLayouts(block, options.vector_bytes());
+  });
+}
+
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,30 @@
+// Copyright 2018, Intel Corporation
+
+#pragma once
+
+#include "tile/codegen/codegen.pb.h"
+#include "tile/codegen/tags.h"
+#include "tile/stripe/stripe.h"
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+
+// Rewrites the buffers of each block matching the pass's reqs into a blocked layout (e.g. NCHW into NCHWc), so that
+// vector-width runs of a channel-like dimension are contiguous.
+//
+// A buffer's channel-like dimension is the innermost dimension that every kernel accesses by indexes outside of any
+// sliding window, and whose size is a multiple of the blocking factor (vector_bytes / element size).  That dimension
+// is split into an outer dimension, in its place, and an inner dimension of the blocking factor, appended with a
+// stride of one.  Every refinement of the buffer is rewritten to match; kernel indexes over the dimension are split
+// in the same way where needed, and the indexes addressing the inner dimension become the kernels' innermost
+// indexes.  Buffers that are already contiguous along a channel-like dimension, or that can't be rewritten without
+// leaving affine accesses, keep their layout.
+//
+// Program inputs and outputs keep the caller's layout: blocks converting them to and from blocked copies are added
+// at the start and end of the block.
+void BlockedLayoutPass(stripe::Block* root, const proto::BlockedLayoutPass& options);
+
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
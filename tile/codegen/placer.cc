@@ -2,13 +2,21 @@
 
 #include "tile/codegen/placer.h"
 
+#include <algorithm>
 #include <list>
+#include <map>
+#include <queue>
 #include <set>
 #include <stack>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <boost/dynamic_bitset.hpp>
 #include <boost/graph/undirected_graph.hpp>
 
+#include "base/util/logging.h"
 #include "tile/base/shape.h"
 #include "tile/codegen/alias.h"
 
@@ -64,6 +72,17 @@
 //   we take the set of temporally-overlapping chunks, sort them by
 //   existing offset, and then walk the list in order, looking for the
 //   smallest free range that's big enough for the chunk.
+//
+// * Largest-to-smallest order can leave gaps that no later chunk
+//   fits.  So we then search for a better order: placing chunks in
+//   order of first access, and then repeatedly moving a chunk at the
+//   top of the arena earlier in the order, keeping each move that
+//   shrinks the arena.
+//
+// * Finally, for each location, we report the arena size along with
+//   a lower bound on it -- the total size of a set of chunks that all
+//   interfere with each other -- so that the cost of fragmentation is
+//   visible.
 
 namespace vertexai {
 namespace tile {
@@ -281,82 +300,17 @@ std::size_t CountStatements(stripe::Block* outermost_block) {
   return result;
 }
 
-}  // namespace
-
-void PlaceRefinements(stripe::Block* outermost_block, const proto::MemoryPlacementPass& options) {
-  std::set<stripe::Location> locations;
-  for (const auto& loc : options.locs()) {
-    locations.emplace(stripe::FromProto(loc));
-  }
-
-  std::size_t stmt_limit = CountStatements(outermost_block);
-
-  std::list<Chunk> chunks =
-      BuildChunkList(outermost_block, locations, options.alignment() ? options.alignment() : kDefaultAlignment,
-                     stmt_limit, options.num_banks());
-
-  // Edge case: no chunks means nothing to do.  And then after this,
-  // we can assume there's at least one chunk.
-  if (!chunks.size()) {
-    return;
-  }
-
-  // Ensure chunks are sorted by earliest accessor.
-  chunks.sort([](const Chunk& lhs, const Chunk& rhs) { return lhs.first_accessor_idx < rhs.first_accessor_idx; });
-
-  // Initialize subsequent accessor dependencies.
-  {
-    boost::dynamic_bitset<> deps = chunks.back().transitive_accessor_deps;
-    for (auto it = chunks.rbegin(); it != chunks.rend(); ++it) {
-      deps &= it->transitive_accessor_deps;
-      it->subsequent_accessor_deps = deps;
-    }
-  }
-
-  // Initialize the graph.
-  InterferenceGraph interference_graph;
-  for (auto& chunk : chunks) {
-    chunk.interference_vertex = boost::add_vertex(InterferenceVertex{&chunk}, interference_graph);
-  }
-
-  // Compute the interference edges.  Note that this is O(N^2) in the
-  // worst case.  :-/
-  for (auto earlier = chunks.begin(); earlier != chunks.end(); ++earlier) {
-    auto later = earlier;
-    ++later;
-    for (; later != chunks.end(); ++later) {
-      if (earlier->ref->location != later->ref->location) {
-        // These cannot spatially overlap; they never interfere with
-        // each other.
-        continue;
-      }
-      if (earlier->accessors.is_subset_of(later->subsequent_accessor_deps)) {
-        // All accessors of the earlier chunk are transitive
-        // dependencies of this and every subsequent chunk; there can
-        // be no interference, so we are done checking chunks later
-        // than the current earliest.
-        break;
-      }
-      if (earlier->accessors.is_subset_of(later->transitive_accessor_deps)) {
-        // All accessors of the earlier chunk are transitive
-        // dependencies of all of the accessors of the later chunk --
-        // these chunks do not temporally overlap, and cannot
-        // interfere with each other.
-        continue;
-      }
-      // Otherwise, these chunks may be alive at the same time in the
-      // same location; they may interfere with each other.
-      add_edge(earlier->interference_vertex, later->interference_vertex, interference_graph);
-    }
+// Places the chunks in the indicated order, each in the smallest gap
+// that fits among the already-placed chunks it interferes with, and
+// returns the size of the arena holding them.
+std::size_t PlaceInOrder(const std::vector<Chunk*>& order, const InterferenceGraph& interference_graph) {
+  for (Chunk* chunk : order) {
+    chunk->placed = false;
   }
-
-  // Re-sort chunks by size, since we want to place them in
-  // largest-to-smallest order.
-  chunks.sort([](const Chunk& lhs, const Chunk& rhs) { return lhs.size > rhs.size; });
-
-  // Place the chunks.
+  std::size_t arena_size = 0;
   std::vector<Chunk*> already_placed;
-  for (auto& chunk : chunks) {
+  for (Chunk* next : order) {
+    Chunk& chunk = *next;
     // Build a vector of already-placed chunks that we need to
     // consider when placing this chunk.
     already_placed.clear();
@@ -429,7 +383,206 @@ void PlaceRefinements(stripe::Block* outermost_block, const proto::MemoryPlaceme
     // We have an offset for this chunk.
     chunk.ref->offset = gap_offset;
     chunk.placed = true;
+    arena_size = std::max(arena_size, gap_offset + chunk.size);
+  }
+  return arena_size;
+}
+
+// Returns the chunks that interfere with a chunk.
+std::vector<Chunk*> Interferers(const Chunk& chunk, const InterferenceGraph& interference_graph) {
+  std::vector<Chunk*> result;
+  auto edges = out_edges(chunk.interference_vertex, interference_graph);
+  for (auto it = edges.first; it != edges.second; ++it) {
+    result.push_back(interference_graph[target(*it, interference_graph)].chunk);
+  }
+  return result;
+}
+
+// Returns a lower bound on the arena size needed by the chunks: the
+// total size of a set of chunks that all interfere with each other,
+// which no placement can fit in less.  Finding the largest such set
+// is itself NP-hard, so we grow one greedily from each chunk, adding
+// its interferers in largest-to-smallest order.
+std::size_t ArenaLowerBound(const std::vector<Chunk*>& chunks, const InterferenceGraph& interference_graph) {
+  std::unordered_map<const Chunk*, std::unordered_set<const Chunk*>> interferers;
+  for (const Chunk* chunk : chunks) {
+    auto chunk_interferers = Interferers(*chunk, interference_graph);
+    interferers[chunk].insert(chunk_interferers.begin(), chunk_interferers.end());
+  }
+  std::size_t bound = 0;
+  for (Chunk* seed : chunks) {
+    auto candidates = Interferers(*seed, interference_graph);
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Chunk* lhs, const Chunk* rhs) { return lhs->size > rhs->size; });
+    std::vector<const Chunk*> clique{seed};
+    std::size_t clique_size = seed->size;
+    for (const Chunk* candidate : candidates) {
+      const auto& candidate_interferers = interferers[candidate];
+      if (std::all_of(clique.begin(), clique.end(),
+                      [&](const Chunk* member) { return candidate_interferers.count(member); })) {
+        clique.push_back(candidate);
+        clique_size += candidate->size;
+      }
+    }
+    bound = std::max(bound, clique_size);
+  }
+  return bound;
+}
+
+// Searches for an order in which to place a location's chunks that
+// yields a smaller arena than the largest-to-smallest order, and
+// places the chunks in the best order found.  Returns the arena size.
+//
+// The search tries placing the chunks in order of first access (which
+// packs chunks with short, successive lifetimes well), and then
+// repeatedly tries moving a chunk that ends at the top of the arena
+// to an earlier point in the order, keeping the change if it shrinks
+// the arena.
+std::size_t SearchPlacement(std::vector<Chunk*> order, const InterferenceGraph& interference_graph,
+                            std::size_t rounds) {
+  std::size_t arena_size = PlaceInOrder(order, interference_graph);
+  if (!rounds) {
+    return arena_size;
+  }
+  auto by_lifetime = order;
+  std::stable_sort(by_lifetime.begin(), by_lifetime.end(), [](const Chunk* lhs, const Chunk* rhs) {
+    return lhs->first_accessor_idx < rhs->first_accessor_idx;
+  });
+  std::size_t lifetime_arena_size = PlaceInOrder(by_lifetime, interference_graph);
+  if (lifetime_arena_size < arena_size) {
+    order.swap(by_lifetime);
+    arena_size = lifetime_arena_size;
   }
+  for (std::size_t round = 0; round < rounds; ++round) {
+    PlaceInOrder(order, interference_graph);
+    std::vector<std::size_t> tops;
+    for (std::size_t pos = 0; pos < order.size(); ++pos) {
+      if (order[pos]->ref->offset + order[pos]->size == arena_size) {
+        tops.push_back(pos);
+      }
+    }
+    bool improved = false;
+    for (std::size_t pos : tops) {
+      for (std::size_t dest : std::set<std::size_t>{0, pos / 2, pos ? pos - 1 : 0}) {
+        if (pos <= dest) {
+          continue;
+        }
+        auto trial = order;
+        std::rotate(trial.begin() + dest, trial.begin() + pos, trial.begin() + pos + 1);
+        std::size_t trial_arena_size = PlaceInOrder(trial, interference_graph);
+        if (trial_arena_size < arena_size) {
+          order.swap(trial);
+          arena_size = trial_arena_size;
+          improved = true;
+          break;
+        }
+      }
+      if (improved) {
+        break;
+      }
+    }
+    if (!improved) {
+      break;
+    }
+  }
+  return PlaceInOrder(order, interference_graph);
+}
+
+}  // namespace
+
+std::vector<proto::PlacementStats> PlaceRefinements(stripe::Block* outermost_block,
+                                                    const proto::MemoryPlacementPass& options) {
+  std::set<stripe::Location> locations;
+  for (const auto& loc : options.locs()) {
+    locations.emplace(stripe::FromProto(loc));
+  }
+
+  std::size_t stmt_limit = CountStatements(outermost_block);
+
+  std::list<Chunk> chunks =
+      BuildChunkList(outermost_block, locations, options.alignment() ? options.alignment() : kDefaultAlignment,
+                     stmt_limit, options.num_banks());
+
+  // Edge case: no chunks means nothing to do.  And then after this,
+  // we can assume there's at least one chunk.
+  if (!chunks.size()) {
+    return {};
+  }
+
+  // Ensure chunks are sorted by earliest accessor.
+  chunks.sort([](const Chunk& lhs, const Chunk& rhs) { return lhs.first_accessor_idx < rhs.first_accessor_idx; });
+
+  // Initialize subsequent accessor dependencies.
+  {
+    boost::dynamic_bitset<> deps = chunks.back().transitive_accessor_deps;
+    for (auto it = chunks.rbegin(); it != chunks.rend(); ++it) {
+      deps &= it->transitive_accessor_deps;
+      it->subsequent_accessor_deps = deps;
+    }
+  }
+
+  // Initialize the graph.
+  InterferenceGraph interference_graph;
+  for (auto& chunk : chunks) {
+    chunk.interference_vertex = boost::add_vertex(InterferenceVertex{&chunk}, interference_graph);
+  }
+
+  // Compute the interference edges.  Note that this is O(N^2) in the
+  // worst case.  :-/
+  for (auto earlier = chunks.begin(); earlier != chunks.end(); ++earlier) {
+    auto later = earlier;
+    ++later;
+    for (; later != chunks.end(); ++later) {
+      if (earlier->ref->location != later->ref->location) {
+        // These cannot spatially overlap; they never interfere with
+        // each other.
+        continue;
+      }
+      if (earlier->accessors.is_subset_of(later->subsequent_accessor_deps)) {
+        // All accessors of the earlier chunk are transitive
+        // dependencies of this and every subsequent chunk; there can
+        // be no interference, so we are done checking chunks later
+        // than the current earliest.
+        break;
+      }
+      if (earlier->accessors.is_subset_of(later->transitive_accessor_deps)) {
+        // All accessors of the earlier chunk are transitive
+        // dependencies of all of the accessors of the later chunk --
+        // these chunks do not temporally overlap, and cannot
+        // interfere with each other.
+        continue;
+      }
+      // Otherwise, these chunks may be alive at the same time in the
+      // same location; they may interfere with each other.
+      add_edge(earlier->interference_vertex, later->interference_vertex, interference_graph);
+    }
+  }
+
+  // Re-sort chunks by size, since we want to place them in
+  // largest-to-smallest order.
+  chunks.sort([](const Chunk& lhs, const Chunk& rhs) { return lhs.size > rhs.size; });
+
+  // Place the chunks.  Chunks in different locations never interfere,
+  // so each location's arena is placed separately.
+  std::map<stripe::Location, std::vector<Chunk*>> chunks_by_loc;
+  for (auto& chunk : chunks) {
+    chunks_by_loc[chunk.ref->location].push_back(&chunk);
+  }
+  std::vector<proto::PlacementStats> result;
+  for (const auto& kvp : chunks_by_loc) {
+    std::size_t arena_size = SearchPlacement(kvp.second, interference_graph, options.search_rounds());
+    std::size_t lower_bound = ArenaLowerBound(kvp.second, interference_graph);
+    proto::PlacementStats stats;
+    *stats.mutable_loc() = stripe::IntoProto(kvp.first);
+    stats.set_chunks(kvp.second.size());
+    stats.set_lower_bound_bytes(lower_bound);
+    stats.set_arena_bytes(arena_size);
+    stats.set_fragmentation(arena_size ? 1.0 - static_cast<double>(lower_bound) / arena_size : 0.0);
+    IVLOG(2, "Placed " << kvp.second.size() << " chunks at " << kvp.first << " in " << arena_size
+                       << " bytes; lower bound " << lower_bound << " bytes");
+    result.emplace_back(std::move(stats));
+  }
+  return result;
 }
 
 }  // namespace codegen
@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "tile/codegen/codegen.pb.h"
 #include "tile/codegen/tags.h"
 #include "tile/stripe/stripe.h"
@@ -13,12 +15,23 @@ namespace codegen {
 // Assigns locations to all Refinements within a Block, including all
 // nested sub-Blocks.  Note that all dependencies for the block and
 // sub-blocks should be established when this function is called.
-void PlaceRefinements(stripe::Block* outermost_block, const proto::MemoryPlacementPass& options);
+// Returns the resulting arena size of each location, along with a
+// lower bound on it.
+std::vector<proto::PlacementStats> PlaceRefinements(stripe::Block* outermost_block,
+                                                    const proto::MemoryPlacementPass& options);
 
-inline void MemPlacementPass(stripe::Block* root, const proto::MemoryPlacementPass& options) {
+// Places the refinements of each block matching the pass's reqs.  If
+// stats is non-null, the placement statistics of every block are
+// appended to it.
+inline void MemPlacementPass(stripe::Block* root, const proto::MemoryPlacementPass& options,
+                             google::protobuf::RepeatedPtrField<proto::PlacementStats>* stats = nullptr) {
   auto reqs = FromProto(options.reqs());
   RunOnBlocks(root, reqs, [&](const AliasMap& map, stripe::Block* block) {  //
-    PlaceRefinements(block, options);
+    for (auto& block_stats : PlaceRefinements(block, options)) {
+      if (stats) {
+        *stats->Add() = std::move(block_stats);
+      }
+    }
   });
 }
 
@@ -36,6 +36,13 @@
 // runtime-future state of the system than those datastructures are
 // tracking the runtime-past of the system and then fixing up that
 // past.)
+//
+// When the pass asks for multiple buffers, the scheduler tries not to
+// place a Statement's CacheEntries over the CacheEntries being swapped
+// in for the next few (runtime-future) Statements.  Overwriting such a
+// CacheEntry would give its swap-in a dependency on the current
+// Statement, serializing the transfer with the compute; leaving it be
+// means the swap-in can run while the current Statement does.
 
 namespace vertexai {
 namespace tile {
@@ -264,6 +271,12 @@ struct CacheEntry {
   stripe::Statement* writer = nullptr;
   std::unordered_set<stripe::Statement*> readers;
 
+  // The scheduling sequence number of the first reader, and whether
+  // the writer is a swap-in; used to avoid overwriting the
+  // CacheEntries being prefetched for upcoming Statements.
+  std::size_t first_reader_seq = 0;
+  bool swapped_in = false;
+
   // The CacheEntry's position in the active cache entry list.
   std::list<CacheEntry*>::iterator active_iterator;
 
@@ -396,15 +409,26 @@ class Scheduler {
   // Attempts to make a placement plan that preserves the current
   // Statement's existing inputs and outputs, and does not collide
   // with any previously-scheduled CacheEntry unless that CacheEntry
-  // has a writer (i.e. does not require swap-in).
+  // has a writer (i.e. does not require swap-in).  If
+  // avoid_prefetches is set, the plan also avoids CacheEntries that
+  // are being prefetched.
   bool TryMakePlanWithNoSwaps(PlacementPlan* plan, stripe::Statement* stmt,
-                              const std::vector<std::pair<RefInfo*, stripe::RefDir>>& todos);
+                              const std::vector<std::pair<RefInfo*, stripe::RefDir>>& todos, bool avoid_prefetches);
 
   // Attempts to make a placement plan that preserves the current
   // Statement's existing inputs and outputs, but allows collisions
-  // with previously-scheduled CacheEntries (producing swap-ins).
+  // with previously-scheduled CacheEntries (producing swap-ins).  If
+  // avoid_prefetches is set, the plan avoids CacheEntries that are
+  // being prefetched.
   bool TryMakePlanWithSwaps(PlacementPlan* plan, stripe::Statement* stmt,
-                            const std::vector<std::pair<RefInfo*, stripe::RefDir>>& todos);
+                            const std::vector<std::pair<RefInfo*, stripe::RefDir>>& todos, bool avoid_prefetches);
+
+  // Returns true iff the CacheEntry is (or will be) filled by a
+  // swap-in, and is first read by one of the buffers_ - 1 Statements
+  // that follow the current Statement at runtime -- i.e. its swap-in
+  // can overlap the current Statement, unless the current Statement's
+  // CacheEntries are placed over it.
+  bool IsPrefetch(const CacheEntry& ent) const;
 
   // Makes a worst-possible-case placement plan; guaranteed to always
   // work (as long as every Statement can fit into memory), but not
@@ -458,6 +482,7 @@ class Scheduler {
   stripe::Location xfer_loc_;
   bool allow_out_of_range_accesses_;
   uint64_t num_banks_;
+  std::size_t buffers_;
   std::unordered_map<std::string, RefInfo> ri_map_;
   std::unordered_map<stripe::Refinement*, std::vector<RefInfo*>> base_ref_aliases_;
 
@@ -483,6 +508,10 @@ class Scheduler {
   // will have already added dependencies to the accessors of the
   // runtime-future CacheEntry.
   std::list<CacheEntry*> active_entries_;
+
+  // The number of Statements scheduled so far, including the one being
+  // scheduled.
+  std::size_t seq_ = 0;
 };
 
 void Scheduler::Schedule(const AliasMap& alias_map, stripe::Block* block, const proto::SchedulePass& options) {
@@ -506,6 +535,7 @@ Scheduler::Scheduler(const AliasMap* alias_map, stripe::Block* block, const prot
       xfer_loc_(stripe::FromProto(options.xfer_loc())),
       allow_out_of_range_accesses_{options.allow_out_of_range_accesses()},
       num_banks_{options.num_banks()},
+      buffers_{std::max<std::size_t>(options.buffers(), 1)},
       ri_map_{BuildRefInfoMap(block, num_banks_)} {
   for (auto& name_ref : ri_map_) {
     RefInfo* ri = &name_ref.second;
@@ -529,6 +559,7 @@ void Scheduler::Run() {
     --si;
 
     IVLOG(3, "Scheduling " << si->get());
+    ++seq_;
 
     // Add swap-ins for any existing CacheEntries that are invalidated
     // by scheduling this statement.
@@ -656,12 +687,14 @@ void Scheduler::Run() {
         if (IsReadDir(placement.dir)) {
           ent->readers.emplace(si->get());
           ent->first_reader = si;
+          ent->first_reader_seq = seq_;
         } else {
           ent->writer = si->get();
         }
       } else if (IsReadDir(placement.dir)) {
         ent->readers.emplace(si->get());
         ent->first_reader = si;
+        ent->first_reader_seq = seq_;
       }
 
       // Determine whether this CacheEntry will need to be swapped
@@ -856,14 +889,29 @@ PlacementPlan Scheduler::MakePlacementPlan(stripe::Statement* stmt) {
 
   std::tie(existing_entry_plan, todos) = GatherPlacementState(stmt);
 
-  PlacementPlan plan{existing_entry_plan};
-  if (TryMakePlanWithNoSwaps(&plan, stmt, todos)) {
+  PlacementPlan plan;
+  if (1 < buffers_) {
+    plan = existing_entry_plan;
+    if (TryMakePlanWithNoSwaps(&plan, stmt, todos, true)) {
+      IVLOG(3, "  Made plan with no swaps, preserving prefetches");
+      return plan;
+    }
+
+    plan = existing_entry_plan;
+    if (TryMakePlanWithSwaps(&plan, stmt, todos, true)) {
+      IVLOG(3, "  Made plan with swaps, preserving prefetches");
+      return plan;
+    }
+  }
+
+  plan = existing_entry_plan;
+  if (TryMakePlanWithNoSwaps(&plan, stmt, todos, false)) {
     IVLOG(3, "  Made plan with no swaps");
     return plan;
   }
 
   plan = existing_entry_plan;
-  if (TryMakePlanWithSwaps(&plan, stmt, todos)) {
+  if (TryMakePlanWithSwaps(&plan, stmt, todos, false)) {
     IVLOG(3, "  Made plan with swaps");
     return plan;
   }
@@ -910,7 +958,8 @@ bool Scheduler::TryPlaceInRanges(PlacementPlan* plan, stripe::Statement* stmt,
 }
 
 bool Scheduler::TryMakePlanWithNoSwaps(PlacementPlan* plan, stripe::Statement* stmt,
-                                       const std::vector<std::pair<RefInfo*, stripe::RefDir>>& todos) {
+                                       const std::vector<std::pair<RefInfo*, stripe::RefDir>>& todos,
+                                       bool avoid_prefetches) {
   // Build a list of the available ranges.  For our purposes, a range
   // is available if it already has an initial writer (=> it is not
   // going to require a swap-in), and if its RefInfo is not already in
@@ -921,7 +970,7 @@ bool Scheduler::TryMakePlanWithNoSwaps(PlacementPlan* plan, stripe::Statement* s
   for (auto* ent : active_entries_) {
     IVLOG(3, "      Saw range " << ent->range << " used by " << ent->name << " writer=" << ent->writer
                                 << " plan.count=" << plan->count(ent->source->ref.into));
-    if (!(ent->writer && !plan->count(ent->source->ref.into))) {
+    if (!(ent->writer && !plan->count(ent->source->ref.into)) || (avoid_prefetches && IsPrefetch(*ent))) {
       IVLOG(3, "      Subtracting range " << ent->range << " used by " << ent->name);
       SubtractRange(ent->range, &ranges);
     }
@@ -931,7 +980,8 @@ bool Scheduler::TryMakePlanWithNoSwaps(PlacementPlan* plan, stripe::Statement* s
 }
 
 bool Scheduler::TryMakePlanWithSwaps(PlacementPlan* plan, stripe::Statement* stmt,
-                                     const std::vector<std::pair<RefInfo*, stripe::RefDir>>& todos) {
+                                     const std::vector<std::pair<RefInfo*, stripe::RefDir>>& todos,
+                                     bool avoid_prefetches) {
   // Build a list of the available ranges.  For our purposes, a range
   // is available as long as its RefInfo is not already in the plan
   // (because RefInfos that are in the plan are required by the
@@ -941,7 +991,7 @@ bool Scheduler::TryMakePlanWithSwaps(PlacementPlan* plan, stripe::Statement* stm
   for (auto* ent : active_entries_) {
     IVLOG(3, "      Saw range " << ent->range << " used by " << ent->name << " writer=" << ent->writer
                                 << " plan.count=" << plan->count(ent->source->ref.into));
-    if (plan->count(ent->source->ref.into)) {
+    if (plan->count(ent->source->ref.into) || (avoid_prefetches && IsPrefetch(*ent))) {
       IVLOG(3, "      Subtracting range " << ent->range << " used by " << ent->name);
       SubtractRange(ent->range, &ranges);
     }
@@ -950,6 +1000,11 @@ bool Scheduler::TryMakePlanWithSwaps(PlacementPlan* plan, stripe::Statement* stm
   return TryPlaceInRanges(plan, stmt, todos, std::move(ranges));
 }
 
+bool Scheduler::IsPrefetch(const CacheEntry& ent) const {
+  return (!ent.writer || ent.swapped_in) && 0 < ent.first_reader_seq && ent.first_reader_seq < seq_ &&
+         seq_ - ent.first_reader_seq < buffers_;
+}
+
 PlacementPlan Scheduler::MakeFallbackPlan(stripe::Statement* stmt) {
   PlacementPlan plan;
   std::size_t offset = 0;
@@ -1013,6 +1068,7 @@ stripe::StatementIt Scheduler::AddSwapIn(stripe::StatementIt si, CacheEntry* ent
   stripe::StatementIt swap_in_it = block_->stmts.emplace(si, std::make_shared<stripe::Block>(std::move(swap_block)));
   stripe::Statement* swap_in = swap_in_it->get();
   ent->writer = swap_in;
+  ent->swapped_in = true;
   ent->source->swap_in_readers.emplace(swap_in);
   for (stripe::Statement* reader : ent->readers) {
     reader->deps.emplace_back(swap_in_it);
@@ -17,10 +17,11 @@ void ScheduleBlock(const AliasMap& alias_map, stripe::Block* block, const proto:
 //     Assigns the new refinements offsets within the mem_loc.
 //   Inserts IO sub-block statements as needed.
 //   Updates the block's statements' dependencies for correctness.
+// Matching blocks are scheduled concurrently.
 inline void SchedulePass(stripe::Block* root, const proto::SchedulePass& options) {
   auto reqs = FromProto(options.reqs());
-  RunOnBlocks(root, reqs,
-              [&options](const AliasMap& map, stripe::Block* block) { ScheduleBlock(map, block, options); });
+  RunOnBlocksParallel(
+      root, reqs, [&options](const AliasMap& map, stripe::Block* block) { ScheduleBlock(map, block, options); });
 }
 
 }  // namespace codegen
@@ -0,0 +1,436 @@
+// Copyright 2018, Intel Corporation
+
+#include "tile/codegen/simulate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "base/util/printstring.h"
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+
+using namespace stripe;  // NOLINT
+
+namespace {
+
+// Something that does one thing at a time: an instance of a unit, or a bus.
+struct Resource {
+  std::string name;
+  uint64_t free_at = 0;
+  uint64_t busy = 0;
+};
+
+struct Unit {
+  std::vector<Resource> instances;
+  double ops_per_cycle = 1;
+};
+
+struct Bus {
+  Resource resource;
+  const proto::Bus* config;
+  uint64_t bytes = 0;
+  uint64_t wait = 0;
+};
+
+struct Memory {
+  uint64_t capacity;
+  std::vector<std::pair<uint64_t, int64_t>> changes;  // (cycle, change in bytes allocated)
+};
+
+// The memory unit holding each of a block's refinements, by name.
+using Scope = std::map<std::string, std::string>;
+
+uint64_t Iterations(const Block& block) {
+  uint64_t iterations = 1;
+  for (const auto& idx : block.idxs) {
+    iterations *= std::max<uint64_t>(idx.range, 1);
+  }
+  return iterations;
+}
+
+// Specials count an op per output element.
+double SpecialOps(const Block& block, const Special& special) {
+  double ops = 0;
+  for (const auto& out : special.outputs) {
+    auto ref_it = block.ref_by_into(out, false);
+    ops += ref_it == block.refs.end() ? 1 : ref_it->shape.elem_size();
+  }
+  return ops;
+}
+
+// Counts the statements run by a block over all of its iterations.
+double CountOps(const Block& block) {
+  double ops = 0;
+  for (const auto& stmt : block.stmts) {
+    switch (stmt->kind()) {
+      case StmtKind::Block:
+        ops += CountOps(*Block::Downcast(stmt));
+        break;
+      case StmtKind::Special:
+        ops += SpecialOps(block, *Special::Downcast(stmt));
+        break;
+      default:
+        ops++;
+        break;
+    }
+  }
+  return ops * Iterations(block);
+}
+
+uint64_t Cycles(double work, double per_cycle) {
+  return std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(work / per_cycle)));
+}
+
+std::string Join(const google::protobuf::RepeatedPtrField<std::string>& names) {
+  std::string joined;
+  for (const auto& name : names) {
+    if (!joined.empty()) {
+      joined += ",";
+    }
+    joined += name;
+  }
+  return joined;
+}
+
+std::vector<Resource> MakeInstances(const std::string& name, uint32_t count) {
+  std::vector<Resource> instances(std::max(1u, count));
+  for (size_t i = 0; i < instances.size(); i++) {
+    instances[i].name = instances.size() == 1 ? name : printstring("%s[%zu]", name.c_str(), i);
+  }
+  return instances;
+}
+
+class Simulator {
+ public:
+  Simulator(const proto::Config& cfg, const SimulateOptions& options) : cfg_{cfg}, options_{options} {
+    for (const auto& kvp : cfg.exec_units()) {
+      auto& unit = exec_units_[kvp.first];
+      unit.instances = MakeInstances(kvp.first, kvp.second.count());
+      unit.ops_per_cycle = std::max(1u, kvp.second.ops_per_cycle());
+    }
+    for (const auto& kvp : cfg.tx_units()) {
+      tx_units_[kvp.first].instances = MakeInstances(kvp.first, kvp.second.count());
+    }
+    for (const auto& kvp : cfg.mem_units()) {
+      mems_[kvp.first].capacity = static_cast<uint64_t>(kvp.second.size_kib()) * 1024 * kvp.second.count();
+    }
+    for (const auto& bus : cfg.buses()) {
+      buses_.emplace_back();
+      buses_.back().resource.name = Join(bus.sources()) + "->" + Join(bus.sinks());
+      buses_.back().config = &bus;
+    }
+    if (exec_units_.empty()) {
+      // With no execution units, statements run on a notional one at an op per cycle.
+      exec_units_[""].instances = MakeInstances("default", 1);
+    }
+    default_unit_ = &exec_units_.begin()->second;
+  }
+
+  Simulation Run(const Block& program) {
+    Simulation simulation;
+    auto cycles = RunBlock(program, Scope{}, 0);
+    auto& stats = simulation.stats;
+    stats.set_cycles(cycles);
+    stats.set_seconds(cfg_.clock_mhz() ? cycles / (cfg_.clock_mhz() * 1e6) : 0);
+    for (const auto* units : {&exec_units_, &tx_units_}) {
+      for (const auto& kvp : *units) {
+        for (const auto& instance : kvp.second.instances) {
+          auto* unit = stats.add_units();
+          unit->set_name(instance.name);
+          unit->set_busy_cycles(instance.busy);
+          unit->set_occupancy(cycles ? static_cast<double>(instance.busy) / cycles : 0);
+        }
+      }
+    }
+    for (const auto& bus : buses_) {
+      auto* sim_bus = stats.add_buses();
+      sim_bus->set_name(bus.resource.name);
+      sim_bus->set_bytes(bus.bytes);
+      sim_bus->set_busy_cycles(bus.resource.busy);
+      sim_bus->set_wait_cycles(bus.wait);
+    }
+    for (auto& kvp : mems_) {
+      auto& changes = kvp.second.changes;
+      // Frees happen before allocations made in the same cycle.
+      std::sort(changes.begin(), changes.end());
+      int64_t live = 0;
+      int64_t peak = 0;
+      for (const auto& change : changes) {
+        live += change.second;
+        peak = std::max(peak, live);
+      }
+      auto* memory = stats.add_memories();
+      memory->set_name(kvp.first);
+      memory->set_peak_bytes(peak);
+      memory->set_capacity_bytes(kvp.second.capacity);
+    }
+    simulation.events = std::move(events_);
+    return simulation;
+  }
+
+ private:
+  // Simulates a block whose dependencies are met at ready, returning the cycle at which it's done.
+  uint64_t RunBlock(const Block& block, const Scope& outer, uint64_t ready) {
+    Scope scope;
+    for (const auto& ref : block.refs) {
+      if (!ref.location.name.empty()) {
+        scope[ref.into] = ref.location.name;
+      } else if (ref.dir != RefDir::None && outer.count(ref.from)) {
+        scope[ref.into] = outer.at(ref.from);
+      }
+    }
+    uint64_t done;
+    auto exec_it = exec_units_.find(block.location.name);
+    auto tx_it = tx_units_.find(block.location.name);
+    if (!block.location.name.empty() && exec_it != exec_units_.end()) {
+      done = Occupy(block.name, block.location, &exec_it->second,
+                    Cycles(CountOps(block), exec_it->second.ops_per_cycle), ready);
+    } else if (!block.location.name.empty() && tx_it != tx_units_.end()) {
+      done = RunTransfer(block, scope, &tx_it->second, ready);
+    } else {
+      done = RunIterations(block, scope, ready);
+    }
+    for (const auto& ref : block.refs) {
+      auto mem_it = mems_.find(ref.location.name);
+      if (ref.dir == RefDir::None && mem_it != mems_.end()) {
+        auto bytes = static_cast<int64_t>(ref.shape.byte_size());
+        mem_it->second.changes.emplace_back(ready, bytes);
+        mem_it->second.changes.emplace_back(done, -bytes);
+      }
+    }
+    return done;
+  }
+
+  // Runs a block's statements once per iteration, extrapolating past the detailed iterations.
+  uint64_t RunIterations(const Block& block, const Scope& scope, uint64_t ready) {
+    uint64_t iterations = Iterations(block);
+    uint64_t detailed = std::min<uint64_t>(iterations, std::max<std::size_t>(options_.max_detailed_iterations, 1));
+    std::vector<uint64_t> busy_before;
+    ForEachResource([&busy_before](Resource* resource) { busy_before.push_back(resource->busy); });
+    std::vector<std::pair<uint64_t, uint64_t>> bus_before;
+    for (const auto& bus : buses_) {
+      bus_before.emplace_back(bus.bytes, bus.wait);
+    }
+    uint64_t done = ready;
+    for (uint64_t i = 0; i < detailed; i++) {
+      done = RunStatements(block, scope, done);
+    }
+    if (iterations == detailed) {
+      return done;
+    }
+    double scale = static_cast<double>(iterations - detailed) / detailed;
+    done += static_cast<uint64_t>(std::llround((done - ready) * scale));
+    size_t i = 0;
+    ForEachResource([&](Resource* resource) {
+      uint64_t delta = resource->busy - busy_before[i++];
+      if (delta) {
+        resource->busy += static_cast<uint64_t>(std::llround(delta * scale));
+        resource->free_at = std::max(resource->free_at, done);
+      }
+    });
+    for (size_t b = 0; b < buses_.size(); b++) {
+      buses_[b].bytes += static_cast<uint64_t>(std::llround((buses_[b].bytes - bus_before[b].first) * scale));
+      buses_[b].wait += static_cast<uint64_t>(std::llround((buses_[b].wait - bus_before[b].second) * scale));
+    }
+    return done;
+  }
+
+  uint64_t RunStatements(const Block& block, const Scope& scope, uint64_t ready) {
+    // Without dependencies (e.g. if they were never computed), statements run in order.
+    bool has_deps = std::any_of(block.stmts.begin(), block.stmts.end(),
+                                [](const std::shared_ptr<Statement>& stmt) { return !stmt->deps.empty(); });
+    std::unordered_map<const Statement*, uint64_t> done_by_stmt;
+    uint64_t prev = ready;
+    uint64_t done = ready;
+    for (const auto& stmt : block.stmts) {
+      uint64_t start = has_deps ? ready : prev;
+      for (const auto& dep : stmt->deps) {
+        auto dep_it = done_by_stmt.find(dep->get());
+        if (dep_it != done_by_stmt.end()) {
+          start = std::max(start, dep_it->second);
+        }
+      }
+      uint64_t stmt_done;
+      switch (stmt->kind()) {
+        case StmtKind::Block:
+          stmt_done = RunBlock(*Block::Downcast(stmt), scope, start);
+          break;
+        case StmtKind::Special: {
+          auto special = Special::Downcast(stmt);
+          auto cycles = Cycles(SpecialOps(block, *special), default_unit_->ops_per_cycle);
+          stmt_done = Occupy(special->name, Location{}, default_unit_, cycles, start);
+        } break;
+        default:
+          stmt_done = Occupy("", Location{}, default_unit_, 1, start);
+          break;
+      }
+      done_by_stmt[stmt.get()] = stmt_done;
+      prev = stmt_done;
+      done = std::max(done, stmt_done);
+    }
+    return done;
+  }
+
+  // Runs work on a unit: on the instance named by the location's unit if it's constant, or else split evenly across
+  // every instance.
+  uint64_t Occupy(const std::string& name, const Location& location, Unit* unit, uint64_t cycles, uint64_t ready) {
+    auto& instances = unit->instances;
+    if (location.unit.isConstant()) {
+      auto& instance = instances[location.unit.constant() % instances.size()];
+      uint64_t start = std::max(ready, instance.free_at);
+      Use(name, &instance, start, cycles);
+      return start + cycles;
+    }
+    uint64_t per_instance = (cycles + instances.size() - 1) / instances.size();
+    uint64_t start = ready;
+    for (const auto& instance : instances) {
+      start = std::max(start, instance.free_at);
+    }
+    for (auto& instance : instances) {
+      Use(name, &instance, start, per_instance);
+    }
+    return start + per_instance;
+  }
+
+  // Moves a block's output bytes from the memory unit holding its inputs to the one holding its outputs, occupying
+  // both the transfer unit and the bus between them.
+  uint64_t RunTransfer(const Block& block, const Scope& scope, Unit* unit, uint64_t ready) {
+    double bytes = 0;
+    std::string src;
+    std::string dst;
+    for (const auto& ref : block.refs) {
+      auto loc_it = scope.find(ref.into);
+      std::string loc = loc_it == scope.end() ? "" : loc_it->second;
+      if (IsWriteDir(ref.dir)) {
+        bytes += static_cast<double>(ref.shape.elem_size()) * byte_width(ref.shape.type);
+        if (dst.empty()) {
+          dst = loc;
+        }
+      } else if (IsReadDir(ref.dir) && src.empty()) {
+        src = loc;
+      }
+    }
+    bytes *= Iterations(block);
+    Bus* bus = nullptr;
+    for (auto& candidate : buses_) {
+      const auto& sources = candidate.config->sources();
+      const auto& sinks = candidate.config->sinks();
+      if (std::count(sources.begin(), sources.end(), src) && std::count(sinks.begin(), sinks.end(), dst)) {
+        bus = &candidate;
+        break;
+      }
+    }
+    // Transfers between memories with no bus between them move a byte per cycle.
+    uint64_t cycles = Cycles(bytes, bus ? bus->config->bytes_per_cycle() : 1);
+    auto& instances = unit->instances;
+    Resource* instance = &instances[0];
+    if (block.location.unit.isConstant()) {
+      instance = &instances[block.location.unit.constant() % instances.size()];
+    } else {
+      for (auto& candidate : instances) {
+        if (candidate.free_at < instance->free_at) {
+          instance = &candidate;
+        }
+      }
+    }
+    uint64_t unit_ready = std::max(ready, instance->free_at);
+    uint64_t start = unit_ready;
+    if (bus) {
+      start = std::max(start, bus->resource.free_at);
+      bus->wait += start - unit_ready;
+      bus->bytes += static_cast<uint64_t>(bytes);
+      Use(block.name, &bus->resource, start, cycles);
+    }
+    Use(block.name, instance, start, cycles);
+    return start + cycles;
+  }
+
+  void Use(const std::string& name, Resource* resource, uint64_t start, uint64_t cycles) {
+    resource->free_at = start + cycles;
+    resource->busy += cycles;
+    if (!name.empty()) {
+      events_.emplace_back(SimulatedEvent{name, resource->name, start, cycles});
+    }
+  }
+
+  template <typename F>
+  void ForEachResource(const F& func) {
+    for (auto* units : {&exec_units_, &tx_units_}) {
+      for (auto& kvp : *units) {
+        for (auto& instance : kvp.second.instances) {
+          func(&instance);
+        }
+      }
+    }
+    for (auto& bus : buses_) {
+      func(&bus.resource);
+    }
+  }
+
+  const proto::Config& cfg_;
+  SimulateOptions options_;
+  std::map<std::string, Unit> exec_units_;
+  std::map<std::string, Unit> tx_units_;
+  std::map<std::string, Memory> mems_;
+  std::vector<Bus> buses_;
+  Unit* default_unit_;
+  std::vector<SimulatedEvent> events_;
+};
+
+std::string JsonString(const std::string& str) {
+  std::string quoted = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+}  // namespace
+
+Simulation Simulate(const Block& program, const proto::Config& cfg, const SimulateOptions& options) {
+  return Simulator{cfg, options}.Run(program);
+}
+
+void WriteChromeTrace(const Simulation& simulation, const proto::Config& cfg, std::ostream* out) {
+  // Trace timestamps are in microseconds; without a clock, a cycle is shown as a microsecond.
+  double cycles_per_us = cfg.clock_mhz() ? cfg.clock_mhz() : 1;
+  std::map<std::string, size_t> tids;
+  *out << "{\"traceEvents\":[";
+  const char* sep = "\n";
+  auto add_thread = [&](const std::string& name) {
+    size_t tid = tids.size();
+    tids[name] = tid;
+    *out << sep << printstring(R"({"name":"thread_name","ph":"M","pid":0,"tid":%zu,"args":{"name":%s}})", tid,
+                               JsonString(name).c_str());
+    sep = ",\n";
+  };
+  for (const auto& unit : simulation.stats.units()) {
+    add_thread(unit.name());
+  }
+  for (const auto& bus : simulation.stats.buses()) {
+    add_thread(bus.name());
+  }
+  for (const auto& event : simulation.events) {
+    auto tid_it = tids.find(event.unit);
+    if (tid_it == tids.end()) {
+      continue;
+    }
+    *out << sep
+         << printstring(R"({"name":%s,"ph":"X","pid":0,"tid":%zu,"ts":%.3f,"dur":%.3f})",
+                        JsonString(event.name).c_str(), tid_it->second, event.start / cycles_per_us,
+                        event.cycles / cycles_per_us);
+  }
+  *out << "\n]}\n";
+}
+
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
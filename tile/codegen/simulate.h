@@ -0,0 +1,53 @@
+// Copyright 2018, Intel Corporation
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "tile/codegen/codegen.pb.h"
+#include "tile/stripe/stripe.h"
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+
+struct SimulateOptions {
+  // Blocks that aren't located on a unit run their statements once per iteration.  Only this many iterations are
+  // simulated in detail; the rest are extrapolated from their average duration.
+  std::size_t max_detailed_iterations = 16;
+};
+
+// An interval during which a unit or bus was busy.
+struct SimulatedEvent {
+  std::string name;  // The block's name
+  std::string unit;  // The unit or bus, as named in SimulationStats
+  uint64_t start;
+  uint64_t cycles;
+};
+
+struct Simulation {
+  proto::SimulationStats stats;
+  std::vector<SimulatedEvent> events;
+};
+
+// Estimates the execution of an optimized program on the hardware described by cfg.
+//
+// Blocks located on one of the Config's execution units run there for as many cycles as their statements take at
+// the unit's ops_per_cycle; blocks located on a transfer unit move their refinements' bytes over the bus joining
+// their source and destination memory units.  A unit or bus runs one block at a time, so blocks contend for them.
+// If a block's location has a unit index, it runs on that instance of the unit; otherwise, it's split across every
+// instance.  Other blocks run their statements as soon as the statements named by their deps are done (or in order,
+// if no statement has deps), and statements outside located blocks take one cycle on the first execution unit.
+// Allocations in memory units are live for the duration of the block that declares them.
+Simulation Simulate(const stripe::Block& program, const proto::Config& cfg,
+                    const SimulateOptions& options = SimulateOptions{});
+
+// Writes the simulation as Chrome trace event JSON (viewable in chrome://tracing), with a thread per unit and bus.
+void WriteChromeTrace(const Simulation& simulation, const proto::Config& cfg, std::ostream* out);
+
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,36 @@
+// Copyright 2018, Intel Corporation
+
+#include "tile/codegen/tags.h"
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+
+namespace {
+
+void CollectBlocksRecurse(const AliasMap& map, stripe::Block* block, const Tags& reqs,
+                          std::vector<std::pair<AliasMap, stripe::Block*>>* matches) {
+  if (HasTags(*block, reqs)) {
+    matches->emplace_back(map, block);
+    return;
+  }
+  for (auto& stmt : block->stmts) {
+    auto inner = stripe::Block::Downcast(stmt);
+    if (inner) {
+      AliasMap inner_map(map, inner.get());
+      CollectBlocksRecurse(inner_map, inner.get(), reqs, matches);
+    }
+  }
+}
+
+}  // namespace
+
+void CollectBlocks(stripe::Block* root, const Tags& reqs, std::vector<std::pair<AliasMap, stripe::Block*>>* matches) {
+  AliasMap base;
+  AliasMap root_map(base, root);
+  CollectBlocksRecurse(root_map, root, reqs, matches);
+}
+
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
@@ -2,9 +2,14 @@
 
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "base/util/parallel.h"
 #include "tile/codegen/alias.h"
 #include "tile/codegen/codegen.pb.h"
 #include "tile/stripe/stripe.h"
@@ -52,6 +57,21 @@ void RunOnBlocks(stripe::Block* root, const Tags& reqs, const F& func) {
   RunOnBlocksRecurse(root_map, root, reqs, func);
 }
 
+// Collects the outermost blocks matching reqs, each paired with its AliasMap, in program order.
+void CollectBlocks(stripe::Block* root, const Tags& reqs, std::vector<std::pair<AliasMap, stripe::Block*>>* matches);
+
+// Like RunOnBlocks, but runs func on the matching blocks concurrently.  Matches are never nested within one another,
+// so each call works on a disjoint subtree, and each call is given its own AliasMap, built before any call begins.
+// func may therefore modify the block it's given and that block's descendants, including adding refinements and
+// indexes named by unique_ref_name and unique_idx_name (which only consult the block they're called on); it must not
+// modify the block's ancestors or siblings, or other state shared between calls, without its own synchronization.
+template <typename F>
+void RunOnBlocksParallel(stripe::Block* root, const Tags& reqs, const F& func) {
+  std::vector<std::pair<AliasMap, stripe::Block*>> matches;
+  CollectBlocks(root, reqs, &matches);
+  ParallelForEach(matches.size(), [&matches, &func](std::size_t i) { func(matches[i].first, matches[i].second); });
+}
+
 inline Tags FromProto(const google::protobuf::RepeatedPtrField<std::string>& pb_tags) {
   Tags tags;
   for (const auto& tag : pb_tags) {
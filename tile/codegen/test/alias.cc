@@ -0,0 +1,236 @@
+// Copyright 2018, Intel Corp.
+
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "tile/codegen/alias.h"
+#include "tile/stripe/stripe.h"
+
+namespace {
+
+std::atomic<size_t> allocations{0};
+
+}  // namespace
+
+// Counts heap allocations, so that the benchmark below can report them.
+void* operator new(std::size_t size) {
+  allocations++;
+  void* ptr = std::malloc(size ? size : 1);
+  if (!ptr) {
+    throw std::bad_alloc{};
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+using ::testing::ContainerEq;
+using ::testing::Eq;
+using ::testing::Lt;
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+namespace test {
+
+using stripe::Affine;
+using stripe::Block;
+using stripe::CompactAffine;
+using stripe::RefDir;
+using stripe::Refinement;
+using stripe::Symbol;
+
+namespace {
+
+Refinement MakeRef(RefDir dir, const std::string& from, const std::string& into, std::vector<Affine> access) {
+  Refinement ref{};
+  ref.dir = dir;
+  ref.from = from;
+  ref.into = into;
+  ref.shape = SimpleShape(DataType::FLOAT32, std::vector<size_t>(access.size(), 8));
+  ref.access = std::move(access);
+  return ref;
+}
+
+// A program shaped like ResNet-50 after tiling: a chain of convolution kernels, each holding a tile block, with
+// four-dimensional accesses throughout.
+std::shared_ptr<Block> ResNetSizedProgram(size_t kernels) {
+  auto program = std::make_shared<Block>();
+  auto main = std::make_shared<Block>();
+  for (size_t i = 0; i <= kernels; i++) {
+    for (const auto& name : {"T" + std::to_string(i), "W" + std::to_string(i)}) {
+      program->refs.push_back(MakeRef(RefDir::None, "", name, std::vector<Affine>(4)));
+      main->refs.push_back(MakeRef(RefDir::InOut, name, name, std::vector<Affine>(4)));
+    }
+  }
+  for (size_t i = 0; i < kernels; i++) {
+    auto kernel = std::make_shared<Block>();
+    kernel->name = "conv_" + std::to_string(i);
+    for (const auto& idx : {"n", "x", "y", "ci", "co", "kx", "ky"}) {
+      kernel->idxs.push_back({idx, 3, Affine{}});
+    }
+    kernel->refs.push_back(MakeRef(RefDir::In, "T" + std::to_string(i), "I",
+                                   {Affine("n"), Affine("x") + Affine("kx") - 1, Affine("y") + Affine("ky") - 1,
+                                    Affine("ci")}));
+    kernel->refs.push_back(
+        MakeRef(RefDir::In, "W" + std::to_string(i), "K", {Affine("kx"), Affine("ky"), Affine("ci"), Affine("co")}));
+    kernel->refs.push_back(MakeRef(RefDir::Out, "T" + std::to_string(i + 1), "O",
+                                   {Affine("n"), Affine("x"), Affine("y"), Affine("co")}));
+    auto tile = std::make_shared<Block>();
+    for (const auto& idx : {"x", "y", "co"}) {
+      tile->idxs.push_back({idx, 4, Affine{}});
+    }
+    tile->refs.push_back(MakeRef(RefDir::In, "I", "I", {0, Affine("x", 4), Affine("y", 4), 0}));
+    tile->refs.push_back(MakeRef(RefDir::In, "K", "K", {0, 0, 0, Affine("co", 16)}));
+    tile->refs.push_back(MakeRef(RefDir::Out, "O", "O", {0, Affine("x", 4), Affine("y", 4), Affine("co", 16)}));
+    kernel->stmts.push_back(tile);
+    main->stmts.push_back(kernel);
+  }
+  program->stmts.push_back(main);
+  return program;
+}
+
+// AliasMap as it was before accesses were compact, with every access term keyed by a depth-qualified string.
+struct StringAliasMap {
+  struct Info {
+    Block* base_block;
+    Refinement* base_ref;
+    std::string base_name;
+    std::vector<Affine> access;
+    TensorShape shape;
+  };
+
+  StringAliasMap() = default;
+  StringAliasMap(const StringAliasMap& outer, Block& block) : depth{outer.depth + 1} {
+    std::string prefix = std::string("d") + std::to_string(depth) + ":";
+    for (auto& ref : block.refs) {
+      auto& info = info_by_ref[ref.into];
+      if (ref.dir != RefDir::None) {
+        const auto& outer_info = outer.info_by_ref.at(ref.from);
+        info.base_block = outer_info.base_block;
+        info.base_ref = outer_info.base_ref;
+        info.base_name = outer_info.base_name;
+        info.access = outer_info.access;
+      } else {
+        info.base_block = &block;
+        info.base_ref = &ref;
+        info.base_name = prefix + ref.into;
+        info.access.resize(ref.access.size());
+      }
+      for (size_t i = 0; i < ref.access.size(); i++) {
+        Affine uniq;
+        for (const auto& kvp : ref.access[i].getMap()) {
+          uniq += kvp.first.empty() ? Affine(kvp.second) : Affine(prefix + kvp.first, kvp.second);
+        }
+        info.access[i] += uniq;
+      }
+      info.shape = ref.shape;
+    }
+  }
+
+  size_t depth = 0;
+  std::map<std::string, Info> info_by_ref;
+};
+
+template <typename Map, typename F>
+void WalkAliasMaps(const Map& outer, Block* block, const F& visit) {
+  Map map(outer, *block);
+  visit(map, *block);
+  for (const auto& stmt : block->stmts) {
+    auto inner = Block::Downcast(stmt);
+    if (inner) {
+      WalkAliasMaps(map, inner.get(), visit);
+    }
+  }
+}
+
+// Adapts AliasMap's constructor to WalkAliasMaps.
+struct CompactAliasMap : AliasMap {
+  CompactAliasMap() = default;
+  CompactAliasMap(const CompactAliasMap& outer, Block& block) : AliasMap(outer, &block) {}
+};
+
+}  // namespace
+
+TEST(Codegen, CompactAffineArithmetic) {
+  CompactAffine a{Affine("i", 2) + Affine("j") + 3};
+  CompactAffine b = CompactAffine{Symbol{"j"}, -1} + CompactAffine{Symbol{"k"}, 5};
+  EXPECT_THAT(a.constant(), Eq(3));
+  EXPECT_THAT(a[Symbol{"i"}], Eq(2));
+  EXPECT_THAT(a[Symbol{"k"}], Eq(0));
+  EXPECT_THAT((a + b).ToPolynomial(), Eq(Affine("i", 2) + Affine("k", 5) + 3));
+  EXPECT_THAT((a - a).terms().size(), Eq(0));
+  EXPECT_THAT((a * 0).isConstant(), Eq(true));
+  EXPECT_THAT(-a, Eq(CompactAffine{-1 * (Affine("i", 2) + Affine("j") + 3)}));
+  EXPECT_THAT(CompactAffine{Affine("j") + Affine("i", 2) + 3}, Eq(a));
+  EXPECT_THAT(Symbol{"i"}, Eq(Symbol{std::string("i")}));
+  EXPECT_THAT(Symbol{}.id(), Eq(0));
+
+  // Terms are ordered by name, whatever order their symbols were interned in.
+  Symbol late{"symbol_order_z"};
+  Symbol early{"symbol_order_a"};
+  EXPECT_THAT(early < late, Eq(true));
+  EXPECT_THAT(late < early, Eq(false));
+  EXPECT_THAT(early < early, Eq(false));
+  EXPECT_THAT(Symbol{} < early, Eq(true));
+  CompactAffine ordered{CompactAffine::Terms{{late, 1}, {Symbol{}, 4}, {early, 2}}};
+  ASSERT_THAT(ordered.terms().size(), Eq(3));
+  EXPECT_THAT(ordered.terms()[0].first, Eq(Symbol{}));
+  EXPECT_THAT(ordered.terms()[1].first, Eq(early));
+  EXPECT_THAT(ordered.terms()[2].first, Eq(late));
+  EXPECT_THAT(CompactAffine{early, 1} < CompactAffine{late, 1}, Eq(true));
+
+  // Accesses of up to four terms never touch the heap.
+  size_t before = allocations;
+  CompactAffine c = a;
+  c += b;
+  c -= CompactAffine{Symbol{}, 3};
+  EXPECT_THAT(allocations - before, Eq(0));
+}
+
+TEST(Codegen, AliasMapCompactAccess) {
+  auto program = ResNetSizedProgram(2);
+  std::vector<std::vector<Affine>> expected;
+  WalkAliasMaps(StringAliasMap{}, program.get(), [&expected](const StringAliasMap& map, const Block& block) {
+    for (const auto& ref : block.refs) {
+      expected.push_back(map.info_by_ref.at(ref.into).access);
+    }
+  });
+  std::vector<std::vector<Affine>> actual;
+  WalkAliasMaps(CompactAliasMap{}, program.get(), [&actual](const AliasMap& map, const Block& block) {
+    for (const auto& ref : block.refs) {
+      std::vector<Affine> access;
+      for (const auto& affine : map.at(ref.into).access) {
+        access.push_back(affine.ToPolynomial());
+      }
+      actual.push_back(access);
+    }
+  });
+  EXPECT_THAT(actual, ContainerEq(expected));
+}
+
+// Building every AliasMap in a ResNet-50-sized program with compact accesses
+// makes fewer heap allocations than with string-keyed accesses.
+TEST(Codegen, AliasMapCompactAccessAllocatesLess) {
+  auto program = ResNetSizedProgram(160);
+
+  size_t before = allocations;
+  WalkAliasMaps(StringAliasMap{}, program.get(), [](const StringAliasMap& map, const Block& block) {});
+  size_t string_allocations = allocations - before;
+
+  before = allocations;
+  WalkAliasMaps(CompactAliasMap{}, program.get(), [](const AliasMap& map, const Block& block) {});
+  size_t compact_allocations = allocations - before;
+
+  EXPECT_THAT(compact_allocations, Lt(string_allocations));
+}
+
+}  // namespace test
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,242 @@
+// Copyright 2018, Intel Corp.
+
+#include <gmock/gmock.h>
+#include <google/protobuf/text_format.h>
+#include <google/protobuf/util/json_util.h>
+
+#include <fstream>
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
+#include "tile/codegen/autotile.h"
+#include "tile/lang/gen_stripe.h"
+#include "tile/lib/lib.h"
+#include "tile/stripe/stripe.h"
+
+namespace gp = google::protobuf;
+
+using ::testing::DoubleEq;
+using ::testing::Eq;
+using ::testing::Le;
+using ::testing::Lt;
+using ::testing::Ne;
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+namespace test {
+
+namespace {
+
+// A CPU core with a 256KiB L2 cache, fed from DRAM.
+proto::Config CpuConfig() {
+  proto::Config cfg;
+  gp::TextFormat::ParseFromString(R"(
+    clock_mhz: 2000
+    exec_units { key: "core" value { ops_per_cycle: 16 } }
+    mem_units { key: "L2" value { size_KiB: 256 } }
+    mem_units { key: "DRAM" value { size_KiB: 16777216 } }
+    buses { sources: "DRAM" sinks: "L2" bytes_per_cycle: 32 }
+  )",
+                                  &cfg);
+  return cfg;
+}
+
+proto::AutotilePass AutotileOptions(bool roofline, bool fast) {
+  proto::AutotilePass options;
+  gp::TextFormat::ParseFromString(R"(
+    reqs: "contraction" outer_set: "outer" inner_set: "inner"
+    only_po2: true use_bytes: false skip_1d: false
+    max_output_size: 1024 max_input_size: 1024 output_cost: 1.0 input_cost: 1.0
+  )",
+                                  &options);
+  options.set_fast(fast);
+  if (roofline) {
+    gp::TextFormat::ParseFromString(R"(exec_unit: "core" mem_unit: "L2" outer_mem_unit: "DRAM")",
+                                    options.mutable_roofline());
+  }
+  return options;
+}
+
+// Every tile that the power-of-two search can reach: in each dimension, a power of two below the range, or the range.
+std::vector<TileShape> AllTiles(const stripe::Block& block) {
+  std::vector<TileShape> tiles{TileShape{}};
+  for (const auto& idx : block.idxs) {
+    std::vector<TileShape> next;
+    for (const auto& tile : tiles) {
+      for (uint64_t size = 1;; size = std::min(2 * size, idx.range)) {
+        next.push_back(tile);
+        next.back().push_back(size);
+        if (size == idx.range) {
+          break;
+        }
+      }
+    }
+    tiles.swap(next);
+  }
+  return tiles;
+}
+
+// The tile that AutotilePass applied to the kernel, read back from the inner block.
+TileShape AppliedTile(const stripe::Block& original, const stripe::Block& tiled) {
+  TileShape tile(original.idxs.size(), 1);
+  if (tiled.stmts.empty() || !stripe::Block::Downcast(tiled.stmts.front())) {
+    return tile;
+  }
+  auto inner = stripe::Block::Downcast(tiled.stmts.front());
+  for (size_t i = 0; i < original.idxs.size(); i++) {
+    auto idx = inner->idx_by_name(original.idxs[i].name);
+    if (idx) {
+      tile[i] = idx->range;
+    }
+  }
+  return tile;
+}
+
+// Compares the tiles picked by AutotilePass with the best tile found by exhaustive search under the roofline model.
+void CompareWithExhaustive(const std::string& name, const lang::RunInfo& runinfo) {
+  auto cfg = CpuConfig();
+  auto roofline = AutotileOptions(true, false).roofline();
+  auto program = GenerateStripe(runinfo);
+  auto kernel = program->SubBlock(0)->SubBlock(0);
+
+  double best = std::numeric_limits<double>::infinity();
+  for (const auto& tile : AllTiles(*kernel)) {
+    best = std::min(best, RooflineTileCost(*kernel, roofline, cfg, tile));
+  }
+
+  auto picked_cost = [&](bool use_roofline, bool fast) {
+    auto tiled = GenerateStripe(runinfo);
+    AutotilePass(tiled.get(), AutotileOptions(use_roofline, fast), cfg);
+    auto tile = AppliedTile(*kernel, *tiled->SubBlock(0)->SubBlock(0));
+    return RooflineTileCost(*kernel, roofline, cfg, tile);
+  };
+  double search = picked_cost(true, false);
+  double fast = picked_cost(true, true);
+  double weighted = picked_cost(false, false);
+
+  // The search visits every tile that fits, so it must find the best one.
+  EXPECT_THAT(search, DoubleEq(best)) << name;
+  EXPECT_THAT(best, Le(fast)) << name;
+  EXPECT_THAT(best, Le(weighted)) << name;
+  EXPECT_THAT(best, Lt(std::numeric_limits<double>::infinity())) << name;
+}
+
+}  // namespace
+
+TEST(Codegen, RooflineCostModel) {
+  auto cfg = CpuConfig();
+  auto roofline = AutotileOptions(true, false).roofline();
+  auto runinfo = lib::LoadMatMul("matmul",                                    //
+                                 SimpleShape(DataType::FLOAT32, {256, 256}),  //
+                                 SimpleShape(DataType::FLOAT32, {256, 256}));
+  auto kernel = GenerateStripe(runinfo)->SubBlock(0)->SubBlock(0);
+  ASSERT_THAT(kernel->idxs.size(), Eq(3));
+
+  // Untiled, each point moves its operands from DRAM, so the kernel is bound by transfer.
+  double untiled = RooflineTileCost(*kernel, roofline, cfg, {1, 1, 1});
+  EXPECT_THAT(untiled, DoubleEq(256.0 * 256 * 256 * (4 + 4 + 2 * 4) / 32 / 2e9));
+  // A 64x64x64 tile (48KiB) fits in L2 and is bound by compute.
+  EXPECT_THAT(RooflineTileCost(*kernel, roofline, cfg, {64, 64, 64}), DoubleEq(256.0 * 256 * 256 / 16 / 2e9));
+  // The whole problem (768KiB) doesn't fit.
+  EXPECT_THAT(RooflineTileCost(*kernel, roofline, cfg, {256, 256, 256}),
+              Eq(std::numeric_limits<double>::infinity()));
+
+  auto bad = roofline;
+  bad.set_mem_unit("L3");
+  EXPECT_THROW(RooflineTileCost(*kernel, bad, cfg, {1, 1, 1}), std::runtime_error);
+}
+
+TEST(Codegen, RooflineAutotileFindsBestTile) {
+  CompareWithExhaustive("matmul 256x256x256", lib::LoadMatMul("matmul",                                    //
+                                                              SimpleShape(DataType::FLOAT32, {256, 256}),  //
+                                                              SimpleShape(DataType::FLOAT32, {256, 256})));
+  CompareWithExhaustive("matmul 1024x64x1024", lib::LoadMatMul("matmul",                                    //
+                                                               SimpleShape(DataType::FLOAT32, {1024, 64}),  //
+                                                               SimpleShape(DataType::FLOAT32, {64, 1024})));
+  CompareWithExhaustive("conv 56x56x64x64 3x3", lib::LoadConv2d("conv",                                          //
+                                                                SimpleShape(DataType::FLOAT32, {56, 56, 64}),    //
+                                                                SimpleShape(DataType::FLOAT32, {3, 3, 64, 64}),  //
+                                                                SimpleShape(DataType::FLOAT32, {56, 56, 64})));
+  CompareWithExhaustive("conv 14x14x256x256 1x1", lib::LoadConv2d("conv",                                            //
+                                                                  SimpleShape(DataType::FLOAT32, {14, 14, 256}),     //
+                                                                  SimpleShape(DataType::FLOAT32, {1, 1, 256, 256}),  //
+                                                                  SimpleShape(DataType::FLOAT32, {14, 14, 256})));
+}
+
+TEST(Codegen, AutotileMeasured) {
+  namespace fs = boost::filesystem;
+  auto cfg = CpuConfig();
+  auto runinfo = lib::LoadMatMul("matmul",                                  //
+                                 SimpleShape(DataType::FLOAT32, {64, 64}),  //
+                                 SimpleShape(DataType::FLOAT32, {64, 64}));
+  auto kernel = GenerateStripe(runinfo)->SubBlock(0)->SubBlock(0);
+  auto cache_path = fs::temp_directory_path() / fs::unique_path();
+  auto options = AutotileOptions(true, false);
+  options.mutable_measure()->set_candidates(3);
+  options.mutable_measure()->set_runs(2);
+  options.mutable_measure()->set_cache_path(cache_path.string());
+  auto key = MeasurementKey(*kernel, options, cfg);
+
+  // Tiles chosen under different options or for different hardware are kept apart.
+  EXPECT_THAT(key.find(BlockSignature(*kernel)), Eq(0));
+  auto other_options = options;
+  other_options.set_only_po2(false);
+  EXPECT_THAT(MeasurementKey(*kernel, other_options, cfg), Ne(key));
+  auto other_cfg = cfg;
+  other_cfg.set_clock_mhz(1000);
+  EXPECT_THAT(MeasurementKey(*kernel, options, other_cfg), Ne(key));
+
+  // The measured tile is applied and recorded under the block's key.
+  auto program = GenerateStripe(runinfo);
+  AutotilePass(program.get(), options, cfg);
+  auto measured = AppliedTile(*kernel, *program->SubBlock(0)->SubBlock(0));
+  {
+    std::ifstream cache{cache_path.string()};
+    std::string line;
+    ASSERT_TRUE(std::getline(cache, line));
+    proto::AutotileCacheEntry entry;
+    ASSERT_TRUE(gp::util::JsonStringToMessage(line, &entry).ok());
+    EXPECT_THAT(entry.key(), Eq(key));
+    EXPECT_THAT(TileShape(entry.tile().begin(), entry.tile().end()), Eq(measured));
+    EXPECT_FALSE(std::getline(cache, line));
+  }
+
+  // A later compile of the same block takes its tile from the cache.
+  auto plant = [&](uint64_t size) {
+    auto path = fs::temp_directory_path() / fs::unique_path();
+    proto::AutotileCacheEntry entry;
+    entry.set_key(key);
+    for (size_t i = 0; i < kernel->idxs.size(); i++) {
+      entry.add_tile(size);
+    }
+    entry.set_seconds(1);
+    std::string line;
+    gp::util::MessageToJsonString(entry, &line);
+    std::ofstream planted{path.string()};
+    planted << line << std::endl;
+    return path;
+  };
+  auto planted_path = plant(2);
+  options.mutable_measure()->set_cache_path(planted_path.string());
+  program = GenerateStripe(runinfo);
+  AutotilePass(program.get(), options, cfg);
+  EXPECT_THAT(AppliedTile(*kernel, *program->SubBlock(0)->SubBlock(0)), Eq(TileShape(kernel->idxs.size(), 2)));
+
+  // A cached tile the options rule out, here one that isn't a power of two, is measured over.
+  auto excluded_path = plant(3);
+  options.mutable_measure()->set_cache_path(excluded_path.string());
+  program = GenerateStripe(runinfo);
+  AutotilePass(program.get(), options, cfg);
+  EXPECT_THAT(AppliedTile(*kernel, *program->SubBlock(0)->SubBlock(0)), Ne(TileShape(kernel->idxs.size(), 3)));
+
+  fs::remove(cache_path);
+  fs::remove(planted_path);
+  fs::remove(excluded_path);
+}
+
+}  // namespace test
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
@@ -81,6 +81,147 @@ TEST(DepsTest, SmallDepMix) {
   EXPECT_THAT(output_proto, EqualsProtoText(expected));
 }
 
+TEST(DepsTest, SubBlockRegions) {
+  // Blocks writing disjoint parts of b are independent; a block reading
+  // parts written by both depends on both, and a block overwriting part of
+  // what was read depends only on the reader.
+  auto input_text = R"(
+    location: { unit { } }
+    stmts {
+      tags: "main"
+      block {
+        location: { unit { } }
+        refs {
+          into: "b"
+          location: { unit { } }
+          shape { type: FLOAT32 dimensions: {size:10 stride:1} }
+        }
+        stmts {
+          block {
+            location: { unit { } }
+            idxs { name: "i" range: 4 affine { } }
+            refs {
+              dir: 2 from: "b" into: "b"
+              access { terms { key: "i" value: 1 } }
+              location: { unit { } }
+              shape { type: FLOAT32 dimensions: {size:1 stride:1} }
+            }
+          }
+        }
+        stmts {
+          block {
+            location: { unit { } }
+            idxs { name: "i" range: 4 affine { } }
+            refs {
+              dir: 2 from: "b" into: "b"
+              access { offset: 4 terms { key: "i" value: 1 } }
+              location: { unit { } }
+              shape { type: FLOAT32 dimensions: {size:1 stride:1} }
+            }
+          }
+        }
+        stmts {
+          block {
+            location: { unit { } }
+            idxs { name: "i" range: 4 affine { } }
+            refs {
+              dir: 1 from: "b" into: "b"
+              access { offset: 2 terms { key: "i" value: 1 } }
+              location: { unit { } }
+              shape { type: FLOAT32 dimensions: {size:1 stride:1} }
+            }
+          }
+        }
+        stmts {
+          block {
+            location: { unit { } }
+            idxs { name: "i" range: 4 affine { } }
+            refs {
+              dir: 2 from: "b" into: "b"
+              access { offset: 5 terms { key: "i" value: 1 } }
+              location: { unit { } }
+              shape { type: FLOAT32 dimensions: {size:1 stride:1} }
+            }
+          }
+        }
+      }
+    }
+  )";
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(input_text, &input_proto);
+
+  auto block = stripe::FromProto(input_proto);
+  proto::GenericPass options;
+  options.add_reqs("main");
+  ComputeDepsPass(block.get(), options);
+
+  const char* expected = R"(
+    location: { unit { } }
+    stmts {
+      tags: "main"
+      block {
+        location: { unit { } }
+        refs {
+          into: "b"
+          location: { unit { } }
+          shape { type: FLOAT32 dimensions: {size:10 stride:1} }
+        }
+        stmts {
+          block {
+            location: { unit { } }
+            idxs { name: "i" range: 4 affine { } }
+            refs {
+              dir: 2 from: "b" into: "b"
+              access { terms { key: "i" value: 1 } }
+              location: { unit { } }
+              shape { type: FLOAT32 dimensions: {size:1 stride:1} }
+            }
+          }
+        }
+        stmts {
+          block {
+            location: { unit { } }
+            idxs { name: "i" range: 4 affine { } }
+            refs {
+              dir: 2 from: "b" into: "b"
+              access { offset: 4 terms { key: "i" value: 1 } }
+              location: { unit { } }
+              shape { type: FLOAT32 dimensions: {size:1 stride:1} }
+            }
+          }
+        }
+        stmts {
+          block {
+            location: { unit { } }
+            idxs { name: "i" range: 4 affine { } }
+            refs {
+              dir: 1 from: "b" into: "b"
+              access { offset: 2 terms { key: "i" value: 1 } }
+              location: { unit { } }
+              shape { type: FLOAT32 dimensions: {size:1 stride:1} }
+            }
+          } deps: 0 deps: 1
+        }
+        stmts {
+          block {
+            location: { unit { } }
+            idxs { name: "i" range: 4 affine { } }
+            refs {
+              dir: 2 from: "b" into: "b"
+              access { offset: 5 terms { key: "i" value: 1 } }
+              location: { unit { } }
+              shape { type: FLOAT32 dimensions: {size:1 stride:1} }
+            }
+          } deps: 2
+        }
+      }
+    }
+  )";
+
+  auto output_proto = IntoProto(*block);
+  EXPECT_THAT(output_proto, EqualsProtoText(expected));
+}
+
 }  // namespace codegen
 }  // namespace tile
 }  // namespace vertexai
@@ -0,0 +1,65 @@
+// Copyright 2018, Intel Corp.
+
+#include <gmock/gmock.h>
+#include <google/protobuf/text_format.h>
+
+#include "tile/codegen/driver.h"
+#include "tile/lang/gen_stripe.h"
+#include "tile/lib/lib.h"
+#include "tile/stripe/stripe.h"
+
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::Gt;
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+namespace test {
+
+TEST(Codegen, OptimizePassStats) {
+  auto runinfo = lib::LoadMatMul("matmul",                                  //
+                                 SimpleShape(DataType::FLOAT32, {64, 64}),  //
+                                 SimpleShape(DataType::FLOAT32, {64, 64}));
+  auto program = GenerateStripe(runinfo);
+  auto initial = ComputeIRStats(*program);
+  EXPECT_THAT(initial.blocks(), Eq(3));
+
+  proto::Config cfg;
+  google::protobuf::TextFormat::ParseFromString(R"(
+    clock_mhz: 1000
+    passes { name: "prune" prune_indexes { reqs: "kernel" } }
+    passes { name: "deps" compute_deps { reqs: "main" } }
+  )",
+                                                &cfg);
+  proto::OptimizeStats stats;
+  OptimizeOptions options;
+  options.stats = &stats;
+  Optimize(program.get(), cfg, options);
+
+  ASSERT_THAT(stats.passes_size(), Eq(2));
+  EXPECT_THAT(stats.passes(0).name(), Eq("prune"));
+  EXPECT_THAT(stats.passes(0).kind(), Eq("prune_indexes"));
+  EXPECT_THAT(stats.passes(1).kind(), Eq("compute_deps"));
+  EXPECT_THAT(stats.passes(0).before().blocks(), Eq(initial.blocks()));
+  EXPECT_THAT(stats.passes(1).before().SerializeAsString(), Eq(stats.passes(0).after().SerializeAsString()));
+  EXPECT_THAT(stats.passes(1).after().SerializeAsString(), Eq(ComputeIRStats(*program).SerializeAsString()));
+  double total = 0;
+  for (const auto& pass : stats.passes()) {
+    EXPECT_THAT(pass.seconds(), Ge(0));
+    total += pass.seconds();
+  }
+  EXPECT_THAT(stats.seconds(), Ge(total));
+  EXPECT_THAT(stats.passes(0).after().stmts(), Gt(0));
+#if defined(__linux__)
+  for (const auto& pass : stats.passes()) {
+    EXPECT_THAT(pass.rss_bytes(), Gt(0));
+    EXPECT_THAT(pass.peak_rss_bytes(), Ge(pass.rss_bytes()));
+  }
+#endif
+}
+
+}  // namespace test
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
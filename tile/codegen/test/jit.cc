@@ -3,6 +3,9 @@
 #include <gmock/gmock.h>
 #include <google/protobuf/text_format.h>
 
+#include <thread>
+
+#include "base/util/printstring.h"
 #include "tile/codegen/jit.h"
 #include "tile/codegen/tile.h"
 #include "tile/lang/compose.h"
@@ -398,6 +401,386 @@ TEST(Codegen, JitNestedAlloc) {
   EXPECT_THAT(bufB, ContainerEq(expected));
 }
 
+// An elementwise program computing c[i] = a[i] * b[i], with the loop block's tags.
+std::shared_ptr<stripe::Block> ElementwiseMul(size_t size, const std::string& tags = "") {
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(printstring(R"(
+    location { unit { } }
+    refs {
+      location { unit { } }
+      dir: 1
+      into: "a"
+      access { }
+      shape { type: FLOAT32 dimensions: {size:%zu stride:1} }
+    }
+    refs {
+      location { unit { } }
+      dir: 1
+      into: "b"
+      access { }
+      shape { type: FLOAT32 dimensions: {size:%zu stride:1} }
+    }
+    refs {
+      location { unit { } }
+      dir: 2
+      into: "c"
+      access { }
+      shape { type: FLOAT32 dimensions: {size:%zu stride:1} }
+    }
+    stmts { %s block {
+      location { unit { } }
+      idxs { name: "i" range: %zu }
+      refs { location { unit { } } dir: 1 from: "a" into: "a" access { terms { key: "i" value: 1 } }
+             shape { type: FLOAT32 dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 1 from: "b" into: "b" access { terms { key: "i" value: 1 } }
+             shape { type: FLOAT32 dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 2 from: "c" into: "c" access { terms { key: "i" value: 1 } }
+             shape { type: FLOAT32 dimensions: {size:1 stride:1} } }
+      stmts { load { from:"a" into:"$a" } }
+      stmts { load { from:"b" into:"$b" } }
+      stmts { intrinsic { name:"mul" type:FLOAT32 inputs:"$a" inputs:"$b" outputs:"$c"} }
+      stmts { store { from:"$c" into:"c"} }
+    } }
+  )",
+                                              size, size, size, tags.c_str(), size),
+                                  &input_proto);
+  return std::shared_ptr<stripe::Block>{stripe::FromProto(input_proto)};
+}
+
+TEST(Codegen, JitProgramRunsConcurrently) {
+  const size_t size = 64;
+  auto block = ElementwiseMul(size);
+  JitProgram program{*block};
+  EXPECT_THAT(program.parameters(), ContainerEq(std::vector<std::string>{"a", "b", "c"}));
+
+  std::vector<std::thread> threads;
+  std::vector<std::vector<float>> results(4);
+  for (size_t t = 0; t < results.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<float> a(size, t + 1);
+      std::vector<float> b(size);
+      std::vector<float> c(size);
+      for (int iter = 0; iter < 100; ++iter) {
+        for (size_t i = 0; i < size; ++i) {
+          b[i] = i + iter;
+        }
+        program.Run({a.data(), b.data(), c.data()});
+        for (size_t i = 0; i < size; ++i) {
+          if (c[i] != (t + 1) * (i + iter)) {
+            return;
+          }
+        }
+      }
+      results[t] = c;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (size_t t = 0; t < results.size(); ++t) {
+    ASSERT_THAT(results[t].size(), Eq(size)) << "thread " << t;
+    EXPECT_THAT(results[t][size - 1], Eq(static_cast<float>((t + 1) * (size - 1 + 99))));
+  }
+  std::vector<float> a(size);
+  EXPECT_THROW(program.Run({a.data()}), std::runtime_error);
+  EXPECT_THROW(program.Run(std::map<std::string, void*>{{"a", a.data()}}), std::runtime_error);
+}
+
+// c[i] += a[i], with the loop block tagged "outer".  Since c is accumulated,
+// an index visited twice (or not at all) changes the result.
+std::shared_ptr<stripe::Block> ElementwiseAccumulate(size_t size) {
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(printstring(R"(
+    location { unit { } }
+    refs {
+      location { unit { } }
+      dir: 1
+      into: "a"
+      access { }
+      shape { type: INT32 dimensions: {size:%zu stride:1} }
+    }
+    refs {
+      location { unit { } }
+      dir: 2
+      into: "c"
+      agg_op: "add"
+      access { }
+      shape { type: INT32 dimensions: {size:%zu stride:1} }
+    }
+    stmts { tags: "outer" block {
+      location { unit { } }
+      idxs { name: "i" range: %zu }
+      refs { location { unit { } } dir: 1 from: "a" into: "a" access { terms { key: "i" value: 1 } }
+             shape { type: INT32 dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 2 from: "c" into: "c" agg_op: "add" access { terms { key: "i" value: 1 } }
+             shape { type: INT32 dimensions: {size:1 stride:1} } }
+      stmts { load { from:"a" into:"$a" } }
+      stmts { store { from:"$a" into:"c"} }
+    } }
+  )",
+                                              size, size, size),
+                                  &input_proto);
+  return std::shared_ptr<stripe::Block>{stripe::FromProto(input_proto)};
+}
+
+TEST(Codegen, JitParallelCoversEachIndexOnce) {
+  // Sizes smaller than, equal to, and not divisible by the thread counts.
+  for (size_t size : {1, 3, 8, 1001}) {
+    auto block = ElementwiseAccumulate(size);
+    std::vector<int32_t> a(size);
+    for (size_t i = 0; i < size; ++i) {
+      a[i] = i + 1;
+    }
+    std::vector<int32_t> serial(size);
+    JitExecute(*block, {{"a", a.data()}, {"c", serial.data()}});
+    EXPECT_THAT(serial, ContainerEq(a));
+    for (size_t threads : {2, 3, 8}) {
+      std::vector<int32_t> parallel(size);
+      JitOptions options;
+      options.parallel_tags = {"outer"};
+      options.max_threads = threads;
+      JitExecute(*block, {{"a", a.data()}, {"c", parallel.data()}}, options);
+      EXPECT_THAT(parallel, ContainerEq(serial)) << "size " << size << ", " << threads << " threads";
+    }
+  }
+}
+
+TEST(Codegen, JitParallelReduction) {
+  // sum += a[i, j], parallelized over i: no index partitions sum, so each
+  // thread accumulates into a private copy, merged when the thread finishes.
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(R"(
+    location { unit { } }
+    refs {
+      location { unit { } }
+      dir: 1
+      into: "a"
+      access { }
+      access { }
+      shape { type: INT32 dimensions: {size:100 stride:3} dimensions: {size:3 stride:1} }
+    }
+    refs {
+      location { unit { } }
+      dir: 2
+      into: "sum"
+      agg_op: "add"
+      access { }
+      shape { type: INT32 dimensions: {size:1 stride:1} }
+    }
+    stmts { tags: "outer" block {
+      location { unit { } }
+      idxs { name: "i" range: 100 }
+      idxs { name: "j" range: 3 }
+      refs { location { unit { } } dir: 1 from: "a" into: "a"
+             access { terms { key: "i" value: 1 } } access { terms { key: "j" value: 1 } }
+             shape { type: INT32 dimensions: {size:1 stride:3} dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 2 from: "sum" into: "sum" agg_op: "add"
+             access { }
+             shape { type: INT32 dimensions: {size:1 stride:1} } }
+      stmts { load { from:"a" into:"$a" } }
+      stmts { store { from:"$a" into:"sum"} }
+    } }
+  )",
+                                  &input_proto);
+  std::shared_ptr<stripe::Block> block{stripe::FromProto(input_proto)};
+
+  std::vector<int32_t> a(300);
+  for (size_t i = 0; i < a.size(); ++i) {
+    a[i] = i;
+  }
+  std::vector<int32_t> serial{0};
+  JitExecute(*block, {{"a", a.data()}, {"sum", serial.data()}});
+  EXPECT_THAT(serial[0], Eq(299 * 300 / 2));
+  for (size_t threads : {1, 3, 8}) {
+    std::vector<int32_t> sum{0};
+    JitOptions options;
+    options.parallel_tags = {"outer"};
+    options.max_threads = threads;
+    JitExecute(*block, {{"a", a.data()}, {"sum", sum.data()}}, options);
+    EXPECT_THAT(sum, ContainerEq(serial)) << threads << " threads";
+  }
+}
+
+TEST(Codegen, JitParallelInOutReduction) {
+  // prod += a[i] * prod, i.e. prod *= 1 + a[i]: prod is accumulated, but is
+  // also read, so it can't be accumulated privately; since no index
+  // partitions it, the block must run serially.
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(R"(
+    location { unit { } }
+    refs {
+      location { unit { } }
+      dir: 1
+      into: "a"
+      access { }
+      shape { type: INT32 dimensions: {size:40 stride:1} }
+    }
+    refs {
+      location { unit { } }
+      dir: 3
+      into: "prod"
+      agg_op: "add"
+      access { }
+      shape { type: INT32 dimensions: {size:1 stride:1} }
+    }
+    stmts { tags: "outer" block {
+      location { unit { } }
+      idxs { name: "i" range: 40 }
+      refs { location { unit { } } dir: 1 from: "a" into: "a" access { terms { key: "i" value: 1 } }
+             shape { type: INT32 dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 3 from: "prod" into: "prod" agg_op: "add"
+             access { }
+             shape { type: INT32 dimensions: {size:1 stride:1} } }
+      stmts { load { from:"a" into:"$a" } }
+      stmts { load { from:"prod" into:"$p" } }
+      stmts { intrinsic { name:"mul" type:INT32 inputs:"$a" inputs:"$p" outputs:"$x"} }
+      stmts { store { from:"$x" into:"prod"} }
+    } }
+  )",
+                                  &input_proto);
+  std::shared_ptr<stripe::Block> block{stripe::FromProto(input_proto)};
+
+  std::vector<int32_t> a(40);
+  for (size_t i = 0; i < a.size(); ++i) {
+    a[i] = i % 3 == 0;
+  }
+  std::vector<int32_t> serial{1};
+  JitExecute(*block, {{"a", a.data()}, {"prod", serial.data()}});
+  EXPECT_THAT(serial[0], Eq(1 << 14));
+  for (size_t threads : {2, 3, 8}) {
+    std::vector<int32_t> prod{1};
+    JitOptions options;
+    options.parallel_tags = {"outer"};
+    options.max_threads = threads;
+    JitExecute(*block, {{"a", a.data()}, {"prod", prod.data()}}, options);
+    EXPECT_THAT(prod, ContainerEq(serial)) << threads << " threads";
+  }
+}
+
+TEST(Codegen, JitVectorElementwise) {
+  // Sizes around multiples of every vector width exercise the scalar remainder loop.
+  for (size_t size : {1, 7, 16, 17, 1003}) {
+    auto block = ElementwiseMul(size);
+    std::vector<float> a(size);
+    std::vector<float> b(size);
+    std::vector<float> expected(size);
+    for (size_t i = 0; i < size; ++i) {
+      a[i] = i;
+      b[i] = 0.5f * i;
+      expected[i] = a[i] * b[i];
+    }
+    for (bool vectorize : {false, true}) {
+      std::vector<float> c(size);
+      JitOptions options;
+      options.vectorize = vectorize;
+      JitExecute(*block, {{"a", a.data()}, {"b", b.data()}, {"c", c.data()}}, options);
+      EXPECT_THAT(c, ContainerEq(expected)) << "size " << size << (vectorize ? ", vectorized" : ", scalar");
+    }
+  }
+}
+
+TEST(Codegen, JitVectorReduction) {
+  // sum[i] += a[i, j] * 2: j is unit-stride in a, and ignored by sum, so each
+  // vector of products is summed across its lanes before being accumulated.
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(R"(
+    location { unit { } }
+    refs {
+      location { unit { } }
+      dir: 1
+      into: "a"
+      access { }
+      access { }
+      shape { type: INT32 dimensions: {size:3 stride:101} dimensions: {size:101 stride:1} }
+    }
+    refs {
+      location { unit { } }
+      dir: 2
+      into: "sum"
+      agg_op: "add"
+      access { }
+      shape { type: INT32 dimensions: {size:3 stride:1} }
+    }
+    stmts { block {
+      location { unit { } }
+      idxs { name: "i" range: 3 }
+      idxs { name: "j" range: 101 }
+      refs { location { unit { } } dir: 1 from: "a" into: "a"
+             access { terms { key: "i" value: 1 } } access { terms { key: "j" value: 1 } }
+             shape { type: INT32 dimensions: {size:1 stride:101} dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 2 from: "sum" into: "sum" agg_op: "add"
+             access { terms { key: "i" value: 1 } }
+             shape { type: INT32 dimensions: {size:1 stride:1} } }
+      stmts { load { from:"a" into:"$a" } }
+      stmts { constant { name:"$two" iconst:2 } }
+      stmts { intrinsic { name:"mul" type:INT32 inputs:"$a" inputs:"$two" outputs:"$x"} }
+      stmts { store { from:"$x" into:"sum"} }
+    } }
+  )",
+                                  &input_proto);
+  std::shared_ptr<stripe::Block> block{stripe::FromProto(input_proto)};
+
+  std::vector<int32_t> a(303);
+  std::vector<int32_t> expected(3);
+  for (size_t i = 0; i < a.size(); ++i) {
+    a[i] = i;
+    expected[i / 101] += 2 * i;
+  }
+  std::vector<int32_t> sum(3);
+  JitExecute(*block, {{"a", a.data()}, {"sum", sum.data()}});
+  EXPECT_THAT(sum, ContainerEq(expected));
+}
+
+// Vectorized loads and stores must not assume that buffers are aligned to
+// the vector width.
+TEST(Codegen, JitVectorElementwiseUnaligned) {
+  const size_t size = 67;
+  auto block = ElementwiseMul(size);
+  std::vector<float> a(size + 1);
+  std::vector<float> b(size + 1);
+  for (size_t i = 0; i <= size; ++i) {
+    a[i] = i;
+    b[i] = 3;
+  }
+  std::vector<float> scalar(size + 1);
+  std::vector<float> vectorized(size + 1);
+  JitOptions options;
+  options.vectorize = false;
+  JitProgram{*block, options}.Run({a.data() + 1, b.data() + 1, scalar.data() + 1});
+  options.vectorize = true;
+  JitProgram{*block, options}.Run({a.data() + 1, b.data() + 1, vectorized.data() + 1});
+  EXPECT_THAT(vectorized, ContainerEq(scalar));
+  EXPECT_THAT(vectorized[0], Eq(0));  // Before the buffer
+  EXPECT_THAT(vectorized[size], Eq(static_cast<float>(3 * size)));
+}
+
+// Programs are compiled, run and destroyed on several threads at once; each
+// program's code lives in its own LLVM context.
+TEST(Codegen, JitProgramsCompileAndDestroyConcurrently) {
+  const size_t size = 16;
+  auto block = ElementwiseMul(size);
+  std::vector<std::thread> threads;
+  std::vector<int> correct(4);
+  for (size_t t = 0; t < correct.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<float> a(size, t + 1);
+      std::vector<float> b(size, 3);
+      std::vector<float> c(size);
+      for (int iter = 0; iter < 5; ++iter) {
+        JitProgram program{*block};
+        program.Run({a.data(), b.data(), c.data()});
+        if (c == std::vector<float>(size, 3 * (t + 1))) {
+          correct[t]++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_THAT(correct, ContainerEq(std::vector<int>(correct.size(), 5)));
+}
+
 }  // namespace test
 }  // namespace codegen
 }  // namespace tile
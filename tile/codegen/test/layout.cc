@@ -0,0 +1,107 @@
+// Copyright 2018, Intel Corp.
+
+#include <gmock/gmock.h>
+
+#include "tile/codegen/layout.h"
+#include "tile/codegen/vm.h"
+#include "tile/lang/compose.h"
+#include "tile/lang/gen_stripe.h"
+#include "tile/stripe/stripe.h"
+
+using ::testing::ContainerEq;
+using ::testing::ElementsAre;
+using ::testing::Eq;
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+namespace test {
+
+using namespace stripe;  // NOLINT
+
+namespace {
+
+std::shared_ptr<Block> NchwConv() {
+  lang::RunInfo runinfo;
+  runinfo.program_name = "nchw_conv";
+  runinfo.code = R"***(
+    function (I[N, CI, H, W], K[CO, CI, KH, KW]) -> (O) {
+      [[pid(conv)]] O[n, co, y, x : N, CO, 4, 4] = +(I[n, ci, y + ky, x + kx] * K[co, ci, ky, kx]);
+    }
+  )***";
+  runinfo.input_shapes.emplace("I", SimpleShape(DataType::FLOAT32, {1, 16, 6, 6}));
+  runinfo.input_shapes.emplace("K", SimpleShape(DataType::FLOAT32, {8, 16, 3, 3}));
+  runinfo.output_shapes.emplace("O", SimpleShape(DataType::FLOAT32, {1, 8, 4, 4}));
+  return GenerateStripe(runinfo);
+}
+
+std::vector<uint64_t> Sizes(const Refinement& ref) {
+  std::vector<uint64_t> sizes;
+  for (const auto& dim : ref.shape.dims) {
+    sizes.push_back(dim.size);
+  }
+  return sizes;
+}
+
+std::vector<int64_t> Strides(const Refinement& ref) {
+  std::vector<int64_t> strides;
+  for (const auto& dim : ref.shape.dims) {
+    strides.push_back(dim.stride);
+  }
+  return strides;
+}
+
+}  // namespace
+
+TEST(Codegen, BlockedLayoutConv) {
+  std::map<std::string, std::vector<float>> data;
+  for (size_t i = 0; i < 16 * 6 * 6; i++) {
+    data["I"].push_back(i % 5);
+  }
+  for (size_t i = 0; i < 8 * 16 * 3 * 3; i++) {
+    data["K"].push_back(static_cast<float>(i % 4) - 1);
+  }
+  data["O"].resize(8 * 4 * 4);
+  auto expected = data;
+  ExecuteProgram(*NchwConv(), &expected);
+
+  auto program = NchwConv();
+  proto::BlockedLayoutPass options;
+  options.add_reqs("main");
+  options.set_vector_bytes(32);
+  BlockedLayoutPass(program.get(), options);
+  IVLOG(2, "Blocked>\n" << *program);
+
+  // Eight floats to a vector: each channel dimension is split into blocks of eight contiguous channels.
+  auto main = program->SubBlock(0);
+  auto input = main->ref_by_into("I_blocked");
+  EXPECT_THAT(Sizes(*input), ElementsAre(1, 2, 6, 6, 8));
+  EXPECT_THAT(Strides(*input), ElementsAre(576, 288, 48, 8, 1));
+  auto output = main->ref_by_into("O_blocked");
+  EXPECT_THAT(Sizes(*output), ElementsAre(1, 1, 4, 4, 8));
+  EXPECT_THAT(Strides(*output), ElementsAre(128, 128, 32, 8, 1));
+  EXPECT_THAT(main->SubBlock(0)->name, Eq("to_blocked_I"));
+  EXPECT_THAT(std::dynamic_pointer_cast<Block>(main->stmts.back())->name, Eq("from_blocked_O"));
+
+  // The kernel's innermost indexes walk the blocked channels.
+  std::shared_ptr<Block> kernel;
+  for (const auto& stmt : main->stmts) {
+    auto block = Block::Downcast(stmt);
+    if (block->has_tag("contraction")) {
+      kernel = block;
+    }
+  }
+  ASSERT_TRUE(kernel);
+  auto idxs = kernel->idxs.size();
+  EXPECT_THAT(kernel->idxs[idxs - 2].range, Eq(8));
+  EXPECT_THAT(kernel->idxs[idxs - 1].range, Eq(8));
+  EXPECT_THAT(kernel->ref_by_from("I_blocked")->access.back(), Eq(Affine(kernel->idxs[idxs - 2].name)));
+
+  ExecuteProgram(*program, &data);
+  EXPECT_THAT(data["O"], ContainerEq(expected["O"]));
+}
+
+}  // namespace test
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
@@ -278,6 +278,69 @@ TEST(PlacerTest, LocationSubsetCanBePlaced) {
   EXPECT_THAT(output_proto, EqualsProtoText(expected));
 }
 
+TEST(PlacerTest, SearchShrinksFragmentedArena) {
+  // Largest-first best-fit places a and d at 0, then b above a and c
+  // above b, leaving a gap above d that c could have used.  Placing
+  // the chunks in order of first access packs them into the smallest
+  // possible arena, the size of a and b together.
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(R"(
+    location { unit { } }
+    refs {
+      location { name: "loc_1" unit { } }
+      into: "a"
+      shape { type: FLOAT32 dimensions: {size:4 stride:1} }
+    }
+    refs {
+      location { name: "loc_1" unit { } }
+      into: "b"
+      shape { type: FLOAT32 dimensions: {size:3 stride:1} }
+    }
+    refs {
+      location { name: "loc_1" unit { } }
+      into: "c"
+      shape { type: FLOAT32 dimensions: {size:2 stride:1} }
+    }
+    refs {
+      location { name: "loc_1" unit { } }
+      into: "d"
+      shape { type: FLOAT32 dimensions: {size:4 stride:1} }
+    }
+    stmts { special { name:"COPY" inputs:"a" outputs:"b"} }
+    stmts { load { from:"a" into:"$1" } deps: 0 }
+    stmts { constant { name:"$2" iconst: 0 } deps: 1 }
+    stmts { special { name:"COPY" inputs:"b" outputs:"c"} deps: 2 }
+    stmts { special { name:"COPY" inputs:"c" outputs:"d"} deps: 3 }
+    stmts { load { from:"d" into:"$3" } deps: 4 }
+  )",
+                                  &input_proto);
+
+  proto::MemoryPlacementPass options;
+  options.add_locs()->set_name("loc_1");
+  options.set_alignment(4);
+
+  // Search is opt-in; by default chunks are placed largest-first.
+  std::shared_ptr<stripe::Block> best_fit{stripe::FromProto(input_proto)};
+  auto best_fit_stats = PlaceRefinements(best_fit.get(), options);
+  ASSERT_EQ(best_fit_stats.size(), 1);
+  EXPECT_EQ(best_fit_stats[0].chunks(), 4);
+  EXPECT_EQ(best_fit_stats[0].lower_bound_bytes(), 28);
+  EXPECT_EQ(best_fit_stats[0].arena_bytes(), 36);
+  EXPECT_DOUBLE_EQ(best_fit_stats[0].fragmentation(), 1.0 - 28.0 / 36.0);
+
+  options.set_search_rounds(32);
+  std::shared_ptr<stripe::Block> searched{stripe::FromProto(input_proto)};
+  auto searched_stats = PlaceRefinements(searched.get(), options);
+  ASSERT_EQ(searched_stats.size(), 1);
+  EXPECT_EQ(searched_stats[0].loc().name(), "loc_1");
+  EXPECT_EQ(searched_stats[0].arena_bytes(), 28);
+  EXPECT_DOUBLE_EQ(searched_stats[0].fragmentation(), 0.0);
+  EXPECT_EQ(searched->ref_by_into("a")->offset, 0);
+  EXPECT_EQ(searched->ref_by_into("b")->offset, 16);
+  EXPECT_EQ(searched->ref_by_into("c")->offset, 0);
+  EXPECT_EQ(searched->ref_by_into("d")->offset, 8);
+}
+
 }  // namespace codegen
 }  // namespace tile
 }  // namespace vertexai
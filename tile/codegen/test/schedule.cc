@@ -2,6 +2,11 @@
 
 #include <gtest/gtest.h>
 
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "testing/matchers.h"
 #include "tile/codegen/schedule.h"
 #include "tile/stripe/stripe.h"
@@ -15,6 +20,13 @@ namespace vertexai {
 namespace tile {
 namespace codegen {
 
+template <typename P>
+P ParseProto(const char* txt) {
+  P proto;
+  gp::TextFormat::ParseFromString(txt, &proto);
+  return proto;
+}
+
 class ScheduleTest : public ::testing::Test {
  public:
   void SetUp() override {
@@ -233,6 +245,96 @@ TEST_F(ScheduleTest, UsesTmps) {
   )"));
 }
 
+// Streams four tiles of input through a 3KiB cache while accumulating
+// into a single output, and returns the main block's statements by name,
+// along with the names of the statements each transitively depends on.
+std::map<std::string, std::set<std::string>> ScheduleStream(std::uint32_t buffers) {
+  auto block = stripe::FromProto(ParseProto<stripe::proto::Block>(R"(
+    name: "program" location {unit {}}
+    refs [{into: "i1" location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}},
+          {into: "i2" location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}},
+          {into: "i3" location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}},
+          {into: "i4" location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}},
+          {into: "o" location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}}]
+    stmts [{
+      tags: ["main"] block {
+        name: "main" location {unit {}}
+        refs [{from: "i1" into: "i1" dir: In location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}},
+              {from: "i2" into: "i2" dir: In location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}},
+              {from: "i3" into: "i3" dir: In location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}},
+              {from: "i4" into: "i4" dir: In location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}},
+              {from: "o" into: "o" dir: InOut location {name: "RAM" unit {}} shape {type: FLOAT32 dimensions: {size:256 stride:1}}}]
+      }
+    }]
+  )"));
+  auto main = block->SubBlock(0);
+  for (const auto& input : {"i1", "i2", "i3", "i4"}) {
+    auto sub_block = std::make_shared<stripe::Block>();
+    sub_block->name = std::string("accumulate_") + input;
+    for (const auto& ref : main->refs) {
+      if (ref.into == input || ref.into == "o") {
+        sub_block->refs.push_back(ref);
+      }
+    }
+    main->stmts.push_back(sub_block);
+  }
+  auto options = ParseProto<proto::SchedulePass>(R"(
+    reqs: ["main"],
+    mem_loc: { name: "CACHE" },
+    mem_KiB: 3,
+    alignment: 16,
+    xfer_loc: { name: "DMA" }
+  )");
+  options.set_buffers(buffers);
+  SchedulePass(block.get(), options);
+
+  std::map<std::string, std::set<std::string>> tdeps;
+  for (const auto& stmt : main->stmts) {
+    auto& stmt_tdeps = tdeps[stripe::Block::Downcast(stmt)->name];
+    for (const auto& dep : stmt->deps) {
+      const auto& dep_name = stripe::Block::Downcast(*dep)->name;
+      stmt_tdeps.insert(dep_name);
+      stmt_tdeps.insert(tdeps[dep_name].begin(), tdeps[dep_name].end());
+    }
+  }
+  for (const auto& ref : main->refs) {
+    EXPECT_LE(ref.offset + ref.shape.byte_size(), 3 * 1024) << ref.into;
+  }
+  return tdeps;
+}
+
+// Returns the name of the swap-in statement that fills the cache for the indicated refinement.
+std::string SwapInFor(const std::map<std::string, std::set<std::string>>& tdeps, const std::string& ref) {
+  for (const auto& kvp : tdeps) {
+    if (kvp.first.find("swap_in_" + ref + "_") == 0) {
+      return kvp.first;
+    }
+  }
+  return "";
+}
+
+TEST(ScheduleStreamTest, SingleBufferSerializesSwapIns) {
+  auto tdeps = ScheduleStream(1);
+  // The cache holds the output and two tiles, and i1 is placed over i2,
+  // so i2 can't be swapped in until i1's statement is done.
+  auto swap_in_i2 = SwapInFor(tdeps, "i2");
+  ASSERT_NE(swap_in_i2, "");
+  EXPECT_EQ(tdeps[swap_in_i2].count("accumulate_i1"), 1);
+}
+
+TEST(ScheduleStreamTest, DoubleBufferOverlapsSwapIns) {
+  auto tdeps = ScheduleStream(2);
+  // Each tile is swapped in without waiting for the statement that
+  // precedes its reader, so the transfer runs alongside that statement.
+  std::vector<std::string> inputs{"i1", "i2", "i3", "i4"};
+  for (size_t i = 1; i < inputs.size(); i++) {
+    auto swap_in = SwapInFor(tdeps, inputs[i]);
+    ASSERT_NE(swap_in, "") << inputs[i];
+    EXPECT_EQ(tdeps[swap_in].count("accumulate_" + inputs[i - 1]), 0) << swap_in;
+    EXPECT_EQ(tdeps["accumulate_" + inputs[i]].count(swap_in), 1) << swap_in;
+  }
+}
+
 }  // namespace codegen
 }  // namespace tile
 }  // namespace vertexai
@@ -0,0 +1,182 @@
+// Copyright 2018, Intel Corp.
+
+#include <gmock/gmock.h>
+#include <google/protobuf/text_format.h>
+
+#include <sstream>
+
+#include "tile/codegen/simulate.h"
+#include "tile/stripe/stripe.h"
+
+namespace gp = google::protobuf;
+
+using ::testing::DoubleEq;
+using ::testing::Eq;
+using ::testing::HasSubstr;
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+namespace test {
+
+using stripe::Affine;
+using stripe::Block;
+using stripe::Location;
+using stripe::RefDir;
+using stripe::Refinement;
+
+namespace {
+
+// Two cores and two DMA engines, with 4 bytes per cycle between DRAM and SRAM each way.
+proto::Config AcceleratorConfig() {
+  proto::Config cfg;
+  gp::TextFormat::ParseFromString(R"(
+    clock_mhz: 1000
+    exec_units { key: "core" value { count: 2 ops_per_cycle: 4 } }
+    tx_units { key: "dma" value { count: 2 } }
+    mem_units { key: "DRAM" value { count: 1 size_KiB: 1024 } }
+    mem_units { key: "SRAM" value { count: 1 size_KiB: 1 } }
+    buses { sources: "DRAM" sinks: "SRAM" bytes_per_cycle: 4 }
+    buses { sources: "SRAM" sinks: "DRAM" bytes_per_cycle: 4 }
+  )",
+                                  &cfg);
+  return cfg;
+}
+
+Refinement MakeRef(RefDir dir, const std::string& from, const std::string& into, size_t size,
+                   const std::string& loc = "") {
+  Refinement ref{};
+  ref.dir = dir;
+  ref.from = from;
+  ref.into = into;
+  ref.shape = SimpleShape(DataType::FLOAT32, {size});
+  ref.access.resize(1);
+  ref.location.name = loc;
+  return ref;
+}
+
+Location UnitLocation(const std::string& name, int64_t unit) {
+  Location loc;
+  loc.name = name;
+  loc.unit = Affine(unit);
+  return loc;
+}
+
+// Copies 16 floats between two refinements, an element per iteration.
+std::shared_ptr<Block> Transfer(const std::string& name, const std::string& src, const std::string& dst,
+                                int64_t unit) {
+  auto block = std::make_shared<Block>();
+  block->name = name;
+  block->location = UnitLocation("dma", unit);
+  block->idxs.push_back({"i", 16, Affine{}});
+  block->refs.push_back(MakeRef(RefDir::In, src, "src", 1));
+  block->refs.push_back(MakeRef(RefDir::Out, dst, "dst", 1));
+  block->stmts.push_back(std::make_shared<stripe::Load>("src", "$x"));
+  block->stmts.push_back(std::make_shared<stripe::Store>("$x", "dst"));
+  return block;
+}
+
+// Scales 64 floats in place: three statements per iteration.
+std::shared_ptr<Block> Compute(const std::string& name, int64_t unit) {
+  auto block = std::make_shared<Block>();
+  block->name = name;
+  block->location = UnitLocation("core", unit);
+  block->idxs.push_back({"i", 64, Affine{}});
+  block->refs.push_back(MakeRef(RefDir::InOut, "S", "S", 1));
+  auto mul = std::make_shared<stripe::Intrinsic>();
+  mul->name = stripe::Intrinsic::MUL;
+  mul->type = DataType::FLOAT32;
+  mul->inputs = {"$x", "$x"};
+  mul->outputs = {"$y"};
+  block->stmts.push_back(std::make_shared<stripe::Load>("S", "$x"));
+  block->stmts.push_back(mul);
+  block->stmts.push_back(std::make_shared<stripe::Store>("$y", "S"));
+  return block;
+}
+
+// Loads A from DRAM into SRAM, works on it on both cores, and stores it to B.
+std::shared_ptr<Block> SwapProgram(bool serialize_transfers) {
+  auto program = std::make_shared<Block>();
+  program->refs.push_back(MakeRef(RefDir::None, "", "A", 16, "DRAM"));
+  program->refs.push_back(MakeRef(RefDir::None, "", "B", 16, "DRAM"));
+  auto main = std::make_shared<Block>();
+  main->refs.push_back(MakeRef(RefDir::In, "A", "A", 16));
+  main->refs.push_back(MakeRef(RefDir::Out, "B", "B", 16));
+  main->refs.push_back(MakeRef(RefDir::None, "", "S", 16, "SRAM"));
+  main->stmts.push_back(Transfer("swap_in", "A", "S", 0));
+  auto swap_in = main->stmts.begin();
+  main->stmts.push_back(Compute("compute_0", 0));
+  auto compute_0 = std::prev(main->stmts.end());
+  main->stmts.push_back(Compute("compute_1", 1));
+  auto compute_1 = std::prev(main->stmts.end());
+  main->stmts.push_back(Transfer("swap_out", "S", "B", 1));
+  auto swap_out = std::prev(main->stmts.end());
+  (*compute_0)->deps.push_back(swap_in);
+  (*compute_1)->deps.push_back(swap_in);
+  if (serialize_transfers) {
+    (*swap_out)->deps.push_back(compute_0);
+    (*swap_out)->deps.push_back(compute_1);
+  }
+  program->stmts.push_back(main);
+  return program;
+}
+
+const proto::SimulatedUnit& UnitStats(const Simulation& simulation, const std::string& name) {
+  for (const auto& unit : simulation.stats.units()) {
+    if (unit.name() == name) {
+      return unit;
+    }
+  }
+  throw std::runtime_error("No unit named " + name);
+}
+
+}  // namespace
+
+TEST(Codegen, SimulateSwapAndCompute) {
+  auto cfg = AcceleratorConfig();
+  auto simulation = Simulate(*SwapProgram(true), cfg);
+  const auto& stats = simulation.stats;
+
+  // 64 bytes in at 4 bytes per cycle, then 192 ops on each core at 4 ops per cycle, then 64 bytes out.
+  EXPECT_THAT(stats.cycles(), Eq(16 + 48 + 16));
+  EXPECT_THAT(stats.seconds(), DoubleEq(80 / 1e9));
+  EXPECT_THAT(UnitStats(simulation, "core[0]").busy_cycles(), Eq(48));
+  EXPECT_THAT(UnitStats(simulation, "core[1]").busy_cycles(), Eq(48));
+  EXPECT_THAT(UnitStats(simulation, "core[1]").occupancy(), DoubleEq(48.0 / 80));
+  EXPECT_THAT(UnitStats(simulation, "dma[0]").busy_cycles(), Eq(16));
+  EXPECT_THAT(UnitStats(simulation, "dma[1]").busy_cycles(), Eq(16));
+  ASSERT_THAT(stats.buses_size(), Eq(2));
+  EXPECT_THAT(stats.buses(0).name(), Eq("DRAM->SRAM"));
+  EXPECT_THAT(stats.buses(0).bytes(), Eq(64));
+  EXPECT_THAT(stats.buses(1).bytes(), Eq(64));
+  EXPECT_THAT(stats.buses(1).wait_cycles(), Eq(0));
+  ASSERT_THAT(stats.memories_size(), Eq(2));
+  EXPECT_THAT(stats.memories(1).name(), Eq("SRAM"));
+  EXPECT_THAT(stats.memories(1).peak_bytes(), Eq(64));
+  EXPECT_THAT(stats.memories(1).capacity_bytes(), Eq(1024));
+  EXPECT_THAT(simulation.events.size(), Eq(2 + 2 + 2));
+
+  std::ostringstream trace;
+  WriteChromeTrace(simulation, cfg, &trace);
+  EXPECT_THAT(trace.str(), HasSubstr("\"traceEvents\""));
+  EXPECT_THAT(trace.str(), HasSubstr(R"({"name":"compute_1","ph":"X","pid":0,"tid":1,"ts":0.016,"dur":0.048})"));
+}
+
+TEST(Codegen, SimulateBusContention) {
+  // A second load on the idle DMA engine must wait for the bus the first load is using.
+  auto program = SwapProgram(false);
+  auto main = program->SubBlock(0);
+  main->stmts.pop_back();
+  main->stmts.push_back(Transfer("swap_in_again", "A", "S", 1));
+  auto simulation = Simulate(*program, AcceleratorConfig());
+  const auto& stats = simulation.stats;
+  EXPECT_THAT(stats.buses(0).bytes(), Eq(128));
+  EXPECT_THAT(stats.buses(0).wait_cycles(), Eq(16));
+  EXPECT_THAT(stats.buses(0).busy_cycles(), Eq(32));
+  EXPECT_THAT(UnitStats(simulation, "dma[1]").busy_cycles(), Eq(16));
+}
+
+}  // namespace test
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
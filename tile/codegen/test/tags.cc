@@ -0,0 +1,108 @@
+// Copyright 2018, Intel Corp.
+
+#include <gmock/gmock.h>
+#include <google/protobuf/text_format.h>
+
+#include <atomic>
+#include <mutex>
+#include <set>
+
+#include "tile/codegen/autotile.h"
+#include "tile/codegen/tags.h"
+#include "tile/lang/gen_stripe.h"
+#include "tile/lib/lib.h"
+#include "tile/stripe/stripe.h"
+
+using ::testing::ContainerEq;
+using ::testing::Eq;
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+namespace test {
+
+namespace {
+
+// A matmul program whose main block holds the indicated number of
+// independent copies of the matmul kernel.
+std::shared_ptr<stripe::Block> ManyKernels(size_t count, size_t dim) {
+  auto runinfo = lib::LoadMatMul("matmul",                                    //
+                                 SimpleShape(DataType::FLOAT32, {dim, dim}),  //
+                                 SimpleShape(DataType::FLOAT32, {dim, dim}));
+  auto program = GenerateStripe(runinfo);
+  auto main = program->SubBlock(0);
+  auto kernel = main->SubBlock(0);
+  auto kernel_proto = stripe::IntoProto(*kernel);
+  for (size_t i = 1; i < count; ++i) {
+    auto copy = stripe::FromProto(kernel_proto);
+    copy->name = kernel->name + "_" + std::to_string(i);
+    main->stmts.push_back(copy);
+  }
+  return program;
+}
+
+}  // namespace
+
+TEST(Codegen, RunOnBlocksParallelVisitsEachMatchOnce) {
+  auto program = ManyKernels(64, 8);
+  std::set<std::string> serial;
+  RunOnBlocks(program.get(), {"contraction"},
+              [&serial](const AliasMap& map, stripe::Block* block) { serial.insert(block->name); });
+  EXPECT_THAT(serial.size(), Eq(64));
+
+  std::mutex mu;
+  std::set<std::string> parallel;
+  std::atomic<size_t> calls{0};
+  RunOnBlocksParallel(program.get(), {"contraction"}, [&](const AliasMap& map, stripe::Block* block) {
+    // Each call may add uniquely named refinements to its own block.
+    auto ref = block->refs[0];
+    ref.into = block->unique_ref_name(ref.into);
+    block->refs.push_back(ref);
+    map.at(block->refs[0].into);
+    calls++;
+    std::lock_guard<std::mutex> lock{mu};
+    parallel.insert(block->name);
+  });
+  EXPECT_THAT(calls.load(), Eq(64));
+  EXPECT_THAT(parallel, ContainerEq(serial));
+
+  calls = 0;
+  EXPECT_THROW(RunOnBlocksParallel(program.get(), {"contraction"},
+                                   [&calls](const AliasMap& map, stripe::Block* block) {
+                                     if (calls++ == 17) {
+                                       throw std::runtime_error{"failed"};
+                                     }
+                                   }),
+               std::runtime_error);
+}
+
+// Autotiling independent kernels concurrently gives the same program as
+// autotiling them one at a time.
+TEST(Codegen, AutotileParallelMatchesSerial) {
+  proto::AutotilePass options;
+  google::protobuf::TextFormat::ParseFromString(R"(
+    reqs: "contraction" outer_set: "outer" inner_set: "inner"
+    only_po2: true fast: false use_bytes: false skip_1d: false
+    max_output_size: 1024 max_input_size: 1024 output_cost: 1.0 input_cost: 1.0
+  )",
+                                                &options);
+  const size_t kernels = 128;
+  auto serial_program = ManyKernels(kernels, 32);
+  auto parallel_program = ManyKernels(kernels, 32);
+
+  auto reqs = FromProto(options.reqs());
+  RunOnBlocks(serial_program.get(), reqs, [&options](const AliasMap& map, stripe::Block* block) {
+    proto::AutotilePass one = options;
+    one.clear_reqs();
+    AutotilePass(block, one);
+  });
+  AutotilePass(parallel_program.get(), options);
+
+  EXPECT_THAT(stripe::IntoProto(*parallel_program).SerializeAsString(),
+              Eq(stripe::IntoProto(*serial_program).SerializeAsString()));
+}
+
+}  // namespace test
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,183 @@
+// Copyright 2018, Intel Corp.
+
+#include <gmock/gmock.h>
+#include <google/protobuf/text_format.h>
+
+#include <cstdint>
+#include <thread>
+
+#include <half.hpp>
+
+#include "base/util/printstring.h"
+#include "tile/codegen/vm.h"
+#include "tile/stripe/stripe.h"
+#include "tile/stripe/stripe.pb.h"
+
+namespace gp = google::protobuf;
+
+using ::testing::ContainerEq;
+using ::testing::Eq;
+
+namespace vertexai {
+namespace tile {
+namespace codegen {
+namespace test {
+
+namespace {
+
+// A program computing out[i] = op(a[i], b[i]) with the indicated types.
+std::shared_ptr<stripe::Block> Elementwise(const std::string& op, const std::string& in_type,
+                                           const std::string& op_type, const std::string& out_type, size_t size) {
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(
+      printstring(R"(
+    location { unit { } }
+    refs { location { unit { } } dir: 1 into: "a" access { } shape { type: %s dimensions: {size:%zu stride:1} } }
+    refs { location { unit { } } dir: 1 into: "b" access { } shape { type: %s dimensions: {size:%zu stride:1} } }
+    refs { location { unit { } } dir: 2 into: "out" access { } shape { type: %s dimensions: {size:%zu stride:1} } }
+    stmts { block {
+      location { unit { } }
+      idxs { name: "i" range: %zu }
+      refs { location { unit { } } dir: 1 from: "a" into: "a" access { terms { key: "i" value: 1 } }
+             shape { type: %s dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 1 from: "b" into: "b" access { terms { key: "i" value: 1 } }
+             shape { type: %s dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 2 from: "out" into: "out" access { terms { key: "i" value: 1 } }
+             shape { type: %s dimensions: {size:1 stride:1} } }
+      stmts { load { from:"a" into:"$a" } }
+      stmts { load { from:"b" into:"$b" } }
+      stmts { intrinsic { name:"%s" type:%s inputs:"$a" inputs:"$b" outputs:"$out"} }
+      stmts { store { from:"$out" into:"out"} }
+    } }
+  )",
+                  in_type.c_str(), size, in_type.c_str(), size, out_type.c_str(), size, size, in_type.c_str(),
+                  in_type.c_str(), out_type.c_str(), op.c_str(), op_type.c_str()),
+      &input_proto);
+  return std::shared_ptr<stripe::Block>{stripe::FromProto(input_proto)};
+}
+
+template <typename In, typename Out>
+std::vector<Out> RunElementwise(const std::string& op, const std::string& in_type, const std::string& op_type,
+                                const std::string& out_type, std::vector<In> a, std::vector<In> b) {
+  std::vector<Out> out(a.size());
+  VmProgram program{*Elementwise(op, in_type, op_type, out_type, a.size())};
+  program.Run({{"a", a.data()}, {"b", b.data()}, {"out", out.data()}});
+  return out;
+}
+
+}  // namespace
+
+TEST(Codegen, VmIntegerArithmeticWraps) {
+  EXPECT_THAT((RunElementwise<int8_t, int8_t>("add", "INT8", "INT8", "INT8", {100, -100, 5}, {100, -100, 6})),
+              ContainerEq(std::vector<int8_t>{-56, 56, 11}));
+  EXPECT_THAT((RunElementwise<uint8_t, uint8_t>("sub", "UINT8", "UINT8", "UINT8", {1, 200}, {2, 100})),
+              ContainerEq(std::vector<uint8_t>{255, 100}));
+  EXPECT_THAT((RunElementwise<int32_t, int32_t>("div", "INT32", "INT32", "INT32", {7, -7, 9}, {2, 2, -3})),
+              ContainerEq(std::vector<int32_t>{3, -3, -3}));
+  EXPECT_THAT((RunElementwise<int32_t, int32_t>("mod", "INT32", "INT32", "INT32", {7, -7}, {3, 3})),
+              ContainerEq(std::vector<int32_t>{1, -1}));
+  EXPECT_THROW((RunElementwise<int32_t, int32_t>("div", "INT32", "INT32", "INT32", {1}, {0})), std::runtime_error);
+}
+
+TEST(Codegen, VmTypedIntrinsics) {
+  // Operands are converted to the intrinsic's type, so integers divided as
+  // FLOAT32 keep their fraction until the store truncates it.
+  EXPECT_THAT((RunElementwise<int32_t, float>("div", "INT32", "FLOAT32", "FLOAT32", {7, 1}, {2, 3})),
+              ContainerEq(std::vector<float>{3.5f, 1.0f / 3}));
+  EXPECT_THAT((RunElementwise<int32_t, int32_t>("div", "INT32", "FLOAT32", "INT32", {7}, {2})),
+              ContainerEq(std::vector<int32_t>{3}));
+  EXPECT_THAT((RunElementwise<float, int8_t>("cmp_lt", "FLOAT32", "FLOAT32", "INT8", {1, 2, 3}, {2, 2, 2})),
+              ContainerEq(std::vector<int8_t>{1, 0, 0}));
+  EXPECT_THAT((RunElementwise<int64_t, int64_t>("gte", "INT64", "INT64", "INT64", {1, 2, 3}, {2, 2, 2})),
+              ContainerEq(std::vector<int64_t>{0, 1, 1}));
+  EXPECT_THAT((RunElementwise<uint32_t, uint32_t>("bit_xor", "UINT32", "UINT32", "UINT32", {0xF0F0}, {0xFF00})),
+              ContainerEq(std::vector<uint32_t>{0x0FF0}));
+  EXPECT_THAT((RunElementwise<int16_t, int16_t>("bit_right", "INT16", "INT16", "INT16", {-16, 16}, {2, 2})),
+              ContainerEq(std::vector<int16_t>{-4, 4}));
+  EXPECT_THAT((RunElementwise<double, double>("mod", "FLOAT64", "FLOAT64", "FLOAT64", {7.5}, {2})),
+              ContainerEq(std::vector<double>{1.5}));
+  EXPECT_THROW((RunElementwise<float, float>("frobnicate", "FLOAT32", "FLOAT32", "FLOAT32", {1}, {1})),
+               std::runtime_error);
+}
+
+TEST(Codegen, VmHalfPrecision) {
+  using half_float::half;
+  // 2048 + 1 isn't representable in half precision, so the sum rounds.
+  std::vector<half> a{half(2048.0f), half(1.5f)};
+  std::vector<half> b{half(1.0f), half(0.25f)};
+  auto out = RunElementwise<half, half>("add", "FLOAT16", "FLOAT16", "FLOAT16", a, b);
+  EXPECT_THAT(static_cast<float>(out[0]), Eq(2048.0f));
+  EXPECT_THAT(static_cast<float>(out[1]), Eq(1.75f));
+}
+
+TEST(Codegen, VmAggregationAndBounds) {
+  // max[0] = max over i of a[i], with the loop overrunning a by one element.
+  stripe::proto::Block input_proto;
+  gp::TextFormat::ParseFromString(R"(
+    location { unit { } }
+    refs { location { unit { } } dir: 1 into: "a" access { } shape { type: INT32 dimensions: {size:4 stride:1} } }
+    refs { location { unit { } } dir: 2 into: "max" agg_op: "max" access { }
+           shape { type: INT32 dimensions: {size:1 stride:1} } }
+    stmts { block {
+      location { unit { } }
+      idxs { name: "i" range: 5 }
+      constraints { terms { key: "" value: 3 } terms { key: "i" value: -1 } }
+      refs { location { unit { } } dir: 1 from: "a" into: "a" access { terms { key: "i" value: 1 } }
+             shape { type: INT32 dimensions: {size:1 stride:1} } }
+      refs { location { unit { } } dir: 2 from: "max" into: "max" agg_op: "max" access { }
+             shape { type: INT32 dimensions: {size:1 stride:1} } }
+      stmts { load { from:"a" into:"$a" } }
+      stmts { store { from:"$a" into:"max"} }
+    } }
+  )",
+                                  &input_proto);
+  std::shared_ptr<stripe::Block> block{stripe::FromProto(input_proto)};
+  std::vector<int32_t> a{3, 9, -2, 4};
+  std::vector<int32_t> max{0};
+  VmProgram program{*block};
+  program.Run({{"a", a.data()}, {"max", max.data()}});
+  EXPECT_THAT(max[0], Eq(9));
+
+  // Without the constraint, the fifth iteration reads past the end of a.
+  block->SubBlock(0)->constraints.clear();
+  VmProgram unconstrained{*block};
+  EXPECT_THROW(unconstrained.Run({{"a", a.data()}, {"max", max.data()}}), std::runtime_error);
+  EXPECT_THROW(program.Run({{"a", a.data()}}), std::runtime_error);
+}
+
+// A compiled program keeps no per-run state, so it may be run from several
+// threads at once, each binding its own buffers.
+TEST(Codegen, VmProgramRunsConcurrently) {
+  const size_t size = 256;
+  VmProgram program{*Elementwise("mul", "FLOAT32", "FLOAT32", "FLOAT32", size)};
+  EXPECT_THAT(program.parameters(), ContainerEq(std::vector<std::string>{"a", "b", "out"}));
+  std::vector<std::thread> threads;
+  std::vector<int> correct(4);
+  for (size_t t = 0; t < correct.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<float> a(size, t + 1);
+      std::vector<float> b(size);
+      std::vector<float> out(size);
+      for (int iter = 0; iter < 20; ++iter) {
+        for (size_t i = 0; i < size; ++i) {
+          b[i] = i + iter;
+        }
+        program.Run({{"a", a.data()}, {"b", b.data()}, {"out", out.data()}});
+        bool matches = true;
+        for (size_t i = 0; i < size; ++i) {
+          matches = matches && out[i] == (t + 1) * (i + iter);
+        }
+        correct[t] += matches;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_THAT(correct, ContainerEq(std::vector<int>(correct.size(), 20)));
+}
+
+}  // namespace test
+}  // namespace codegen
+}  // namespace tile
+}  // namespace vertexai
@@ -310,7 +310,10 @@ void StencilPass(stripe::Block* block, const proto::StencilPass& options) {
   for (const auto& stencil : options.stencils()) {
     sopts.specs.push_back(stencil);
   }
-  StencilPassRecurse(block, sopts);
+  // Blocks without the required tags are left alone, so each outermost
+  // matching block's subtree can be processed independently.
+  RunOnBlocksParallel(block, sopts.reqs,
+                      [&sopts](const AliasMap& map, stripe::Block* inner) { StencilPassRecurse(inner, sopts); });
 }
 
 std::ostream& operator<<(std::ostream& os, const StencilIndexMatch& idx) {
@@ -3,10 +3,16 @@
 #include "tile/codegen/vm.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <utility>
+
+#include <half.hpp>
 
 #include "base/util/lookup.h"
 #include "base/util/printstring.h"
-#include "base/util/stream_container.h"
 #include "base/util/throw.h"
 #include "tile/stripe/stripe.h"
 
@@ -16,206 +22,988 @@ namespace codegen {
 
 using namespace stripe;  // NOLINT
 
-namespace {
+namespace vm {
 
-std::map<std::string, std::function<float(float, float)>> BINARY_OPS = {
-    {"add", [](float a, float b) { return a + b; }},
-    {"mul", [](float a, float b) { return a * b; }},
-    {"cmp_lt", [](float a, float b) { return a < b; }},
+// Every scalar is held in a word, in the representation of its type's kind:
+// signed integers and booleans sign-extended in i, unsigned integers
+// zero-extended in u, and floating point values in f.
+union Word {
+  int64_t i;
+  uint64_t u;
+  double f;
 };
 
-std::map<std::string, std::function<float(float, float, float)>> TERNARY_OPS = {
-    {"cond", [](float c, float t, float f) { return c ? t : f; }},
+enum class Kind : uint8_t {
+  Int,
+  Uint,
+  Float,
 };
 
-class Scope {
- public:
-  Scope() {}
-  explicit Scope(Scope* outer) : outer_(outer), depth_(outer->depth_ + 1) {}
+enum class Op : uint8_t {
+  Load,
+  Store,
+  Const,
+  Cast,
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Mod,
+  Neg,
+  Lt,
+  Lte,
+  Gt,
+  Gte,
+  Eq,
+  Neq,
+  And,
+  Or,
+  Xor,
+  Not,
+  BitAnd,
+  BitOr,
+  BitXor,
+  BitLeft,
+  BitRight,
+  Cond,
+  Block,
+  Zero,
+  Copy,
+};
 
-  void ExecuteProgram(const Block& block, std::map<std::string, Buffer>* buffers) {
-    Scope outer;
-    outer_ = &outer;
-    for (const auto& ref : block.refs) {
-      assert(ref.from.empty());
-      refs_[ref.into] = &safe_at(buffers, ref.into);
+enum class Agg : uint8_t {
+  Assign,
+  Add,
+  Max,
+  Min,
+  Mul,
+};
+
+struct Instr {
+  Op op;
+  Kind kind;                          // The representation the operation computes in
+  DataType type;                      // The operation's type; for Cast, the destination type
+  DataType from = DataType::INVALID;  // For Cast, the source type
+  uint32_t dst = 0;                   // The scalar slot written
+  uint32_t a = 0;                     // Operands: scalar slots, view slots, or a child block
+  uint32_t b = 0;
+  uint32_t c = 0;
+  Word imm{0};  // For Const, the value
+};
+
+// An affine over index slots.
+struct Affine {
+  int64_t constant = 0;
+  std::vector<std::pair<uint32_t, int64_t>> terms;
+
+  int64_t Eval(const int64_t* idxs) const {
+    int64_t result = constant;
+    for (const auto& term : terms) {
+      result += idxs[term.first] * term.second;
     }
-    ExecuteStatements(block);
+    return result;
   }
+};
 
- private:
-  void ExecuteBlock(const Block& block) {
-    IVLOG(4, Tab() << "ExecuteBlock: " << block.name);
-    std::map<std::string, Buffer> buffers;
-    for (const auto& ref : block.refs) {
-      if (ref.from.empty()) {
-        Buffer buf(ref.shape.elem_size());
-        buffers.emplace(ref.into, buf);
-        refs_[ref.into] = &safe_at(&buffers, ref.into);
-      } else {
-        refs_[ref.into] = safe_at(outer_->refs_, ref.from);
+struct RefCode {
+  std::string name;
+  uint32_t slot = 0;  // The view slot
+  DataType type = DataType::INVALID;
+  size_t elem_bytes = 0;
+  Affine offset;        // The element offset, over the block's index slots
+  int64_t parent = -1;  // The parent's view slot, if the refinement aliases the parent's buffer
+  bool param = false;   // Whether the buffer is a program parameter
+  size_t elems = 0;     // The element extent of the shape
+  Agg agg = Agg::Assign;
+  TensorShape shape;
+};
+
+struct BlockCode {
+  std::string name;
+  std::vector<uint32_t> idx_slots;
+  std::vector<uint64_t> ranges;
+  std::vector<Affine> idx_inits;  // Over the parent's index slots
+  std::vector<Affine> constraints;
+  std::vector<RefCode> refs;
+  std::vector<Instr> code;
+  std::vector<std::unique_ptr<BlockCode>> children;
+
+  // Slot counts for the whole program; only set on the program's block.
+  size_t num_idxs = 0;
+  size_t num_scalars = 0;
+  size_t num_views = 0;
+};
+
+// The current element of a refinement, and the bounds of the buffer it's in.
+struct View {
+  char* base = nullptr;
+  char* ptr = nullptr;
+  char* begin = nullptr;
+  char* end = nullptr;
+  const RefCode* ref = nullptr;
+};
+
+namespace {
+
+struct IntrinsicInfo {
+  Op op;
+  size_t arity;
+};
+
+const std::map<std::string, IntrinsicInfo>& Intrinsics() {
+  // The JIT's intrinsic names, along with the Tile function names that are
+  // passed through to Stripe unchanged.
+  static const std::map<std::string, IntrinsicInfo> intrinsics{
+      {"add", {Op::Add, 2}},          {"sub", {Op::Sub, 2}},          {"mul", {Op::Mul, 2}},
+      {"div", {Op::Div, 2}},          {"mod", {Op::Mod, 2}},          {"neg", {Op::Neg, 1}},
+      {"lt", {Op::Lt, 2}},            {"lte", {Op::Lte, 2}},          {"gt", {Op::Gt, 2}},
+      {"gte", {Op::Gte, 2}},          {"eq", {Op::Eq, 2}},            {"neq", {Op::Neq, 2}},
+      {"cmp_lt", {Op::Lt, 2}},        {"cmp_le", {Op::Lte, 2}},       {"cmp_gt", {Op::Gt, 2}},
+      {"cmp_ge", {Op::Gte, 2}},       {"cmp_eq", {Op::Eq, 2}},        {"cmp_ne", {Op::Neq, 2}},
+      {"and", {Op::And, 2}},          {"or", {Op::Or, 2}},            {"xor", {Op::Xor, 2}},
+      {"not", {Op::Not, 1}},          {"bit_and", {Op::BitAnd, 2}},   {"bit_or", {Op::BitOr, 2}},
+      {"bit_xor", {Op::BitXor, 2}},   {"bit_left", {Op::BitLeft, 2}}, {"bit_right", {Op::BitRight, 2}},
+      {"cond", {Op::Cond, 3}},
+  };
+  return intrinsics;
+}
+
+Kind KindOf(DataType type) {
+  if (is_float(type)) {
+    return Kind::Float;
+  }
+  if (is_uint(type)) {
+    return Kind::Uint;
+  }
+  return Kind::Int;
+}
+
+bool IsCompare(Op op) { return Op::Lt <= op && op <= Op::Neq; }
+bool IsLogical(Op op) { return Op::And <= op && op <= Op::Not; }
+bool IsBitwise(Op op) { return Op::BitAnd <= op && op <= Op::BitRight; }
+
+// The number of elements spanned by a shape.
+size_t Extent(const TensorShape& shape) {
+  size_t extent = 1;
+  for (const auto& dim : shape.dims) {
+    if (!dim.size) {
+      return 0;
+    }
+    extent += (dim.size - 1) * std::abs(dim.stride);
+  }
+  return extent;
+}
+
+Agg ParseAgg(const std::string& agg_op) {
+  if (agg_op.empty() || agg_op == Intrinsic::ASSIGN) {
+    return Agg::Assign;
+  }
+  if (agg_op == Intrinsic::SUM) {
+    return Agg::Add;
+  }
+  if (agg_op == Intrinsic::MAX) {
+    return Agg::Max;
+  }
+  if (agg_op == Intrinsic::MIN) {
+    return Agg::Min;
+  }
+  if (agg_op == Intrinsic::PROD) {
+    return Agg::Mul;
+  }
+  throw_with_trace(std::runtime_error(printstring("Unsupported agg_op: %s", agg_op.c_str())));
+  return Agg::Assign;
+}
+
+// Rounds or wraps a value to the precision of its type.
+Word Normalize(DataType type, Word w) {
+  switch (type) {
+    case DataType::BOOLEAN:
+      w.i = w.i != 0;
+      break;
+    case DataType::INT8:
+      w.i = static_cast<int8_t>(w.u);
+      break;
+    case DataType::INT16:
+      w.i = static_cast<int16_t>(w.u);
+      break;
+    case DataType::INT32:
+      w.i = static_cast<int32_t>(w.u);
+      break;
+    case DataType::UINT8:
+      w.u = static_cast<uint8_t>(w.u);
+      break;
+    case DataType::UINT16:
+      w.u = static_cast<uint16_t>(w.u);
+      break;
+    case DataType::UINT32:
+      w.u = static_cast<uint32_t>(w.u);
+      break;
+    case DataType::FLOAT16:
+      w.f = static_cast<float>(half_float::half(static_cast<float>(w.f)));
+      break;
+    case DataType::FLOAT32:
+      w.f = static_cast<float>(w.f);
+      break;
+    default:
+      break;
+  }
+  return w;
+}
+
+Word Convert(Word w, DataType from, DataType to) {
+  Kind from_kind = KindOf(from);
+  Word result{0};
+  if (to == DataType::BOOLEAN) {
+    result.i = from_kind == Kind::Float ? w.f != 0 : w.u != 0;
+    return result;
+  }
+  switch (KindOf(to)) {
+    case Kind::Int:
+      result.i = from_kind == Kind::Float ? static_cast<int64_t>(w.f) : w.i;
+      break;
+    case Kind::Uint:
+      result.u = from_kind == Kind::Float ? static_cast<uint64_t>(static_cast<int64_t>(w.f)) : w.u;
+      break;
+    case Kind::Float:
+      result.f = from_kind == Kind::Float ? w.f : from_kind == Kind::Uint ? static_cast<double>(w.u)
+                                                                            : static_cast<double>(w.i);
+      break;
+  }
+  return Normalize(to, result);
+}
+
+template <typename T>
+T ReadAs(const char* ptr) {
+  T value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+template <typename T>
+void WriteAs(char* ptr, T value) {
+  std::memcpy(ptr, &value, sizeof(value));
+}
+
+Word ReadRaw(const char* ptr, DataType type) {
+  Word w{0};
+  switch (type) {
+    case DataType::BOOLEAN:
+      w.i = ReadAs<uint8_t>(ptr) != 0;
+      break;
+    case DataType::INT8:
+      w.i = ReadAs<int8_t>(ptr);
+      break;
+    case DataType::INT16:
+      w.i = ReadAs<int16_t>(ptr);
+      break;
+    case DataType::INT32:
+      w.i = ReadAs<int32_t>(ptr);
+      break;
+    case DataType::INT64:
+      w.i = ReadAs<int64_t>(ptr);
+      break;
+    case DataType::UINT8:
+      w.u = ReadAs<uint8_t>(ptr);
+      break;
+    case DataType::UINT16:
+      w.u = ReadAs<uint16_t>(ptr);
+      break;
+    case DataType::UINT32:
+      w.u = ReadAs<uint32_t>(ptr);
+      break;
+    case DataType::UINT64:
+      w.u = ReadAs<uint64_t>(ptr);
+      break;
+    case DataType::FLOAT16:
+      w.f = static_cast<float>(ReadAs<half_float::half>(ptr));
+      break;
+    case DataType::FLOAT32:
+      w.f = ReadAs<float>(ptr);
+      break;
+    case DataType::FLOAT64:
+      w.f = ReadAs<double>(ptr);
+      break;
+    default:
+      throw_with_trace(std::runtime_error("Invalid buffer type: " + to_string(type)));
+  }
+  return w;
+}
+
+void WriteRaw(char* ptr, DataType type, Word w) {
+  switch (type) {
+    case DataType::BOOLEAN:
+      WriteAs<uint8_t>(ptr, w.i != 0);
+      break;
+    case DataType::INT8:
+    case DataType::UINT8:
+      WriteAs<uint8_t>(ptr, w.u);
+      break;
+    case DataType::INT16:
+    case DataType::UINT16:
+      WriteAs<uint16_t>(ptr, w.u);
+      break;
+    case DataType::INT32:
+    case DataType::UINT32:
+      WriteAs<uint32_t>(ptr, w.u);
+      break;
+    case DataType::INT64:
+    case DataType::UINT64:
+      WriteAs<uint64_t>(ptr, w.u);
+      break;
+    case DataType::FLOAT16:
+      WriteAs(ptr, half_float::half(static_cast<float>(w.f)));
+      break;
+    case DataType::FLOAT32:
+      WriteAs<float>(ptr, w.f);
+      break;
+    case DataType::FLOAT64:
+      WriteAs<double>(ptr, w.f);
+      break;
+    default:
+      throw_with_trace(std::runtime_error("Invalid buffer type: " + to_string(type)));
+  }
+}
+
+template <typename T>
+T Arith(Op op, T a, T b) {
+  switch (op) {
+    case Op::Add:
+      return a + b;
+    case Op::Sub:
+      return a - b;
+    case Op::Mul:
+      return a * b;
+    case Op::Div:
+      return a / b;
+    default:
+      return a % b;
+  }
+}
+
+template <>
+double Arith(Op op, double a, double b) {
+  switch (op) {
+    case Op::Add:
+      return a + b;
+    case Op::Sub:
+      return a - b;
+    case Op::Mul:
+      return a * b;
+    case Op::Div:
+      return a / b;
+    default:
+      return std::fmod(a, b);
+  }
+}
+
+Word Arith(Op op, Kind kind, Word a, Word b) {
+  Word r{0};
+  switch (kind) {
+    case Kind::Float:
+      r.f = Arith(op, a.f, b.f);
+      break;
+    case Kind::Int:
+      if (op == Op::Div || op == Op::Mod) {
+        if (!b.i) {
+          throw_with_trace(std::runtime_error("Integer division by zero"));
+        }
+        if (b.i == -1) {
+          // Avoid overflow trapping on the most negative value.
+          r.u = op == Op::Div ? -a.u : 0;
+        } else {
+          r.i = Arith(op, a.i, b.i);
+        }
+        break;
+      }
+      // Signed arithmetic wraps; computing on the unsigned representation
+      // keeps that well-defined.
+      r.u = Arith(op, a.u, b.u);
+      break;
+    case Kind::Uint:
+      if ((op == Op::Div || op == Op::Mod) && !b.u) {
+        throw_with_trace(std::runtime_error("Integer division by zero"));
       }
+      r.u = Arith(op, a.u, b.u);
+      break;
+  }
+  return r;
+}
+
+template <typename T>
+bool Compare(Op op, T a, T b) {
+  switch (op) {
+    case Op::Lt:
+      return a < b;
+    case Op::Lte:
+      return a <= b;
+    case Op::Gt:
+      return a > b;
+    case Op::Gte:
+      return a >= b;
+    case Op::Eq:
+      return a == b;
+    default:
+      return a != b;
+  }
+}
+
+bool Compare(Op op, Kind kind, Word a, Word b) {
+  switch (kind) {
+    case Kind::Float:
+      return Compare(op, a.f, b.f);
+    case Kind::Int:
+      return Compare(op, a.i, b.i);
+    default:
+      return Compare(op, a.u, b.u);
+  }
+}
+
+Word Bitwise(Op op, Word a, Word b) {
+  Word r{0};
+  switch (op) {
+    case Op::BitAnd:
+      r.u = a.u & b.u;
+      break;
+    case Op::BitOr:
+      r.u = a.u | b.u;
+      break;
+    case Op::BitXor:
+      r.u = a.u ^ b.u;
+      break;
+    case Op::BitLeft:
+      r.u = b.u < 64 ? a.u << b.u : 0;
+      break;
+    default:
+      // Signed values shift in their sign; Normalize has sign-extended them.
+      r.i = b.u < 64 ? a.i >> b.u : (a.i < 0 ? -1 : 0);
+      break;
+  }
+  return r;
+}
+
+// Visits the element offset of every element of a shape.
+void ForEachElement(const TensorShape& shape, size_t dim, int64_t offset, const std::function<void(int64_t)>& fn) {
+  if (dim == shape.dims.size()) {
+    fn(offset);
+    return;
+  }
+  for (size_t i = 0; i < shape.dims[dim].size; ++i) {
+    ForEachElement(shape, dim + 1, offset + i * shape.dims[dim].stride, fn);
+  }
+}
+
+class Compiler {
+ public:
+  std::unique_ptr<BlockCode> CompileProgram(const Block& program);
+
+ private:
+  struct Scope {
+    const Scope* parent = nullptr;
+    BlockCode* code = nullptr;
+    std::map<std::string, uint32_t> idxs;
+    std::map<std::string, uint32_t> refs;  // Into the block's refs
+    std::map<std::string, std::pair<uint32_t, DataType>> scalars;
+  };
+
+  std::unique_ptr<BlockCode> CompileBlock(const Block& block, const Scope* parent);
+  void CompileStatement(const std::shared_ptr<Statement>& stmt, Scope* scope);
+  void CompileIntrinsic(const Intrinsic& intrinsic, Scope* scope);
+  void CompileSpecial(const Special& special, Scope* scope);
+  Affine Resolve(const stripe::Affine& affine, const std::map<std::string, uint32_t>& idxs, const std::string& what);
+  const RefCode& Ref(const std::string& name, const Scope& scope);
+  uint32_t Operand(const std::string& name, DataType type, Scope* scope);
+  uint32_t Emit(Scope* scope, const Instr& instr);
+  uint32_t Define(const std::string& name, DataType type, Scope* scope);
+
+  size_t num_idxs_ = 0;
+  size_t num_scalars_ = 0;
+  size_t num_views_ = 0;
+};
+
+std::unique_ptr<BlockCode> Compiler::CompileProgram(const Block& program) {
+  auto code = CompileBlock(program, nullptr);
+  code->num_idxs = num_idxs_;
+  code->num_scalars = num_scalars_;
+  code->num_views = num_views_;
+  return code;
+}
+
+std::unique_ptr<BlockCode> Compiler::CompileBlock(const Block& block, const Scope* parent) {
+  auto code = std::make_unique<BlockCode>();
+  code->name = block.name;
+  Scope scope;
+  scope.parent = parent;
+  scope.code = code.get();
+
+  for (const auto& idx : block.idxs) {
+    uint32_t slot = num_idxs_++;
+    scope.idxs[idx.name] = slot;
+    code->idx_slots.push_back(slot);
+    code->ranges.push_back(idx.range);
+    // The program's indexes begin at zero.
+    code->idx_inits.push_back(parent ? Resolve(idx.affine, parent->idxs, "index " + idx.name) : Affine{});
+  }
+  for (const auto& constraint : block.constraints) {
+    code->constraints.push_back(Resolve(constraint, scope.idxs, "constraint in " + block.name));
+  }
+
+  code->refs.reserve(block.refs.size());
+  for (const auto& ref : block.refs) {
+    if (ref.access.size() != ref.shape.dims.size()) {
+      throw_with_trace(std::runtime_error(printstring("Refinement '%s' in block '%s' has %zu accesses for %zu dims",
+                                                      ref.into.c_str(), block.name.c_str(), ref.access.size(),
+                                                      ref.shape.dims.size())));
     }
-    if (block.idxs.size()) {
-      Loop(block, 0);
+    RefCode rc;
+    rc.name = ref.into;
+    rc.slot = num_views_++;
+    rc.type = ref.shape.type;
+    rc.elem_bytes = byte_width(rc.type);
+    rc.offset = Resolve(ref.FlatAccess(), scope.idxs, "access of " + ref.into);
+    rc.elems = Extent(ref.shape);
+    rc.agg = ParseAgg(ref.agg_op);
+    rc.shape = ref.shape;
+    if (!parent) {
+      rc.param = true;
     } else {
-      ExecuteStatements(block);
+      // As in the JIT, a refinement without a source refers to the parent's
+      // buffer of the same name, unless it's a local allocation.
+      const std::string& name = ref.from.empty() ? ref.into : ref.from;
+      bool local = ref.dir == RefDir::None && ref.from.empty();
+      auto it = parent->refs.find(name);
+      if (!local && it != parent->refs.end()) {
+        rc.parent = parent->code->refs[it->second].slot;
+      } else if (!ref.from.empty()) {
+        throw_with_trace(std::runtime_error(
+            printstring("Unknown source buffer '%s' in block '%s'", ref.from.c_str(), block.name.c_str())));
+      }
     }
+    scope.refs[ref.into] = code->refs.size();
+    code->refs.push_back(rc);
   }
 
-  void Loop(const Block& block, size_t depth) {
-    const auto& idx = block.idxs[depth];
-    auto base = idx.affine.eval(outer_->idxs_);
-    for (size_t i = 0; i < idx.range; i++) {
-      idxs_[idx.name] = base + i;
-      if (depth < block.idxs.size() - 1) {
-        Loop(block, depth + 1);
+  for (const auto& stmt : block.stmts) {
+    CompileStatement(stmt, &scope);
+  }
+  return code;
+}
+
+void Compiler::CompileStatement(const std::shared_ptr<Statement>& stmt, Scope* scope) {
+  switch (stmt->kind()) {
+    case StmtKind::Load: {
+      const auto& op = *Load::Downcast(stmt);
+      const auto& ref = Ref(op.from, *scope);
+      Instr instr{Op::Load, KindOf(ref.type), ref.type};
+      instr.a = ref.slot;
+      instr.dst = Define(op.into, ref.type, scope);
+      Emit(scope, instr);
+    } break;
+    case StmtKind::Store: {
+      const auto& op = *Store::Downcast(stmt);
+      const auto& ref = Ref(op.into, *scope);
+      Instr instr{Op::Store, KindOf(ref.type), ref.type};
+      instr.a = ref.slot;
+      instr.b = Operand(op.from, ref.type, scope);
+      instr.c = static_cast<uint32_t>(ref.agg);
+      Emit(scope, instr);
+    } break;
+    case StmtKind::Constant: {
+      const auto& op = *Constant::Downcast(stmt);
+      DataType type = op.type == ConstType::Integer ? DataType::INT64 : DataType::FLOAT64;
+      Instr instr{Op::Const, KindOf(type), type};
+      if (op.type == ConstType::Integer) {
+        instr.imm.i = op.iconst;
       } else {
-        ExecuteStatements(block);
+        instr.imm.f = op.fconst;
       }
-    }
+      instr.dst = Define(op.name, type, scope);
+      Emit(scope, instr);
+    } break;
+    case StmtKind::Intrinsic:
+      CompileIntrinsic(*Intrinsic::Downcast(stmt), scope);
+      break;
+    case StmtKind::Special:
+      CompileSpecial(*Special::Downcast(stmt), scope);
+      break;
+    case StmtKind::Block: {
+      Instr instr{Op::Block, Kind::Int, DataType::INVALID};
+      instr.a = scope->code->children.size();
+      scope->code->children.push_back(CompileBlock(*Block::Downcast(stmt), scope));
+      Emit(scope, instr);
+    } break;
   }
+}
 
-  bool CheckConstraints(const Block& block) {
-    for (const auto& constraint : block.constraints) {
-      if (constraint.eval(idxs_) < 0) {
-        return false;
-      }
+void Compiler::CompileIntrinsic(const Intrinsic& intrinsic, Scope* scope) {
+  auto it = Intrinsics().find(intrinsic.name);
+  if (it == Intrinsics().end()) {
+    throw_with_trace(std::runtime_error(printstring("Unsupported intrinsic: %s", intrinsic.name.c_str())));
+  }
+  Op op = it->second.op;
+  if (intrinsic.inputs.size() != it->second.arity || intrinsic.outputs.size() != 1) {
+    throw_with_trace(std::runtime_error(printstring("Unsupported number of operands for intrinsic: %s",  //
+                                                    intrinsic.name.c_str())));
+  }
+  // Logical operations work on booleans; bitwise operations on a floating
+  // point type work on its integral value.
+  DataType type = intrinsic.type;
+  if (IsLogical(op)) {
+    type = DataType::BOOLEAN;
+  } else if (IsBitwise(op) && is_float(type)) {
+    type = DataType::INT64;
+  }
+  Instr instr{op, KindOf(type), type};
+  uint32_t* operands[] = {&instr.a, &instr.b, &instr.c};
+  for (size_t i = 0; i < intrinsic.inputs.size(); ++i) {
+    DataType operand_type = (op == Op::Cond && i == 0) ? DataType::BOOLEAN : type;
+    *operands[i] = Operand(intrinsic.inputs[i], operand_type, scope);
+  }
+  DataType result_type = IsCompare(op) ? DataType::BOOLEAN : type;
+  instr.dst = num_scalars_++;
+  Emit(scope, instr);
+  if (result_type != intrinsic.type && IsBitwise(op)) {
+    Instr cast{Op::Cast, KindOf(intrinsic.type), intrinsic.type};
+    cast.from = result_type;
+    cast.a = instr.dst;
+    cast.dst = num_scalars_++;
+    result_type = intrinsic.type;
+    instr.dst = Emit(scope, cast);
+  }
+  scope->scalars[intrinsic.outputs[0]] = std::make_pair(instr.dst, result_type);
+}
+
+void Compiler::CompileSpecial(const Special& special, Scope* scope) {
+  if (special.name == Special::ZERO && special.outputs.size() == 1) {
+    const auto& ref = Ref(special.outputs[0], *scope);
+    Instr instr{Op::Zero, KindOf(ref.type), ref.type};
+    instr.a = ref.slot;
+    Emit(scope, instr);
+    return;
+  }
+  if (special.name == Special::COPY && special.inputs.size() == 1 && special.outputs.size() == 1) {
+    const auto& dst = Ref(special.outputs[0], *scope);
+    const auto& src = Ref(special.inputs[0], *scope);
+    if (dst.shape.dims.size() != src.shape.dims.size()) {
+      throw_with_trace(std::runtime_error(
+          printstring("Copy from '%s' to '%s' changes the rank", src.name.c_str(), dst.name.c_str())));
     }
-    return true;
+    Instr instr{Op::Copy, KindOf(dst.type), dst.type};
+    instr.a = dst.slot;
+    instr.b = src.slot;
+    Emit(scope, instr);
+    return;
   }
+  throw_with_trace(std::runtime_error(printstring("Unsupported special: %s", special.name.c_str())));
+}
 
-  size_t ComputeOffsetFor(const Block& block, const Refinement& ref) {
-    int offset = 0;
-    if (!ref.from.empty()) {
-      offset = safe_at(outer_->offsets_, ref.from);
+Affine Compiler::Resolve(const stripe::Affine& affine, const std::map<std::string, uint32_t>& idxs,
+                         const std::string& what) {
+  Affine result;
+  result.constant = affine.constant();
+  for (const auto& term : affine.getMap()) {
+    if (term.first.empty()) {
+      continue;
     }
-    std::stringstream ss;
-    ss << "ref: " << ref.into << ", offset = " << offset;
-    assert(ref.shape.dims.size() == ref.access.size());
-    for (size_t i = 0; i < ref.shape.dims.size(); i++) {
-      auto access = ref.access[i].eval(idxs_);
-      auto stride = ref.shape.dims[i].stride;
-      offset += access * stride;
-      ss << " + (" << access << " * " << stride << ")";
+    auto it = idxs.find(term.first);
+    if (it == idxs.end()) {
+      throw_with_trace(
+          std::runtime_error(printstring("Unknown index '%s' in %s", term.first.c_str(), what.c_str())));
     }
-    ss << " = " << offset;
-    IVLOG(5, Tab() << ss.str());
-    return offset;
+    result.terms.emplace_back(it->second, term.second);
+  }
+  return result;
+}
+
+const RefCode& Compiler::Ref(const std::string& name, const Scope& scope) {
+  auto it = scope.refs.find(name);
+  if (it == scope.refs.end()) {
+    throw_with_trace(
+        std::runtime_error(printstring("Unknown buffer '%s' in block '%s'", name.c_str(), scope.code->name.c_str())));
   }
+  return scope.code->refs[it->second];
+}
+
+uint32_t Compiler::Operand(const std::string& name, DataType type, Scope* scope) {
+  auto it = scope->scalars.find(name);
+  if (it == scope->scalars.end()) {
+    throw_with_trace(
+        std::runtime_error(printstring("Unknown scalar '%s' in block '%s'", name.c_str(), scope->code->name.c_str())));
+  }
+  if (it->second.second == type) {
+    return it->second.first;
+  }
+  Instr cast{Op::Cast, KindOf(type), type};
+  cast.from = it->second.second;
+  cast.a = it->second.first;
+  cast.dst = num_scalars_++;
+  return Emit(scope, cast);
+}
 
-  float DoLoad(const std::string& name, size_t offset) {
-    auto it = refs_.find(name);
-    if (it == refs_.end()) {
-      throw_with_trace(std::runtime_error("Unknown buffer"));
+uint32_t Compiler::Emit(Scope* scope, const Instr& instr) {
+  scope->code->code.push_back(instr);
+  return instr.dst;
+}
+
+uint32_t Compiler::Define(const std::string& name, DataType type, Scope* scope) {
+  uint32_t slot = num_scalars_++;
+  scope->scalars[name] = std::make_pair(slot, type);
+  return slot;
+}
+
+class Interpreter {
+ public:
+  explicit Interpreter(const BlockCode& program)
+      : idxs_(program.num_idxs), scalars_(program.num_scalars), views_(program.num_views) {}
+
+  void Bind(const RefCode& ref, char* base) {
+    views_[ref.slot] = View{base, base, base, base + ref.elems * ref.elem_bytes, &ref};
+  }
+
+  void Enter(const BlockCode& block) {
+    IVLOG(4, "Execute block: " << block.name);
+    std::vector<std::unique_ptr<char[]>> allocs;
+    for (const auto& ref : block.refs) {
+      if (ref.param) {
+        continue;
+      }
+      if (0 <= ref.parent) {
+        const View& parent = views_[ref.parent];
+        views_[ref.slot] = View{parent.ptr, parent.ptr, parent.begin, parent.end, &ref};
+      } else {
+        allocs.emplace_back(new char[ref.elems * ref.elem_bytes]());
+        Bind(ref, allocs.back().get());
+      }
     }
-    if (offset >= it->second->size()) {
-      throw_with_trace(std::runtime_error(printstring("LOAD: Out of bounds access on '%s', offset: %zu, size: %zu",  //
-                                                      name.c_str(), offset, it->second->size())));
+    std::vector<int64_t> inits(block.idx_inits.size());
+    for (size_t i = 0; i < inits.size(); ++i) {
+      inits[i] = block.idx_inits[i].Eval(idxs_.data());
     }
-    return (*it->second)[offset];
+    Loop(block, inits, 0);
   }
 
-  void DoStore(const std::string& name, size_t offset, float value, const std::string& agg_op) {
-    auto it = refs_.find(name);
-    if (it == refs_.end()) {
-      throw_with_trace(std::runtime_error("Unknown buffer"));
-    }
-    if (offset >= it->second->size()) {
-      throw_with_trace(std::runtime_error(printstring("STORE: Out of bounds access on '%s', offset: %zu, size: %zu",  //
-                                                      name.c_str(), offset, it->second->size())));
+ private:
+  void Loop(const BlockCode& block, const std::vector<int64_t>& inits, size_t depth) {
+    if (depth == block.idx_slots.size()) {
+      Execute(block);
+      return;
     }
-    if (agg_op == Intrinsic::SUM) {
-      (*it->second)[offset] += value;
-    } else {
-      (*it->second)[offset] = value;
+    int64_t& idx = idxs_[block.idx_slots[depth]];
+    for (uint64_t i = 0; i < block.ranges[depth]; ++i) {
+      idx = inits[depth] + i;
+      Loop(block, inits, depth + 1);
     }
   }
 
-  void ExecuteStatements(const Block& block) {
-    if (!CheckConstraints(block)) {
-      return;
+  void Execute(const BlockCode& block) {
+    const int64_t* idxs = idxs_.data();
+    for (const auto& constraint : block.constraints) {
+      if (constraint.Eval(idxs) < 0) {
+        return;
+      }
     }
-    std::map<std::string, float> vars;
     for (const auto& ref : block.refs) {
-      offsets_[ref.into] = ComputeOffsetFor(block, ref);
-    }
-    IVLOG(5, Tab() << "idxs: " << StreamContainer(idxs_));
-    IVLOG(5, Tab() << "offsets: " << StreamContainer(offsets_));
-    for (const auto& stmt : block.stmts) {
-      switch (stmt->kind()) {
-        case StmtKind::Load: {
-          const auto& op = Load::Downcast(stmt);
-          vars[op->into] = DoLoad(op->from, offsets_[op->from]);
-        } break;
-        case StmtKind::Store: {
-          const auto& op = Store::Downcast(stmt);
-          auto it = block.ref_by_into(op->into, false);
-          if (it == block.refs.end()) {
-            throw_with_trace(std::runtime_error("Missing agg_op"));
-          }
-          DoStore(op->into, offsets_[op->into], vars[op->from], it->agg_op);
-        } break;
-        case StmtKind::Intrinsic: {
-          const auto& op = Intrinsic::Downcast(stmt);
-          switch (op->inputs.size()) {
-            case 2: {
-              auto it = BINARY_OPS.find(op->name);
-              if (it == BINARY_OPS.end()) {
-                throw_with_trace(std::runtime_error(printstring("Unsupported binary intrinsic: %s", op->name.c_str())));
-              }
-              vars[op->outputs[0]] = it->second(vars[op->inputs[0]], vars[op->inputs[1]]);
-            } break;
-            case 3: {
-              auto it = TERNARY_OPS.find(op->name);
-              if (it == TERNARY_OPS.end()) {
-                throw_with_trace(
-                    std::runtime_error(printstring("Unsupported ternary intrinsic: %s", op->name.c_str())));
-              }
-              vars[op->outputs[0]] = it->second(vars[op->inputs[0]], vars[op->inputs[1]], vars[op->inputs[2]]);
-            } break;
-            default:
-              throw_with_trace(std::runtime_error(
-                  printstring("Unsupported number of operands for intrinsic: %s", op->name.c_str())));
-              break;
-          }
-        } break;
-        case StmtKind::Constant: {
-          const auto& op = Constant::Downcast(stmt);
-          switch (op->type) {
-            case ConstType::Integer:
-              vars[op->name] = op->iconst;
-              break;
-            case ConstType::Float:
-              vars[op->name] = op->fconst;
-              break;
+      View& view = views_[ref.slot];
+      view.ptr = view.base + ref.offset.Eval(idxs) * static_cast<int64_t>(ref.elem_bytes);
+    }
+    Word* s = scalars_.data();
+    for (const auto& in : block.code) {
+      switch (in.op) {
+        case Op::Load:
+          s[in.dst] = ReadRaw(Check(views_[in.a], views_[in.a].ptr, "LOAD"), in.type);
+          break;
+        case Op::Store:
+          Store(views_[in.a], in, s[in.b]);
+          break;
+        case Op::Const:
+          s[in.dst] = in.imm;
+          break;
+        case Op::Cast:
+          s[in.dst] = Convert(s[in.a], in.from, in.type);
+          break;
+        case Op::Add:
+        case Op::Sub:
+        case Op::Mul:
+        case Op::Div:
+        case Op::Mod:
+          s[in.dst] = Normalize(in.type, Arith(in.op, in.kind, s[in.a], s[in.b]));
+          break;
+        case Op::Neg: {
+          Word r;
+          if (in.kind == Kind::Float) {
+            r.f = -s[in.a].f;
+          } else {
+            r.u = -s[in.a].u;
           }
+          s[in.dst] = Normalize(in.type, r);
         } break;
-        case StmtKind::Block: {
-          Scope scope(this);
-          scope.ExecuteBlock(*Block::Downcast(stmt));
-        } break;
+        case Op::Lt:
+        case Op::Lte:
+        case Op::Gt:
+        case Op::Gte:
+        case Op::Eq:
+        case Op::Neq:
+          s[in.dst].i = Compare(in.op, in.kind, s[in.a], s[in.b]);
+          break;
+        case Op::And:
+          s[in.dst].i = s[in.a].i && s[in.b].i;
+          break;
+        case Op::Or:
+          s[in.dst].i = s[in.a].i || s[in.b].i;
+          break;
+        case Op::Xor:
+          s[in.dst].i = s[in.a].i != s[in.b].i;
+          break;
+        case Op::Not:
+          s[in.dst].i = !s[in.a].i;
+          break;
+        case Op::BitAnd:
+        case Op::BitOr:
+        case Op::BitXor:
+        case Op::BitLeft:
+        case Op::BitRight:
+          s[in.dst] = Normalize(in.type, Bitwise(in.op, s[in.a], s[in.b]));
+          break;
+        case Op::Cond:
+          s[in.dst] = s[in.a].i ? s[in.b] : s[in.c];
+          break;
+        case Op::Block:
+          Enter(*block.children[in.a]);
+          break;
+        case Op::Zero:
+          Zero(views_[in.a]);
+          break;
+        case Op::Copy:
+          Copy(views_[in.a], views_[in.b]);
+          break;
+      }
+    }
+  }
+
+  char* Check(const View& view, char* ptr, const char* what) {
+    if (ptr < view.begin || view.end < ptr + view.ref->elem_bytes) {
+      throw_with_trace(std::runtime_error(printstring("%s: Out of bounds access on '%s', offset: %td, size: %td",  //
+                                                      what, view.ref->name.c_str(),
+                                                      (ptr - view.begin) / static_cast<ptrdiff_t>(view.ref->elem_bytes),
+                                                      (view.end - view.begin) /
+                                                          static_cast<ptrdiff_t>(view.ref->elem_bytes))));
+    }
+    return ptr;
+  }
+
+  void Store(const View& view, const Instr& in, Word value) {
+    char* ptr = Check(view, view.ptr, "STORE");
+    auto agg = static_cast<Agg>(in.c);
+    if (agg != Agg::Assign) {
+      Word prev = ReadRaw(ptr, in.type);
+      switch (agg) {
+        case Agg::Add:
+          value = Normalize(in.type, Arith(Op::Add, in.kind, prev, value));
+          break;
+        case Agg::Mul:
+          value = Normalize(in.type, Arith(Op::Mul, in.kind, prev, value));
+          break;
+        case Agg::Max:
+          value = Compare(Op::Gt, in.kind, prev, value) ? prev : value;
+          break;
+        case Agg::Min:
+          value = Compare(Op::Lt, in.kind, prev, value) ? prev : value;
+          break;
         default:
           break;
       }
     }
+    WriteRaw(ptr, in.type, value);
   }
 
-  std::string Tab() const { return std::string(depth_ * 2, ' '); }
+  void Zero(const View& view) {
+    const RefCode& ref = *view.ref;
+    ForEachElement(ref.shape, 0, 0, [&](int64_t offset) {
+      WriteRaw(Check(view, view.ptr + offset * static_cast<int64_t>(ref.elem_bytes), "ZERO"), ref.type, Word{0});
+    });
+  }
 
- private:
-  Scope* outer_ = nullptr;
-  size_t depth_ = 0;
-  std::map<std::string, int64_t> idxs_;
-  std::map<std::string, Buffer*> refs_;
-  std::map<std::string, size_t> offsets_;
+  void Copy(const View& dst, const View& src) {
+    const RefCode& dref = *dst.ref;
+    const RefCode& sref = *src.ref;
+    // Walk both shapes together, element by element.
+    std::vector<size_t> pos(dref.shape.dims.size());
+    ForEachElement(dref.shape, 0, 0, [&](int64_t offset) {
+      int64_t src_offset = 0;
+      for (size_t i = 0; i < pos.size(); ++i) {
+        src_offset += pos[i] * sref.shape.dims[i].stride;
+      }
+      Word value = ReadRaw(Check(src, src.ptr + src_offset * static_cast<int64_t>(sref.elem_bytes), "COPY"), sref.type);
+      WriteRaw(Check(dst, dst.ptr + offset * static_cast<int64_t>(dref.elem_bytes), "COPY"), dref.type,
+               Convert(value, sref.type, dref.type));
+      for (size_t i = pos.size(); i-- > 0;) {
+        if (++pos[i] < dref.shape.dims[i].size) {
+          break;
+        }
+        pos[i] = 0;
+      }
+    });
+  }
+
+  std::vector<int64_t> idxs_;
+  std::vector<Word> scalars_;
+  std::vector<View> views_;
 };
 
 }  // namespace
+}  // namespace vm
+
+VmProgram::VmProgram(const Block& program) : code_{vm::Compiler{}.CompileProgram(program)} {
+  for (const auto& ref : program.refs) {
+    parameters_.push_back(ref.into);
+  }
+}
+
+VmProgram::~VmProgram() {}
+
+const std::vector<std::string>& VmProgram::parameters() const { return parameters_; }
+
+void VmProgram::Run(const std::map<std::string, void*>& buffers) const {
+  vm::Interpreter interpreter{*code_};
+  for (const auto& ref : code_->refs) {
+    auto it = buffers.find(ref.name);
+    if (it == buffers.end()) {
+      throw_with_trace(std::runtime_error(printstring("Missing buffer for program parameter: '%s'", ref.name.c_str())));
+    }
+    interpreter.Bind(ref, static_cast<char*>(it->second));
+  }
+  interpreter.Enter(*code_);
+}
 
 void ExecuteProgram(const Block& program, std::map<std::string, Buffer>* buffers) {
-  Scope scope;
-  scope.ExecuteProgram(program, buffers);
+  VmProgram vm{program};
+  std::map<std::string, std::vector<char>> storage;
+  std::map<std::string, void*> args;
+  for (const auto& ref : program.refs) {
+    const auto& buf = safe_at(buffers, ref.into);
+    auto type = ref.shape.type;
+    size_t elem_bytes = byte_width(type);
+    auto& bytes = storage[ref.into];
+    bytes.resize(std::max(buf.size(), vm::Extent(ref.shape)) * elem_bytes);
+    for (size_t i = 0; i < buf.size(); ++i) {
+      vm::Word value;
+      value.f = buf[i];
+      vm::WriteRaw(&bytes[i * elem_bytes], type, vm::Convert(value, DataType::FLOAT32, type));
+    }
+    args[ref.into] = bytes.data();
+  }
+  vm.Run(args);
+  for (const auto& ref : program.refs) {
+    if (ref.dir == RefDir::In) {
+      continue;
+    }
+    auto& buf = safe_at(buffers, ref.into);
+    auto type = ref.shape.type;
+    size_t elem_bytes = byte_width(type);
+    const auto& bytes = storage[ref.into];
+    for (size_t i = 0; i < buf.size(); ++i) {
+      buf[i] = vm::Convert(vm::ReadRaw(&bytes[i * elem_bytes], type), type, DataType::FLOAT32).f;
+    }
+  }
 }
 
 }  // namespace codegen
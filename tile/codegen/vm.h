@@ -3,6 +3,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,8 +13,35 @@ namespace vertexai {
 namespace tile {
 namespace codegen {
 
+namespace vm {
+struct BlockCode;
+}  // namespace vm
+
+// A Stripe program compiled for the reference interpreter.  Compilation resolves every buffer, index, and scalar
+// name to a slot and every statement to a typed instruction, so running the program does no name lookups.  Values
+// are computed with the semantics of their Stripe types: integers wrap at their width, FLOAT32 and FLOAT16 results
+// are rounded to their precision, and comparisons produce booleans.  Loads and stores are bounds-checked against the
+// buffers passed to Run.
+class VmProgram {
+ public:
+  explicit VmProgram(const stripe::Block& program);
+  ~VmProgram();
+
+  // The names of the program's buffer parameters.
+  const std::vector<std::string>& parameters() const;
+
+  // Runs the program.  Each buffer holds elements of its refinement's type, laid out as described by its shape.
+  // A program may be run from multiple threads concurrently.
+  void Run(const std::map<std::string, void*>& buffers) const;
+
+ private:
+  std::unique_ptr<vm::BlockCode> code_;
+  std::vector<std::string> parameters_;
+};
+
 using Buffer = std::vector<float>;
 
+// Runs a program once over buffers of floats, converting each to and from its refinement's type.
 void ExecuteProgram(const stripe::Block& program, std::map<std::string, Buffer>* buffers);
 
 }  // namespace codegen
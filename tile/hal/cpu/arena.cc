@@ -2,21 +2,185 @@
 
 #include "tile/hal/cpu/arena.h"
 
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
 #include "base/util/error.h"
+#include "base/util/logging.h"
 #include "tile/hal/cpu/buffer.h"
 
 namespace vertexai {
 namespace tile {
 namespace hal {
 namespace cpu {
+namespace {
+
+constexpr std::size_t kDefaultAlignment = 64;
+
+#if defined(__linux__)
+
+// Memory policies from <linux/mempolicy.h>; we issue the mbind system call
+// directly rather than depending on libnuma.
+constexpr int kMpolBind = 2;
+constexpr int kMpolInterleave = 3;
+
+constexpr std::size_t kMaskBits = 8 * sizeof(unsigned long);  // NOLINT(runtime/int)
+
+// Reads the set of online NUMA nodes, e.g. "0-1,3".
+std::vector<std::uint32_t> OnlineNodes() {
+  std::vector<std::uint32_t> nodes;
+  std::ifstream file{"/sys/devices/system/node/online"};
+  std::string range;
+  while (std::getline(file, range, ',')) {
+    std::istringstream parse{range};
+    std::uint32_t first;
+    std::uint32_t last;
+    char dash;
+    if (!(parse >> first)) {
+      continue;
+    }
+    last = first;
+    if (parse >> dash >> last) {
+      last = std::max(first, last);
+    }
+    for (std::uint32_t node = first; node <= last; ++node) {
+      nodes.push_back(node);
+    }
+  }
+  return nodes;
+}
+
+void ApplyNumaPolicy(void* base, std::uint64_t size, const hal::proto::CpuSettings& settings) {
+  int mode;
+  std::vector<std::uint32_t> nodes{settings.numa_nodes().begin(), settings.numa_nodes().end()};
+  switch (settings.numa_policy()) {
+    case hal::proto::NumaPolicy::Bind:
+      mode = kMpolBind;
+      break;
+    case hal::proto::NumaPolicy::Interleave:
+      mode = kMpolInterleave;
+      if (nodes.empty()) {
+        nodes = OnlineNodes();
+      }
+      break;
+    default:
+      return;
+  }
+  if (nodes.empty()) {
+    LOG(WARNING) << "No NUMA nodes available for arena placement; using the default policy";
+    return;
+  }
+  std::uint32_t max_node = *std::max_element(nodes.begin(), nodes.end());
+  std::vector<unsigned long> mask(max_node / kMaskBits + 1, 0);  // NOLINT(runtime/int)
+  for (auto node : nodes) {
+    mask[node / kMaskBits] |= 1UL << (node % kMaskBits);
+  }
+  if (syscall(SYS_mbind, base, size, mode, mask.data(), mask.size() * kMaskBits + 1, 0)) {
+    LOG(WARNING) << "Unable to apply NUMA policy to arena: " << std::strerror(errno);
+  }
+}
+
+#endif  // defined(__linux__)
+
+}  // namespace
 
-Arena::Arena(std::uint64_t size) { mem_.resize(size, '\0'); }
+Arena::Arena(std::uint64_t size, const hal::proto::CpuSettings& settings) : size_{size} {
+  if (!settings.mmap_arenas() || !AllocateMapped(settings)) {
+    AllocateHeap(Alignment(settings));
+  }
+}
+
+Arena::~Arena() {
+#if !defined(_WIN32)
+  if (mapped_size_) {
+    munmap(base_, mapped_size_);
+    return;
+  }
+#endif
+#if defined(_WIN32)
+  _aligned_free(base_);
+#else
+  std::free(base_);
+#endif
+}
+
+std::size_t Arena::Alignment(const hal::proto::CpuSettings& settings) {
+  std::size_t alignment = settings.arena_alignment() ? settings.arena_alignment() : kDefaultAlignment;
+  if ((alignment - 1) & alignment) {
+    throw error::InvalidArgument{"CPU arena alignment must be a power of two: " + std::to_string(alignment)};
+  }
+  return std::max(alignment, alignof(std::max_align_t));
+}
+
+void Arena::AllocateHeap(std::size_t alignment) {
+  // Heap arenas are zero-filled, matching the historical behavior.
+  std::size_t alloc_size = std::max<std::uint64_t>(size_, 1);
+#if defined(_WIN32)
+  base_ = static_cast<char*>(_aligned_malloc(alloc_size, alignment));
+#else
+  void* mem = nullptr;
+  if (posix_memalign(&mem, alignment, alloc_size) == 0) {
+    base_ = static_cast<char*>(mem);
+  }
+#endif
+  if (!base_) {
+    throw std::bad_alloc{};
+  }
+  std::memset(base_, 0, size_);
+}
+
+bool Arena::AllocateMapped(const hal::proto::CpuSettings& settings) {
+#if defined(_WIN32)
+  return false;
+#else
+  // mmap returns page-aligned memory; round the mapping up to whole pages.
+  std::uint64_t page_size = sysconf(_SC_PAGESIZE);
+  if (page_size < Alignment(settings)) {
+    return false;
+  }
+  std::uint64_t mapped_size = (std::max<std::uint64_t>(size_, 1) + page_size - 1) / page_size * page_size;
+  void* mem = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    LOG(WARNING) << "Unable to mmap a " << mapped_size << " byte arena: " << std::strerror(errno);
+    return false;
+  }
+  base_ = static_cast<char*>(mem);
+  mapped_size_ = mapped_size;
+#if defined(MADV_HUGEPAGE)
+  if (settings.huge_pages() && madvise(mem, mapped_size, MADV_HUGEPAGE)) {
+    VLOG(1) << "Unable to enable huge pages for arena: " << std::strerror(errno);
+  }
+#endif
+#if defined(__linux__)
+  ApplyNumaPolicy(mem, mapped_size, settings);
+#endif
+  return true;
+#endif
+}
 
 std::shared_ptr<hal::Buffer> Arena::MakeBuffer(std::uint64_t offset, std::uint64_t size) {
-  if (mem_.size() < offset || mem_.size() < size || mem_.size() < (offset + size)) {
+  if (size_ < offset || size_ < size || size_ < (offset + size)) {
     throw error::OutOfRange{"Requesting memory outside arena bounds"};
   }
-  return std::make_shared<Buffer>(shared_from_this(), mem_.data() + offset, size);
+  return std::make_shared<Buffer>(shared_from_this(), base_ + offset, size);
 }
 
 }  // namespace cpu
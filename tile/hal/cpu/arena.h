@@ -3,7 +3,6 @@
 #pragma once
 
 #include <memory>
-#include <vector>
 
 #include "tile/base/hal.h"
 
@@ -14,12 +13,27 @@ namespace cpu {
 
 class Arena : public hal::Arena, public std::enable_shared_from_this<Arena> {
  public:
-  explicit Arena(std::uint64_t size);
+  // Allocates an arena as described by the settings: either from the heap,
+  // zero-filled, or via mmap, with optional huge page and NUMA placement.
+  // In both cases the arena is aligned to the settings' arena alignment.
+  Arena(std::uint64_t size, const hal::proto::CpuSettings& settings);
+  ~Arena();
 
   std::shared_ptr<hal::Buffer> MakeBuffer(std::uint64_t offset, std::uint64_t size) final;
 
+  // The arena alignment implied by the settings.
+  static std::size_t Alignment(const hal::proto::CpuSettings& settings);
+
+  // Whether the arena was obtained from mmap rather than from the heap.
+  bool mapped() const { return mapped_size_ != 0; }
+
  private:
-  std::vector<char> mem_;
+  void AllocateHeap(std::size_t alignment);
+  bool AllocateMapped(const hal::proto::CpuSettings& settings);
+
+  char* base_ = nullptr;
+  std::uint64_t size_;
+  std::uint64_t mapped_size_ = 0;  // Non-zero if base_ was obtained from mmap
 };
 
 }  // namespace cpu
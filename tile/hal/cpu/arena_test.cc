@@ -0,0 +1,146 @@
+// Copyright 2018 Intel Corporation.
+
+#include <gmock/gmock.h>
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "base/util/error.h"
+#include "tile/hal/cpu/arena.h"
+#include "tile/hal/cpu/buffer.h"
+
+using ::testing::Eq;
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+namespace {
+
+constexpr std::uint64_t kArenaSize = 1 << 16;
+
+bool IsAligned(const void* ptr, std::size_t alignment) {
+  return reinterpret_cast<std::uintptr_t>(ptr) % alignment == 0;
+}
+
+bool IsZero(const void* ptr, std::uint64_t size) {
+  const char* bytes = static_cast<const char*>(ptr);
+  for (std::uint64_t idx = 0; idx < size; ++idx) {
+    if (bytes[idx]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the start of the arena, checking that it can be written.
+void* Base(const std::shared_ptr<Arena>& arena) {
+  auto buffer = Buffer::Downcast(arena->MakeBuffer(0, kArenaSize));
+  std::memset(buffer->base(), 0xa5, kArenaSize);
+  return buffer->base();
+}
+
+TEST(CpuArena, Alignment) {
+  hal::proto::CpuSettings settings;
+  EXPECT_THAT(Arena::Alignment(settings), Eq(64));
+  settings.set_arena_alignment(4096);
+  EXPECT_THAT(Arena::Alignment(settings), Eq(4096));
+  // Alignments below the platform minimum are raised to it.
+  settings.set_arena_alignment(1);
+  EXPECT_THAT(Arena::Alignment(settings), Eq(alignof(std::max_align_t)));
+  settings.set_arena_alignment(96);
+  EXPECT_THROW(Arena::Alignment(settings), error::InvalidArgument);
+}
+
+TEST(CpuArena, InvalidAlignmentFailsAllocation) {
+  hal::proto::CpuSettings settings;
+  settings.set_arena_alignment(100);
+  EXPECT_THROW(std::make_shared<Arena>(kArenaSize, settings), error::InvalidArgument);
+}
+
+TEST(CpuArena, HeapIsAlignedAndZeroFilled) {
+  hal::proto::CpuSettings settings;
+  settings.set_arena_alignment(256);
+  auto arena = std::make_shared<Arena>(kArenaSize, settings);
+  EXPECT_FALSE(arena->mapped());
+  auto buffer = Buffer::Downcast(arena->MakeBuffer(0, kArenaSize));
+  EXPECT_TRUE(IsAligned(buffer->base(), 256));
+  EXPECT_TRUE(IsZero(buffer->base(), kArenaSize));
+}
+
+TEST(CpuArena, Mapped) {
+  hal::proto::CpuSettings settings;
+  settings.set_mmap_arenas(true);
+  settings.set_huge_pages(true);
+  auto arena = std::make_shared<Arena>(kArenaSize, settings);
+  EXPECT_TRUE(arena->mapped());
+  auto buffer = Buffer::Downcast(arena->MakeBuffer(0, kArenaSize));
+  EXPECT_TRUE(IsAligned(buffer->base(), sysconf(_SC_PAGESIZE)));
+  EXPECT_TRUE(IsZero(buffer->base(), kArenaSize));
+  Base(arena);
+}
+
+TEST(CpuArena, MappedFallsBackToHeapPastPageAlignment) {
+  hal::proto::CpuSettings settings;
+  settings.set_mmap_arenas(true);
+  std::size_t alignment = 4 * sysconf(_SC_PAGESIZE);
+  settings.set_arena_alignment(alignment);
+  auto arena = std::make_shared<Arena>(kArenaSize, settings);
+  EXPECT_FALSE(arena->mapped());
+  EXPECT_TRUE(IsAligned(Base(arena), alignment));
+}
+
+TEST(CpuArena, EmptyArena) {
+  hal::proto::CpuSettings settings;
+  auto heap = std::make_shared<Arena>(0, settings);
+  EXPECT_THAT(Buffer::Downcast(heap->MakeBuffer(0, 0))->size(), Eq(0));
+  settings.set_mmap_arenas(true);
+  auto mapped = std::make_shared<Arena>(0, settings);
+  EXPECT_TRUE(mapped->mapped());
+  EXPECT_THAT(Buffer::Downcast(mapped->MakeBuffer(0, 0))->size(), Eq(0));
+}
+
+TEST(CpuArena, MakeBufferChecksBounds) {
+  hal::proto::CpuSettings settings;
+  auto arena = std::make_shared<Arena>(kArenaSize, settings);
+  auto base = static_cast<char*>(Base(arena));
+  auto buffer = Buffer::Downcast(arena->MakeBuffer(1024, kArenaSize - 1024));
+  EXPECT_THAT(buffer->base(), Eq(base + 1024));
+  EXPECT_THAT(buffer->size(), Eq(kArenaSize - 1024));
+  EXPECT_THAT(Buffer::Downcast(arena->MakeBuffer(kArenaSize, 0))->size(), Eq(0));
+
+  EXPECT_THROW(arena->MakeBuffer(kArenaSize + 1, 0), error::OutOfRange);
+  EXPECT_THROW(arena->MakeBuffer(0, kArenaSize + 1), error::OutOfRange);
+  EXPECT_THROW(arena->MakeBuffer(1024, kArenaSize - 1023), error::OutOfRange);
+  // The end of the buffer wraps around; it must still be rejected.
+  EXPECT_THROW(arena->MakeBuffer(1024, UINT64_MAX - 512), error::OutOfRange);
+}
+
+TEST(CpuArena, NumaPolicies) {
+  // Whether or not the host has several NUMA nodes (or permits mbind), the
+  // arena is still allocated and usable.
+  for (auto policy : {hal::proto::NumaPolicy::Default, hal::proto::NumaPolicy::Bind,
+                      hal::proto::NumaPolicy::Interleave}) {
+    hal::proto::CpuSettings settings;
+    settings.set_mmap_arenas(true);
+    settings.set_numa_policy(policy);
+    auto arena = std::make_shared<Arena>(kArenaSize, settings);
+    EXPECT_TRUE(arena->mapped());
+    Base(arena);
+
+    // Binding to node zero, which every host has.
+    settings.add_numa_nodes(0);
+    auto bound = std::make_shared<Arena>(kArenaSize, settings);
+    EXPECT_TRUE(bound->mapped());
+    Base(bound);
+  }
+}
+
+}  // namespace
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
@@ -3,6 +3,9 @@
 #include "tile/hal/cpu/compiler.h"
 
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/MemoryBuffer.h>
 
 #include <exception>
 #include <memory>
@@ -16,6 +19,8 @@
 #include "tile/hal/cpu/emitllvm.h"
 #include "tile/hal/cpu/executable.h"
 #include "tile/hal/cpu/library.h"
+#include "tile/hal/cpu/loader.h"
+#include "tile/hal/cpu/object_cache.h"
 #include "tile/hal/cpu/runtime.h"
 #include "tile/lang/semprinter.h"
 
@@ -23,15 +28,34 @@ namespace vertexai {
 namespace tile {
 namespace hal {
 namespace cpu {
+namespace {
+
+// Captures the object code MCJIT generates for a module, so that it can be
+// stored in the ObjectCache and serialized with the library.
+class ObjectCapture final : public llvm::ObjectCache {
+ public:
+  void notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef obj) final {
+    object_.assign(obj.getBufferStart(), obj.getBufferSize());
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module) final { return nullptr; }
+
+  const std::string& object() const { return object_; }
+
+ private:
+  std::string object_;
+};
+
+}  // namespace
 
 Compiler::Compiler() {}
 
 boost::future<std::unique_ptr<hal::Library>> Compiler::Build(const context::Context& ctx,
                                                              const std::vector<lang::KernelInfo>& kernel_info,
-                                                             const hal::proto::HardwareSettings&) {
+                                                             const hal::proto::HardwareSettings& settings) {
   if (!kernel_info.size()) {
-    return boost::make_ready_future(std::unique_ptr<hal::Library>{
-        std::make_unique<cpu::Library>(std::vector<std::shared_ptr<llvm::ExecutionEngine>>{}, kernel_info)});
+    return boost::make_ready_future(std::unique_ptr<hal::Library>{std::make_unique<cpu::Library>(
+        std::vector<std::shared_ptr<llvm::ExecutionEngine>>{}, std::vector<std::string>{}, kernel_info)});
   }
 
   static std::once_flag init_once;
@@ -42,21 +66,39 @@ boost::future<std::unique_ptr<hal::Library>> Compiler::Build(const context::Cont
     LLVMInitializeNativeAsmParser();
   });
   std::vector<std::shared_ptr<llvm::ExecutionEngine>> engines;
+  std::vector<std::string> objects;
   for (const auto& ki : kernel_info) {
-    BuildKernel(ki, &engines);
+    BuildKernel(ki, settings, &engines, &objects);
   }
-  std::unique_ptr<hal::Library> lib(new cpu::Library(engines, kernel_info));
+  std::unique_ptr<hal::Library> lib(new cpu::Library(engines, std::move(objects), kernel_info));
   return boost::make_ready_future<>(std::move(lib));
 }
 
-void Compiler::BuildKernel(const lang::KernelInfo& ki, std::vector<std::shared_ptr<llvm::ExecutionEngine>>* engines) {
+void Compiler::BuildKernel(const lang::KernelInfo& ki, const hal::proto::HardwareSettings& settings,
+                           std::vector<std::shared_ptr<llvm::ExecutionEngine>>* engines,
+                           std::vector<std::string>* objects) {
+  // If this kernel has been compiled for this host before, reuse its object
+  // code; relocating an object file is far cheaper than generating one.
+  auto cache = ObjectCache::Instance();
+  std::string key = ObjectCache::Key(ki, settings);
+  auto cached = cache->Lookup(key);
+  if (cached) {
+    VLOG(4) << "Using cached object code for kernel " << ki.kname;
+    std::string object(cached->getBufferStart(), cached->getBufferSize());
+    engines->emplace_back(LoadObject(std::move(cached)));
+    objects->emplace_back(std::move(object));
+    return;
+  }
+
   if (VLOG_IS_ON(4)) {
     sem::Print debug_emit(*ki.kfunc);
     VLOG(4) << "Compiling kernel:\n" << debug_emit.str();
   }
 
-  // Generate LLVM IR for the kernel.
-  Emit emit;
+  // Generate LLVM IR for the kernel, in a context of its own so that kernels
+  // can be built concurrently.
+  auto context = std::make_shared<llvm::LLVMContext>();
+  Emit emit{*context};
   assert(ki.kfunc);
   ki.kfunc->Accept(emit);
   // Generate an invoker function wrapping the kernel params: we will pass in
@@ -76,8 +118,15 @@ void Compiler::BuildKernel(const lang::KernelInfo& ki, std::vector<std::shared_p
                                   .setSymbolResolver(std::move(rez))
                                   .create();
   if (ee) {
+    ObjectCapture capture;
+    ee->setObjectCache(&capture);
     ee->finalizeObject();
-    engines->emplace_back(ee);
+    ee->setObjectCache(nullptr);
+    if (!capture.object().empty()) {
+      cache->Store(key, capture.object());
+    }
+    engines->emplace_back(OwnEngine(ee, std::move(context)));
+    objects->emplace_back(capture.object());
   } else {
     std::cerr << "Failed to create ExecutionEngine: " << errStr << std::endl;
   }
@@ -90,7 +139,7 @@ void Compiler::GenerateInvoker(const lang::KernelInfo& ki, llvm::Module* module)
   // using each element of the array as an argument. Following the array of
   // buffer pointers, it will pass along the GridSize value for the current
   // work index.
-  llvm::LLVMContext& context(llvm::getGlobalContext());
+  llvm::LLVMContext& context(module->getContext());
   llvm::IRBuilder<> builder(context);
   // LLVM doesn't have the notion of a void pointer, so we'll pretend all of
   // these buffers are arrays of int32.
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "tile/base/hal.h"
@@ -23,10 +24,15 @@ class Compiler final : public hal::Compiler {
 
   boost::future<std::unique_ptr<hal::Library>> Build(const context::Context& ctx,
                                                      const std::vector<lang::KernelInfo>& kernels,
-                                                     const hal::proto::HardwareSettings& /* settings */) final;
+                                                     const hal::proto::HardwareSettings& settings) final;
+
+  // Each kernel is built in its own LLVMContext, and the runtime's symbol
+  // table and the object cache are locked.
+  bool is_thread_safe() const final { return true; }
 
  private:
-  void BuildKernel(const lang::KernelInfo&, std::vector<std::shared_ptr<llvm::ExecutionEngine>>* engines);
+  void BuildKernel(const lang::KernelInfo&, const hal::proto::HardwareSettings& settings,
+                   std::vector<std::shared_ptr<llvm::ExecutionEngine>>* engines, std::vector<std::string>* objects);
   void GenerateInvoker(const lang::KernelInfo&, llvm::Module*);
 };
 
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/PassManager.h>
@@ -22,7 +23,7 @@ namespace cpu {
 
 class Emit : public sem::Visitor {
  public:
-  Emit();
+  explicit Emit(llvm::LLVMContext& context = llvm::getGlobalContext());
   void Visit(const sem::IntConst&) override;
   void Visit(const sem::FloatConst&) override;
   void Visit(const sem::LookupLVal&) override;
@@ -5,17 +5,17 @@
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 
 #include <algorithm>
-#include <condition_variable>
-#include <mutex>
-#include <thread>
+#include <exception>
+#include <memory>
 #include <utility>
 
-#include <boost/asio.hpp>
 #include <boost/asio/thread_pool.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "base/util/error.h"
 #include "tile/hal/cpu/buffer.h"
 #include "tile/hal/cpu/event.h"
+#include "tile/hal/cpu/parallel_for.h"
 #include "tile/hal/cpu/runtime.h"
 
 namespace vertexai {
@@ -33,11 +33,22 @@ const char invoker_prefix_[] = "__invoke_";
 // a long time, so we'll perform the count only once at startup.
 const size_t physical_cores_ = boost::thread::physical_concurrency();
 
+// Converts a worker's error for the kernel's promise.  boost::promise::set_exception(std::exception_ptr) would store
+// the pointer itself as the exception; boost::current_exception keeps the original exception (wrapping the
+// std::exception_ptr) for any type it doesn't copy directly.
+boost::exception_ptr ToBoostException(const std::exception_ptr& error) {
+  try {
+    std::rethrow_exception(error);
+  } catch (...) {
+    return boost::current_exception();
+  }
+}
+
 }  // namespace
 
 Executable::Executable(std::vector<std::shared_ptr<llvm::ExecutionEngine>> engines, std::vector<lang::KernelInfo> kis,
-                       std::shared_ptr<boost::asio::thread_pool> thread_pool)
-    : engines_{engines}, kis_(kis), thread_pool_(thread_pool) {}
+                       std::shared_ptr<boost::asio::thread_pool> thread_pool, std::shared_ptr<Dispatch> dispatch)
+    : engines_{engines}, kis_(kis), thread_pool_(thread_pool), dispatch_{std::move(dispatch)} {}
 
 std::shared_ptr<hal::Event> Executable::Run(const context::Context& ctx, std::size_t kidx,
                                             const std::vector<std::shared_ptr<hal::Buffer>>& params,
@@ -48,57 +59,69 @@ std::shared_ptr<hal::Event> Executable::Run(const context::Context& ctx, std::si
   auto deps = Event::WaitFor(dependencies);
   auto evt = deps.then([params = std::move(param_refs), act = std::move(activity), engine = engines_[kidx],
                         invoker_name = InvokerName(kis_[kidx].kname), thread_pool = thread_pool_,
-                        gwork = kis_[kidx].gwork](decltype(deps) future) -> std::shared_ptr<hal::Result> {
-    future.get();
+                        dispatch = dispatch_, kname = kis_[kidx].kname,
+                        gwork = kis_[kidx].gwork](decltype(deps) future) {
+    auto promise = std::make_shared<boost::promise<std::shared_ptr<hal::Result>>>();
+    auto result = promise->get_future();
+    try {
+      future.get();
+    } catch (...) {
+      promise->set_exception(boost::current_exception());
+      return result;
+    }
     auto start = std::chrono::high_resolution_clock::now();
     // Get the base address for all of these buffers, populating an argument
     // array, which we will pass in to the kernel's main function.
-    std::vector<void*> args(params.size());
-    for (size_t i = 0; i < args.size(); ++i) {
-      args[i] = Buffer::Downcast(params[i])->base();
+    auto args = std::make_shared<std::vector<void*>>(params.size());
+    for (size_t i = 0; i < args->size(); ++i) {
+      (*args)[i] = Buffer::Downcast(params[i])->base();
     }
-    void* argvec = args.data();
     uint64_t entrypoint = engine->getFunctionAddress(invoker_name);
     // Iterate through the grid coordinates specified for this kernel, invoking
-    // the kernel function once for each. We'll create one thread per core and
-    // run one loop in each thread, staggering kernel invocations accordingly.
+    // the kernel function once for each. The grid is divided into contiguous
+    // ranges which are shared among the workers by work-stealing, so that
+    // uneven work groups don't leave the other cores idle.
     size_t iterations = gwork[0] * gwork[1] * gwork[2];
     lang::GridSize denom = {{gwork[2] * gwork[1], gwork[2], 1}};
-    size_t threads = std::min(iterations, physical_cores_);
-
-    // The condition variable will guard the completion count. Each worker
-    // will increment the completion count, and we'll wait until it reaches
-    // the number of threads before returning.
-    std::mutex mutex;
-    std::condition_variable cv;
-    size_t completed = 0;
-
-    for (size_t offset = 0; offset < threads; ++offset) {
-      boost::asio::post(*thread_pool, [=, &mutex, &cv, &completed]() {
-        for (size_t i = offset; i < iterations; i += threads) {
-          lang::GridSize index;
-          index[0] = i / denom[0] % gwork[0];
-          index[1] = i / denom[1] % gwork[1];
-          index[2] = i / denom[2] % gwork[2];
-          ((void (*)(void*, lang::GridSize*))entrypoint)(argvec, &index);
-        }
-        {
-          std::unique_lock<std::mutex> lock{mutex};
-          if (++completed == threads) {
-            cv.notify_all();
-          }
-        }
-      });
-    }
-    {
-      std::unique_lock<std::mutex> lock{mutex};
-      cv.wait(lock, [&]() { return threads <= completed; });
+    // The workers run the engine's code, so they hold a reference to it; the continuation returns as soon as the
+    // work has been dispatched.
+    auto body = [args, engine, entrypoint, gwork, denom](size_t begin, size_t end) {
+      void* argvec = args->data();
+      for (size_t i = begin; i < end; ++i) {
+        lang::GridSize index;
+        index[0] = i / denom[0] % gwork[0];
+        index[1] = i / denom[1] % gwork[1];
+        index[2] = i / denom[2] % gwork[2];
+        ((void (*)(void*, lang::GridSize*))entrypoint)(argvec, &index);
+      }
+    };
+    // Small grids are given fewer workers when kernels may run concurrently,
+    // leaving the remaining cores free for other ready kernels.
+    size_t workers = physical_cores_;
+    if (dispatch->concurrent_kernels) {
+      workers = std::max<size_t>(1, std::min(workers, iterations / dispatch->groups_per_worker));
     }
-
-    return std::make_shared<Result>(act.ctx(), "tile::hal::cpu::Executing", start,
-                                    std::chrono::high_resolution_clock::now());
+    proto::RunInfo run_info;
+    run_info.set_kname(kname);
+    run_info.set_groups(iterations);
+    run_info.set_workers(std::min(iterations, workers));
+    run_info.set_overlapped_kernels(dispatch->running++);
+    // Rather than blocking this thread until the workers finish, the final
+    // worker resolves the kernel's event.
+    auto on_complete = [promise, params, engine, dispatch, run_info, ctx = act.ctx(),
+                        start](std::exception_ptr error) {
+      dispatch->running--;
+      if (error) {
+        promise->set_exception(ToBoostException(error));
+        return;
+      }
+      promise->set_value(std::make_shared<Result>(ctx, "tile::hal::cpu::Executing", start,
+                                                  std::chrono::high_resolution_clock::now(), run_info));
+    };
+    ParallelFor(thread_pool.get(), iterations, workers, std::move(body), std::move(on_complete));
+    return result;
   });
-  return std::make_shared<cpu::Event>(std::move(evt));
+  return std::make_shared<cpu::Event>(evt.unwrap().share());
 }
 
 std::string Executable::InvokerName(std::string kname) { return invoker_prefix_ + kname; }
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -20,10 +21,22 @@ namespace tile {
 namespace hal {
 namespace cpu {
 
+// Dispatch state shared by all of an executor's executables.
+struct Dispatch {
+  // When set, kernels are divided among workers in proportion to their grid
+  // size, so that ready kernels with small grids run alongside each other
+  // instead of each fanning out across every core.
+  bool concurrent_kernels = false;
+  std::size_t groups_per_worker = 1;
+
+  // The number of kernels currently running.
+  std::atomic<std::size_t> running{0};
+};
+
 class Executable final : public hal::Executable {
  public:
   Executable(std::vector<std::shared_ptr<llvm::ExecutionEngine>> engines, std::vector<lang::KernelInfo> kis,
-             std::shared_ptr<boost::asio::thread_pool> thread_pool);
+             std::shared_ptr<boost::asio::thread_pool> thread_pool, std::shared_ptr<Dispatch> dispatch);
 
   std::shared_ptr<hal::Event> Run(const context::Context& ctx, std::size_t kidx,
                                   const std::vector<std::shared_ptr<hal::Buffer>>& params,
@@ -36,6 +49,7 @@ class Executable final : public hal::Executable {
   std::vector<std::shared_ptr<llvm::ExecutionEngine>> engines_;
   std::vector<lang::KernelInfo> kis_;
   std::shared_ptr<boost::asio::thread_pool> thread_pool_;
+  std::shared_ptr<Dispatch> dispatch_;
 };
 
 }  // namespace cpu
@@ -74,7 +74,17 @@ hal::proto::HardwareInfo GetHardwareInfo() {
 
 }  // namespace
 
-Executor::Executor() : info_{GetHardwareInfo()}, memory_{new Memory()}, thread_pool_{new boost::asio::thread_pool} {}
+Executor::Executor()
+    : info_{GetHardwareInfo()},
+      memory_{new Memory()},
+      thread_pool_{new boost::asio::thread_pool},
+      dispatch_{std::make_shared<Dispatch>()} {}
+
+void Executor::Initialize(const hal::proto::CpuSettings& settings) {
+  dispatch_->concurrent_kernels = settings.concurrent_kernels();
+  dispatch_->groups_per_worker = settings.groups_per_worker() ? settings.groups_per_worker() : 16;
+  memory_->Initialize(settings);
+}
 
 std::shared_ptr<hal::Event> Executor::Copy(const context::Context& ctx, const std::shared_ptr<hal::Buffer>& from,
                                            std::size_t from_offset, const std::shared_ptr<hal::Buffer>& to,
@@ -103,7 +113,7 @@ std::shared_ptr<hal::Event> Executor::Copy(const context::Context& ctx, const st
 
 boost::future<std::unique_ptr<hal::Executable>> Executor::Prepare(hal::Library* library) {
   auto lib = Library::Downcast(library);
-  auto k = std::make_unique<cpu::Executable>(lib->engines(), lib->kernels(), thread_pool_);
+  auto k = std::make_unique<cpu::Executable>(lib->engines(), lib->kernels(), thread_pool_, dispatch_);
   return boost::make_ready_future(std::unique_ptr<hal::Executable>(std::move(k)));
 }
 
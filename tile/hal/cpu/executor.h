@@ -8,16 +8,22 @@
 #include <boost/asio/thread_pool.hpp>
 
 #include "tile/base/hal.h"
+#include "tile/hal/cpu/memory.h"
 
 namespace vertexai {
 namespace tile {
 namespace hal {
 namespace cpu {
 
+struct Dispatch;
+
 class Executor : public hal::Executor {
  public:
   Executor();
 
+  // Applies the CPU-specific hardware settings.
+  void Initialize(const hal::proto::CpuSettings& settings);
+
   const hal::proto::HardwareInfo& info() final { return info_; }
 
   Memory* device_memory() final { return memory_.get(); }
@@ -44,6 +50,7 @@ class Executor : public hal::Executor {
   const hal::proto::HardwareInfo info_;
   std::unique_ptr<Memory> memory_;
   std::shared_ptr<boost::asio::thread_pool> thread_pool_;
+  std::shared_ptr<Dispatch> dispatch_;
 };
 
 }  // namespace cpu
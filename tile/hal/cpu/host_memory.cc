@@ -0,0 +1,192 @@
+// Copyright 2018 Intel Corporation.
+
+#include "tile/hal/cpu/host_memory.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "base/util/logging.h"
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// cgroup v1 reports "no limit" as a page-rounded LONG_MAX; anything this
+// large is treated as unlimited.
+constexpr std::uint64_t kUnlimited = std::uint64_t{1} << 60;
+
+// Reads a single integer from a file; returns false if the file is missing,
+// unparseable, or contains "max" (cgroup v2's "no limit").
+bool ReadValue(const fs::path& path, std::uint64_t* value) {
+  fs::ifstream ifs{path};
+  std::string text;
+  if (!(ifs >> text) || text == "max") {
+    return false;
+  }
+  std::istringstream parse{text};
+  return static_cast<bool>(parse >> *value);
+}
+
+// Reads a "<key> <value>" entry from a file such as memory.stat or
+// /proc/meminfo (where the key carries a trailing colon).
+bool ReadKey(const fs::path& path, const std::string& key, std::uint64_t* value) {
+  fs::ifstream ifs{path};
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream parse{line};
+    std::string name;
+    if (parse >> name && name == key) {
+      return static_cast<bool>(parse >> *value);
+    }
+  }
+  return false;
+}
+
+// Finds the memory cgroup of this process.  Returns the cgroup's directory and
+// whether the hierarchy is cgroup v2.
+bool FindCgroup(const fs::path& root, fs::path* dir, bool* v2) {
+  fs::ifstream ifs{root / "proc/self/cgroup"};
+  std::string line;
+  fs::path v2_dir;
+  while (std::getline(ifs, line)) {
+    // Each line is "<id>:<controllers>:<path>".
+    auto first = line.find(':');
+    auto second = line.find(':', first + 1);
+    if (first == std::string::npos || second == std::string::npos) {
+      continue;
+    }
+    std::string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+    std::string path = line.substr(second + 1);
+    path.erase(0, path.find_first_not_of('/'));
+    if (controllers.find(",memory,") != std::string::npos) {
+      *dir = root / "sys/fs/cgroup/memory" / path;
+      if (!fs::exists(*dir / "memory.limit_in_bytes")) {
+        // Containers commonly mount their own cgroup as the hierarchy root.
+        *dir = root / "sys/fs/cgroup/memory";
+      }
+      *v2 = false;
+      return true;
+    }
+    if (line.compare(0, 3, "0::") == 0) {
+      v2_dir = root / "sys/fs/cgroup" / path;
+    }
+  }
+  if (!v2_dir.empty()) {
+    *dir = v2_dir;
+    *v2 = true;
+    return true;
+  }
+  return false;
+}
+
+// Limits apply hierarchically, so the tightest limit of the cgroup and its
+// ancestors (up to the hierarchy's root, base) wins.
+std::uint64_t TightestLimit(const fs::path& base, const fs::path& dir, const std::string& filename) {
+  std::uint64_t limit = kUnlimited;
+  for (fs::path cur = dir; base.string().size() <= cur.string().size(); cur = cur.parent_path()) {
+    std::uint64_t value;
+    if (ReadValue(cur / filename, &value)) {
+      limit = std::min(limit, value);
+    }
+  }
+  return limit;
+}
+
+void QueryCgroup(const fs::path& root, HostMemory* mem) {
+  fs::path dir;
+  bool v2;
+  if (!FindCgroup(root, &dir, &v2)) {
+    return;
+  }
+  std::uint64_t limit;
+  std::uint64_t usage = 0;
+  std::uint64_t inactive_file = 0;
+  if (v2) {
+    limit = TightestLimit(root / "sys/fs/cgroup", dir, "memory.max");
+    ReadValue(dir / "memory.current", &usage);
+    ReadKey(dir / "memory.stat", "inactive_file", &inactive_file);
+  } else {
+    limit = TightestLimit(root / "sys/fs/cgroup/memory", dir, "memory.limit_in_bytes");
+    ReadValue(dir / "memory.usage_in_bytes", &usage);
+    ReadKey(dir / "memory.stat", "total_inactive_file", &inactive_file);
+  }
+  if (limit < kUnlimited) {
+    mem->limit = limit;
+    mem->usage = usage - std::min(usage, inactive_file);
+    VLOG(1) << "CPU memory: cgroup limit " << mem->limit << " bytes, usage " << mem->usage << " bytes";
+  }
+}
+
+}  // namespace
+
+std::uint64_t HostMemory::Budget() const {
+  if (limit && (limit < physical || !physical)) {
+    return limit;
+  }
+  return physical;
+}
+
+std::uint64_t HostMemory::Available() const {
+  std::uint64_t result = Budget();
+  if (available) {
+    result = std::min(result, available);
+  }
+  if (limit) {
+    result = std::min(result, limit - std::min(limit, usage));
+  }
+  return result;
+}
+
+HostMemory QueryHostMemory(const std::string& root) {
+  HostMemory mem;
+#if defined(_WIN32)
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status)) {
+    mem.physical = status.ullTotalPhys;
+    mem.available = status.ullAvailPhys;
+  }
+#elif defined(__APPLE__)
+  std::uint64_t memsize = 0;
+  std::size_t len = sizeof(memsize);
+  if (sysctlbyname("hw.memsize", &memsize, &len, nullptr, 0) == 0) {
+    mem.physical = memsize;
+  }
+#else
+  fs::path meminfo = fs::path{root} / "proc/meminfo";
+  std::uint64_t kib;
+  if (ReadKey(meminfo, "MemTotal:", &kib)) {
+    mem.physical = kib * 1024;
+  } else {
+    mem.physical = static_cast<std::uint64_t>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+  }
+  if (ReadKey(meminfo, "MemAvailable:", &kib)) {
+    mem.available = kib * 1024;
+  }
+  QueryCgroup(fs::path{root}, &mem);
+#endif
+  return mem;
+}
+
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,36 @@
+// Copyright 2018 Intel Corporation.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+
+// A snapshot of the host's memory, as seen by this process.
+struct HostMemory {
+  std::uint64_t physical = 0;   // Installed physical memory
+  std::uint64_t available = 0;  // Memory available without swapping; 0 if unknown
+  std::uint64_t limit = 0;      // The tightest enclosing cgroup memory limit; 0 if unlimited
+  std::uint64_t usage = 0;      // The cgroup's memory usage, excluding reclaimable page cache
+
+  // The most memory this process can expect to use: the physical memory,
+  // capped by the cgroup limit.
+  std::uint64_t Budget() const;
+
+  // The memory currently available to this process: the budget, reduced by
+  // memory in use elsewhere on the host or in the cgroup.
+  std::uint64_t Available() const;
+};
+
+// Queries the host memory.  On Linux, cgroup v1 and v2 memory limits are
+// read from /proc and /sys beneath the indicated root directory.
+HostMemory QueryHostMemory(const std::string& root = "/");
+
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,117 @@
+// Copyright 2018 Intel Corporation.
+
+#include <gmock/gmock.h>
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "tile/hal/cpu/host_memory.h"
+
+using ::testing::Eq;
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+namespace {
+
+namespace fs = boost::filesystem;
+
+constexpr std::uint64_t kGiB = std::uint64_t{1} << 30;
+
+// A fake /proc and /sys tree.
+class FakeRoot {
+ public:
+  FakeRoot() : root_{fs::temp_directory_path() / fs::unique_path()} {
+    Write("proc/meminfo",
+          "MemTotal:       16777216 kB\n"
+          "MemFree:         1048576 kB\n"
+          "MemAvailable:    8388608 kB\n");
+  }
+  ~FakeRoot() { fs::remove_all(root_); }
+
+  void Write(const std::string& name, const std::string& contents) {
+    fs::path path = root_ / name;
+    fs::create_directories(path.parent_path());
+    fs::ofstream ofs{path};
+    ofs << contents;
+  }
+
+  std::string root() const { return root_.string(); }
+
+ private:
+  fs::path root_;
+};
+
+TEST(HostMemory, NoCgroup) {
+  FakeRoot fake;
+  HostMemory mem = QueryHostMemory(fake.root());
+  EXPECT_THAT(mem.physical, Eq(16 * kGiB));
+  EXPECT_THAT(mem.available, Eq(8 * kGiB));
+  EXPECT_THAT(mem.limit, Eq(0));
+  EXPECT_THAT(mem.Budget(), Eq(16 * kGiB));
+  EXPECT_THAT(mem.Available(), Eq(8 * kGiB));
+}
+
+TEST(HostMemory, CgroupV1) {
+  FakeRoot fake;
+  fake.Write("proc/self/cgroup", "5:cpu,cpuacct:/docker/abc\n4:memory:/docker/abc\n");
+  fake.Write("sys/fs/cgroup/memory/docker/abc/memory.limit_in_bytes", std::to_string(4 * kGiB));
+  fake.Write("sys/fs/cgroup/memory/docker/abc/memory.usage_in_bytes", std::to_string(3 * kGiB));
+  fake.Write("sys/fs/cgroup/memory/docker/abc/memory.stat",
+             "cache 100\ntotal_inactive_file " + std::to_string(kGiB) + "\n");
+  HostMemory mem = QueryHostMemory(fake.root());
+  EXPECT_THAT(mem.limit, Eq(4 * kGiB));
+  EXPECT_THAT(mem.usage, Eq(2 * kGiB));
+  EXPECT_THAT(mem.Budget(), Eq(4 * kGiB));
+  EXPECT_THAT(mem.Available(), Eq(2 * kGiB));
+}
+
+TEST(HostMemory, CgroupV1UsesTightestAncestor) {
+  FakeRoot fake;
+  fake.Write("proc/self/cgroup", "4:memory:/kubepods/pod1/abc\n");
+  fake.Write("sys/fs/cgroup/memory/memory.limit_in_bytes", "9223372036854771712\n");
+  fake.Write("sys/fs/cgroup/memory/kubepods/pod1/memory.limit_in_bytes", std::to_string(3 * kGiB));
+  fake.Write("sys/fs/cgroup/memory/kubepods/pod1/abc/memory.limit_in_bytes", "9223372036854771712\n");
+  fake.Write("sys/fs/cgroup/memory/kubepods/pod1/abc/memory.usage_in_bytes", std::to_string(kGiB));
+  HostMemory mem = QueryHostMemory(fake.root());
+  EXPECT_THAT(mem.limit, Eq(3 * kGiB));
+  EXPECT_THAT(mem.usage, Eq(kGiB));
+  EXPECT_THAT(mem.Available(), Eq(2 * kGiB));
+}
+
+TEST(HostMemory, CgroupV1Unlimited) {
+  FakeRoot fake;
+  fake.Write("proc/self/cgroup", "4:memory:/\n");
+  fake.Write("sys/fs/cgroup/memory/memory.limit_in_bytes", "9223372036854771712\n");
+  HostMemory mem = QueryHostMemory(fake.root());
+  EXPECT_THAT(mem.limit, Eq(0));
+  EXPECT_THAT(mem.Budget(), Eq(16 * kGiB));
+}
+
+TEST(HostMemory, CgroupV2UsesTightestAncestor) {
+  FakeRoot fake;
+  fake.Write("proc/self/cgroup", "0::/user.slice/session.scope\n");
+  fake.Write("sys/fs/cgroup/user.slice/memory.max", std::to_string(6 * kGiB));
+  fake.Write("sys/fs/cgroup/user.slice/session.scope/memory.max", "max\n");
+  fake.Write("sys/fs/cgroup/user.slice/session.scope/memory.current", std::to_string(kGiB));
+  HostMemory mem = QueryHostMemory(fake.root());
+  EXPECT_THAT(mem.limit, Eq(6 * kGiB));
+  EXPECT_THAT(mem.usage, Eq(kGiB));
+  EXPECT_THAT(mem.Budget(), Eq(6 * kGiB));
+  EXPECT_THAT(mem.Available(), Eq(5 * kGiB));
+}
+
+TEST(HostMemory, QueriesHost) {
+  HostMemory mem = QueryHostMemory();
+  EXPECT_LT(0, mem.Budget());
+  EXPECT_LE(mem.Available(), mem.Budget());
+}
+
+}  // namespace
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
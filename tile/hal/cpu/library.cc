@@ -6,6 +6,8 @@
 #include <utility>
 
 #include "base/util/error.h"
+#include "tile/hal/cpu/cpu.pb.h"
+#include "tile/hal/cpu/object_cache.h"
 
 namespace vertexai {
 namespace tile {
@@ -18,8 +20,23 @@ Library* Library::Downcast(hal::Library* library) {
 }
 
 Library::Library(const std::vector<std::shared_ptr<llvm::ExecutionEngine>>& engines,
-                 const std::vector<lang::KernelInfo>& kernels)
-    : engines_{engines}, kernels_{kernels} {}
+                 std::vector<std::string> objects, const std::vector<lang::KernelInfo>& kernels)
+    : engines_{engines}, objects_{std::move(objects)}, kernels_{kernels} {}
+
+std::string Library::Serialize() {
+  if (objects_.size() != kernels_.size()) {
+    throw error::FailedPrecondition{"CPU library is missing object code for some of its kernels"};
+  }
+  proto::Library pb;
+  pb.set_triple(ObjectCache::HostTriple());
+  pb.set_cpu(ObjectCache::HostCPU());
+  for (std::size_t kidx = 0; kidx < kernels_.size(); ++kidx) {
+    auto* kobj = pb.add_kernels();
+    kobj->set_kname(kernels_[kidx].kname);
+    kobj->set_object(objects_[kidx]);
+  }
+  return pb.SerializeAsString();
+}
 
 }  // namespace cpu
 }  // namespace hal
@@ -22,16 +22,17 @@ class Library final : public hal::Library {
  public:
   static Library* Downcast(hal::Library* library);
 
-  Library(const std::vector<std::shared_ptr<llvm::ExecutionEngine>>& engines,
+  Library(const std::vector<std::shared_ptr<llvm::ExecutionEngine>>& engines, std::vector<std::string> objects,
           const std::vector<lang::KernelInfo>& kernels);
 
-  std::string Serialize() final { return ""; }
+  std::string Serialize() final;
 
   const std::vector<std::shared_ptr<llvm::ExecutionEngine>>& engines() { return engines_; }
   const std::vector<lang::KernelInfo>& kernels() { return kernels_; }
 
  private:
   std::vector<std::shared_ptr<llvm::ExecutionEngine>> engines_;
+  std::vector<std::string> objects_;  // The relocatable object code for each engine
   std::vector<lang::KernelInfo> kernels_;
 };
 
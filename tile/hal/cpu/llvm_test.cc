@@ -4,13 +4,23 @@
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
 
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <half.hpp>
 
+#include "tile/hal/cpu/compiler.h"
 #include "tile/hal/cpu/emitllvm.h"
+#include "tile/hal/cpu/executable.h"
+#include "tile/hal/cpu/library.h"
+#include "tile/hal/cpu/loader.h"
 #include "tile/hal/cpu/runtime.h"
 #include "tile/lang/sembuilder.h"
 #include "tile/lang/semtree.h"
 
+using ::testing::DoubleEq;
 using ::testing::Eq;
 using ::testing::Ne;
 using ::testing::NotNull;
@@ -31,6 +41,7 @@ static const sem::Type int32Type{sem::Type::VALUE, DataType::INT32};
 static const sem::Type int64Type{sem::Type::VALUE, DataType::INT64};
 static const sem::Type fp32Type{sem::Type::VALUE, DataType::FLOAT32};
 static const sem::Type fp64Type{sem::Type::VALUE, DataType::FLOAT64};
+static const sem::Type ptrFP64Type{sem::Type::POINTER_MUT, DataType::FLOAT64};
 static const sem::Type ptrInt32Type{sem::Type::POINTER_MUT, DataType::INT32};
 static const sem::Type ptrFP32Type{sem::Type::POINTER_MUT, DataType::FLOAT32};
 
@@ -408,6 +419,82 @@ TEST(CpuDevice, LLVM_vec_add_loop) {
   }
 }
 
+TEST(CpuDevice, LLVM_serialize_library) {
+  using namespace sem::builder;  // NOLINT
+  lang::KernelInfo ki;
+  ki.kname = "serialize_copy";
+  ki.kfunc = _Function(ki.kname, voidType, {{ptrInt32Type, "a"}, {ptrInt32Type, "b"}},
+                       {_("a")[_Const(0)] = _("b")[_Const(0)]});
+  ki.gwork = {{1, 1, 1}};
+  context::Context ctx;
+  hal::cpu::Compiler compiler;
+  auto built = compiler.Build(ctx, {ki}, hal::proto::HardwareSettings{}).get();
+  std::string serialized = built->Serialize();
+  EXPECT_THAT(serialized.size(), Ne(0));
+
+  hal::cpu::Loader loader;
+  auto loaded = loader.Deserialize(ctx, serialized, {ki}).get();
+  auto lib = hal::cpu::Library::Downcast(loaded.get());
+  EXPECT_THAT(lib, NotNull());
+  EXPECT_THAT(lib->engines().size(), Eq(1));
+  auto invoker = (void (*)(void*, lang::GridSize*))lib->engines()[0]->getFunctionAddress(
+      hal::cpu::Executable::InvokerName(ki.kname));
+  EXPECT_THAT(invoker, NotNull());
+  int32_t a = 19;
+  int32_t b = 42;
+  void* args[] = {&a, &b};
+  lang::GridSize index = {{0, 0, 0}};
+  invoker(args, &index);
+  EXPECT_THAT(a, Eq(42));
+}
+
+TEST(CpuDevice, LLVM_build_concurrently) {
+  // Each thread builds kernels calling external math functions, so that the
+  // runtime resolves symbols for several kernels at once.
+  using namespace sem::builder;  // NOLINT
+  const std::vector<std::string> funcs = {"acos", "asin", "atan", "cosh", "sinh", "tan", "tanh"};
+  const std::vector<double (*)(double)> refs = {::acos, ::asin, ::atan, ::cosh, ::sinh, ::tan, ::tanh};
+  const size_t thread_count = 8;
+  const size_t builds_per_thread = 4;
+  std::vector<std::vector<double>> results(thread_count);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t rep = 0; rep < builds_per_thread; ++rep) {
+        lang::KernelInfo ki;
+        ki.kname = "concurrent_" + std::to_string(t) + "_" + std::to_string(rep);
+        ki.kfunc = _Function(ki.kname, voidType, {{ptrFP64Type, "out"}, {ptrFP64Type, "in"}},
+                             {_("out")[_Const(0)] = _(funcs[(t + rep) % funcs.size()])(_("in")[_Const(0)])});
+        ki.gwork = {{1, 1, 1}};
+        context::Context ctx;
+        hal::cpu::Compiler compiler;
+        auto built = compiler.Build(ctx, {ki}, hal::proto::HardwareSettings{}).get();
+        auto lib = hal::cpu::Library::Downcast(built.get());
+        auto invoker = (void (*)(void*, lang::GridSize*))lib->engines()[0]->getFunctionAddress(
+            hal::cpu::Executable::InvokerName(ki.kname));
+        double out = 0;
+        double in = 0.5;
+        void* args[] = {&out, &in};
+        lang::GridSize index = {{0, 0, 0}};
+        if (invoker) {
+          invoker(args, &index);
+        }
+        results[t].push_back(out);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (size_t t = 0; t < thread_count; ++t) {
+    ASSERT_THAT(results[t].size(), Eq(builds_per_thread));
+    for (size_t rep = 0; rep < builds_per_thread; ++rep) {
+      EXPECT_THAT(results[t][rep], DoubleEq(refs[(t + rep) % funcs.size()](0.5)))
+          << funcs[(t + rep) % funcs.size()] << " on thread " << t;
+    }
+  }
+}
+
 }  // namespace
 }  // namespace testing
 }  // namespace tile
@@ -0,0 +1,92 @@
+// Copyright 2018 Intel Corporation.
+
+#include "tile/hal/cpu/loader.h"
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <utility>
+
+#include "base/util/error.h"
+#include "tile/hal/cpu/cpu.pb.h"
+#include "tile/hal/cpu/library.h"
+#include "tile/hal/cpu/object_cache.h"
+#include "tile/hal/cpu/runtime.h"
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+
+std::shared_ptr<llvm::ExecutionEngine> LoadObject(std::unique_ptr<llvm::MemoryBuffer> object) {
+  auto obj = llvm::object::ObjectFile::createObjectFile(object->getMemBufferRef());
+  if (!obj) {
+    throw error::DataLoss{"Unable to read CPU object: " + obj.getError().message()};
+  }
+  // MCJIT needs a module to create an engine, but all of the code comes from the
+  // object file, so the module is left empty.
+  auto context = std::make_shared<llvm::LLVMContext>();
+  std::unique_ptr<llvm::Module> module(new llvm::Module("cpu_object", *context));
+  module->setTargetTriple(ObjectCache::HostTriple());
+  std::string errStr;
+  std::unique_ptr<llvm::RuntimeDyld::SymbolResolver> rez(new Runtime);
+  llvm::ExecutionEngine* raw_ee = llvm::EngineBuilder(std::move(module))
+                                     .setErrorStr(&errStr)
+                                     .setEngineKind(llvm::EngineKind::JIT)
+                                     .setSymbolResolver(std::move(rez))
+                                     .create();
+  std::shared_ptr<llvm::ExecutionEngine> ee = OwnEngine(raw_ee, std::move(context));
+  if (!ee) {
+    throw error::Internal{"Failed to create ExecutionEngine: " + errStr};
+  }
+  ee->addObjectFile(llvm::object::OwningBinary<llvm::object::ObjectFile>(std::move(obj.get()), std::move(object)));
+  ee->finalizeObject();
+  return ee;
+}
+
+std::shared_ptr<llvm::ExecutionEngine> OwnEngine(llvm::ExecutionEngine* ee,
+                                                 std::shared_ptr<llvm::LLVMContext> context) {
+  if (!ee) {
+    return nullptr;
+  }
+  // The deleter holds the context, so it's released once the engine has been deleted.
+  return std::shared_ptr<llvm::ExecutionEngine>(ee, [context](llvm::ExecutionEngine* engine) { delete engine; });
+}
+
+boost::future<std::unique_ptr<hal::Library>> Loader::Deserialize(const context::Context& ctx,
+                                                                  const std::string& serialized_executable,
+                                                                  const std::vector<lang::KernelInfo>& info) {
+  context::Activity activity{ctx, "tile::hal::cpu::Deserialize"};
+  proto::Library pb;
+  if (!pb.ParseFromString(serialized_executable)) {
+    throw error::DataLoss{"Unable to parse serialized CPU library"};
+  }
+  if (pb.triple() != ObjectCache::HostTriple() || pb.cpu() != ObjectCache::HostCPU()) {
+    throw error::FailedPrecondition{"Serialized CPU library was built for " + pb.triple() + " (" + pb.cpu() +
+                                    "), not for this host"};
+  }
+  if (static_cast<std::size_t>(pb.kernels_size()) != info.size()) {
+    throw error::InvalidArgument{"Serialized CPU library does not match the supplied kernels"};
+  }
+  std::vector<std::shared_ptr<llvm::ExecutionEngine>> engines;
+  std::vector<std::string> objects;
+  for (std::size_t kidx = 0; kidx < info.size(); ++kidx) {
+    const auto& kobj = pb.kernels(kidx);
+    if (kobj.kname() != info[kidx].kname) {
+      throw error::InvalidArgument{"Serialized CPU library kernel " + kobj.kname() + " does not match " +
+                                   info[kidx].kname};
+    }
+    engines.emplace_back(LoadObject(llvm::MemoryBuffer::getMemBufferCopy(kobj.object(), kobj.kname())));
+    objects.emplace_back(kobj.object());
+  }
+  std::unique_ptr<hal::Library> lib(new cpu::Library(engines, std::move(objects), info));
+  return boost::make_ready_future<>(std::move(lib));
+}
+
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
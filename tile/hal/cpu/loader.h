@@ -0,0 +1,43 @@
+// Copyright 2018 Intel Corporation.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tile/base/hal.h"
+
+namespace llvm {
+class ExecutionEngine;
+class LLVMContext;
+class MemoryBuffer;
+}  // namespace llvm
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+
+// Loader restores libraries produced by cpu::Library::Serialize, relocating
+// the saved object code without rerunning LLVM code generation.
+class Loader final : public hal::Loader {
+ public:
+  boost::future<std::unique_ptr<hal::Library>> Deserialize(const context::Context& ctx,
+                                                           const std::string& serialized_executable,
+                                                           const std::vector<lang::KernelInfo>& info) final;
+};
+
+// Creates an execution engine from a relocatable object file.
+std::shared_ptr<llvm::ExecutionEngine> LoadObject(std::unique_ptr<llvm::MemoryBuffer> object);
+
+// Takes ownership of an execution engine along with the LLVM context its
+// module was created in, which is destroyed after the engine.  Each engine has
+// a context of its own, so that kernels can be compiled concurrently.
+std::shared_ptr<llvm::ExecutionEngine> OwnEngine(llvm::ExecutionEngine* ee,
+                                                 std::shared_ptr<llvm::LLVMContext> context);
+
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
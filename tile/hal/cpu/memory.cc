@@ -2,22 +2,60 @@
 
 #include "tile/hal/cpu/memory.h"
 
+#include <algorithm>
+#include <ratio>
 #include <utility>
 
+#include "base/util/logging.h"
 #include "tile/hal/cpu/arena.h"
 #include "tile/hal/cpu/buffer.h"
+#include "tile/hal/cpu/host_memory.h"
 
 namespace vertexai {
 namespace tile {
 namespace hal {
 namespace cpu {
 
+namespace {
+
+// Used if the host memory can't be determined.
+constexpr std::uint64_t kDefaultSizeGoal = 16 * std::giga::num;
+
+}  // namespace
+
+Memory::Memory() : size_goal_{QueryHostMemory().Budget()} {
+  if (!size_goal_) {
+    LOG(WARNING) << "Unable to determine the host memory size; assuming " << kDefaultSizeGoal << " bytes";
+    size_goal_ = kDefaultSizeGoal;
+  }
+  VLOG(1) << "CPU memory size goal: " << size_goal_ << " bytes";
+}
+
+void Memory::Initialize(const hal::proto::CpuSettings& settings) {
+  // Validate the alignment up front, rather than on the first allocation.
+  Arena::Alignment(settings);
+  settings_ = settings;
+}
+
+std::uint64_t Memory::size_goal() const {
+  if (settings_.requery_memory()) {
+    std::uint64_t available = QueryHostMemory().Available();
+    if (available) {
+      VLOG(1) << "CPU memory currently available: " << available << " bytes";
+      return std::min(available, size_goal_);
+    }
+  }
+  return size_goal_;
+}
+
+std::size_t Memory::ArenaBufferAlignment() const { return Arena::Alignment(settings_); }
+
 std::shared_ptr<hal::Buffer> Memory::MakeBuffer(std::uint64_t size, BufferAccessMask /* access */) {
-  return std::make_shared<Arena>(size)->MakeBuffer(0, size);
+  return std::make_shared<Arena>(size, settings_)->MakeBuffer(0, size);
 }
 
 std::shared_ptr<hal::Arena> Memory::MakeArena(std::uint64_t size, BufferAccessMask /* access */) {
-  return std::make_shared<Arena>(size);
+  return std::make_shared<Arena>(size, settings_);
 }
 
 }  // namespace cpu
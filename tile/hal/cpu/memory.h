@@ -5,7 +5,6 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
-#include <ratio>
 
 #include "tile/base/hal.h"
 
@@ -16,17 +15,21 @@ namespace cpu {
 
 class Memory final : public hal::Memory {
  public:
-  Memory() {}
+  Memory();
 
-  std::uint64_t size_goal() const final {
-    // TODO: Actually query the system physical memory size.
-    return 16 * std::giga::num;
-  }
+  // Applies the arena allocation and memory query settings; arenas created afterwards use them.
+  void Initialize(const hal::proto::CpuSettings& settings);
+
+  std::uint64_t size_goal() const final;
   BufferAccessMask AllowedAccesses() const final { return BufferAccessMask::ALL; }
-  std::size_t ArenaBufferAlignment() const final { return alignof(long double); /* TODO: Use std::max_align_t */ }
+  std::size_t ArenaBufferAlignment() const final;
 
   std::shared_ptr<hal::Buffer> MakeBuffer(std::uint64_t size, BufferAccessMask access) final;
   std::shared_ptr<hal::Arena> MakeArena(std::uint64_t size, BufferAccessMask access) final;
+
+ private:
+  hal::proto::CpuSettings settings_;
+  std::uint64_t size_goal_;
 };
 
 }  // namespace cpu
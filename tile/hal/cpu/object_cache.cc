@@ -0,0 +1,235 @@
+// Copyright 2018 Intel Corporation.
+
+#include "tile/hal/cpu/object_cache.h"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "base/util/env.h"
+#include "base/util/logging.h"
+#include "base/util/perf_counter.h"
+#include "tile/lang/fnv1a64.h"
+#include "tile/lang/semprinter.h"
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+static PerfCounter cpu_object_cache_hits("cpu_object_cache_hits");
+static PerfCounter cpu_object_cache_misses("cpu_object_cache_misses");
+static PerfCounter cpu_object_cache_evictions("cpu_object_cache_evictions");
+
+std::string ReadFile(const fs::path& path) {
+  fs::ifstream ifs;
+  ifs.open(path, std::ios::binary);
+  auto it = std::istreambuf_iterator<char>(ifs);
+  auto it_end = std::istreambuf_iterator<char>();
+  std::string contents(it, it_end);
+  if (ifs.bad()) {
+    throw std::runtime_error("Unable to fully read file: " + path.string());
+  }
+  return contents;
+}
+
+// Writes the file under a temporary name and then renames it into place, so
+// that concurrent processes sharing the cache never observe partial objects.
+void WriteFileAtomic(const fs::path& path, const std::string& contents) {
+  fs::path tmp_path = path;
+  tmp_path += fs::unique_path(".%%%%-%%%%-%%%%-%%%%.tmp");
+  {
+    fs::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+    ofs.write(contents.data(), contents.size());
+    if (!ofs) {
+      throw std::runtime_error("Unable to write file: " + tmp_path.string());
+    }
+  }
+  fs::rename(tmp_path, path);
+}
+
+// A persisted entry is a single file holding the key's length, a newline, the
+// key, and then the object, so that the key and object are always replaced
+// together.
+std::string EncodeEntry(const std::string& key, const std::string& object) {
+  return std::to_string(key.size()) + "\n" + key + object;
+}
+
+// Returns the object from an encoded entry, or nullptr if the entry is
+// malformed or was stored under a different key.
+std::unique_ptr<llvm::MemoryBuffer> DecodeEntry(const std::string& entry, const std::string& key) {
+  auto newline = entry.find('\n');
+  if (newline == std::string::npos || newline == 0 || newline > 20) {
+    return nullptr;
+  }
+  std::string key_size = entry.substr(0, newline);
+  if (key_size.find_first_not_of("0123456789") != std::string::npos ||
+      std::strtoull(key_size.c_str(), nullptr, 10) != key.size()) {
+    return nullptr;
+  }
+  std::size_t obj_offset = newline + 1 + key.size();
+  if (entry.size() <= obj_offset || entry.compare(newline + 1, key.size(), key) != 0) {
+    return nullptr;
+  }
+  return llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(entry.data() + obj_offset, entry.size() - obj_offset));
+}
+
+std::string HostFeatures() {
+  llvm::StringMap<bool> features;
+  std::ostringstream result;
+  if (llvm::sys::getHostCPUFeatures(features)) {
+    std::map<std::string, bool> sorted;
+    for (const auto& feature : features) {
+      sorted.emplace(feature.getKey().str(), feature.getValue());
+    }
+    for (const auto& feature : sorted) {
+      result << (feature.second ? '+' : '-') << feature.first << ',';
+    }
+  }
+  return result.str();
+}
+
+}  // namespace
+
+constexpr std::size_t ObjectCache::kDefaultMaxEntries;
+
+ObjectCache::ObjectCache(std::size_t max_entries, const std::string& dirname, bool use_env)
+    : max_entries_{max_entries}, dirname_{dirname} {
+  if (dirname_.empty() && use_env) {
+    dirname_ = env::Get("PLAIDML_CPU_OBJECT_CACHE");
+  }
+  if (dirname_.empty()) {
+    return;
+  }
+  boost::system::error_code ec;
+  fs::create_directories(dirname_, ec);
+  if (ec || !fs::is_directory(dirname_)) {
+    LOG(WARNING) << "Unable to use CPU object cache directory " << dirname_ << ": " << ec.message();
+    dirname_.clear();
+    return;
+  }
+  VLOG(1) << "Using CPU object cache directory: " << dirname_;
+}
+
+ObjectCache* ObjectCache::Instance() {
+  static ObjectCache instance{kDefaultMaxEntries, "", true};
+  return &instance;
+}
+
+const std::string& ObjectCache::HostTriple() {
+  static const std::string triple = llvm::sys::getProcessTriple();
+  return triple;
+}
+
+const std::string& ObjectCache::HostCPU() {
+  static const std::string cpu = llvm::sys::getHostCPUName().str();
+  return cpu;
+}
+
+std::string ObjectCache::Key(const lang::KernelInfo& ki, const hal::proto::HardwareSettings& settings) {
+  // The kernel key identifies the contraction but not the tiling or the kernel name, both of which change the
+  // generated code, so the printed kernel function is included as well.
+  static const std::string host = HostTriple() + ";" + HostCPU() + ";" + HostFeatures();
+  std::ostringstream key;
+  key << host << "\n";
+  key << settings.ShortDebugString() << "\n";
+  key << ki.kname << "\n";
+  key << ki.key << "\n";
+  if (ki.kfunc) {
+    sem::Print emit(*ki.kfunc);
+    key << emit.str();
+  }
+  return key.str();
+}
+
+std::string ObjectCache::PathFor(const std::string& key) const {
+  std::ostringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << fnv1a64::hash(key.c_str()) << ".cpuobj";
+  return (fs::path(dirname_) / name.str()).string();
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectCache::Lookup(const std::string& key) {
+  {
+    std::lock_guard<std::mutex> lock{mu_};
+    auto it = objects_.find(key);
+    if (it != objects_.end()) {
+      cpu_object_cache_hits.inc();
+      lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+      return llvm::MemoryBuffer::getMemBufferCopy(it->second.object);
+    }
+  }
+  if (dirname_.empty()) {
+    cpu_object_cache_misses.inc();
+    return nullptr;
+  }
+  try {
+    // The file name is derived from a hash of the key; the full key is stored
+    // in the file to guard against collisions.
+    fs::path path = PathFor(key);
+    if (fs::is_regular_file(path)) {
+      auto buffer = DecodeEntry(ReadFile(path), key);
+      if (buffer) {
+        VLOG(3) << "Read CPU object from cache: " << path;
+        cpu_object_cache_hits.inc();
+        return buffer;
+      }
+    }
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "Unable to read CPU object cache: " << ex.what();
+  }
+  cpu_object_cache_misses.inc();
+  return nullptr;
+}
+
+void ObjectCache::Store(const std::string& key, const std::string& object) {
+  if (dirname_.empty()) {
+    StoreInMemory(key, object);
+    return;
+  }
+  try {
+    WriteFileAtomic(PathFor(key), EncodeEntry(key, object));
+    VLOG(3) << "Wrote CPU object to cache: " << PathFor(key);
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "Unable to write CPU object cache: " << ex.what();
+    StoreInMemory(key, object);
+  }
+}
+
+std::size_t ObjectCache::size() const {
+  std::lock_guard<std::mutex> lock{mu_};
+  return objects_.size();
+}
+
+void ObjectCache::StoreInMemory(const std::string& key, const std::string& object) {
+  if (!max_entries_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock{mu_};
+  if (objects_.count(key)) {
+    return;
+  }
+  lru_.push_front(key);
+  objects_.emplace(key, Entry{object, lru_.begin()});
+  while (objects_.size() > max_entries_) {
+    objects_.erase(lru_.back());
+    lru_.pop_back();
+    cpu_object_cache_evictions.inc();
+  }
+}
+
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,76 @@
+// Copyright 2018 Intel Corporation.
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "tile/base/hal.h"
+
+namespace llvm {
+class MemoryBuffer;
+}  // namespace llvm
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+
+// ObjectCache is a content-addressed store of the relocatable object code
+// produced by the CPU compiler.  If a directory is supplied, entries are
+// persisted there so that new processes can skip the LLVM code generation
+// pipeline entirely; otherwise (or if the directory can't be written) they are
+// kept in memory.  The number of in-memory entries is bounded, evicting the
+// least recently used.
+class ObjectCache {
+ public:
+  static constexpr std::size_t kDefaultMaxEntries = 256;
+
+  // Construct a cache, if given a directory, use that for storage
+  explicit ObjectCache(std::size_t max_entries = kDefaultMaxEntries, const std::string& dirname = "",
+                       bool use_env = false);
+
+  // Get the 'singleton' instance, persisting to PLAIDML_CPU_OBJECT_CACHE if set
+  static ObjectCache* Instance();
+
+  // Builds the cache key for a kernel: the kernel's own key and generated
+  // code, the hardware settings it was compiled with, and the host target.
+  static std::string Key(const lang::KernelInfo& ki, const hal::proto::HardwareSettings& settings);
+
+  // The target triple and CPU that object code is generated for.
+  static const std::string& HostTriple();
+  static const std::string& HostCPU();
+
+  // Returns the cached object for the key, or nullptr if there is none.
+  std::unique_ptr<llvm::MemoryBuffer> Lookup(const std::string& key);
+
+  // Adds an object to the cache.
+  void Store(const std::string& key, const std::string& object);
+
+  // The number of objects held in memory.
+  std::size_t size() const;
+
+ private:
+  struct Entry {
+    std::string object;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  std::string PathFor(const std::string& key) const;
+  void StoreInMemory(const std::string& key, const std::string& object);
+
+  const std::size_t max_entries_;
+  std::string dirname_;
+  mutable std::mutex mu_;
+  std::unordered_map<std::string, Entry> objects_;
+  std::list<std::string> lru_;  // Most recently used first
+};
+
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
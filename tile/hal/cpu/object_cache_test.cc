@@ -0,0 +1,151 @@
+// Copyright 2018 Intel Corporation.
+
+#include "tile/hal/cpu/object_cache.h"
+
+#include <gmock/gmock.h>
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "tile/lang/fnv1a64.h"
+#include "tile/lang/sembuilder.h"
+
+using ::testing::Eq;
+using ::testing::IsNull;
+using ::testing::Ne;
+using ::testing::NotNull;
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+namespace {
+
+namespace fs = boost::filesystem;
+
+std::string Contents(const std::unique_ptr<llvm::MemoryBuffer>& buffer) {
+  return std::string(buffer->getBufferStart(), buffer->getBufferSize());
+}
+
+class ObjectCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override { dirname_ = fs::temp_directory_path() / fs::unique_path(); }
+
+  void TearDown() override { fs::remove_all(dirname_); }
+
+  // The file a key's entry is persisted in.
+  fs::path PathFor(const std::string& key) {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << fnv1a64::hash(key.c_str()) << ".cpuobj";
+    return dirname_ / name.str();
+  }
+
+  fs::path dirname_;
+};
+
+TEST_F(ObjectCacheTest, KeepsObjectsInMemory) {
+  ObjectCache cache;
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  cache.Store("a", "object a");
+  auto hit = cache.Lookup("a");
+  ASSERT_THAT(hit, NotNull());
+  EXPECT_THAT(Contents(hit), Eq("object a"));
+  EXPECT_THAT(cache.Lookup("b"), IsNull());
+  EXPECT_THAT(cache.size(), Eq(1));
+}
+
+TEST_F(ObjectCacheTest, EvictsLeastRecentlyUsed) {
+  ObjectCache cache{2};
+  cache.Store("a", "object a");
+  cache.Store("b", "object b");
+  EXPECT_THAT(cache.Lookup("a"), NotNull());
+  cache.Store("c", "object c");
+  EXPECT_THAT(cache.size(), Eq(2));
+  EXPECT_THAT(cache.Lookup("a"), NotNull());
+  EXPECT_THAT(cache.Lookup("b"), IsNull());
+  EXPECT_THAT(cache.Lookup("c"), NotNull());
+}
+
+TEST_F(ObjectCacheTest, ZeroEntriesDisablesMemory) {
+  ObjectCache cache{0};
+  cache.Store("a", "object a");
+  EXPECT_THAT(cache.size(), Eq(0));
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+}
+
+TEST_F(ObjectCacheTest, PersistsToDirectory) {
+  {
+    ObjectCache cache{ObjectCache::kDefaultMaxEntries, dirname_.string()};
+    cache.Store("a", "object a");
+    // Persisted entries aren't also held in memory.
+    EXPECT_THAT(cache.size(), Eq(0));
+  }
+  ObjectCache cache{ObjectCache::kDefaultMaxEntries, dirname_.string()};
+  auto hit = cache.Lookup("a");
+  ASSERT_THAT(hit, NotNull());
+  EXPECT_THAT(Contents(hit), Eq("object a"));
+  EXPECT_THAT(cache.Lookup("b"), IsNull());
+}
+
+TEST_F(ObjectCacheTest, RejectsCollidingKey) {
+  ObjectCache cache{ObjectCache::kDefaultMaxEntries, dirname_.string()};
+  cache.Store("a", "object a");
+  // Plant a's entry where b's would go, as if the two keys' hashes collided.
+  fs::copy_file(PathFor("a"), PathFor("b"));
+  EXPECT_THAT(cache.Lookup("b"), IsNull());
+  EXPECT_THAT(cache.Lookup("a"), NotNull());
+}
+
+TEST_F(ObjectCacheTest, RejectsMalformedEntries) {
+  ObjectCache cache{ObjectCache::kDefaultMaxEntries, dirname_.string()};
+  auto write = [this](const std::string& key, const std::string& contents) {
+    fs::ofstream ofs{PathFor(key), std::ios::binary | std::ios::trunc};
+    ofs << contents;
+  };
+  write("a", "");
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  write("a", "1\na");
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  write("a", "2\nab object");
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  write("a", "x\na object");
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  write("a", "1\na object");
+  auto hit = cache.Lookup("a");
+  ASSERT_THAT(hit, NotNull());
+  EXPECT_THAT(Contents(hit), Eq(" object"));
+}
+
+TEST_F(ObjectCacheTest, KeyCoversNameAndSettings) {
+  using namespace sem::builder;  // NOLINT
+  lang::KernelInfo ki;
+  ki.kname = "kernel_0";
+  ki.key = "contraction";
+  ki.kfunc = std::make_shared<sem::Function>(ki.kname, sem::Type{sem::Type::TVOID},
+                                             sem::Function::params_t{{sem::Type{sem::Type::INDEX}, "n"}},
+                                             _Block({_Declare({sem::Type::INDEX}, "x", _("n") + 1)}));
+  hal::proto::HardwareSettings settings;
+  settings.set_threads(1);
+  std::string key = ObjectCache::Key(ki, settings);
+  EXPECT_THAT(ObjectCache::Key(ki, settings), Eq(key));
+
+  lang::KernelInfo renamed = ki;
+  renamed.kname = "kernel_1";
+  EXPECT_THAT(ObjectCache::Key(renamed, settings), Ne(key));
+
+  hal::proto::HardwareSettings other_settings = settings;
+  other_settings.set_threads(2);
+  EXPECT_THAT(ObjectCache::Key(ki, other_settings), Ne(key));
+}
+
+}  // namespace
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,171 @@
+// Copyright 2018 Intel Corporation.
+
+#include "tile/hal/cpu/parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+namespace {
+
+// Workers claim 1/kChunkDivisor of their remaining range at a time, so that
+// large ranges are processed in large chunks while the tail end of a range is
+// left in small pieces that are cheap to steal.
+constexpr std::size_t kChunkDivisor = 8;
+
+struct Range {
+  std::size_t begin;
+  std::size_t end;
+
+  std::size_t size() const { return end - begin; }
+};
+
+struct Worker {
+  std::mutex mu;
+  std::deque<Range> ranges;
+};
+
+class ParallelForState final {
+ public:
+  ParallelForState(std::size_t iterations, std::size_t workers,
+                   std::function<void(std::size_t, std::size_t)> body,
+                   std::function<void(std::exception_ptr)> on_complete);
+
+  // Runs the worker loop for the indicated worker.
+  void Work(std::size_t self);
+
+ private:
+  bool Claim(std::size_t self, Range* chunk);
+  bool Steal(std::size_t self);
+  void Complete(std::size_t count);
+
+  std::vector<Worker> workers_;
+  std::function<void(std::size_t, std::size_t)> body_;
+  std::function<void(std::exception_ptr)> on_complete_;
+  std::atomic<std::size_t> remaining_;
+  std::mutex error_mu_;
+  std::exception_ptr error_;
+};
+
+ParallelForState::ParallelForState(std::size_t iterations, std::size_t workers,
+                                   std::function<void(std::size_t, std::size_t)> body,
+                                   std::function<void(std::exception_ptr)> on_complete)
+    : workers_(workers), body_{std::move(body)}, on_complete_{std::move(on_complete)}, remaining_{iterations} {
+  // Seed each worker with an equal contiguous share of the iteration space.
+  std::size_t begin = 0;
+  for (std::size_t idx = 0; idx < workers; ++idx) {
+    std::size_t end = begin + (iterations - begin) / (workers - idx);
+    if (begin < end) {
+      workers_[idx].ranges.push_back(Range{begin, end});
+    }
+    begin = end;
+  }
+}
+
+void ParallelForState::Work(std::size_t self) {
+  Range chunk;
+  for (;;) {
+    if (!Claim(self, &chunk)) {
+      if (!Steal(self)) {
+        break;
+      }
+      continue;
+    }
+    try {
+      body_(chunk.begin, chunk.end);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock{error_mu_};
+      if (!error_) {
+        error_ = std::current_exception();
+      }
+    }
+    Complete(chunk.size());
+  }
+}
+
+bool ParallelForState::Claim(std::size_t self, Range* chunk) {
+  Worker& worker = workers_[self];
+  std::lock_guard<std::mutex> lock{worker.mu};
+  if (worker.ranges.empty()) {
+    return false;
+  }
+  Range& front = worker.ranges.front();
+  std::size_t size = std::max<std::size_t>(1, front.size() / kChunkDivisor);
+  *chunk = Range{front.begin, front.begin + size};
+  front.begin += size;
+  if (!front.size()) {
+    worker.ranges.pop_front();
+  }
+  return true;
+}
+
+bool ParallelForState::Steal(std::size_t self) {
+  for (std::size_t offset = 1; offset < workers_.size(); ++offset) {
+    Worker& victim = workers_[(self + offset) % workers_.size()];
+    Range stolen;
+    {
+      std::lock_guard<std::mutex> lock{victim.mu};
+      if (victim.ranges.empty()) {
+        continue;
+      }
+      Range& back = victim.ranges.back();
+      if (back.size() == 1) {
+        stolen = back;
+        victim.ranges.pop_back();
+      } else {
+        std::size_t mid = back.begin + back.size() / 2;
+        stolen = Range{mid, back.end};
+        back.end = mid;
+      }
+    }
+    Worker& worker = workers_[self];
+    std::lock_guard<std::mutex> lock{worker.mu};
+    worker.ranges.push_back(stolen);
+    return true;
+  }
+  return false;
+}
+
+void ParallelForState::Complete(std::size_t count) {
+  if (remaining_.fetch_sub(count) != count) {
+    return;
+  }
+  // This was the final chunk; every other worker has finished its calls to body_.
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock{error_mu_};
+    error = error_;
+  }
+  on_complete_(error);
+}
+
+}  // namespace
+
+void ParallelFor(boost::asio::thread_pool* thread_pool, std::size_t iterations, std::size_t max_workers,
+                 std::function<void(std::size_t begin, std::size_t end)> body,
+                 std::function<void(std::exception_ptr error)> on_complete) {
+  std::size_t workers = std::min(iterations, std::max<std::size_t>(1, max_workers));
+  if (!workers) {
+    on_complete(nullptr);
+    return;
+  }
+  auto state = std::make_shared<ParallelForState>(iterations, workers, std::move(body), std::move(on_complete));
+  for (std::size_t idx = 0; idx < workers; ++idx) {
+    boost::asio::post(*thread_pool, [state, idx]() { state->Work(idx); });
+  }
+}
+
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,35 @@
+// Copyright 2018 Intel Corporation.
+
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+
+#include <boost/asio/thread_pool.hpp>
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+
+// Runs body(begin, end) over contiguous subranges covering [0, iterations),
+// using up to max_workers workers posted to the thread pool.
+//
+// Each worker owns a deque of contiguous ranges.  A worker claims chunks from
+// the front of its own deque, with the chunk size shrinking as its remaining
+// range shrinks; once its deque is empty, it steals the back half of another
+// worker's range.  Uneven iterations therefore migrate to idle workers instead
+// of stalling the whole loop behind the slowest worker.
+//
+// ParallelFor does not block.  on_complete is invoked exactly once, on the
+// thread that finishes the final chunk (or on the calling thread if there is
+// no work), with the first exception thrown by body, if any.
+void ParallelFor(boost::asio::thread_pool* thread_pool, std::size_t iterations, std::size_t max_workers,
+                 std::function<void(std::size_t begin, std::size_t end)> body,
+                 std::function<void(std::exception_ptr error)> on_complete);
+
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
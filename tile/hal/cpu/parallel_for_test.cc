@@ -0,0 +1,96 @@
+// Copyright 2018 Intel Corporation.
+
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/thread_pool.hpp>
+#include <boost/thread/future.hpp>
+
+#include "tile/hal/cpu/parallel_for.h"
+
+using ::testing::Eq;
+
+namespace vertexai {
+namespace tile {
+namespace hal {
+namespace cpu {
+namespace {
+
+// Runs ParallelFor and waits for it to complete.
+void RunParallelFor(boost::asio::thread_pool* pool, std::size_t iterations, std::size_t workers,
+                    std::function<void(std::size_t, std::size_t)> body) {
+  boost::promise<void> done;
+  ParallelFor(pool, iterations, workers, std::move(body), [&done](std::exception_ptr error) {
+    if (!error) {
+      done.set_value();
+      return;
+    }
+    try {
+      std::rethrow_exception(error);
+    } catch (...) {
+      done.set_exception(boost::current_exception());
+    }
+  });
+  done.get_future().get();
+}
+
+TEST(ParallelFor, VisitsEveryIterationOnce) {
+  boost::asio::thread_pool pool{4};
+  for (std::size_t iterations : {0, 1, 3, 4, 17, 1000, 65536}) {
+    std::vector<std::atomic<int>> visits(iterations);
+    RunParallelFor(&pool, iterations, 4, [&visits](std::size_t begin, std::size_t end) {
+      for (std::size_t i = begin; i < end; ++i) {
+        visits[i]++;
+      }
+    });
+    for (std::size_t i = 0; i < iterations; ++i) {
+      EXPECT_THAT(visits[i].load(), Eq(1)) << "iteration " << i << " of " << iterations;
+    }
+  }
+}
+
+TEST(ParallelFor, ReportsExceptions) {
+  boost::asio::thread_pool pool{4};
+  std::atomic<std::size_t> count{0};
+  EXPECT_THROW(RunParallelFor(&pool, 100, 4,
+                              [&count](std::size_t begin, std::size_t end) {
+                                count += end - begin;
+                                if (begin <= 50 && 50 < end) {
+                                  throw std::runtime_error{"failed"};
+                                }
+                              }),
+               std::runtime_error);
+  EXPECT_THAT(count.load(), Eq(100));
+}
+
+// Blocks the worker holding the first chunk until every other iteration has run, which only completes if the other
+// worker steals the remainder of the blocked worker's range.
+TEST(ParallelFor, IdleWorkersStealFromBusyWorkers) {
+  boost::asio::thread_pool pool{2};
+  const std::size_t iterations = 1024;
+  std::mutex mu;
+  std::condition_variable cv;
+  std::size_t completed = 0;
+  bool stolen = false;
+  RunParallelFor(&pool, iterations, 2, [&](std::size_t begin, std::size_t end) {
+    std::unique_lock<std::mutex> lock{mu};
+    if (begin == 0) {
+      stolen = cv.wait_for(lock, std::chrono::seconds{30}, [&]() { return completed == iterations - end; });
+    }
+    completed += end - begin;
+    cv.notify_all();
+  });
+  EXPECT_TRUE(stolen);
+}
+
+}  // namespace
+}  // namespace cpu
+}  // namespace hal
+}  // namespace tile
+}  // namespace vertexai
@@ -2,6 +2,10 @@
 
 #include "tile/hal/cpu/result.h"
 
+#include <utility>
+
+#include "base/util/logging.h"
+
 namespace vertexai {
 namespace tile {
 namespace hal {
@@ -17,6 +21,14 @@ Result::Result(const context::Context& ctx, const char* verb, std::chrono::high_
                std::chrono::high_resolution_clock::time_point end)
     : ctx_{ctx}, verb_{verb}, start_{start}, end_{end} {}
 
+Result::Result(const context::Context& ctx, const char* verb, std::chrono::high_resolution_clock::time_point start,
+               std::chrono::high_resolution_clock::time_point end, proto::RunInfo run_info)
+    : ctx_{ctx},
+      verb_{verb},
+      start_{start},
+      end_{end},
+      run_info_{std::make_unique<proto::RunInfo>(std::move(run_info))} {}
+
 std::chrono::high_resolution_clock::duration Result::GetDuration() const { return end_ - start_; }
 
 void Result::LogStatistics() const {
@@ -24,7 +36,13 @@ void Result::LogStatistics() const {
   pb::Duration end;
   context::StdDurationToProto(&start, start_.time_since_epoch());
   context::StdDurationToProto(&end, end_.time_since_epoch());
-  kSystemClock.LogActivity(ctx_, verb_, start, end);
+  if (run_info_) {
+    VLOG(2) << "Ran " << run_info_->kname() << ": dur=" << GetDuration().count() << " groups=" << run_info_->groups()
+            << " workers=" << run_info_->workers() << " overlapped=" << run_info_->overlapped_kernels();
+    kSystemClock.LogActivity(ctx_, verb_, start, end, *run_info_);
+  } else {
+    kSystemClock.LogActivity(ctx_, verb_, start, end);
+  }
 }
 
 }  // namespace cpu
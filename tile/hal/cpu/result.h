@@ -3,8 +3,10 @@
 #pragma once
 
 #include <chrono>
+#include <memory>
 
 #include "tile/base/hal.h"
+#include "tile/hal/cpu/cpu.pb.h"
 
 namespace vertexai {
 namespace tile {
@@ -16,6 +18,10 @@ class Result final : public hal::Result {
   Result(const context::Context& ctx, const char* verb, std::chrono::high_resolution_clock::time_point start,
          std::chrono::high_resolution_clock::time_point end);
 
+  // Constructs a kernel execution result carrying the supplied run statistics.
+  Result(const context::Context& ctx, const char* verb, std::chrono::high_resolution_clock::time_point start,
+         std::chrono::high_resolution_clock::time_point end, proto::RunInfo run_info);
+
   std::chrono::high_resolution_clock::duration GetDuration() const final;
   void LogStatistics() const final;
 
@@ -24,6 +30,7 @@ class Result final : public hal::Result {
   const char* verb_;
   std::chrono::high_resolution_clock::time_point start_;
   std::chrono::high_resolution_clock::time_point end_;
+  std::unique_ptr<proto::RunInfo> run_info_;
 };
 
 }  // namespace cpu
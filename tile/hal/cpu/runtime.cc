@@ -4,6 +4,9 @@
 
 #include <llvm/Support/DynamicLibrary.h>
 
+#include <map>
+#include <mutex>
+
 #include <half.hpp>
 
 namespace vertexai {
@@ -29,10 +32,14 @@ SymbolInfo symInfo(T ptr) {
 }
 
 SymbolInfo Runtime::findSymbol(const std::string& name) {
+  // Kernels may be compiled (and loaded) on several threads at once, and each
+  // resolves its symbols through this table, so it's guarded by a lock.
+  static std::mutex mu;
   static std::map<std::string, SymbolInfo> symbols{
       {"Barrier", symInfo(rt::barrier)},   {"__gnu_h2f_ieee", symInfo(rt::h2f)}, {"__gnu_f2h_ieee", symInfo(rt::f2h)},
       {"___truncsfhf2", symInfo(rt::f2h)}, {"___extendhfsf2", symInfo(rt::h2f)},
   };
+  std::lock_guard<std::mutex> lock{mu};
   auto loc = symbols.find(name);
   if (loc != symbols.end()) {
     return loc->second;
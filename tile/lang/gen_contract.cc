@@ -29,11 +29,11 @@ namespace {
 const size_t SELECT_THRESHOLD = 32;
 }  // namespace
 
-static std::map<AggregationOp, sem::LimitConst::Which> INITIAL_VALUES = {{AggregationOp::MAX, sem::LimitConst::MIN},
-                                                                         {AggregationOp::MIN, sem::LimitConst::MAX},
-                                                                         {AggregationOp::ASSIGN, sem::LimitConst::ZERO},
-                                                                         {AggregationOp::PROD, sem::LimitConst::ONE},
-                                                                         {AggregationOp::SUM, sem::LimitConst::ZERO}};
+// Read concurrently when kernels are generated in parallel, so this must not be modified (e.g. by operator[]).
+static const std::map<AggregationOp, sem::LimitConst::Which> INITIAL_VALUES = {
+    {AggregationOp::MAX, sem::LimitConst::MIN},     {AggregationOp::MIN, sem::LimitConst::MAX},
+    {AggregationOp::ASSIGN, sem::LimitConst::ZERO}, {AggregationOp::PROD, sem::LimitConst::ONE},
+    {AggregationOp::SUM, sem::LimitConst::ZERO},    {AggregationOp::NONE, sem::LimitConst::MIN}};
 
 static sem::ExprPtr combine(const CombinationOp& co, sem::ExprPtr rhs, sem::ExprPtr lhs) {
   using namespace sem::builder;  // NOLINT
@@ -196,7 +196,7 @@ KernelInfo GenContract(const string& kname, const DirectSettings& settings, cons
     sem::Type type = {sem::Type::VALUE, op.agg_type, op.agg_vec};
 
     // Initalize local output variable to correct value based on agg_type
-    auto tc = INITIAL_VALUES[op.agg_op];
+    auto tc = INITIAL_VALUES.at(op.agg_op);
     sem::ExprPtr agg_base = _LimitConst(tc, op.agg_type);
     if (type.vec_width > 1) {
       agg_base = _Cast(type, agg_base);
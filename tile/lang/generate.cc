@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cctype>
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <set>
@@ -9,12 +10,14 @@
 #include <utility>
 
 #include "base/util/logging.h"
+#include "base/util/parallel.h"
 #include "tile/lang/compile.h"
 #include "tile/lang/flat.h"
 #include "tile/lang/fpconv.h"
 #include "tile/lang/gen_contract.h"
 #include "tile/lang/gen_special.h"
 #include "tile/lang/gen_trivial.h"
+#include "tile/lang/kernel_cache.h"
 #include "tile/lang/ops.h"
 #include "tile/lang/parser.h"
 #include "tile/lang/simplifier.h"
@@ -68,7 +71,7 @@ static bool NeedsZero(const FlatContraction& flat, const TensorShape& ts) {
 static KernelInfo GenerateContractionKernel(const std::string& kname, const HardwareSettings& settings,
                                             const Contraction* c, const FlatContraction& flat, const TileOption& option,
                                             const std::vector<std::string>& inputs, const Bindings& vars,
-                                            const VarRewrites& var_rewrites) {
+                                            const std::vector<std::string>& kernel_inputs) {
   proto::PerfStats perf = ComputeTileStats(settings, flat, option.shape);
   KernelInfo ki = GenContract(kname, settings, flat, option.shape, vars, inputs, perf);
   ki.outputs = flat.kernel_outputs;
@@ -76,14 +79,7 @@ static KernelInfo GenerateContractionKernel(const std::string& kname, const Hard
   ki.settings = settings;
   ki.flat = flat;
   ki.tile = option;
-  for (const auto& input : inputs) {
-    if (vars.at(input).tag == Binding::TENSOR) {
-      ki.inputs.emplace_back(var_rewrites.Lookup(input));
-    }
-  }
-  for (const auto& op_input : flat.post_op_inputs) {
-    ki.inputs.emplace_back(var_rewrites.Lookup(op_input.name));
-  }
+  ki.inputs = kernel_inputs;
   ki.tot_bytes = perf.work_groups() * ((perf.inner_loops() * perf.mem_read()) + perf.mem_write());
   ki.tot_flops = perf.true_ops();
   *(ki.info.mutable_perf_stats()) = perf;
@@ -226,10 +222,23 @@ static bool SimplifyFlat(FlatContraction* flat) {
   return false;
 }
 
+// A contraction kernel found by the walk over the program's operations.  Finding kernels depends on the order of the
+// operations (each one may unify later ones into itself), but tiling and generating a kernel's code depend only on
+// the kernel itself, so those are deferred until the walk is complete and then run concurrently.
+struct PendingKernel {
+  std::size_t slot;                        // The kernel's index in KernelList::kernels
+  const Contraction* c;                    // The kernel's contraction, or nullptr if it's purely elementwise
+  FlatContraction flat;                    // The flattened contraction, including unified elementwise operations
+  std::string kname;                       // The kernel's name
+  std::vector<std::string> inputs;         // The contraction's inputs
+  std::vector<std::string> kernel_inputs;  // The kernel's inputs, rewritten as of when the kernel was found
+  std::string flat_key;                    // The flattened contraction's cache key
+  std::size_t source;                      // The pending kernel whose code this one reuses, or its own index
+};
+
 static void ContractionWrap(KernelList& r, const Contraction* c, FlatContraction flat,  // NOLINT(runtime/references)
-                            const std::string& kname, const HardwareSettings& settings, const Bindings& vars,
-                            size_t tile_trials, const VarRewrites& var_rewrites, const TileOptimizer& optimizer,
-                            std::map<std::string, KernelInfo>* flat_cache) {
+                            const std::string& kname, const Bindings& vars, const VarRewrites& var_rewrites,
+                            std::vector<PendingKernel>* pending) {
   if (!flat.generate_contraction && !flat.post_ops.size()) {
     // The kernel consists entirely of elided elementwise operations; nothing to do.
     return;
@@ -252,57 +261,124 @@ static void ContractionWrap(KernelList& r, const Contraction* c, FlatContraction
       first = false;
     }
   }
-  // Flatten out needless dimensions
-  while (SimplifyFlat(&flat)) {
+  std::vector<std::string> kernel_inputs;
+  for (const auto& input : inputs) {
+    if (vars.at(input).tag == Binding::TENSOR) {
+      kernel_inputs.emplace_back(var_rewrites.Lookup(input));
+    }
   }
-  // Do memory based tile optimization
-  for (auto vec_size = settings.vec_size; flat.agg_vec == 1 && 1 < vec_size; vec_size /= 2) {
-    flat = Vectorize(flat, vec_size);
+  for (const auto& op_input : flat.post_op_inputs) {
+    kernel_inputs.emplace_back(var_rewrites.Lookup(op_input.name));
   }
-  std::string flat_key = flat.CacheKeyString(vars);
-  auto it = flat_cache->find(flat_key);
-  if (it != flat_cache->end()) {
-    IVLOG(2, "Cache key: " << flat_key << ", Hit!");
-    r.kernels.emplace_back(it->second);
+  PendingKernel pk{r.kernels.size(), c, std::move(flat), kname, std::move(inputs), std::move(kernel_inputs), "",
+                   pending->size()};
+  pending->emplace_back(std::move(pk));
+  r.kernels.emplace_back();  // Filled in by GenerateContractionKernels
+}
 
-    auto update_kernel_info = [&](KernelInfo& ki) {
-      ki.outputs = flat.kernel_outputs;
-      ki.inputs.clear();
-      for (const auto& input : inputs) {
-        if (vars.at(input).tag == Binding::TENSOR) {
-          ki.inputs.emplace_back(var_rewrites.Lookup(input));
-        }
-      }
-      for (const auto& op_input : flat.post_op_inputs) {
-        ki.inputs.emplace_back(var_rewrites.Lookup(op_input.name));
+static void GenerateContractionKernels(KernelList* r, std::vector<PendingKernel>* pending,
+                                       const HardwareSettings& settings, const Bindings& vars, size_t tile_trials,
+                                       const TileOptimizer& optimizer) {
+  // Registered cost models aren't known to be safe to call concurrently, so with them, kernels are tiled serially.
+  auto for_each = [&optimizer](std::size_t count, const std::function<void(std::size_t)>& func) {
+    if (optimizer.has_models()) {
+      for (std::size_t i = 0; i < count; ++i) {
+        func(i);
       }
-    };
-
-    auto& ki = r.kernels.back();
-    update_kernel_info(ki);
-    for (KernelInfo& candidate : ki.candidates) {
-      update_kernel_info(candidate);
+    } else {
+      ParallelForEach(count, func);
     }
+  };
 
-    return;
+  ParallelForEach(pending->size(), [&](std::size_t i) {
+    auto& pk = (*pending)[i];
+    // Flatten out needless dimensions
+    while (SimplifyFlat(&pk.flat)) {
+    }
+    // Do memory based tile optimization
+    for (auto vec_size = settings.vec_size; pk.flat.agg_vec == 1 && 1 < vec_size; vec_size /= 2) {
+      pk.flat = Vectorize(pk.flat, vec_size);
+    }
+    pk.flat_key = pk.flat.CacheKeyString(vars);
+  });
+
+  // Kernels with identical flattened contractions share the code of the first of them, as found in program order.
+  std::vector<std::size_t> sources;
+  std::map<std::string, std::size_t> flat_cache;
+  for (std::size_t i = 0; i < pending->size(); ++i) {
+    auto& pk = (*pending)[i];
+    auto inserted = flat_cache.emplace(pk.flat_key, i);
+    pk.source = inserted.first->second;
+    if (inserted.second) {
+      sources.push_back(i);
+    }
   }
-  IVLOG(2, "Cache key: " << flat_key << ", Miss!");
+  IVLOG(2, "Generating " << sources.size() << " of " << pending->size() << " contraction kernels");
+
+  auto update_kernel_info = [](const PendingKernel& pk, KernelInfo* ki) {
+    ki->outputs = pk.flat.kernel_outputs;
+    ki->inputs = pk.kernel_inputs;
+    ki->flat = pk.flat;
+    ki->safe_self_aliases = pk.flat.safe_self_aliases;
+    for (KernelInfo& candidate : ki->candidates) {
+      candidate.outputs = pk.flat.kernel_outputs;
+      candidate.inputs = pk.kernel_inputs;
+      candidate.flat = pk.flat;
+      candidate.safe_self_aliases = pk.flat.safe_self_aliases;
+    }
+  };
+
+  // Kernels generated by other programs are shared through the process-wide cache.  Its key doesn't capture
+  // registered cost models, so it's only used with the built-in tile optimizer.
+  bool use_kernel_cache = !optimizer.has_models();
+  for_each(sources.size(), [&](std::size_t i) {
+    const auto& pk = (*pending)[sources[i]];
+    KernelInfo* primary = &r->kernels[pk.slot];
+    std::string kernel_key;
+    if (use_kernel_cache) {
+      kernel_key = KernelCache::Key(pk.flat_key, settings, tile_trials);
+      auto cached = KernelCache::Instance()->Lookup(kernel_key, pk.kname);
+      if (cached) {
+        IVLOG(2, "Cache key: " << pk.flat_key << ", Process-wide hit!");
+        *primary = std::move(*cached);
+        update_kernel_info(pk, primary);
+        return;
+      }
+    }
+    IVLOG(2, "Cache key: " << pk.flat_key << ", Miss!");
 
-  IVLOG(4, "Optimizing " << kname);
-  auto options = optimizer.OptionsFor(kname, settings, flat, tile_trials);
+    IVLOG(4, "Optimizing " << pk.kname);
+    boost::optional<TileOptions> options;
+    if (use_kernel_cache) {
+      options = KernelCache::Instance()->LookupOptions(kernel_key);
+    }
+    if (!options) {
+      options = optimizer.OptionsFor(pk.kname, settings, pk.flat, tile_trials);
+    }
 
-  KernelInfo primary;
-  for (size_t i = 0; i < options.size(); i++) {
-    const auto& option = options[i];
-    KernelInfo ki = GenerateContractionKernel(kname, settings, c, flat, option, inputs, vars, var_rewrites);
-    if (i == 0) {
-      primary = ki;
-    } else {
-      primary.candidates.push_back(ki);
+    for (size_t j = 0; j < options->size(); j++) {
+      KernelInfo ki = GenerateContractionKernel(pk.kname, settings, pk.c, pk.flat, (*options)[j], pk.inputs, vars,
+                                                pk.kernel_inputs);
+      if (j == 0) {
+        *primary = std::move(ki);
+      } else {
+        primary->candidates.emplace_back(std::move(ki));
+      }
+    }
+    if (use_kernel_cache) {
+      KernelCache::Instance()->Insert(kernel_key, *primary);
+    }
+  });
+
+  for (std::size_t i = 0; i < pending->size(); ++i) {
+    const auto& pk = (*pending)[i];
+    if (pk.source != i) {
+      IVLOG(2, "Cache key: " << pk.flat_key << ", Hit!");
+      KernelInfo* ki = &r->kernels[pk.slot];
+      *ki = r->kernels[(*pending)[pk.source].slot];
+      update_kernel_info(pk, ki);
     }
   }
-  flat_cache->emplace(flat_key, primary);
-  r.kernels.emplace_back(std::move(primary));
 }
 
 static bool DifferentSize(const Binding& a, const Binding& b) {
@@ -787,7 +863,7 @@ static KernelList Compile(const Program& orig_prog, const ShapeMap& inputs, cons
   size_t knum = 0;
   auto next_kname = [&knum, kid] { return printstring("%s_%zu", kid.c_str(), knum++); };
   time_t last_update = time(nullptr);
-  std::map<std::string, KernelInfo> flat_cache;
+  std::vector<PendingKernel> pending;
   for (size_t i = 0; i < prog.ops.size(); i++) {
     if (time(nullptr) - last_update >= 2) {
       LOG(INFO) << "Analyzing Ops: " << i << " of " << prog.ops.size() << " operations complete";
@@ -819,8 +895,7 @@ static KernelList Compile(const Program& orig_prog, const ShapeMap& inputs, cons
       } else {
         DoUnification(&flat, &computed, &r.var_rewrites, prog, i, ud, vars, inputs, outputs, out_poly, settings);
       }
-      ContractionWrap(r, &op.c, std::move(flat), kname, settings, vars, tile_trials, r.var_rewrites, optimizer,
-                      &flat_cache);
+      ContractionWrap(r, &op.c, std::move(flat), kname, vars, r.var_rewrites, &pending);
       continue;
     }
     // Ignore constants
@@ -922,10 +997,11 @@ static KernelList Compile(const Program& orig_prog, const ShapeMap& inputs, cons
 
     DoUnification(&flat, &computed, &r.var_rewrites, prog, i, ud, vars, inputs, outputs, out_poly, settings);
 
-    ContractionWrap(r, nullptr, std::move(flat), next_kname(), settings, vars, tile_trials, r.var_rewrites, optimizer,
-                    &flat_cache);
+    ContractionWrap(r, nullptr, std::move(flat), next_kname(), vars, r.var_rewrites, &pending);
   }
 
+  GenerateContractionKernels(&r, &pending, settings, vars, tile_trials, optimizer);
+
   // Copy only the relevant typing info across
   for (const KernelInfo& ki : r.kernels) {
     for (const std::string& s : ki.inputs) {
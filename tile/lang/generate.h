@@ -138,6 +138,9 @@ class TileOptimizer {
   TileOptions OptionsFor(const std::string& kname, const HardwareSettings& settings, const FlatContraction& op,
                          size_t max_options) const;
 
+  // Whether any cost models have been registered; if not, the built-in tile optimizer is used.
+  bool has_models() const { return !models_.empty(); }
+
  private:
   std::vector<TileCostFunction> models_;
 };
@@ -0,0 +1,239 @@
+#include "tile/lang/kernel_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "base/util/env.h"
+#include "base/util/json_transfer.h"
+#include "base/util/logging.h"
+#include "base/util/perf_counter.h"
+#include "tile/lang/fnv1a64.h"
+
+namespace vertexai {
+namespace tile {
+namespace lang {
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+static PerfCounter kernel_cache_hits("kernel_cache_hits");
+static PerfCounter kernel_cache_misses("kernel_cache_misses");
+static PerfCounter kernel_cache_evictions("kernel_cache_evictions");
+static PerfCounter kernel_cache_persisted_hits("kernel_cache_persisted_hits");
+
+// Copies a kernel and its candidates, giving each its own function body.
+KernelInfo CopyKernel(const KernelInfo& ki, const std::string* kname) {
+  KernelInfo result = ki;
+  auto copy_one = [kname](KernelInfo* k) {
+    if (k->kfunc) {
+      k->kfunc = sem::Clone(*k->kfunc);
+    }
+    if (kname) {
+      k->kname = *kname;
+      if (k->kfunc) {
+        k->kfunc->name = *kname;
+      }
+      k->info.set_name(*kname);
+    }
+  };
+  copy_one(&result);
+  for (auto& candidate : result.candidates) {
+    copy_one(&candidate);
+  }
+  return result;
+}
+
+// JSON has no representation for infinities, which cost models may produce.
+double Finite(double value) { return std::isfinite(value) ? value : std::numeric_limits<double>::max(); }
+
+}  // namespace
+
+constexpr std::size_t KernelCache::kDefaultMaxEntries;
+
+KernelCache::KernelCache(std::size_t max_entries, const std::string& dirname, bool use_env)
+    : max_entries_{max_entries}, dirname_{dirname} {
+  if (dirname_.empty() && use_env) {
+    dirname_ = env::Get("PLAIDML_KERNEL_CACHE");
+  }
+  if (dirname_.empty()) {
+    return;
+  }
+  boost::system::error_code ec;
+  fs::create_directories(dirname_, ec);
+  if (ec || !fs::is_directory(dirname_)) {
+    LOG(WARNING) << "Unable to use kernel cache directory " << dirname_ << ": " << ec.message();
+    dirname_.clear();
+    return;
+  }
+  VLOG(1) << "Using kernel cache directory: " << dirname_;
+}
+
+KernelCache* KernelCache::Instance() {
+  static KernelCache instance{[] {
+                                std::string entries = env::Get("PLAIDML_KERNEL_CACHE_ENTRIES");
+                                if (entries.empty()) {
+                                  return kDefaultMaxEntries;
+                                }
+                                // Only a count of at most nine digits is used, so std::atoi can't overflow.
+                                if (entries.size() > 9 || !std::all_of(entries.begin(), entries.end(), ::isdigit)) {
+                                  LOG(WARNING) << "Ignoring invalid PLAIDML_KERNEL_CACHE_ENTRIES: " << entries;
+                                  return kDefaultMaxEntries;
+                                }
+                                return static_cast<std::size_t>(std::atoi(entries.c_str()));
+                              }(),
+                              "", true};
+  return &instance;
+}
+
+std::string KernelCache::Key(const std::string& flat_key, const HardwareSettings& settings,
+                             std::size_t max_options) {
+  std::ostringstream key;
+  key << flat_key << "\n";
+  key << "threads=" << settings.threads << " use_global=" << settings.use_global
+      << " mem_width=" << settings.mem_width << " vec_size=" << settings.vec_size << " max_mem=" << settings.max_mem
+      << " max_regs=" << settings.max_regs << " goal_groups=" << settings.goal_groups
+      << " goal_flops_per_byte=" << settings.goal_flops_per_byte << " goal_dimension_sizes=";
+  for (auto size : settings.goal_dimension_sizes) {
+    key << size << ",";
+  }
+  key << " disable_io_aliasing=" << settings.disable_io_aliasing << "\n";
+  key << "options=" << max_options;
+  return key.str();
+}
+
+boost::optional<KernelInfo> KernelCache::Lookup(const std::string& key, const std::string& kname) {
+  std::lock_guard<std::mutex> lock{mu_};
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    stats_.misses++;
+    kernel_cache_misses.inc();
+    return boost::none;
+  }
+  stats_.hits++;
+  kernel_cache_hits.inc();
+  lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+  return CopyKernel(it->second.ki, &kname);
+}
+
+boost::optional<TileOptions> KernelCache::LookupOptions(const std::string& key) {
+  if (dirname_.empty()) {
+    return boost::none;
+  }
+  try {
+    // The file name is derived from a hash of the key; the full key is stored
+    // in the file to guard against collisions.
+    fs::path path = PathFor(key);
+    if (!fs::is_regular_file(path)) {
+      return boost::none;
+    }
+    fs::ifstream ifs{path};
+    std::string contents{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+    auto entry = inline_json_deserialize<PersistedEntry>(contents);
+    if (entry.key != key || entry.options.empty()) {
+      return boost::none;
+    }
+    TileOptions options;
+    for (const auto& option : entry.options) {
+      options.emplace_back(TileOption{option.model, option.shape, option.core_tile_cost, option.post_tile_cost,
+                                      option.kernel_cost});
+    }
+    {
+      std::lock_guard<std::mutex> lock{mu_};
+      stats_.persisted_hits++;
+    }
+    kernel_cache_persisted_hits.inc();
+    return options;
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "Unable to read kernel cache: " << ex.what();
+  }
+  return boost::none;
+}
+
+void KernelCache::Insert(const std::string& key, const KernelInfo& ki) {
+  if (max_entries_) {
+    KernelInfo copy = CopyKernel(ki, nullptr);
+    std::lock_guard<std::mutex> lock{mu_};
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      lru_.push_front(key);
+      entries_.emplace(key, Entry{std::move(copy), lru_.begin()});
+      while (entries_.size() > max_entries_) {
+        entries_.erase(lru_.back());
+        lru_.pop_back();
+        stats_.evictions++;
+        kernel_cache_evictions.inc();
+      }
+    }
+  }
+  if (!dirname_.empty()) {
+    Persist(key, ki);
+  }
+}
+
+void KernelCache::Clear() {
+  std::lock_guard<std::mutex> lock{mu_};
+  entries_.clear();
+  lru_.clear();
+}
+
+std::size_t KernelCache::size() const {
+  std::lock_guard<std::mutex> lock{mu_};
+  return entries_.size();
+}
+
+KernelCache::Stats KernelCache::stats() const {
+  std::lock_guard<std::mutex> lock{mu_};
+  return stats_;
+}
+
+std::string KernelCache::PathFor(const std::string& key) const {
+  std::ostringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << fnv1a64::hash(key.c_str()) << ".json";
+  return (fs::path(dirname_) / name.str()).string();
+}
+
+void KernelCache::Persist(const std::string& key, const KernelInfo& ki) {
+  PersistedEntry entry;
+  entry.key = key;
+  auto add_option = [&entry](const TileOption& tile) {
+    entry.options.emplace_back(PersistedOption{tile.model, tile.shape, Finite(tile.core_tile_cost),
+                                               Finite(tile.post_tile_cost), Finite(tile.kernel_cost)});
+  };
+  add_option(ki.tile);
+  for (const auto& candidate : ki.candidates) {
+    add_option(candidate.tile);
+  }
+  try {
+    // Written under a temporary name and then renamed into place, so that
+    // concurrent processes sharing the directory never observe partial files.
+    fs::path path = PathFor(key);
+    fs::path tmp_path = path;
+    tmp_path += fs::unique_path(".%%%%-%%%%-%%%%-%%%%.tmp");
+    {
+      fs::ofstream ofs{tmp_path, std::ios::trunc};
+      ofs << json_serialize(entry);
+      if (!ofs) {
+        throw std::runtime_error("Unable to write file: " + tmp_path.string());
+      }
+    }
+    fs::rename(tmp_path, path);
+    VLOG(3) << "Wrote kernel tile options to cache: " << path;
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "Unable to write kernel cache: " << ex.what();
+  }
+}
+
+}  // namespace lang
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/optional.hpp>
+
+#include "base/util/transfer_object.h"
+#include "tile/lang/generate.h"
+
+namespace vertexai {
+namespace tile {
+namespace lang {
+
+// KernelCache is a process-wide cache of generated contraction kernels, keyed
+// by the flattened contraction's CacheKeyString and the hardware settings it
+// was generated for.  Programs that share contractions (the same conv+relu
+// appearing in many networks, say) reuse each other's tiling and generated
+// code instead of rerunning TileOptimize and GenContract.
+//
+// Entries hold complete KernelInfos, including their sem::Function bodies and
+// tile candidates; the cache keeps private copies, so callers are free to
+// simplify or otherwise rewrite what they get back.  The number of entries is
+// bounded, evicting the least recently used.
+//
+// If a directory is supplied, the tile options chosen for each entry are also
+// persisted there, so that new processes can skip the tile search for kernels
+// generated by earlier ones.  Semtrees have no serialized form, so code for
+// those kernels is still regenerated once per process.
+class KernelCache {
+ public:
+  static constexpr std::size_t kDefaultMaxEntries = 4096;
+
+  struct Stats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t persisted_hits = 0;
+  };
+
+  // Construct a cache, if given a directory, use that for storage
+  explicit KernelCache(std::size_t max_entries = kDefaultMaxEntries, const std::string& dirname = "",
+                       bool use_env = false);
+
+  // Get the 'singleton' instance, persisting to PLAIDML_KERNEL_CACHE if set;
+  // PLAIDML_KERNEL_CACHE_ENTRIES overrides the entry limit (0 disables it).
+  static KernelCache* Instance();
+
+  // Builds the cache key for a flattened contraction: its CacheKeyString, the
+  // hardware settings, and the number of tile options requested.
+  static std::string Key(const std::string& flat_key, const HardwareSettings& settings, std::size_t max_options);
+
+  // Returns a private copy of the cached kernel (and its candidates), renamed
+  // to kname, or none if there is no entry for the key.
+  boost::optional<KernelInfo> Lookup(const std::string& key, const std::string& kname);
+
+  // Returns the tile options persisted for the key by an earlier process, or
+  // none.  Only consulted after an in-memory Lookup has missed.
+  boost::optional<TileOptions> LookupOptions(const std::string& key);
+
+  // Adds a kernel to the cache, persisting its tile options if the cache has
+  // a directory.
+  void Insert(const std::string& key, const KernelInfo& ki);
+
+  // Discards every in-memory entry; persisted options are kept.
+  void Clear();
+
+  std::size_t size() const;
+  Stats stats() const;
+
+ private:
+  struct PersistedOption {
+    std::string model;
+    std::vector<uint64_t> shape;
+    double core_tile_cost;
+    double post_tile_cost;
+    double kernel_cost;
+
+    TRANSFER_OBJECT {
+      VERSION(0);
+      FIELD(model);
+      FIELD(shape);
+      FIELD(core_tile_cost);
+      FIELD(post_tile_cost);
+      FIELD(kernel_cost);
+    }
+  };
+
+  struct PersistedEntry {
+    std::string key;
+    std::vector<PersistedOption> options;
+
+    TRANSFER_OBJECT {
+      VERSION(0);
+      FIELD(key);
+      FIELD(options);
+    }
+  };
+
+  struct Entry {
+    KernelInfo ki;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  std::string PathFor(const std::string& key) const;
+  void Persist(const std::string& key, const KernelInfo& ki);
+
+  const std::size_t max_entries_;
+  std::string dirname_;
+  mutable std::mutex mu_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_;  // Most recently used first
+  Stats stats_;
+};
+
+}  // namespace lang
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,129 @@
+#include "tile/lang/kernel_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "tile/lang/parser.h"
+#include "tile/lang/sembuilder.h"
+#include "tile/lang/semprinter.h"
+
+namespace vertexai {
+namespace tile {
+namespace lang {
+namespace {
+
+HardwareSettings TestSettings() {
+  HardwareSettings settings;
+  settings.threads = 256;
+  settings.vec_size = 1;
+  settings.use_global = false;
+  settings.mem_width = 32;
+  settings.max_mem = 18 * 1024;
+  settings.max_regs = 18 * 1024;
+  settings.goal_groups = 20;
+  settings.goal_flops_per_byte = 20;
+  settings.goal_dimension_sizes = {1024, 1024, 1024};
+  settings.disable_io_aliasing = false;
+  return settings;
+}
+
+KernelInfo MakeKernel(const std::string& kname, std::uint64_t tile) {
+  using namespace sem::builder;  // NOLINT
+  KernelInfo ki;
+  ki.kname = kname;
+  ki.tile = TileOption{"", {tile}, 1.0, 2.0, 3.0};
+  ki.kfunc = std::make_shared<sem::Function>(kname, sem::Type{sem::Type::TVOID},
+                                             sem::Function::params_t{{sem::Type{sem::Type::INDEX}, "n"}},
+                                             _Block({_Declare({sem::Type::INDEX}, "x", _("n") + 1)}));
+  return ki;
+}
+
+TEST(KernelCache, LookupReturnsRenamedPrivateCopies) {
+  KernelCache cache;
+  KernelInfo ki = MakeKernel("kernel_a_0", 4);
+  ki.candidates.push_back(MakeKernel("kernel_a_0", 8));
+  cache.Insert("key", ki);
+
+  auto hit = cache.Lookup("key", "kernel_b_3");
+  ASSERT_TRUE(hit);
+  EXPECT_EQ(hit->kname, "kernel_b_3");
+  EXPECT_EQ(hit->kfunc->name, "kernel_b_3");
+  EXPECT_NE(hit->kfunc, ki.kfunc);
+  EXPECT_NE(hit->kfunc->body, ki.kfunc->body);
+  ASSERT_EQ(hit->candidates.size(), 1);
+  EXPECT_EQ(hit->candidates[0].kname, "kernel_b_3");
+  EXPECT_EQ(hit->candidates[0].tile.shape, TileShape{8});
+
+  // Aside from the name, the copy's code is unchanged.
+  hit->kfunc->name = ki.kfunc->name;
+  EXPECT_EQ(sem::Print(*hit->kfunc).str(), sem::Print(*ki.kfunc).str());
+
+  EXPECT_FALSE(cache.Lookup("other", "kernel_b_4"));
+  EXPECT_EQ(cache.stats().hits, 1);
+  EXPECT_EQ(cache.stats().misses, 1);
+}
+
+TEST(KernelCache, EvictsLeastRecentlyUsed) {
+  KernelCache cache{2};
+  cache.Insert("a", MakeKernel("a", 1));
+  cache.Insert("b", MakeKernel("b", 1));
+  EXPECT_TRUE(cache.Lookup("a", "a"));
+  cache.Insert("c", MakeKernel("c", 1));
+
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.stats().evictions, 1);
+  EXPECT_TRUE(cache.Lookup("a", "a"));
+  EXPECT_FALSE(cache.Lookup("b", "b"));
+  EXPECT_TRUE(cache.Lookup("c", "c"));
+}
+
+TEST(KernelCache, PersistsTileOptions) {
+  auto dirname = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  {
+    KernelCache cache{KernelCache::kDefaultMaxEntries, dirname.string()};
+    KernelInfo ki = MakeKernel("kernel_a_0", 4);
+    ki.candidates.push_back(MakeKernel("kernel_a_0", 8));
+    cache.Insert("key", ki);
+  }
+  KernelCache cache{KernelCache::kDefaultMaxEntries, dirname.string()};
+  EXPECT_FALSE(cache.Lookup("key", "kernel_b_0"));
+  auto options = cache.LookupOptions("key");
+  ASSERT_TRUE(options);
+  ASSERT_EQ(options->size(), 2);
+  EXPECT_EQ((*options)[0].shape, TileShape{4});
+  EXPECT_EQ((*options)[1].shape, TileShape{8});
+  EXPECT_EQ((*options)[0].kernel_cost, 3.0);
+  EXPECT_FALSE(cache.LookupOptions("other"));
+  boost::filesystem::remove_all(dirname);
+}
+
+TEST(KernelCache, SharedAcrossPrograms) {
+  Parser parser;
+  Program prog = parser.Parse("function (A[I,K], B[K,J]) -> (C) { C[i,j : I,J] = +(A[i,k] * B[k,j]); }");
+  ShapeMap inputs;
+  ShapeMap outputs;
+  inputs.emplace("A", SimpleShape(DataType::FLOAT32, {64, 32}));
+  inputs.emplace("B", SimpleShape(DataType::FLOAT32, {32, 48}));
+  outputs.emplace("C", SimpleShape(DataType::FLOAT32, {64, 48}));
+  TileOptimizer optimizer;
+
+  auto* cache = KernelCache::Instance();
+  auto first = GenerateProgram(prog, inputs, outputs, TestSettings(), optimizer, "first");
+  auto hits = cache->stats().hits;
+  auto second = GenerateProgram(prog, inputs, outputs, TestSettings(), optimizer, "second");
+  EXPECT_EQ(cache->stats().hits, hits + 1);
+
+  ASSERT_EQ(first.kernels.size(), 1);
+  ASSERT_EQ(second.kernels.size(), 1);
+  EXPECT_EQ(first.kernels[0].kname, "kernel_first_0");
+  EXPECT_EQ(second.kernels[0].kname, "kernel_second_0");
+  EXPECT_EQ(second.kernels[0].kfunc->name, "kernel_second_0");
+  EXPECT_NE(first.kernels[0].kfunc, second.kernels[0].kfunc);
+  EXPECT_EQ(first.kernels[0].tile.shape, second.kernels[0].tile.shape);
+}
+
+}  // namespace
+}  // namespace lang
+}  // namespace tile
+}  // namespace vertexai
@@ -505,6 +505,36 @@ TEST_CASE("JustRelu", "[emit]") {
   REQUIRE(r.kernels[0].outputs == std::vector<std::string>({"Y"}));
 }
 
+TEST_CASE("Kernels are numbered in program order", "[emit]") {
+  Parser parser;
+  Program prog = parser.Parse(R"***(
+    function (A[I,K], B[K,J], C[I,K], D[K,J]) -> (X, Y) {
+      P[i,j : I,J] = +(A[i,k] * B[k,j]);
+      X = (P < 0 ? 0 : P);
+      Q[i,j : I,J] = +(C[i,k] * D[k,j]);
+      Y = (Q < 0 ? 0 : Q);
+    }
+  )***");
+  ShapeMap inputs;
+  ShapeMap outputs;
+  for (const auto& name : {"A", "B", "C", "D"}) {
+    inputs.emplace(name, SimpleShape(DataType::FLOAT32, {32, 32}));
+  }
+  outputs.emplace("X", SimpleShape(DataType::FLOAT32, {32, 32}));
+  outputs.emplace("Y", SimpleShape(DataType::FLOAT32, {32, 32}));
+  TileOptimizer optimizer;
+  KernelList r = GenerateProgram(prog, inputs, outputs, TestGPU(), optimizer, "order");
+  REQUIRE(r.kernels.size() == 2);
+  REQUIRE(r.kernels[0].kname == "kernel_order_0");
+  REQUIRE(r.kernels[0].inputs == std::vector<std::string>({"A", "B"}));
+  REQUIRE(r.kernels[0].outputs.back() == "X");
+  REQUIRE(r.kernels[1].kname == "kernel_order_0");
+  REQUIRE(r.kernels[1].inputs == std::vector<std::string>({"C", "D"}));
+  REQUIRE(r.kernels[1].outputs.back() == "Y");
+  // Identical contractions share their generated code.
+  REQUIRE(r.kernels[0].kfunc == r.kernels[1].kfunc);
+}
+
 TEST_CASE("NoRedeclare", "[emit]") {
   Parser parser;
   Program prog = parser.Parse("function (X[N]) -> (X) { X = 2*X; }");
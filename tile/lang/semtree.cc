@@ -3,6 +3,8 @@
 
 #include <assert.h>
 
+#include <stdexcept>
+
 namespace vertexai {
 namespace tile {
 namespace sem {
@@ -164,6 +166,127 @@ Function::Function(const std::string n, const Type& r, const params_t& p, StmtPt
 
 void Function::Accept(Visitor& v) const { v.Visit(*this); }
 
+namespace {
+
+class Cloner final : public Visitor {
+ public:
+  ExprPtr Clone(const ExprPtr& expr) {
+    if (!expr) {
+      return expr;
+    }
+    expr->Accept(*this);
+    return std::move(expr_);
+  }
+
+  StmtPtr Clone(const StmtPtr& stmt) {
+    if (!stmt) {
+      return stmt;
+    }
+    stmt->Accept(*this);
+    return std::move(stmt_);
+  }
+
+  LValPtr Clone(const LValPtr& lval) {
+    if (!lval) {
+      return lval;
+    }
+    lval->Accept(*this);
+    return std::move(lval_);
+  }
+
+  void Visit(const IntConst& node) final { expr_ = std::make_shared<IntConst>(node); }
+
+  void Visit(const FloatConst& node) final { expr_ = std::make_shared<FloatConst>(node); }
+
+  void Visit(const LookupLVal& node) final { lval_ = std::make_shared<LookupLVal>(node); }
+
+  void Visit(const LoadExpr& node) final { expr_ = std::make_shared<LoadExpr>(Clone(node.inner)); }
+
+  void Visit(const StoreStmt& node) final { stmt_ = std::make_shared<StoreStmt>(Clone(node.lhs), Clone(node.rhs)); }
+
+  void Visit(const SubscriptLVal& node) final {
+    lval_ = std::make_shared<SubscriptLVal>(Clone(node.ptr), Clone(node.offset));
+  }
+
+  void Visit(const DeclareStmt& node) final {
+    stmt_ = std::make_shared<DeclareStmt>(node.type, node.name, Clone(node.init));
+  }
+
+  void Visit(const UnaryExpr& node) final { expr_ = std::make_shared<UnaryExpr>(node.op, Clone(node.inner)); }
+
+  void Visit(const BinaryExpr& node) final {
+    expr_ = std::make_shared<BinaryExpr>(node.op, Clone(node.lhs), Clone(node.rhs));
+  }
+
+  void Visit(const CondExpr& node) final {
+    expr_ = std::make_shared<CondExpr>(Clone(node.cond), Clone(node.tcase), Clone(node.fcase));
+  }
+
+  void Visit(const SelectExpr& node) final {
+    expr_ = std::make_shared<SelectExpr>(Clone(node.cond), Clone(node.tcase), Clone(node.fcase));
+  }
+
+  void Visit(const ClampExpr& node) final {
+    expr_ = std::make_shared<ClampExpr>(Clone(node.val), Clone(node.min), Clone(node.max));
+  }
+
+  void Visit(const CastExpr& node) final { expr_ = std::make_shared<CastExpr>(node.type, Clone(node.val)); }
+
+  void Visit(const CallExpr& node) final {
+    auto call = std::make_shared<CallExpr>(node);
+    for (auto& val : call->vals) {
+      val = Clone(val);
+    }
+    expr_ = std::move(call);
+  }
+
+  void Visit(const LimitConst& node) final { expr_ = std::make_shared<LimitConst>(node); }
+
+  void Visit(const IndexExpr& node) final { expr_ = std::make_shared<IndexExpr>(node); }
+
+  void Visit(const Block& node) final {
+    auto block = std::make_shared<Block>();
+    block->statements.reserve(node.statements.size());
+    for (const auto& stmt : node.statements) {
+      block->statements.emplace_back(Clone(stmt));
+    }
+    stmt_ = std::move(block);
+  }
+
+  void Visit(const IfStmt& node) final {
+    stmt_ = std::make_shared<IfStmt>(Clone(node.cond), Clone(node.iftrue), Clone(node.iffalse));
+  }
+
+  void Visit(const ForStmt& node) final {
+    stmt_ = std::make_shared<ForStmt>(node.var, node.num, node.step, Clone(node.inner));
+  }
+
+  void Visit(const WhileStmt& node) final { stmt_ = std::make_shared<WhileStmt>(Clone(node.cond), Clone(node.inner)); }
+
+  void Visit(const BarrierStmt& node) final { stmt_ = std::make_shared<BarrierStmt>(); }
+
+  void Visit(const ReturnStmt& node) final { stmt_ = std::make_shared<ReturnStmt>(Clone(node.value)); }
+
+  void Visit(const Function& node) final { throw std::logic_error("Functions may not be nested"); }
+
+ private:
+  ExprPtr expr_;
+  StmtPtr stmt_;
+  LValPtr lval_;
+};
+
+}  // namespace
+
+std::shared_ptr<Function> Clone(const Function& func) {
+  Cloner cloner;
+  auto result = std::make_shared<Function>();
+  result->name = func.name;
+  result->ret = func.ret;
+  result->params = func.params;
+  result->body = cloner.Clone(func.body);
+  return result;
+}
+
 }  // namespace sem
 }  // namespace tile
 }  // namespace vertexai
@@ -4,6 +4,7 @@
 // provided to CG backends (LLVM, OpenCL, etc.)
 
 #include <algorithm>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -308,6 +309,10 @@ class Visitor {
   virtual void Visit(const Function&) = 0;
 };
 
+// Returns a deep copy of a function that shares no nodes with the original, so that either may be rewritten in place
+// (as the simplifier does) without affecting the other.
+std::shared_ptr<Function> Clone(const Function& func);
+
 }  // namespace sem
 }  // namespace tile
 }  // namespace vertexai
@@ -1,5 +1,9 @@
 #include "tile/lang/simplifier.h"
 
+#include <unordered_set>
+#include <utility>
+
+#include "base/util/parallel.h"
 #include "tile/lang/scope.h"
 #include "tile/lang/sembuilder.h"
 #include "tile/lang/semprinter.h"
@@ -451,24 +455,32 @@ class Simplifier : public Visitor {
 
 namespace lang {
 void Simplify(const std::vector<KernelInfo>& kernels) {
+  // Kernels generated from identical contractions share their functions, which must only be simplified once; the
+  // distinct functions are independent of one another, and are simplified concurrently.
+  std::vector<std::pair<const KernelInfo*, sem::Function*>> funcs;
+  std::unordered_set<sem::Function*> seen;
   for (const auto& ki : kernels) {
-    if (VLOG_IS_ON(4)) {
-      sem::Print emit_debug(*ki.kfunc);
-      VLOG(4) << "Generic debug kernel before simplification:";
-      VLOG(4) << ki.comments;
-      VLOG(4) << emit_debug.str();
-    }
-    {
-      lang::Scope<sem::Symbol> scope;
-      sem::Simplifier simplifier{&scope};
-      ki.kfunc->Accept(simplifier);
+    if (seen.insert(ki.kfunc.get()).second) {
+      funcs.emplace_back(&ki, ki.kfunc.get());
     }
-    for (auto& candidate : ki.candidates) {
-      lang::Scope<sem::Symbol> scope;
-      sem::Simplifier simplifier{&scope};
-      candidate.kfunc->Accept(simplifier);
+    for (const auto& candidate : ki.candidates) {
+      if (seen.insert(candidate.kfunc.get()).second) {
+        funcs.emplace_back(nullptr, candidate.kfunc.get());
+      }
     }
   }
+  ParallelForEach(funcs.size(), [&funcs](std::size_t i) {
+    const KernelInfo* ki = funcs[i].first;
+    if (ki && VLOG_IS_ON(4)) {
+      sem::Print emit_debug(*ki->kfunc);
+      VLOG(4) << "Generic debug kernel before simplification:";
+      VLOG(4) << ki->comments;
+      VLOG(4) << emit_debug.str();
+    }
+    lang::Scope<sem::Symbol> scope;
+    sem::Simplifier simplifier{&scope};
+    funcs[i].second->Accept(simplifier);
+  });
 }
 
 }  // namespace lang
@@ -1,34 +1,187 @@
 
 #include "tile/lang/tile_cache.h"
 
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/sync/sharable_lock.hpp>
+
 #include "base/util/env.h"
 #include "base/util/json_transfer.h"
+#include "base/util/logging.h"
 
 namespace vertexai {
 namespace tile {
 namespace lang {
 
-TileCache::TileCache(const std::string& filename, bool use_env) {
-  std::string openname = filename;
-  if (filename == "") {
-    if (!use_env) {
-      return;
+namespace fs = boost::filesystem;
+namespace ipc = boost::interprocess;
+
+namespace {
+
+// The file header: a magic number, then the format version.  Values are stored in host byte order; files are only
+// shared between hosts of the same architecture.
+const char kMagic[8] = {'P', 'M', 'L', 'T', 'I', 'L', 'E', 'S'};
+const std::uint32_t kVersion = 1;
+const std::size_t kHeaderSize = sizeof(kMagic) + sizeof(kVersion);
+
+template <typename T>
+void Put(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void PutString(std::string* out, const std::string& value) {
+  Put<std::uint32_t>(out, value.size());
+  out->append(value);
+}
+
+template <typename T>
+T Get(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+std::string Header() {
+  std::string header(kMagic, sizeof(kMagic));
+  Put(&header, kVersion);
+  return header;
+}
+
+// The index key of an entry, which is also the body of its record.
+std::string IndexKey(const std::string& device, const std::string& key, const DirectSettings& settings,
+                     const std::vector<uint64_t>& tile_size) {
+  std::string result;
+  PutString(&result, device);
+  PutString(&result, key);
+  Put<std::uint64_t>(&result, settings.threads);
+  Put<std::uint8_t>(&result, settings.use_global);
+  Put<std::uint64_t>(&result, settings.mem_width);
+  Put<std::uint32_t>(&result, tile_size.size());
+  for (auto size : tile_size) {
+    Put<std::uint64_t>(&result, size);
+  }
+  return result;
+}
+
+// A record is the size of its payload, then the payload: the entry's index key and its duration.
+void PutRecord(std::string* out, const std::string& index_key, int64_t dur) {
+  Put<std::uint32_t>(out, index_key.size() + sizeof(dur));
+  out->append(index_key);
+  Put<std::int64_t>(out, dur);
+}
+
+// Calls func(index_key, duration) for each complete record in data, returning the size of the complete records.
+template <typename F>
+std::size_t ForEachRecord(const std::string& data, const F& func) {
+  std::size_t pos = 0;
+  while (sizeof(std::uint32_t) <= data.size() - pos) {
+    auto size = Get<std::uint32_t>(data.data() + pos);
+    if (size < sizeof(std::int64_t)) {
+      throw std::runtime_error("Corrupt tile cache record");
     }
-    openname = env::Get("PLAIDML_TILE_CACHE");
-    if (!openname.length()) {
-      return;
+    if (data.size() - pos - sizeof(std::uint32_t) < size) {
+      break;  // Truncated by an interrupted writer
     }
+    const char* payload = data.data() + pos + sizeof(std::uint32_t);
+    std::size_t key_size = size - sizeof(std::int64_t);
+    func(std::string(payload, key_size), Get<std::int64_t>(payload + key_size));
+    pos += sizeof(std::uint32_t) + size;
   }
-  file_.exceptions(std::fstream::failbit | std::fstream::badbit);
-  file_.open(openname, std::fstream::in | std::fstream::out | std::fstream::app);
-  std::string line;
-  file_.exceptions(std::fstream::badbit);
-  while (std::getline(file_, line)) {
-    Entry e = inline_json_deserialize<Entry>(line);
-    AddEntry(e.key, e.subkey, e.value);
+  return pos;
+}
+
+std::string ReadFrom(const std::string& filename, std::uint64_t offset) {
+  std::ifstream ifs(filename, std::ios::binary);
+  ifs.seekg(offset);
+  return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+bool IsBinary(const std::string& filename) {
+  std::ifstream ifs(filename, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!ifs.read(magic, sizeof(magic))) {
+    return false;
+  }
+  std::uint32_t version;
+  if (std::memcmp(magic, kMagic, sizeof(kMagic)) || !ifs.read(reinterpret_cast<char*>(&version), sizeof(version))) {
+    return false;
+  }
+  if (version != kVersion) {
+    throw std::runtime_error("Unsupported tile cache version in " + filename);
+  }
+  return true;
+}
+
+// The lock file guarding a cache file; it's separate from the cache file so that the latter can be replaced.
+std::string LockFilename(const std::string& filename) { return filename + ".lock"; }
+
+ipc::file_lock OpenLock(const std::string& filename) {
+  std::string lock_filename = LockFilename(filename);
+  std::ofstream{lock_filename, std::ios::app};  // file_lock requires the file to exist
+  return ipc::file_lock{lock_filename.c_str()};
+}
+
+// Reads from a cache file that another process may be appending to, holding the file's lock shared.  If the lock
+// file can't be created (e.g. beside an exported file in a read-only directory), the file is read unlocked; a
+// record cut short by a concurrent writer is still ignored.
+std::string ReadLocked(const std::string& filename, std::uint64_t offset) {
+  ipc::file_lock file_lock;
+  try {
+    file_lock = OpenLock(filename);
+  } catch (const ipc::interprocess_exception& ex) {
+    LOG(WARNING) << "Reading tile cache " << filename << " without locking it: " << ex.what();
+    return ReadFrom(filename, offset);
+  }
+  ipc::sharable_lock<ipc::file_lock> shared_file_lock{file_lock};
+  return ReadFrom(filename, offset);
+}
+
+}  // namespace
+
+TileCache::TileCache(const std::string& filename, bool use_env) : filename_{filename} {
+  if (filename_ == "" && use_env) {
+    filename_ = env::Get("PLAIDML_TILE_CACHE");
+  }
+  if (filename_ == "") {
+    return;
+  }
+  try {
+    auto file_lock = OpenLock(filename_);
+    ipc::scoped_lock<ipc::file_lock> lock{file_lock};
+    if (fs::exists(filename_) && fs::file_size(filename_) && !IsBinary(filename_)) {
+      // Convert a legacy JSON-lines file, keeping the original alongside.
+      std::string records;
+      std::size_t count = ImportLegacy(filename_, "", &records);
+      fs::rename(filename_, filename_ + ".json");
+      std::ofstream ofs(filename_, std::ios::binary | std::ios::trunc);
+      ofs << Header() << records;
+      LOG(INFO) << "Converted " << count << " legacy tile cache entries; the original is " << filename_ << ".json";
+    } else if (!fs::exists(filename_) || !fs::file_size(filename_)) {
+      std::ofstream ofs(filename_, std::ios::binary | std::ios::trunc);
+      ofs << Header();
+    }
+    file_offset_ = kHeaderSize;
+    std::unique_lock<std::shared_timed_mutex> mu_lock{mu_};
+    CatchUp();
+    // Drop any record left incomplete by an interrupted writer, so that later records line up.
+    if (file_offset_ < fs::file_size(filename_)) {
+      LOG(WARNING) << "Discarding a truncated record at the end of the tile cache " << filename_;
+      fs::resize_file(filename_, file_offset_);
+    }
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "Unable to use tile cache " << filename_ << ": " << ex.what();
+    filename_.clear();
+    times_.clear();
   }
-  file_.clear();
-  file_.exceptions(std::fstream::failbit | std::fstream::badbit);
 }
 
 TileCache* TileCache::Instance() {
@@ -36,55 +189,161 @@ TileCache* TileCache::Instance() {
   return &instance;
 }
 
-void TileCache::AddEntry(const std::string& key, const DirectSettings& settings, const std::vector<uint64_t>& tile_size,
-                         int64_t dur) {
-  Entry e;
-  e.key = key;
-  e.subkey = Subkey(settings, tile_size);
-  e.value = dur;
-  AddEntry(key, e.subkey, dur);
-  if (file_.is_open()) {
-    std::string row = json_serialize(e);
-    file_.write(row.data(), row.size());
-    file_.flush();
+void TileCache::AddEntry(const std::string& device, const std::string& key, const DirectSettings& settings,
+                         const std::vector<uint64_t>& tile_size, int64_t dur) {
+  std::string index_key = IndexKey(device, key, settings, tile_size);
+  std::unique_lock<std::shared_timed_mutex> lock{mu_};
+  Merge(index_key, dur);
+  if (filename_ != "") {
+    std::string record;
+    PutRecord(&record, index_key, dur);
+    Append(record);
   }
 }
 
-int64_t TileCache::GetDuration(const std::string& key, const DirectSettings& settings,
+int64_t TileCache::GetDuration(const std::string& device, const std::string& key, const DirectSettings& settings,
                                const std::vector<uint64_t>& tile_size) {
-  auto it = cache_.find(key);
-  if (it == cache_.end()) {
-    return -1;
+  std::string index_key = IndexKey(device, key, settings, tile_size);
+  std::string legacy_key = IndexKey("", key, settings, tile_size);
+  auto lookup = [&]() -> int64_t {
+    auto it = times_.find(index_key);
+    if (it == times_.end()) {
+      it = times_.find(legacy_key);
+    }
+    return it == times_.end() ? -1 : it->second;
+  };
+  {
+    std::shared_lock<std::shared_timed_mutex> lock{mu_};
+    auto dur = lookup();
+    if (0 <= dur || filename_ == "") {
+      return dur;
+    }
+  }
+  // Another process may have timed this since the file was last read.
+  std::unique_lock<std::shared_timed_mutex> lock{mu_};
+  try {
+    auto file_lock = OpenLock(filename_);
+    ipc::sharable_lock<ipc::file_lock> shared_file_lock{file_lock};
+    CatchUp();
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "Unable to read tile cache " << filename_ << ": " << ex.what();
+  }
+  return lookup();
+}
+
+std::size_t TileCache::Import(const std::string& filename, const std::string& device) {
+  std::string records;
+  std::size_t count = 0;
+  if (IsBinary(filename)) {
+    std::string data = ReadLocked(filename, kHeaderSize);
+    std::unique_lock<std::shared_timed_mutex> lock{mu_};
+    ForEachRecord(data, [&](const std::string& index_key, int64_t dur) {
+      Merge(index_key, dur);
+      PutRecord(&records, index_key, dur);
+      count++;
+    });
+    if (filename_ != "") {
+      Append(records);
+    }
+    return count;
+  }
+  std::unique_lock<std::shared_timed_mutex> lock{mu_};
+  count = ImportLegacy(filename, device, &records);
+  if (filename_ != "") {
+    Append(records);
   }
-  auto it2 = it->second.times.find(Subkey(settings, tile_size));
-  if (it2 == it->second.times.end()) {
-    return -1;
+  return count;
+}
+
+std::size_t TileCache::Export(const std::string& filename) const {
+  std::string data = Header();
+  std::size_t count;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock{mu_};
+    for (const auto& kvp : times_) {
+      PutRecord(&data, kvp.first, kvp.second);
+    }
+    count = times_.size();
+  }
+  // Written under a temporary name and then renamed into place, so that readers never observe a partial file.
+  fs::path tmp_path = filename;
+  tmp_path += fs::unique_path(".%%%%-%%%%-%%%%-%%%%.tmp");
+  {
+    std::ofstream ofs(tmp_path.string(), std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), data.size());
+    if (!ofs) {
+      throw std::runtime_error("Unable to write file: " + tmp_path.string());
+    }
   }
-  return it2->second;
+  fs::rename(tmp_path, filename);
+  return count;
+}
+
+std::size_t TileCache::size() const {
+  std::shared_lock<std::shared_timed_mutex> lock{mu_};
+  return times_.size();
 }
 
-void TileCache::AddEntry(const std::string& key, const Subkey& subkey, int64_t dur) {
-  PerFC& p = cache_[key];
-  p.times[subkey] = dur;
-  if (p.times.size() == 1 || p.times[p.best] > dur) {
-    p.best = subkey;
+void TileCache::Merge(const std::string& index_key, int64_t dur) {
+  auto it = times_.emplace(index_key, dur).first;
+  if (dur < it->second) {
+    it->second = dur;
   }
 }
 
-TileCache::Subkey::Subkey(const DirectSettings& _settings, const std::vector<uint64_t>& _tile_size)
-    : settings(_settings), tile_size(_tile_size) {}
+void TileCache::CatchUp() {
+  std::string data = ReadFrom(filename_, file_offset_);
+  file_offset_ += ForEachRecord(data, [this](const std::string& index_key, int64_t dur) { Merge(index_key, dur); });
+}
 
-bool TileCache::Subkey::operator<(const Subkey& rhs) const {
-  if (settings.threads != rhs.settings.threads) {
-    return settings.threads < rhs.settings.threads;
+void TileCache::Append(const std::string& records) {
+  if (records.empty()) {
+    return;
   }
-  if (settings.use_global != rhs.settings.use_global) {
-    return settings.use_global;
+  try {
+    auto file_lock = OpenLock(filename_);
+    ipc::scoped_lock<ipc::file_lock> lock{file_lock};
+    // Pick up records appended by other processes first, so that the file stays fully read.
+    CatchUp();
+    // Anything past the last complete record was left by a writer that died mid-record; drop it, so that these
+    // records line up.
+    if (file_offset_ < fs::file_size(filename_)) {
+      LOG(WARNING) << "Discarding a truncated record at the end of the tile cache " << filename_;
+      fs::resize_file(filename_, file_offset_);
+    }
+    bool written;
+    {
+      std::ofstream ofs(filename_, std::ios::binary | std::ios::app);
+      ofs.write(records.data(), records.size());
+      ofs.flush();
+      written = static_cast<bool>(ofs);
+    }
+    if (!written) {
+      // Drop whatever part of the records made it to the file.
+      fs::resize_file(filename_, file_offset_);
+      throw std::runtime_error("Unable to append to " + filename_);
+    }
+    file_offset_ += records.size();
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "Unable to write tile cache " << filename_ << ": " << ex.what();
   }
-  if (settings.mem_width != rhs.settings.mem_width) {
-    return settings.mem_width < rhs.settings.mem_width;
+}
+
+std::size_t TileCache::ImportLegacy(const std::string& filename, const std::string& device, std::string* records) {
+  std::ifstream ifs(filename);
+  std::string line;
+  std::size_t count = 0;
+  while (std::getline(ifs, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    Entry e = inline_json_deserialize<Entry>(line);
+    std::string index_key = IndexKey(device, e.key, e.subkey.settings, e.subkey.tile_size);
+    Merge(index_key, e.value);
+    PutRecord(records, index_key, e.value);
+    count++;
   }
-  return tile_size < rhs.tile_size;
+  return count;
 }
 
 }  // namespace lang
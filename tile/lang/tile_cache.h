@@ -1,10 +1,11 @@
 
 #pragma once
 
-#include <fstream>
+#include <cstdint>
 #include <limits>
-#include <map>
+#include <shared_mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "base/util/transfer_object.h"
@@ -14,23 +15,42 @@ namespace vertexai {
 namespace tile {
 namespace lang {
 
+// TileCache records how long kernels took to run with particular tile sizes, so that tile scanning can skip
+// candidates that have been timed before.  Entries are keyed by the identity of the device the kernel ran on, the
+// kernel's key, its DirectSettings, and the tile size.
+//
+// If given a file, the cache is stored there in a compact binary format: a header followed by length-prefixed
+// records, which are only ever appended.  Each process keeps an index of the records in memory, and picks up records
+// appended by other processes (under an advisory file lock) when it misses, so several processes can share and
+// extend a single file.  Duplicate entries keep the shortest duration.  Import and Export move entries between
+// files in bulk, e.g. to share tuning results across a fleet of hosts.
+//
+// Files in the previous JSON-lines format are converted on open; their entries, which predate device identities,
+// are filed under the empty device, which GetDuration consults when a device has no entry of its own.
 class TileCache {
  public:
   // Construct a cache, if given a filename, use that for storage
   explicit TileCache(const std::string& filename = "", bool use_env = false);
-  // Get the 'singlton' instance, loads for PLAIDML_TILE_CACHE if set
+  // Get the 'singleton' instance, loads for PLAIDML_TILE_CACHE if set
   static TileCache* Instance();
   // Add a new entry with a duration
-  void AddEntry(const std::string& key, const DirectSettings& settings, const std::vector<uint64_t>& tile_size,
-                int64_t dur);
+  void AddEntry(const std::string& device, const std::string& key, const DirectSettings& settings,
+                const std::vector<uint64_t>& tile_size, int64_t dur);
   // Checks for an exact matching entry (to skip tile scan for repeats), or -1 if not found
-  int64_t GetDuration(const std::string& key, const DirectSettings& settings, const std::vector<uint64_t>& tile_size);
+  int64_t GetDuration(const std::string& device, const std::string& key, const DirectSettings& settings,
+                      const std::vector<uint64_t>& tile_size);
+
+  // Merges the entries of another cache file into this one, returning the number of entries read.  The file may be
+  // in the binary format or the legacy JSON-lines format, whose entries are filed under the given device.
+  std::size_t Import(const std::string& filename, const std::string& device = "");
+  // Writes every entry to a compacted binary cache file, returning the number of entries written.
+  std::size_t Export(const std::string& filename) const;
+
+  std::size_t size() const;
 
  private:
   struct Subkey {
     Subkey() = default;  // For deserialization
-    Subkey(const DirectSettings& settings, const std::vector<uint64_t>& tile_size);
-    bool operator<(const Subkey& rhs) const;
 
     DirectSettings settings;
     std::vector<uint64_t> tile_size;
@@ -42,6 +62,7 @@ class TileCache {
     }
   };
 
+  // An entry in the legacy JSON-lines format.
   struct Entry {
     std::string key;
     TileCache::Subkey subkey;
@@ -55,16 +76,16 @@ class TileCache {
     }
   };
 
-  struct PerFC {
-    Subkey best;
-    std::map<Subkey, int64_t> times;
-  };
-
-  void AddEntry(const std::string& key, const Subkey& subkey, int64_t dur);
-
-  std::map<const std::string, PerFC> cache_;
+  // Records are read and appended under the file lock; these require mu_ to be held exclusively.
+  void Merge(const std::string& index_key, int64_t dur);
+  void CatchUp();
+  void Append(const std::string& records);
+  std::size_t ImportLegacy(const std::string& filename, const std::string& device, std::string* records);
 
-  std::fstream file_;
+  std::string filename_;
+  mutable std::shared_timed_mutex mu_;
+  std::unordered_map<std::string, int64_t> times_;  // Keyed by the encoded device, key, settings and tile size
+  std::uint64_t file_offset_ = 0;                   // How much of the file has been read into times_
 };
 
 }  // namespace lang
@@ -0,0 +1,135 @@
+#include "tile/lang/tile_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+namespace vertexai {
+namespace tile {
+namespace lang {
+namespace {
+
+namespace fs = boost::filesystem;
+
+DirectSettings TestSettings() {
+  DirectSettings settings;
+  settings.threads = 256;
+  settings.use_global = false;
+  settings.mem_width = 32;
+  return settings;
+}
+
+class TileCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dirname_ = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dirname_);
+  }
+
+  void TearDown() override { fs::remove_all(dirname_); }
+
+  std::string Path(const std::string& name) { return (dirname_ / name).string(); }
+
+  fs::path dirname_;
+};
+
+TEST_F(TileCacheTest, KeysByDevice) {
+  TileCache cache;
+  cache.AddEntry("gpu0", "key", TestSettings(), {4, 8}, 100);
+  EXPECT_EQ(cache.GetDuration("gpu0", "key", TestSettings(), {4, 8}), 100);
+  EXPECT_EQ(cache.GetDuration("gpu1", "key", TestSettings(), {4, 8}), -1);
+  EXPECT_EQ(cache.GetDuration("gpu0", "key", TestSettings(), {8, 4}), -1);
+  DirectSettings other = TestSettings();
+  other.use_global = true;
+  EXPECT_EQ(cache.GetDuration("gpu0", "key", other, {4, 8}), -1);
+}
+
+TEST_F(TileCacheTest, KeepsShortestDuration) {
+  TileCache cache;
+  cache.AddEntry("gpu0", "key", TestSettings(), {4}, 100);
+  cache.AddEntry("gpu0", "key", TestSettings(), {4}, 50);
+  cache.AddEntry("gpu0", "key", TestSettings(), {4}, 75);
+  EXPECT_EQ(cache.GetDuration("gpu0", "key", TestSettings(), {4}), 50);
+  EXPECT_EQ(cache.size(), 1);
+}
+
+TEST_F(TileCacheTest, SharesFileBetweenInstances) {
+  TileCache first{Path("cache")};
+  TileCache second{Path("cache")};
+  first.AddEntry("gpu0", "key", TestSettings(), {4}, 100);
+  // The second instance picks up the first's record when it misses.
+  EXPECT_EQ(second.GetDuration("gpu0", "key", TestSettings(), {4}), 100);
+
+  second.AddEntry("gpu0", "key", TestSettings(), {8}, 200);
+  TileCache reopened{Path("cache")};
+  EXPECT_EQ(reopened.size(), 2);
+  EXPECT_EQ(reopened.GetDuration("gpu0", "key", TestSettings(), {8}), 200);
+}
+
+TEST_F(TileCacheTest, DiscardsTruncatedRecord) {
+  {
+    TileCache cache{Path("cache")};
+    cache.AddEntry("gpu0", "key", TestSettings(), {4}, 100);
+    cache.AddEntry("gpu0", "key", TestSettings(), {8}, 200);
+  }
+  fs::resize_file(Path("cache"), fs::file_size(Path("cache")) - 3);
+  TileCache cache{Path("cache")};
+  EXPECT_EQ(cache.size(), 1);
+  cache.AddEntry("gpu0", "key", TestSettings(), {16}, 300);
+  TileCache reopened{Path("cache")};
+  EXPECT_EQ(reopened.size(), 2);
+  EXPECT_EQ(reopened.GetDuration("gpu0", "key", TestSettings(), {16}), 300);
+}
+
+TEST_F(TileCacheTest, DropsPartialRecordBeforeAppending) {
+  TileCache cache{Path("cache")};
+  cache.AddEntry("gpu0", "key", TestSettings(), {4}, 100);
+  {
+    // Another process dies partway through writing a record.
+    std::ofstream ofs(Path("cache"), std::ios::binary | std::ios::app);
+    ofs << "\x40\x00";
+  }
+  cache.AddEntry("gpu0", "key", TestSettings(), {8}, 200);
+  TileCache reopened{Path("cache")};
+  EXPECT_EQ(reopened.size(), 2);
+  EXPECT_EQ(reopened.GetDuration("gpu0", "key", TestSettings(), {8}), 200);
+}
+
+TEST_F(TileCacheTest, ExportsAndImports) {
+  TileCache source;
+  source.AddEntry("gpu0", "a", TestSettings(), {4}, 100);
+  source.AddEntry("gpu1", "b", TestSettings(), {4}, 200);
+  EXPECT_EQ(source.Export(Path("export")), 2);
+
+  TileCache dest{Path("cache")};
+  dest.AddEntry("gpu0", "a", TestSettings(), {4}, 50);
+  EXPECT_EQ(dest.Import(Path("export")), 2);
+  EXPECT_EQ(dest.GetDuration("gpu0", "a", TestSettings(), {4}), 50);
+  EXPECT_EQ(dest.GetDuration("gpu1", "b", TestSettings(), {4}), 200);
+
+  TileCache reopened{Path("cache")};
+  EXPECT_EQ(reopened.GetDuration("gpu1", "b", TestSettings(), {4}), 200);
+}
+
+TEST_F(TileCacheTest, ConvertsLegacyFiles) {
+  {
+    std::ofstream ofs(Path("cache"));
+    ofs << R"({"key":"key","subkey":{"settings":{"threads":256,"use_global":false,"mem_width":32},)"
+        << R"("tile_size":[4]},"value":100})" << "\n";
+  }
+  TileCache cache{Path("cache")};
+  EXPECT_EQ(cache.size(), 1);
+  // Legacy entries have no device, and serve as a fallback for every device.
+  EXPECT_EQ(cache.GetDuration("gpu0", "key", TestSettings(), {4}), 100);
+  EXPECT_TRUE(fs::exists(Path("cache.json")));
+
+  TileCache reopened{Path("cache")};
+  EXPECT_EQ(reopened.GetDuration("gpu1", "key", TestSettings(), {4}), 100);
+}
+
+}  // namespace
+}  // namespace lang
+}  // namespace tile
+}  // namespace vertexai
@@ -25,18 +25,36 @@ std::shared_ptr<Buffer> Buffer::Downcast(const std::shared_ptr<tile::Buffer>& bu
 
 Buffer::Buffer(const std::shared_ptr<DevInfo>& devinfo, const std::shared_ptr<MemStrategy>& mem_strategy,
                std::shared_ptr<MemChunk> chunk)
-    : devinfo_{devinfo}, mem_strategy_{mem_strategy}, size_{chunk->size()}, chunk_{std::move(chunk)} {}
+    : devinfo_{devinfo},
+      mem_strategy_{mem_strategy},
+      size_{chunk->size()},
+      chunk_{std::move(chunk)},
+      pending_{boost::make_ready_future().share()} {}
 
 Buffer::Buffer(const std::shared_ptr<DevInfo>& devinfo, const std::shared_ptr<MemStrategy>& mem_strategy,
                std::uint64_t size)
-    : devinfo_{devinfo}, mem_strategy_{mem_strategy}, size_{size} {}
+    : devinfo_{devinfo}, mem_strategy_{mem_strategy}, size_{size}, pending_{boost::make_ready_future().share()} {}
 
 boost::future<std::unique_ptr<View>> Buffer::MapCurrent(const context::Context& ctx) {
-  EnsureChunk(ctx);
-  return chunk()->MapCurrent(ctx);
+  auto pending = this->pending();
+  if (pending.is_ready()) {
+    EnsureChunk(ctx);
+    return chunk()->MapCurrent(ctx);
+  }
+  // The buffer's contents will come from a run that hasn't launched yet; map whichever chunk it leaves behind.
+  context::Context ctx_copy{ctx};
+  return pending
+      .then([self = shared_from_this(), ctx = std::move(ctx_copy)](boost::shared_future<void>) {
+        self->EnsureChunk(ctx);
+        return self->chunk()->MapCurrent(ctx);
+      })
+      .unwrap();
 }
 
 std::unique_ptr<View> Buffer::MapDiscard(const context::Context& ctx) {
+  // Wait for any queued run writing the buffer to launch, so that it doesn't remap the buffer out from under the
+  // caller's view.
+  pending().wait();
   EnsureChunk(ctx);
   return chunk()->MapDiscard(ctx);
 }
@@ -51,6 +69,19 @@ void Buffer::RemapTo(std::shared_ptr<MemChunk> chunk) {
   chunk_ = std::move(chunk);
 }
 
+std::uint64_t Buffer::SetPending(boost::shared_future<void> pending) {
+  std::lock_guard<std::mutex> lock{mu_};
+  pending_ = std::move(pending);
+  return ++pending_token_;
+}
+
+void Buffer::ClearPending(std::uint64_t token) {
+  std::lock_guard<std::mutex> lock{mu_};
+  if (token == pending_token_) {
+    pending_ = boost::make_ready_future().share();
+  }
+}
+
 void Buffer::EnsureChunk(const context::Context& ctx) {
   std::lock_guard<std::mutex> lock{mu_};
   if (!chunk_) {
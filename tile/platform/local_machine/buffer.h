@@ -43,12 +43,30 @@ class Buffer : public tile::Buffer, public std::enable_shared_from_this<Buffer>
   void RemapTo(std::shared_ptr<MemChunk> chunk);
   void EnsureChunk(const context::Context& ctx);
 
+  // A buffer is pending while a run that will write it is waiting to launch (e.g. for its program to finish
+  // compiling); until then, its chunk doesn't yet carry the run's HAL events.  The future resolves once the run has
+  // launched or has failed to; it never holds an error, since the run's own future reports that, so callers just
+  // wait on it.
+  boost::shared_future<void> pending() const {
+    std::lock_guard<std::mutex> lock{mu_};
+    return pending_;
+  }
+
+  // Marks the buffer as pending on the indicated future, returning a token for ClearPending.
+  std::uint64_t SetPending(boost::shared_future<void> pending);
+
+  // Marks the buffer as no longer pending, unless a later run has marked it pending since the indicated call to
+  // SetPending.
+  void ClearPending(std::uint64_t token);
+
  private:
   const std::shared_ptr<DevInfo> devinfo_;
   const std::shared_ptr<MemStrategy> mem_strategy_;
   const std::uint64_t size_;
   mutable std::mutex mu_;
   std::shared_ptr<MemChunk> chunk_;
+  boost::shared_future<void> pending_;
+  std::uint64_t pending_token_ = 0;
 };
 
 }  // namespace local_machine
@@ -707,7 +707,11 @@ schedule::Schedule FinalizeSchedule(Build* b) {
 
 FifoScheduler::FifoScheduler(std::size_t alignment, std::uint64_t size_goal,
                              const hal::proto::HardwareSettings& settings)
-    : alignment_{alignment}, size_goal_{size_goal}, goal_groups_{settings.goal_groups()} {
+    : FifoScheduler{alignment, [size_goal]() { return size_goal; }, settings} {}
+
+FifoScheduler::FifoScheduler(std::size_t alignment, std::function<std::uint64_t()> size_goal,
+                             const hal::proto::HardwareSettings& settings)
+    : alignment_{alignment}, size_goal_{std::move(size_goal)}, goal_groups_{settings.goal_groups()} {
   if (goal_groups_ < 2) {
     goal_groups_ = 2;  // Just to pick something.
   }
@@ -718,7 +722,9 @@ schedule::Schedule FifoScheduler::BuildSchedule(const tile::proto::Program& prog
   IVLOG(4, "Scheduling program:\n" << program.code());
   IVLOG(3, "Initial schedule:\n" << start);
 
-  Build b{program, kl, start.steps.size(), alignment_, size_goal_, goal_groups_};
+  std::uint64_t size_goal = size_goal_();
+  IVLOG(1, "Fifo scheduler: attempting to use up to " << size_goal << " bytes");
+  Build b{program, kl, start.steps.size(), alignment_, size_goal, goal_groups_};
 
   // Ensure that all outputs and inputs are in GPU allocs.
   PushSyntheticFinalOutputStep(&b, &start, program);
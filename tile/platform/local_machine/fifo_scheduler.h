@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
@@ -117,13 +118,18 @@ class FifoScheduler final : public Scheduler {
  public:
   FifoScheduler(std::size_t alignment, std::uint64_t size_goal, const hal::proto::HardwareSettings& settings);
 
+  // Constructs a scheduler whose memory size goal is queried each time a schedule is built, allowing schedules to
+  // adapt to the memory available when each program is compiled.
+  FifoScheduler(std::size_t alignment, std::function<std::uint64_t()> size_goal,
+                const hal::proto::HardwareSettings& settings);
+
   schedule::Schedule BuildSchedule(const tile::proto::Program& program, const lang::KernelList& kl) final;
 
   const char* name() const final;
 
  private:
   std::size_t alignment_;
-  std::uint64_t size_goal_;
+  std::function<std::uint64_t()> size_goal_;
   std::uint64_t goal_groups_;
 };
 
@@ -2,26 +2,110 @@
 
 #include "tile/platform/local_machine/mem_cache.h"
 
+#include <algorithm>
 #include <utility>
 
+#include "base/util/perf_counter.h"
+
 namespace vertexai {
 namespace tile {
 namespace local_machine {
+namespace {
+
+// The smallest size class; smaller allocations are rounded up to it.
+constexpr std::size_t kMinSizeClass = 256;
+
+// Size classes per power of two.
+constexpr std::size_t kClassesPerDoubling = 4;
+
+PerfCounter mem_cache_hits("mem_cache_hits");
+PerfCounter mem_cache_misses("mem_cache_misses");
+PerfCounter mem_cache_evictions("mem_cache_evictions");
+PerfCounter mem_cache_bytes_held("mem_cache_bytes_held");
+
+}  // namespace
+
+MemCache::MemCache(std::size_t budget) : budget_{budget} {}
+
+MemCache::~MemCache() { mem_cache_bytes_held.add(-static_cast<std::int64_t>(bytes_held_)); }
+
+std::size_t MemCache::SizeClass(std::size_t size) {
+  if (size <= kMinSizeClass) {
+    return kMinSizeClass;
+  }
+  std::size_t pow2 = kMinSizeClass;
+  while (pow2 < size) {
+    pow2 <<= 1;
+  }
+  // size is in (pow2 / 2, pow2]; that range is split into kClassesPerDoubling classes.
+  std::size_t step = pow2 / (2 * kClassesPerDoubling);
+  return (size + step - 1) / step * step;
+}
 
 std::shared_ptr<hal::Buffer> MemCache::TryAlloc(std::size_t size) {
   std::lock_guard<std::mutex> lock{mu_};
-  auto& l = mem_[size];
-  if (l.size()) {
-    std::shared_ptr<hal::Buffer> result{std::move(l.top())};
-    l.pop();
-    return result;
+  auto it = classes_.find(SizeClass(size));
+  if (it == classes_.end() || it->second.empty()) {
+    mem_cache_misses.inc();
+    return std::shared_ptr<hal::Buffer>{};
   }
-  return std::shared_ptr<hal::Buffer>{};
+  auto entry = it->second.back();
+  it->second.pop_back();
+  if (it->second.empty()) {
+    classes_.erase(it);
+  }
+  std::shared_ptr<hal::Buffer> result{std::move(entry->buffer)};
+  bytes_held_ -= entry->size_class;
+  mem_cache_bytes_held.add(-static_cast<std::int64_t>(entry->size_class));
+  lru_.erase(entry);
+  mem_cache_hits.inc();
+  return result;
 }
 
 void MemCache::Free(std::size_t size, std::shared_ptr<hal::Buffer> mem) {
+  // Released buffers are destroyed after the lock is dropped.
+  std::list<std::shared_ptr<hal::Buffer>> released;
+  std::lock_guard<std::mutex> lock{mu_};
+  std::size_t size_class = SizeClass(size);
+  if (budget_ < size_class) {
+    released.emplace_back(std::move(mem));
+    mem_cache_evictions.inc();
+    return;
+  }
+  lru_.emplace_front(Entry{size_class, std::move(mem)});
+  classes_[size_class].push_back(lru_.begin());
+  bytes_held_ += size_class;
+  mem_cache_bytes_held.add(size_class);
+  TrimLocked(budget_, &released);
+}
+
+void MemCache::Trim(std::size_t budget) {
+  std::list<std::shared_ptr<hal::Buffer>> released;
   std::lock_guard<std::mutex> lock{mu_};
-  mem_[size].push(std::move(mem));
+  TrimLocked(budget, &released);
+}
+
+std::size_t MemCache::bytes_held() const {
+  std::lock_guard<std::mutex> lock{mu_};
+  return bytes_held_;
+}
+
+void MemCache::TrimLocked(std::size_t budget, std::list<std::shared_ptr<hal::Buffer>>* released) {
+  while (budget < bytes_held_) {
+    auto entry = std::prev(lru_.end());
+    // Within a size class, buffers are freed in LRU order, so the least recently
+    // freed buffer is at the front of its class's list.
+    auto& cls = classes_[entry->size_class];
+    cls.pop_front();
+    if (cls.empty()) {
+      classes_.erase(entry->size_class);
+    }
+    bytes_held_ -= entry->size_class;
+    mem_cache_bytes_held.add(-static_cast<std::int64_t>(entry->size_class));
+    mem_cache_evictions.inc();
+    released->emplace_back(std::move(entry->buffer));
+    lru_.erase(entry);
+  }
 }
 
 }  // namespace local_machine
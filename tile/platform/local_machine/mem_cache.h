@@ -3,9 +3,9 @@
 #pragma once
 
 #include <cstdint>
+#include <list>
 #include <memory>
 #include <mutex>
-#include <stack>
 #include <unordered_map>
 
 #include "tile/base/hal.h"
@@ -15,14 +15,47 @@ namespace tile {
 namespace local_machine {
 
 // Caches device memory allocations.
+//
+// Allocations are rounded up to a size class: each power-of-two range is
+// divided into four equally-spaced classes, bounding the internal waste at 25%
+// while letting requests of similar sizes share buffers.  Free buffers are held
+// up to a byte budget; when the budget is exceeded, the least recently freed
+// buffers are released back to the underlying memory.
 class MemCache {
  public:
+  explicit MemCache(std::size_t budget);
+  ~MemCache();
+
+  // Returns the size of the class used for allocations of the indicated size.
+  // Buffers handed to Free() must have been allocated with this size.
+  static std::size_t SizeClass(std::size_t size);
+
+  // Returns a cached buffer of at least SizeClass(size) bytes, or nullptr.
   std::shared_ptr<hal::Buffer> TryAlloc(std::size_t size);
+
+  // Returns a buffer for the indicated size to the cache.
   void Free(std::size_t size, std::shared_ptr<hal::Buffer>);
 
+  // Releases least recently freed buffers until at most budget bytes are held.
+  void Trim(std::size_t budget);
+
+  std::size_t bytes_held() const;
+
  private:
-  std::mutex mu_;
-  std::unordered_map<std::size_t, std::stack<std::shared_ptr<hal::Buffer>>> mem_;
+  struct Entry {
+    std::size_t size_class;
+    std::shared_ptr<hal::Buffer> buffer;
+  };
+
+  using Lru = std::list<Entry>;
+
+  void TrimLocked(std::size_t budget, std::list<std::shared_ptr<hal::Buffer>>* released);
+
+  const std::size_t budget_;
+  mutable std::mutex mu_;
+  std::size_t bytes_held_ = 0;
+  Lru lru_;  // Most recently freed first
+  std::unordered_map<std::size_t, std::list<Lru::iterator>> classes_;  // Most recently freed last
 };
 
 }  // namespace local_machine
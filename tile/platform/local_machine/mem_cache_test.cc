@@ -0,0 +1,102 @@
+// Copyright 2018 Intel Corporation.
+
+#include <gmock/gmock.h>
+
+#include <memory>
+#include <vector>
+
+#include "base/util/perf_counter.h"
+#include "tile/platform/local_machine/mem_cache.h"
+
+using ::testing::Eq;
+using ::testing::IsNull;
+
+namespace vertexai {
+namespace tile {
+namespace local_machine {
+namespace {
+
+class FakeBuffer final : public hal::Buffer {
+ public:
+  boost::future<void*> MapCurrent(const std::vector<std::shared_ptr<hal::Event>>& deps) final {
+    return boost::make_ready_future<void*>(nullptr);
+  }
+  boost::future<void*> MapDiscard(const std::vector<std::shared_ptr<hal::Event>>& deps) final {
+    return boost::make_ready_future<void*>(nullptr);
+  }
+  std::shared_ptr<hal::Event> Unmap(const context::Context& ctx) final { return nullptr; }
+};
+
+TEST(MemCache, SizeClasses) {
+  EXPECT_THAT(MemCache::SizeClass(1), Eq(256));
+  EXPECT_THAT(MemCache::SizeClass(256), Eq(256));
+  EXPECT_THAT(MemCache::SizeClass(257), Eq(320));
+  EXPECT_THAT(MemCache::SizeClass(512), Eq(512));
+  EXPECT_THAT(MemCache::SizeClass(1000), Eq(1024));
+  EXPECT_THAT(MemCache::SizeClass(1025), Eq(1280));
+  EXPECT_THAT(MemCache::SizeClass((1 << 20) + 1), Eq((1 << 20) + (1 << 18)));
+  for (std::size_t size = 1; size < 100000; size += 7) {
+    std::size_t size_class = MemCache::SizeClass(size);
+    EXPECT_LE(size, size_class);
+    EXPECT_THAT(MemCache::SizeClass(size_class), Eq(size_class));
+    if (256 < size) {
+      EXPECT_LE(size_class, size + size / 4);
+    }
+  }
+}
+
+TEST(MemCache, ReusesBuffersWithinSizeClass) {
+  MemCache cache{1 << 20};
+  auto buffer = std::make_shared<FakeBuffer>();
+  EXPECT_THAT(cache.TryAlloc(1000), IsNull());
+  cache.Free(1000, buffer);
+  EXPECT_THAT(cache.bytes_held(), Eq(1024));
+  EXPECT_THAT(cache.TryAlloc(1500), IsNull());
+  EXPECT_THAT(cache.TryAlloc(999).get(), Eq(buffer.get()));
+  EXPECT_THAT(cache.bytes_held(), Eq(0));
+  EXPECT_THAT(cache.TryAlloc(1000), IsNull());
+}
+
+TEST(MemCache, EvictsLeastRecentlyFreed) {
+  auto held_before = GetPerfCounter("mem_cache_bytes_held");
+  MemCache cache{4096};
+  std::vector<std::weak_ptr<hal::Buffer>> freed;
+  for (std::size_t size : {1024, 2048, 1024, 2048}) {
+    auto buffer = std::make_shared<FakeBuffer>();
+    freed.emplace_back(buffer);
+    cache.Free(size, std::move(buffer));
+  }
+  EXPECT_THAT(cache.bytes_held(), Eq(3072));
+  EXPECT_TRUE(freed[0].expired());
+  EXPECT_TRUE(freed[1].expired());
+  EXPECT_FALSE(freed[2].expired());
+  EXPECT_FALSE(freed[3].expired());
+
+  cache.Trim(2048);
+  EXPECT_THAT(cache.bytes_held(), Eq(2048));
+  EXPECT_TRUE(freed[2].expired());
+  EXPECT_FALSE(freed[3].expired());
+
+  // Buffers larger than the budget are never held.
+  auto large = std::make_shared<FakeBuffer>();
+  std::weak_ptr<hal::Buffer> weak_large = large;
+  cache.Free(8192, std::move(large));
+  EXPECT_TRUE(weak_large.expired());
+  EXPECT_THAT(cache.bytes_held(), Eq(2048));
+  EXPECT_THAT(GetPerfCounter("mem_cache_bytes_held") - held_before, Eq(2048));
+}
+
+TEST(MemCache, ReleasesHeldBytesOnDestruction) {
+  auto held_before = GetPerfCounter("mem_cache_bytes_held");
+  {
+    MemCache cache{4096};
+    cache.Free(1024, std::make_shared<FakeBuffer>());
+    EXPECT_THAT(GetPerfCounter("mem_cache_bytes_held") - held_before, Eq(1024));
+  }
+  EXPECT_THAT(GetPerfCounter("mem_cache_bytes_held"), Eq(held_before));
+}
+
+}  // namespace
+}  // namespace local_machine
+}  // namespace tile
+}  // namespace vertexai
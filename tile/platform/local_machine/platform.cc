@@ -5,12 +5,15 @@
 #include <google/protobuf/util/json_util.h>
 
 #include <algorithm>
+#include <cmath>
 #include <memory>
+#include <string>
 #include <utility>
 
 #include <boost/process/environment.hpp>
 
 #include "base/util/compat.h"
+#include "base/util/env.h"
 #include "base/util/error.h"
 #include "base/util/factory.h"
 #include "base/util/logging.h"
@@ -36,6 +39,21 @@ namespace {
 // TODO: Either autotune this, or move it to the per-device configuration.
 constexpr float kGoalMemPercentage = .85;
 
+// The percentage of the temporary memory source's size goal that may be held
+// by freed temporary buffers awaiting reuse.  PLAIDML_TMP_MEM_CACHE_BYTES
+// overrides this with an absolute byte budget.
+constexpr float kTmpMemCachePercentage = .25;
+
+std::shared_ptr<MemCache> MakeTmpMemCache(hal::Memory* source) {
+  std::size_t budget = std::llround(std::floor(source->size_goal() * kTmpMemCachePercentage));
+  std::string budget_env = env::Get("PLAIDML_TMP_MEM_CACHE_BYTES");
+  if (budget_env.length()) {
+    budget = std::stoull(budget_env);
+  }
+  IVLOG(1, "Temporary memory cache budget: " << budget << " bytes");
+  return std::make_shared<MemCache>(budget);
+}
+
 void GetMemStrategy(const std::shared_ptr<DevInfo>& devinfo, Platform::PlatformDev* pd) {
   if (devinfo->dev->executor() && devinfo->dev->executor()->shared_memory()) {
     IVLOG(1, "Using shared memory for data transfer");
@@ -118,16 +136,19 @@ Platform::Platform(const context::Context& ctx, const proto::Platform& config) {
           }
           VLOG(1) << settings.DebugString();
           GetMemStrategy(devinfo, &pd);
+          pd.tmp_mem_cache = MakeTmpMemCache(pd.tmp_mem_source);
 
           auto memory = (dev->executor() && dev->executor()->device_memory() ? dev->executor()->device_memory()
                                                                              : devset->host_memory());
           if (dev->executor() && dev->executor()->is_synchronous()) {
             IVLOG(1, "Device is synchronous");
           }
-          auto size_goal = memory->size_goal() * kGoalMemPercentage;
-          IVLOG(1, "Using fifo scheduler; size_goal=" << size_goal);
-          pd.scheduler = std::make_shared<fifo_scheduler::FifoScheduler>(memory->ArenaBufferAlignment(),
-                                                                         std::lround(std::floor(size_goal)), settings);
+          IVLOG(1, "Using fifo scheduler; size_goal=" << memory->size_goal() * kGoalMemPercentage);
+          // The memory's size goal may change over time (e.g. to track memory pressure), so it's queried each
+          // time a program is scheduled.
+          auto size_goal = [memory]() { return std::lround(std::floor(memory->size_goal() * kGoalMemPercentage)); };
+          pd.scheduler = std::make_shared<fifo_scheduler::FifoScheduler>(memory->ArenaBufferAlignment(), size_goal,
+                                                                         settings);
           devs_[id] = std::move(pd);
         }
       }
@@ -147,7 +168,8 @@ std::unique_ptr<tile::Program> Platform::MakeProgram(const context::Context& ctx
   auto& platform_dev = LookupDevice(program.dev_id());
   return std::make_unique<Program>(ctx, program, platform_dev.devinfo, platform_dev.scheduler,
                                    platform_dev.mem_strategy,
-                                   std::make_shared<TmpMemStrategy>(platform_dev.devinfo, platform_dev.tmp_mem_source),
+                                   std::make_shared<TmpMemStrategy>(platform_dev.devinfo, platform_dev.tmp_mem_source,
+                                                                    platform_dev.tmp_mem_cache),
                                    platform_dev.tmp_mem_source, tile_optimizer_);
 }
 
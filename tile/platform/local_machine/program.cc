@@ -4,12 +4,15 @@
 
 #include <algorithm>
 #include <forward_list>
+#include <limits>
 #include <numeric>
 #include <set>
 #include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "base/util/error.h"
+#include "base/util/parallel.h"
 #include "base/util/perf_counter.h"
 #include "tile/hal/util/settings.h"
 #include "tile/lang/parser.h"
@@ -34,26 +37,43 @@ void AllocateBuffers(const std::vector<std::string>& names, const ShapeMap& type
   }
 }
 
-int64_t TryKernel(const context::Context& ctx, const lang::KernelInfo& ki,
+// A candidate kernel, built on its own so that it can be timed.
+struct TrialKernel {
+  std::unique_ptr<hal::Library> library;
+  std::unique_ptr<hal::Executable> executable;
+};
+
+// Builds a candidate kernel.  Candidates are built concurrently, so failures are logged rather than thrown; a
+// candidate that fails to build has no executable.
+TrialKernel BuildKernel(const context::Context& ctx, const lang::KernelInfo& ki, const DevInfo& devinfo) {
+  LOG(DEBUG) << "Building kernel: " << ki.kname << ", key: " << ki.key << ", tile: " << ki.tile.shape;
+  TrialKernel trial;
+  try {
+    auto& device = *devinfo.dev;
+    trial.library = device.compiler()->Build(ctx, {ki}, devinfo.settings).get();
+    trial.executable = device.executor()->Prepare(trial.library.get()).get();
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Skipping kernel failure: " << ex.what();
+  } catch (...) {
+    LOG(ERROR) << "Skipping unknown kernel failure";
+  }
+  return trial;
+}
+
+int64_t TryKernel(const context::Context& ctx, const lang::KernelInfo& ki, const TrialKernel& trial,
                   const std::vector<std::shared_ptr<hal::Buffer>>& buffers, const DevInfo& devinfo, size_t trial_runs) {
-  // Check in cache, and early return if found
-  int64_t cached_time = lang::TileCache::Instance()->GetDuration(ki.key, ki.settings, ki.tile.shape);
-  if (cached_time >= 0) {
-    LOG(DEBUG) << "Cached kernel: " << ki.kname << ", key: " << ki.key << ", tile: " << ki.tile.shape;
-    return cached_time;
+  if (!trial.executable) {
+    return std::numeric_limits<int64_t>::max();
   }
 
   LOG(DEBUG) << "Trying kernel: " << ki.kname << ", key: " << ki.key << ", tile: " << ki.tile.shape;
   try {
-    // Prep to do a real run
     auto& device = *devinfo.dev;
-    auto library = device.compiler()->Build(ctx, {ki}, devinfo.settings).get();
-    auto executable = device.executor()->Prepare(library.get()).get();
     int64_t best_time = std::numeric_limits<int64_t>::max();
 
     // Run trial_runs number of times, picking minimum time
     for (size_t i = 0; i < trial_runs; i++) {
-      auto evt = executable->Run(ctx, 0, buffers, {}, true);
+      auto evt = trial.executable->Run(ctx, 0, buffers, {}, true);
       device.executor()->Flush();
       auto result = evt->GetFuture().get();
       int64_t time = result->GetDuration().count();
@@ -61,7 +81,7 @@ int64_t TryKernel(const context::Context& ctx, const lang::KernelInfo& ki,
     }
 
     // Save in cache and return
-    lang::TileCache::Instance()->AddEntry(ki.key, ki.settings, ki.tile.shape, best_time);
+    lang::TileCache::Instance()->AddEntry(device.description(), ki.key, ki.settings, ki.tile.shape, best_time);
     return best_time;
   } catch (const std::exception& ex) {
     LOG(ERROR) << "Skipping kernel failure: " << ex.what();
@@ -76,9 +96,11 @@ lang::KernelList CompileProgram(const tile::proto::Program& program, const DevIn
   IVLOG(2, "Compiling: " << program.code());
   size_t tile_trials = 1;
   size_t trial_runs = 1;
+  double early_stop_margin = 0;
   if (program.has_tile_scanning_params()) {
     tile_trials = program.tile_scanning_params().max_trials();
     trial_runs = program.tile_scanning_params().max_trial_runs();
+    early_stop_margin = program.tile_scanning_params().early_stop_margin();
   }
 
   context::Context ctx;
@@ -105,6 +127,11 @@ lang::KernelList CompileProgram(const tile::proto::Program& program, const DevIn
     }
   }
 
+  // Building candidates dominates the scan, so on compilers that allow it they're built concurrently, a batch at a
+  // time; each batch is then timed serially, with nothing else running on the device.  Batching bounds the work
+  // wasted on candidates that are never timed when the scan stops early.
+  std::size_t batch_size = devinfo.dev->compiler()->is_thread_safe() ? ParallelForEachConcurrency() : 1;
+
   for (auto& ki : kernel_list.kernels) {
     if (ki.candidates.empty()) {
       continue;
@@ -114,22 +141,68 @@ lang::KernelList CompileProgram(const tile::proto::Program& program, const DevIn
     AllocateBuffers(ki.outputs, kernel_list.types, memory, &buffers);
     AllocateBuffers(ki.inputs, kernel_list.types, memory, &buffers);
 
+    // The primary kernel, the analytically best candidate, is tried first.
     std::vector<lang::KernelInfo> candidates;
     std::swap(candidates, ki.candidates);
+    candidates.insert(candidates.begin(), ki);
+
+    // Candidates that have been timed before needn't be built.
+    std::string device_id = devinfo.dev->description();
+    std::vector<int64_t> cached_times(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+      const auto& candidate = candidates[i];
+      cached_times[i] = lang::TileCache::Instance()->GetDuration(device_id, candidate.key, candidate.settings,
+                                                                 candidate.tile.shape);
+    }
 
-    size_t cur_num = 0;
     size_t best_num = 0;
-    uint64_t best_time = TryKernel(ctx, ki, buffers, devinfo, trial_runs);
-    pre_scan_time.add(best_time);
-    for (const auto& candidate : candidates) {
-      cur_num++;
-      uint64_t time = TryKernel(ctx, candidate, buffers, devinfo, trial_runs);
-      if (time < best_time) {
-        best_time = time;
-        ki = candidate;
-        best_num = cur_num;
+    int64_t primary_time = std::numeric_limits<int64_t>::max();
+    int64_t best_time = std::numeric_limits<int64_t>::max();
+    size_t cur_num = 0;
+    while (cur_num < candidates.size()) {
+      std::vector<size_t> batch;
+      for (size_t i = cur_num; i < candidates.size() && batch.size() < batch_size; i++) {
+        if (cached_times[i] < 0) {
+          batch.push_back(i);
+        }
+      }
+      size_t batch_end = batch.size() < batch_size ? candidates.size() : batch.back() + 1;
+      std::vector<TrialKernel> trials(batch.size());
+      ParallelForEach(batch.size(),
+                      [&](std::size_t j) { trials[j] = BuildKernel(ctx, candidates[batch[j]], devinfo); });
+
+      auto trial_it = trials.begin();
+      bool stop = false;
+      for (; cur_num < batch_end && !stop; cur_num++) {
+        const auto& candidate = candidates[cur_num];
+        int64_t time;
+        if (0 <= cached_times[cur_num]) {
+          LOG(DEBUG) << "Cached kernel: " << candidate.kname << ", key: " << candidate.key
+                     << ", tile: " << candidate.tile.shape;
+          time = cached_times[cur_num];
+        } else {
+          time = TryKernel(ctx, candidate, *trial_it++, buffers, devinfo, trial_runs);
+        }
+        if (cur_num == 0) {
+          primary_time = time;
+          pre_scan_time.add(time);
+        }
+        if (time < best_time) {
+          best_time = time;
+          best_num = cur_num;
+        }
+        // The primary kernel's time is the baseline; if it couldn't be built or run, there's nothing to compare
+        // against, and the whole scan runs.
+        stop = 0 < cur_num && 0 < early_stop_margin && primary_time != std::numeric_limits<int64_t>::max() &&
+               best_time <= primary_time * (1 - early_stop_margin);
+      }
+      if (stop) {
+        IVLOG(1, "  stopping early after " << cur_num << " of " << candidates.size() << " candidates");
+        break;
       }
     }
+
+    ki = std::move(candidates[best_num]);
     post_scan_time.add(best_time);
     IVLOG(1, "  best: " << double(best_time) / 1e9 << ", index: " << best_num);
     IVLOG(1, "  pre_scan_time: " << double(pre_scan_time.get()) / 1e9
@@ -147,19 +220,38 @@ Program::Program(const context::Context& ctx, const tile::proto::Program& progra
                  const std::shared_ptr<MemStrategy>& tmp_mem_strategy, hal::Memory* tmp_memory,
                  const lang::TileOptimizer& optimizer)
     : devinfo_{devinfo}, output_mem_strategy_{output_mem_strategy}, tmp_mem_strategy_{tmp_mem_strategy} {
-  // TODO: Make this path asynchronous.
-  // Asynchronous programming is a little tricky in this case, since if we compile asynchronously, the
-  // compilation may not be complete when we're first asked to run a program, which means we'd need to save the run
-  // request and mark the output buffers somehow to indicate that they're not just not ready due to hal events, they're
-  // not ready due to compilation futures (which can't be waited on simultaneously).  There's a relatively
-  // straightforward dataflow-ish way to describe the resulting system, but it's more complicated than just
-  // compiling everything synchronously, so we just do everything synchronously for now.
-
   if (!devinfo->dev->compiler() || !devinfo->dev->executor()) {
     // TODO: Implement a mechanism for providing a pre-compiled program.
     throw error::Unavailable{"The requested device is unavailable for running Tile programs"};
   }
 
+  // Compilation can take seconds, so it runs on its own thread; runs requested in the meantime are queued behind it
+  // (see Run).  The task keeps its own copies of everything it uses except this Program, whose destructor waits for
+  // it and for the queued runs.
+  compiled_ = boost::async(boost::launch::async, [this, ctx = context::Context{ctx}, program, scheduler,
+                                                  optimizer]() { Compile(ctx, program, scheduler.get(), optimizer); })
+                  .share();
+}
+
+Program::~Program() {
+  if (compiled_.valid()) {
+    compiled_.wait();
+  }
+  // Queued runs use this Program to launch.
+  std::unique_lock<std::mutex> lock{queued_mu_};
+  queued_cv_.wait(lock, [this] { return !queued_runs_; });
+}
+
+void Program::Compile(const context::Context& ctx, const tile::proto::Program& program, Scheduler* scheduler,
+                      const lang::TileOptimizer& optimizer) {
+  // Compiling on a thread of its own means that programs created one after another compile concurrently, so
+  // compilation is serialized on compilers that aren't thread-safe.
+  static std::mutex compile_mu;
+  std::unique_lock<std::mutex> compile_lock{compile_mu, std::defer_lock};
+  if (!devinfo_->dev->compiler()->is_thread_safe()) {
+    compile_lock.lock();
+  }
+
   context::Activity activity{ctx, "tile::local_machine::Compile"};
 
   kernel_list_ = CompileProgram(program, *devinfo_.get(), optimizer);
@@ -174,7 +266,7 @@ Program::Program(const context::Context& ctx, const tile::proto::Program& progra
       (*cinfo.mutable_kernels())[kernel.kname] = kernel.info;
     }
     SummarizeSchedule(&cinfo, program, kernel_list_, schedule_);
-    *(cinfo.mutable_program()) = std::move(program);
+    *(cinfo.mutable_program()) = program;
     activity.AddMetadata(cinfo);
     schedule::proto::Schedule sched_pb;
     schedule::ScheduleToProto(&sched_pb, schedule_);
@@ -190,6 +282,64 @@ Program::Program(const context::Context& ctx, const tile::proto::Program& progra
 boost::future<void> Program::Run(const context::Context& ctx,
                                  std::map<std::string, std::shared_ptr<tile::Buffer>> inputs,
                                  std::map<std::string, std::shared_ptr<tile::Buffer>> outputs) {
+  // A run can be launched once the program is compiled and every run that's still waiting to launch with one of
+  // these buffers as an output has launched or failed to.
+  std::vector<boost::shared_future<void>> deps{compiled_};
+  for (const auto& kvp : inputs) {
+    deps.emplace_back(Buffer::Downcast(kvp.second, devinfo_)->pending());
+  }
+  for (const auto& kvp : outputs) {
+    deps.emplace_back(Buffer::Downcast(kvp.second, devinfo_)->pending());
+  }
+  if (std::all_of(deps.begin(), deps.end(), [](const boost::shared_future<void>& dep) { return dep.is_ready(); })) {
+    compiled_.get();
+    return Launch(ctx, std::move(inputs), std::move(outputs));
+  }
+
+  // Otherwise, queue the run.  Its outputs are pending until it launches, at which point their chunks carry the
+  // run's HAL events as usual.
+  IVLOG(1, "Queueing run of program " << this << " behind " << deps.size() << " pending dependencies");
+  auto launched = std::make_shared<boost::promise<void>>();
+  boost::shared_future<void> pending = launched->get_future().share();
+  std::vector<std::pair<std::shared_ptr<Buffer>, std::uint64_t>> pending_outputs;
+  for (const auto& kvp : outputs) {
+    auto buffer = Buffer::Downcast(kvp.second, devinfo_);
+    auto token = buffer->SetPending(pending);
+    pending_outputs.emplace_back(std::move(buffer), token);
+  }
+  {
+    std::lock_guard<std::mutex> lock{queued_mu_};
+    queued_runs_++;
+  }
+  return boost::when_all(deps.begin(), deps.end())
+      .then([this, ctx = context::Context{ctx}, inputs = std::move(inputs), outputs = std::move(outputs), launched,
+             pending_outputs = std::move(pending_outputs)](
+                boost::future<std::vector<boost::shared_future<void>>>) mutable {
+        // Whether or not the run launches, its outputs stop being pending, so that a failed compilation or launch
+        // is reported by the run's own future rather than by every later use of the buffers.
+        auto settle = [&]() {
+          for (const auto& output : pending_outputs) {
+            output.first->ClearPending(output.second);
+          }
+          launched->set_value();
+          FinishQueuedRun();
+        };
+        try {
+          compiled_.get();
+          auto complete = Launch(ctx, std::move(inputs), std::move(outputs));
+          settle();
+          return complete;
+        } catch (...) {
+          settle();
+          throw;
+        }
+      })
+      .unwrap();
+}
+
+boost::future<void> Program::Launch(const context::Context& ctx,
+                                    std::map<std::string, std::shared_ptr<tile::Buffer>> inputs,
+                                    std::map<std::string, std::shared_ptr<tile::Buffer>> outputs) {
   std::map<std::string, std::shared_ptr<tile::Buffer>> rewrite_outputs;
   for (auto kvp : outputs) {
     rewrite_outputs.emplace(kernel_list_.var_rewrites.Lookup(kvp.first), std::move(kvp.second));
@@ -197,6 +347,14 @@ boost::future<void> Program::Run(const context::Context& ctx,
   return RunRequest::Run(ctx, this, std::move(inputs), std::move(rewrite_outputs));
 }
 
+void Program::FinishQueuedRun() {
+  // Notified under the lock, so that the destructor can't finish before this does.
+  std::lock_guard<std::mutex> lock{queued_mu_};
+  if (!--queued_runs_) {
+    queued_cv_.notify_all();
+  }
+}
+
 }  // namespace local_machine
 }  // namespace tile
 }  // namespace vertexai
@@ -2,9 +2,11 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <cstddef>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -21,6 +23,13 @@ namespace vertexai {
 namespace tile {
 namespace local_machine {
 
+// A Tile program compiled for a local device.
+//
+// The program is compiled asynchronously: construction returns immediately, and compiled() resolves once the
+// program's kernels are built and scheduled.  Runs requested before then are queued behind the compilation; their
+// output buffers are marked as pending until the run is launched or fails to launch, so that mapping them or passing
+// them to another run waits for it.  If compilation fails, each run's future holds the compilation's error, and its
+// buffers are left usable.  Destroying the program waits for its compilation and for its queued runs to launch.
 class Program final : public tile::Program {
  public:
   Program(const context::Context& ctx, const tile::proto::Program& program, const std::shared_ptr<DevInfo>& devinfo,
@@ -28,23 +37,43 @@ class Program final : public tile::Program {
           const std::shared_ptr<MemStrategy>& tmp_mem_strategy, hal::Memory* tmp_memory,
           const lang::TileOptimizer& optimizer);
 
+  ~Program();
+
   boost::future<void> Run(const context::Context& ctx, std::map<std::string, std::shared_ptr<tile::Buffer>> inputs,
                           std::map<std::string, std::shared_ptr<tile::Buffer>> outputs) final;
 
+  // Resolved when compilation completes; holds the compilation's error, if it failed.
+  const boost::shared_future<void>& compiled() const { return compiled_; }
+
   const std::shared_ptr<DevInfo>& devinfo() const { return devinfo_; }
   const std::shared_ptr<MemStrategy>& output_mem_strategy() const { return output_mem_strategy_; }
   const std::shared_ptr<MemStrategy>& tmp_mem_strategy() const { return tmp_mem_strategy_; }
+
+  // The results of compilation; these are only valid once compiled() has succeeded.
   const schedule::Schedule& schedule() const { return schedule_; }
   const lang::KernelList& kernel_list() const { return kernel_list_; }
   const std::unique_ptr<hal::Executable>& executable() const { return executable_; }
 
  private:
+  void Compile(const context::Context& ctx, const tile::proto::Program& program, Scheduler* scheduler,
+               const lang::TileOptimizer& optimizer);
+
+  boost::future<void> Launch(const context::Context& ctx, std::map<std::string, std::shared_ptr<tile::Buffer>> inputs,
+                             std::map<std::string, std::shared_ptr<tile::Buffer>> outputs);
+
+  // Called by each queued run once it has launched or failed to.
+  void FinishQueuedRun();
+
   std::shared_ptr<DevInfo> devinfo_;
   std::shared_ptr<MemStrategy> output_mem_strategy_;
   std::shared_ptr<MemStrategy> tmp_mem_strategy_;
   lang::KernelList kernel_list_;
   schedule::Schedule schedule_;
   std::unique_ptr<hal::Executable> executable_;
+  boost::shared_future<void> compiled_;
+  std::mutex queued_mu_;
+  std::condition_variable queued_cv_;
+  std::size_t queued_runs_ = 0;
 };
 
 }  // namespace local_machine
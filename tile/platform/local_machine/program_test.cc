@@ -0,0 +1,318 @@
+// Copyright 2018 Intel Corporation.
+
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "tile/base/shape.h"
+#include "tile/platform/local_machine/buffer.h"
+#include "tile/platform/local_machine/direct_mem_strategy.h"
+#include "tile/platform/local_machine/fifo_scheduler.h"
+#include "tile/platform/local_machine/program.h"
+
+using ::testing::Eq;
+
+namespace vertexai {
+namespace tile {
+namespace local_machine {
+namespace {
+
+// A HAL whose compiler waits to be released, and whose kernels only count their runs.
+
+class FakeResult final : public hal::Result {
+ public:
+  std::chrono::high_resolution_clock::duration GetDuration() const final {
+    return std::chrono::high_resolution_clock::duration::zero();
+  }
+  void LogStatistics() const final {}
+};
+
+class FakeEvent final : public hal::Event {
+ public:
+  boost::shared_future<std::shared_ptr<hal::Result>> GetFuture() final {
+    return boost::make_ready_future(std::shared_ptr<hal::Result>{std::make_shared<FakeResult>()}).share();
+  }
+};
+
+class FakeBuffer final : public hal::Buffer {
+ public:
+  explicit FakeBuffer(std::uint64_t size) : data_(size) {}
+
+  boost::future<void*> MapCurrent(const std::vector<std::shared_ptr<hal::Event>>& deps) final {
+    return boost::make_ready_future<void*>(data_.data());
+  }
+  boost::future<void*> MapDiscard(const std::vector<std::shared_ptr<hal::Event>>& deps) final {
+    return boost::make_ready_future<void*>(data_.data());
+  }
+  std::shared_ptr<hal::Event> Unmap(const context::Context& ctx) final { return std::make_shared<FakeEvent>(); }
+
+ private:
+  std::vector<char> data_;
+};
+
+class FakeMemory final : public hal::Memory {
+ public:
+  std::uint64_t size_goal() const final { return 1 << 30; }
+  hal::BufferAccessMask AllowedAccesses() const final { return hal::BufferAccessMask::ALL; }
+  std::size_t ArenaBufferAlignment() const final { return 4; }
+  std::shared_ptr<hal::Buffer> MakeBuffer(std::uint64_t size, hal::BufferAccessMask access) final {
+    return std::make_shared<FakeBuffer>(size);
+  }
+  std::shared_ptr<hal::Arena> MakeArena(std::uint64_t size, hal::BufferAccessMask access) final {
+    throw std::logic_error{"FakeMemory doesn't support arenas"};
+  }
+};
+
+class FakeLibrary final : public hal::Library {
+ public:
+  std::string Serialize() final { return ""; }
+};
+
+class FakeExecutable final : public hal::Executable {
+ public:
+  explicit FakeExecutable(std::atomic<int>* runs) : runs_{runs} {}
+
+  std::shared_ptr<hal::Event> Run(const context::Context& ctx, std::size_t kernel_index,
+                                  const std::vector<std::shared_ptr<hal::Buffer>>& params,
+                                  const std::vector<std::shared_ptr<hal::Event>>& dependencies,
+                                  bool enable_profiling) final {
+    (*runs_)++;
+    return std::make_shared<FakeEvent>();
+  }
+
+ private:
+  std::atomic<int>* runs_;
+};
+
+class FakeCompiler final : public hal::Compiler {
+ public:
+  explicit FakeCompiler(boost::shared_future<bool> succeed) : succeed_{std::move(succeed)} {}
+
+  boost::future<std::unique_ptr<hal::Library>> Build(const context::Context& ctx,
+                                                     const std::vector<lang::KernelInfo>& kernels,
+                                                     const hal::proto::HardwareSettings& settings) final {
+    if (!succeed_.get()) {
+      throw std::runtime_error{"Fake compilation failure"};
+    }
+    return boost::make_ready_future(std::unique_ptr<hal::Library>{std::make_unique<FakeLibrary>()});
+  }
+
+ private:
+  boost::shared_future<bool> succeed_;
+};
+
+class FakeExecutor final : public hal::Executor {
+ public:
+  FakeExecutor(hal::Memory* memory, std::atomic<int>* runs) : memory_{memory}, runs_{runs} {}
+
+  const hal::proto::HardwareInfo& info() final { return info_; }
+  hal::Memory* device_memory() final { return nullptr; }
+  hal::Memory* shared_memory() final { return memory_; }
+  bool is_synchronous() const final { return true; }
+  std::shared_ptr<hal::Event> Copy(const context::Context& ctx, const std::shared_ptr<hal::Buffer>& from,
+                                   std::size_t from_offset, const std::shared_ptr<hal::Buffer>& to,
+                                   std::size_t to_offset, std::size_t length,
+                                   const std::vector<std::shared_ptr<hal::Event>>& dependencies) final {
+    return std::make_shared<FakeEvent>();
+  }
+  boost::future<std::unique_ptr<hal::Executable>> Prepare(hal::Library* library) final {
+    return boost::make_ready_future(std::unique_ptr<hal::Executable>{std::make_unique<FakeExecutable>(runs_)});
+  }
+  boost::future<std::vector<std::shared_ptr<hal::Result>>> WaitFor(
+      const std::vector<std::shared_ptr<hal::Event>>& events) final {
+    std::vector<std::shared_ptr<hal::Result>> results;
+    for (const auto& event : events) {
+      results.push_back(event->GetFuture().get());
+    }
+    return boost::make_ready_future(std::move(results));
+  }
+  void Flush() final {}
+
+ private:
+  hal::proto::HardwareInfo info_;
+  hal::Memory* memory_;
+  std::atomic<int>* runs_;
+};
+
+class FakeDevice final : public hal::Device {
+ public:
+  FakeDevice(hal::Compiler* compiler, hal::Executor* executor) : compiler_{compiler}, executor_{executor} {}
+
+  void Initialize(const hal::proto::HardwareSettings& settings) final {}
+  std::string description() final { return "Fake device"; }
+  hal::Compiler* compiler() final { return compiler_; }
+  hal::Loader* loader() final { return nullptr; }
+  const std::unordered_map<std::string, std::unique_ptr<hal::Loader>>& il_loader_map() final {
+    return il_loader_map_;
+  }
+  hal::Executor* executor() final { return executor_; }
+
+ private:
+  hal::Compiler* compiler_;
+  hal::Executor* executor_;
+  std::unordered_map<std::string, std::unique_ptr<hal::Loader>> il_loader_map_;
+};
+
+class FakeDeviceSet final : public hal::DeviceSet {
+ public:
+  FakeDeviceSet(std::shared_ptr<hal::Device> device, hal::Memory* memory)
+      : devices_{std::move(device)}, memory_{memory} {}
+
+  const std::vector<std::shared_ptr<hal::Device>>& devices() final { return devices_; }
+  hal::Memory* host_memory() final { return memory_; }
+
+ private:
+  std::vector<std::shared_ptr<hal::Device>> devices_;
+  hal::Memory* memory_;
+};
+
+hal::proto::HardwareSettings TestSettings() {
+  hal::proto::HardwareSettings settings;
+  settings.set_threads(1);
+  settings.set_vec_size(1);
+  settings.set_use_global(true);
+  settings.set_mem_width(64);
+  settings.set_max_mem(32768);
+  settings.set_max_regs(32);
+  settings.set_goal_groups(1);
+  settings.set_goal_flops_per_byte(1);
+  settings.add_dim_sizes(0);
+  return settings;
+}
+
+class ProgramTest : public ::testing::Test {
+ protected:
+  ProgramTest()
+      : compiler_{succeed_.get_future().share()},
+        executor_{&memory_, &runs_},
+        device_{std::make_shared<FakeDevice>(&compiler_, &executor_)},
+        devinfo_{std::make_shared<DevInfo>(
+            DevInfo{std::make_shared<FakeDeviceSet>(device_, &memory_), device_, TestSettings()})},
+        mem_strategy_{std::make_shared<DirectMemStrategy>(devinfo_, &memory_)} {}
+
+  ~ProgramTest() {
+    // Unblock any compilation the test left waiting.
+    if (!released_) {
+      Release(false);
+    }
+  }
+
+  // Lets compilation proceed, succeeding or failing as indicated.
+  void Release(bool succeed) {
+    released_ = true;
+    succeed_.set_value(succeed);
+  }
+
+  std::unique_ptr<Program> MakeProgram() {
+    tile::proto::Program program;
+    program.set_code("function (A, B) -> (C) { C = A + B; }");
+    auto shape = IntoProto(shape_);
+    *(*program.mutable_inputs())["A"].mutable_shape() = shape;
+    *(*program.mutable_inputs())["B"].mutable_shape() = shape;
+    *(*program.mutable_outputs())["C"].mutable_shape() = shape;
+    auto scheduler = std::make_shared<fifo_scheduler::FifoScheduler>(memory_.ArenaBufferAlignment(),
+                                                                     memory_.size_goal(), devinfo_->settings);
+    return std::make_unique<Program>(context::Context{}, program, devinfo_, scheduler, mem_strategy_, mem_strategy_,
+                                     &memory_, optimizer_);
+  }
+
+  std::shared_ptr<Buffer> MakeBuffer() {
+    return std::make_shared<Buffer>(devinfo_, mem_strategy_, shape_.byte_size());
+  }
+
+  boost::future<void> Run(Program* program, const std::shared_ptr<Buffer>& a, const std::shared_ptr<Buffer>& b,
+                          const std::shared_ptr<Buffer>& c) {
+    return program->Run(context::Context{}, {{"A", a}, {"B", b}}, {{"C", c}});
+  }
+
+  TensorShape shape_ = SimpleShape(DataType::INT32, {16});
+  bool released_ = false;
+  boost::promise<bool> succeed_;
+  FakeMemory memory_;
+  std::atomic<int> runs_{0};
+  FakeCompiler compiler_;
+  FakeExecutor executor_;
+  std::shared_ptr<FakeDevice> device_;
+  std::shared_ptr<DevInfo> devinfo_;
+  std::shared_ptr<MemStrategy> mem_strategy_;
+  lang::TileOptimizer optimizer_;
+};
+
+TEST_F(ProgramTest, CompilesAsynchronously) {
+  auto program = MakeProgram();
+  // Construction returns while the compiler is still blocked.
+  EXPECT_FALSE(program->compiled().is_ready());
+  Release(true);
+  program->compiled().get();
+  EXPECT_THAT(program->kernel_list().kernels.size(), Eq(1u));
+  EXPECT_TRUE(program->executable() != nullptr);
+}
+
+TEST_F(ProgramTest, QueuesRunsBehindCompilation) {
+  auto program = MakeProgram();
+  auto a = MakeBuffer();
+  auto b = MakeBuffer();
+  auto c = MakeBuffer();
+  auto d = MakeBuffer();
+  auto first = Run(program.get(), a, b, c);
+  // The second run reads the first's output, so it's queued behind the first as well as the compilation.
+  auto second = Run(program.get(), c, b, d);
+  EXPECT_FALSE(c->pending().is_ready());
+  EXPECT_FALSE(d->pending().is_ready());
+  auto mapped = d->MapCurrent(context::Context{});
+  EXPECT_THAT(runs_.load(), Eq(0));
+
+  Release(true);
+  first.get();
+  second.get();
+  EXPECT_THAT(runs_.load(), Eq(2));
+  EXPECT_TRUE(c->pending().is_ready());
+  EXPECT_TRUE(d->pending().is_ready());
+  EXPECT_TRUE(mapped.get() != nullptr);
+
+  // Once compiled, runs launch directly.
+  Run(program.get(), a, b, c).get();
+  EXPECT_THAT(runs_.load(), Eq(3));
+}
+
+TEST_F(ProgramTest, PropagatesCompileFailure) {
+  auto program = MakeProgram();
+  auto a = MakeBuffer();
+  auto b = MakeBuffer();
+  auto c = MakeBuffer();
+  auto queued = Run(program.get(), a, b, c);
+
+  Release(false);
+  EXPECT_THROW(program->compiled().get(), std::runtime_error);
+  EXPECT_THROW(queued.get(), std::runtime_error);
+  EXPECT_THROW(Run(program.get(), a, b, c).get(), std::runtime_error);
+  EXPECT_THAT(runs_.load(), Eq(0));
+
+  // The failure is reported by the runs alone; their output is still usable.
+  EXPECT_TRUE(c->pending().is_ready());
+  EXPECT_NO_THROW(c->pending().get());
+  EXPECT_TRUE(c->MapDiscard(context::Context{}) != nullptr);
+  EXPECT_TRUE(c->MapCurrent(context::Context{}).get() != nullptr);
+}
+
+TEST_F(ProgramTest, DestructionWaitsForQueuedRuns) {
+  auto program = MakeProgram();
+  auto queued = Run(program.get(), MakeBuffer(), MakeBuffer(), MakeBuffer());
+  std::thread release{[this] { Release(true); }};
+  program.reset();
+  release.join();
+  queued.get();
+  EXPECT_THAT(runs_.load(), Eq(1));
+}
+
+}  // namespace
+}  // namespace local_machine
+}  // namespace tile
+}  // namespace vertexai
@@ -51,17 +51,22 @@ std::shared_ptr<hal::Buffer> TmpMemChunk::hal_buffer() { return hal_buffer_; }
 
 }  // namespace
 
-TmpMemStrategy::TmpMemStrategy(const std::shared_ptr<DevInfo>& devinfo, hal::Memory* source)
-    : devinfo_{devinfo}, source_{source}, cache_{std::make_shared<MemCache>()} {
+TmpMemStrategy::TmpMemStrategy(const std::shared_ptr<DevInfo>& devinfo, hal::Memory* source,
+                               std::shared_ptr<MemCache> cache)
+    : devinfo_{devinfo}, source_{source}, cache_{std::move(cache)} {
   if (!source_) {
     throw std::logic_error{"The temporary memory management strategy requires memory"};
   }
+  if (!cache_) {
+    throw std::logic_error{"The temporary memory management strategy requires a memory cache"};
+  }
 }
 
 std::shared_ptr<MemChunk> TmpMemStrategy::MakeChunk(const context::Context& ctx, std::uint64_t size) const {
   auto hal_buffer = cache_->TryAlloc(size);
   if (!hal_buffer) {
-    auto buffer = source_->MakeBuffer(size, hal::BufferAccessMask::DEVICE_RW);
+    // Allocate the full size class, so that the buffer can be reused for any size in the class.
+    auto buffer = source_->MakeBuffer(MemCache::SizeClass(size), hal::BufferAccessMask::DEVICE_RW);
     hal_buffer = buffer;
   }
   return std::make_shared<TmpMemChunk>(size, cache_, std::move(hal_buffer));
@@ -18,10 +18,11 @@ namespace local_machine {
 // Chunks allocated by TmpMemStrategy may not be directly accessible to the host; map and unmap calls may fail.
 //
 // Memory described by chunks may be reused when the chunk is deleted; callers must make sure to maintain chunk
-// references as long as the underlying memory is in use.
+// references as long as the underlying memory is in use.  Deleted chunks are returned to the supplied cache, which
+// may be shared by multiple strategies allocating from the same memory.
 class TmpMemStrategy final : public MemStrategy {
  public:
-  TmpMemStrategy(const std::shared_ptr<DevInfo>& devinfo, hal::Memory* source);
+  TmpMemStrategy(const std::shared_ptr<DevInfo>& devinfo, hal::Memory* source, std::shared_ptr<MemCache> cache);
 
   std::shared_ptr<MemChunk> MakeChunk(const context::Context& ctx, std::uint64_t size) const final;
 
@@ -0,0 +1,111 @@
+// Copyright 2018, Intel Corporation
+
+#include "tile/stripe/compact_affine.h"
+
+#include <algorithm>
+
+namespace vertexai {
+namespace tile {
+namespace stripe {
+
+namespace {
+
+bool SymbolLess(const CompactAffine::Term& a, const CompactAffine::Term& b) { return a.first < b.first; }
+
+}  // namespace
+
+CompactAffine::CompactAffine(int64_t constant) {
+  if (constant) {
+    terms_.emplace_back(Symbol{}, constant);
+  }
+}
+
+CompactAffine::CompactAffine(Symbol sym, int64_t coeff) {
+  if (coeff) {
+    terms_.emplace_back(sym, coeff);
+  }
+}
+
+CompactAffine::CompactAffine(const math::Polynomial<int64_t>& poly) {
+  Terms terms;
+  for (const auto& kvp : poly.getMap()) {
+    terms.emplace_back(Symbol{kvp.first}, kvp.second);
+  }
+  *this = CompactAffine{std::move(terms)};
+}
+
+CompactAffine::CompactAffine(Terms terms) : terms_{std::move(terms)} {
+  std::sort(terms_.begin(), terms_.end(), SymbolLess);
+  auto out = terms_.begin();
+  for (auto it = terms_.begin(); it != terms_.end();) {
+    Term term = *it;
+    for (++it; it != terms_.end() && it->first == term.first; ++it) {
+      term.second += it->second;
+    }
+    if (term.second) {
+      *out++ = term;
+    }
+  }
+  terms_.erase(out, terms_.end());
+}
+
+int64_t CompactAffine::operator[](const Symbol& sym) const {
+  auto it = std::lower_bound(terms_.begin(), terms_.end(), Term{sym, 0}, SymbolLess);
+  return (it == terms_.end() || it->first != sym) ? 0 : it->second;
+}
+
+CompactAffine& CompactAffine::operator+=(const CompactAffine& rhs) {
+  if (rhs.terms_.empty()) {
+    return *this;
+  }
+  Terms sum;
+  auto lit = terms_.begin();
+  auto rit = rhs.terms_.begin();
+  while (lit != terms_.end() || rit != rhs.terms_.end()) {
+    if (rit == rhs.terms_.end() || (lit != terms_.end() && lit->first < rit->first)) {
+      sum.push_back(*lit++);
+    } else if (lit == terms_.end() || rit->first < lit->first) {
+      sum.push_back(*rit++);
+    } else {
+      int64_t coeff = lit->second + rit->second;
+      if (coeff) {
+        sum.emplace_back(lit->first, coeff);
+      }
+      ++lit;
+      ++rit;
+    }
+  }
+  terms_.swap(sum);
+  return *this;
+}
+
+CompactAffine& CompactAffine::operator-=(const CompactAffine& rhs) { return *this += -rhs; }
+
+CompactAffine& CompactAffine::operator*=(int64_t rhs) {
+  if (rhs == 0) {
+    terms_.clear();
+  } else {
+    for (auto& term : terms_) {
+      term.second *= rhs;
+    }
+  }
+  return *this;
+}
+
+CompactAffine CompactAffine::operator-() const {
+  CompactAffine r = *this;
+  return r *= -1;
+}
+
+math::Polynomial<int64_t> CompactAffine::ToPolynomial() const {
+  math::Polynomial<int64_t> r;
+  auto& map = r.mutateMap();
+  for (const auto& term : terms_) {
+    map.emplace(term.first.str(), term.second);
+  }
+  return r;
+}
+
+}  // namespace stripe
+}  // namespace tile
+}  // namespace vertexai
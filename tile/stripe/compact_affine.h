@@ -0,0 +1,67 @@
+// Copyright 2018, Intel Corporation
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include <boost/container/small_vector.hpp>
+
+#include "tile/math/polynomial.h"
+#include "tile/stripe/symbol.h"
+
+namespace vertexai {
+namespace tile {
+namespace stripe {
+
+// An affine polynomial over Symbols with integer coefficients; the counterpart of a math::Polynomial<int64_t> for
+// code that builds, combines, and compares many of them.  Terms are kept sorted by symbol name with no zero
+// coefficients, and up to four of them are stored inline, so most accesses are built, copied, and compared without
+// touching the heap.  The constant term, if nonzero, is the term whose symbol is empty, and so it always comes first.
+class CompactAffine {
+ public:
+  using Term = std::pair<Symbol, int64_t>;
+  using Terms = boost::container::small_vector<Term, 4>;
+
+  CompactAffine() = default;
+  CompactAffine(int64_t constant);  // NOLINT
+  CompactAffine(Symbol sym, int64_t coeff);
+  explicit CompactAffine(const math::Polynomial<int64_t>& poly);
+  // Builds an affine from terms in any order, summing duplicates and dropping zeros.
+  explicit CompactAffine(Terms terms);
+
+  const Terms& terms() const { return terms_; }
+  int64_t operator[](const Symbol& sym) const;
+  int64_t constant() const { return (terms_.empty() || !terms_[0].first.empty()) ? 0 : terms_[0].second; }
+  bool isConstant() const { return terms_.empty() || (terms_.size() == 1 && terms_[0].first.empty()); }
+
+  CompactAffine& operator+=(const CompactAffine& rhs);
+  CompactAffine& operator-=(const CompactAffine& rhs);
+  CompactAffine& operator*=(int64_t rhs);
+  CompactAffine operator-() const;
+
+  bool operator==(const CompactAffine& rhs) const { return terms_ == rhs.terms_; }
+  bool operator!=(const CompactAffine& rhs) const { return terms_ != rhs.terms_; }
+  bool operator<(const CompactAffine& rhs) const { return terms_ < rhs.terms_; }
+
+  math::Polynomial<int64_t> ToPolynomial() const;
+  std::string toString() const { return ToPolynomial().toString(); }
+
+ private:
+  Terms terms_;
+};
+
+inline CompactAffine operator+(CompactAffine lhs, const CompactAffine& rhs) { return lhs += rhs; }
+inline CompactAffine operator-(CompactAffine lhs, const CompactAffine& rhs) { return lhs -= rhs; }
+inline CompactAffine operator*(CompactAffine lhs, int64_t rhs) { return lhs *= rhs; }
+inline CompactAffine operator*(int64_t lhs, CompactAffine rhs) { return rhs *= lhs; }
+
+inline std::ostream& operator<<(std::ostream& os, const CompactAffine& affine) {
+  os << affine.toString();
+  return os;
+}
+
+}  // namespace stripe
+}  // namespace tile
+}  // namespace vertexai
@@ -13,7 +13,9 @@
 
 #include "tile/base/shape.h"
 #include "tile/math/polynomial.h"
+#include "tile/stripe/compact_affine.h"
 #include "tile/stripe/stripe.pb.h"
+#include "tile/stripe/symbol.h"
 
 namespace vertexai {
 namespace tile {
@@ -0,0 +1,50 @@
+// Copyright 2018, Intel Corporation
+
+#include "tile/stripe/symbol.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace vertexai {
+namespace tile {
+namespace stripe {
+
+namespace {
+
+class SymbolTable {
+ public:
+  SymbolTable() { empty_ = Intern(""); }
+
+  const Symbol::Entry* empty() const { return empty_; }
+
+  const Symbol::Entry* Intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock{mu_};
+    auto& entry = entries_[name];
+    if (!entry) {
+      entry.reset(new Symbol::Entry{name, static_cast<uint32_t>(entries_.size() - 1)});
+    }
+    return entry.get();
+  }
+
+ private:
+  std::mutex mu_;
+  std::unordered_map<std::string, std::unique_ptr<Symbol::Entry>> entries_;
+  const Symbol::Entry* empty_;
+};
+
+SymbolTable& Table() {
+  // Never destroyed, so that Symbols held by other static objects stay valid.
+  static SymbolTable* table = new SymbolTable;
+  return *table;
+}
+
+}  // namespace
+
+Symbol::Symbol() : entry_{Table().empty()} {}
+
+Symbol::Symbol(const std::string& name) : entry_{Table().Intern(name)} {}
+
+}  // namespace stripe
+}  // namespace tile
+}  // namespace vertexai
@@ -0,0 +1,60 @@
+// Copyright 2018, Intel Corporation
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+namespace vertexai {
+namespace tile {
+namespace stripe {
+
+// An interned identifier.  Each distinct name is stored once for the life of the process, so a Symbol is the size of
+// a pointer, and copying, hashing, and testing Symbols for equality never touches the characters of their names.
+// Symbols may be interned from multiple threads concurrently.
+//
+// Ids are assigned in the order in which names are first interned, which varies between runs and with thread
+// scheduling, so they're only used for hashing.  Symbols are ordered by name, so that anything sorted by Symbol
+// (such as the terms of a CompactAffine) comes out the same in every run; the empty name, used for the constant term
+// of an affine, is id 0 and sorts first.
+class Symbol {
+ public:
+  Symbol();  // The empty name
+  explicit Symbol(const std::string& name);
+
+  const std::string& str() const { return entry_->name; }
+  uint32_t id() const { return entry_->id; }
+  bool empty() const { return entry_->id == 0; }
+
+  bool operator==(const Symbol& rhs) const { return entry_ == rhs.entry_; }
+  bool operator!=(const Symbol& rhs) const { return entry_ != rhs.entry_; }
+  bool operator<(const Symbol& rhs) const { return entry_ != rhs.entry_ && str() < rhs.str(); }
+
+  struct Entry {
+    std::string name;
+    uint32_t id;
+  };
+
+ private:
+  const Entry* entry_;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Symbol& sym) {
+  os << sym.str();
+  return os;
+}
+
+}  // namespace stripe
+}  // namespace tile
+}  // namespace vertexai
+
+namespace std {
+
+template <>
+struct hash<vertexai::tile::stripe::Symbol> {
+  std::size_t operator()(const vertexai::tile::stripe::Symbol& sym) const { return hash<uint32_t>{}(sym.id()); }
+};
+
+}  // namespace std